@@ -4,6 +4,8 @@
 #include <stdio.h>
 
 #include "alloc.h"
+#include "../memory.h"
+#include "../trace.h"
 
 
 /* This allocator is designed so that ideally all allocations larger
@@ -15,9 +17,26 @@
  * blocks anyway as they have to be 2k aligned (so you'd need to
  * store them in reverse or something)
  *
+ * All of the house keeping is fixed size bitmaps, there are no
+ * per-allocation heap nodes:
+ *
+ * - free_subblocks has a bit per 256 byte sub-block, set if it's free
+ * - alloc_start has a bit set on the first sub-block of each allocation,
+ *   so the size of an allocation is the distance to the next free
+ *   sub-block or the next allocation, whichever comes first
+ * - free_runs[n] has a bit per 2k block, set if the block contains
+ *   at least n + 1 consecutive free sub-blocks. These are the size
+ *   classes for small allocations, free_runs[7] is the set of entirely
+ *   free blocks which is what large allocations search
+ *
+ * Searching is done a word at a time with count-trailing-zeros, so
+ * free() is proportional to the size of the allocation and malloc()
+ * to the number of free runs it has to skip.
+ *
  * Defragmenting the pool will move larger allocations first, then
  * smaller ones, recursively until you tell it to stop, or until things
- * stop moving.
+ * stop moving. Alternatively alloc_run_defrag_incremental will move
+ * a limited number of bytes per call, picking up where it left off.
  *
  * The maximum pool size is 8M, made up of:
  *
@@ -45,12 +64,17 @@
  */
 
 #include <assert.h>
-#include <stdio.h>
 
 #define EIGHT_MEG (8 * 1024 * 1024)
 #define TWO_KILOBYTES (2 * 1024)
 #define BLOCK_COUNT (EIGHT_MEG / TWO_KILOBYTES)
 
+#define SUBBLOCK_SIZE 256
+#define SUBBLOCKS_PER_BLOCK 8
+#define SUBBLOCK_COUNT (BLOCK_COUNT * SUBBLOCKS_PER_BLOCK)
+
+#define BITMAP_WORDS(bits) (((bits) + 31) / 32)
+
 #define ALLOC_DEBUG 0
 #if ALLOC_DEBUG
 #define DBG_MSG(fmt, ...) fprintf(stderr, fmt, ##__VA_ARGS__)
@@ -69,39 +93,30 @@ static inline intptr_t round_up(intptr_t n, int multiple)
     return ((n + multiple - 1) / multiple) * multiple;
 }
 
-struct AllocEntry {
-    void* pointer;
-    size_t size;
-    struct AllocEntry* next;
-};
-
-
 typedef struct {
-    /* This is a usage bitmask for each block. A block
-     * is divided into 8 x 256 byte subblocks. If a block
-     * is entirely used, it's value will be 255, if
-     * it's entirely free then it will be 0.
-     */
-    uint8_t block_usage[BLOCK_COUNT];
+    uint32_t free_subblocks[BITMAP_WORDS(SUBBLOCK_COUNT)];
+    uint32_t alloc_start[BITMAP_WORDS(SUBBLOCK_COUNT)];
+    uint32_t free_runs[SUBBLOCKS_PER_BLOCK][BITMAP_WORDS(BLOCK_COUNT)];
+
     uint8_t* pool;  // Pointer to the memory pool
     size_t pool_size; // Size of the memory pool
     uint8_t* base_address; // First 2k aligned address in the pool
     size_t block_count;  // Number of 2k blocks in the pool
-
-    /* It's frustrating that we need to do this dynamically
-     * but we need to know the size allocated when we free()...
-     * we could store it statically but it would take 64k if we had
-     * an array of block_index -> block size where there would be 2 ** 32
-     * entries of 16 bit block sizes. The drawback (aside the memory usage)
-     * would be that we won't be able to order by size, so defragging will
-     * take much more time.*/
-    struct AllocEntry* allocations;
+    size_t subblock_count; // block_count * 8
+    size_t allocation_count;
+
+    /* Incremental defrag state, see alloc_run_defrag_incremental */
+    size_t defrag_cursor;
+    size_t defrag_budget;
+    bool defrag_pass_dirty;
+    bool defrag_settled;
 } PoolHeader;
 
 
-static PoolHeader pool_header = {
-    {0}, NULL, 0, NULL, 0, NULL
-};
+static PoolHeader pool_header;
+
+/* Longest run of set bits in each possible block mask */
+static uint8_t LONGEST_RUN[256];
 
 void* alloc_base_address(void* pool) {
     (void) pool;
@@ -113,21 +128,185 @@ size_t alloc_block_count(void* pool) {
     return pool_header.block_count;
 }
 
-static inline void* calc_address(
-    uint8_t* block_usage_iterator,
-    int bit_offset,
-    size_t required_subblocks,
-    size_t* start_subblock_out
-) {
-    uintptr_t offset = (block_usage_iterator - pool_header.block_usage) * 8;
-    offset += (bit_offset + 1);
-    offset -= required_subblocks;
+static inline uint32_t ctz32(uint32_t v) {
+    return __builtin_ctz(v);
+}
+
+/* Returns the index of the first set bit in [from, limit), or limit if
+ * there isn't one. When invert is set, searches for clear bits instead */
+static inline size_t find_bit(const uint32_t* bits, uint32_t invert, size_t from, size_t limit) {
+    if(from >= limit) {
+        return limit;
+    }
 
-    if(start_subblock_out) {
-        *start_subblock_out = offset;
+    size_t w = from / 32;
+    size_t last = BITMAP_WORDS(limit);
+    uint32_t word = (bits[w] ^ invert) & (~0u << (from % 32));
+
+    while(!word) {
+        if(++w >= last) {
+            return limit;
+        }
+
+        word = bits[w] ^ invert;
+    }
+
+    size_t idx = (w * 32) + ctz32(word);
+    return (idx < limit) ? idx : limit;
+}
+
+static inline size_t find_set(const uint32_t* bits, size_t from, size_t limit) {
+    return find_bit(bits, 0, from, limit);
+}
+
+static inline size_t find_clear(const uint32_t* bits, size_t from, size_t limit) {
+    return find_bit(bits, ~0u, from, limit);
+}
+
+static inline bool test_bit(const uint32_t* bits, size_t i) {
+    return bits[i / 32] & (1u << (i % 32));
+}
+
+static inline void set_bit(uint32_t* bits, size_t i) {
+    bits[i / 32] |= (1u << (i % 32));
+}
+
+static inline void clear_bit(uint32_t* bits, size_t i) {
+    bits[i / 32] &= ~(1u << (i % 32));
+}
+
+static void fill_bits(uint32_t* bits, size_t start, size_t count, bool value) {
+    while(count) {
+        size_t offset = start % 32;
+        size_t n = 32 - offset;
+        if(n > count) n = count;
+
+        uint32_t mask = (n == 32) ? ~0u : (((1u << n) - 1) << offset);
+
+        if(value) {
+            bits[start / 32] |= mask;
+        } else {
+            bits[start / 32] &= ~mask;
+        }
+
+        start += n;
+        count -= n;
     }
+}
+
+/* The free sub-blocks of a 2k block, bit 0 being the first sub-block */
+static inline uint8_t block_free_mask(size_t block) {
+    return pool_header.free_subblocks[block / 4] >> ((block % 4) * 8);
+}
+
+static void update_size_classes(size_t first_subblock, size_t count) {
+    size_t first = first_subblock / SUBBLOCKS_PER_BLOCK;
+    size_t last = (first_subblock + count - 1) / SUBBLOCKS_PER_BLOCK;
 
-    return pool_header.base_address + (offset * 256);
+    for(size_t b = first; b <= last; ++b) {
+        uint8_t longest = LONGEST_RUN[block_free_mask(b)];
+        for(uint8_t i = 0; i < SUBBLOCKS_PER_BLOCK; ++i) {
+            if(i < longest) {
+                set_bit(pool_header.free_runs[i], b);
+            } else {
+                clear_bit(pool_header.free_runs[i], b);
+            }
+        }
+    }
+}
+
+static void build_longest_run_table() {
+    for(int m = 0; m < 256; ++m) {
+        uint8_t run = 0, longest = 0;
+        for(int i = 0; i < 8; ++i) {
+            run = (m & (1 << i)) ? run + 1 : 0;
+            if(run > longest) longest = run;
+        }
+        LONGEST_RUN[m] = longest;
+    }
+}
+
+/* First fit for an allocation that must not cross a 2k boundary */
+static size_t find_small(uint32_t required_subblocks) {
+    size_t block = find_set(
+        pool_header.free_runs[required_subblocks - 1], 0, pool_header.block_count
+    );
+
+    if(block == pool_header.block_count) {
+        return SUBBLOCK_COUNT;
+    }
+
+    uint8_t mask = block_free_mask(block);
+    uint32_t starts = mask;
+    for(uint32_t i = 1; i < required_subblocks; ++i) {
+        starts &= (mask >> i);
+    }
+
+    return (block * SUBBLOCKS_PER_BLOCK) + ctz32(starts);
+}
+
+/* First fit for an allocation that must start on a 2k boundary. A run of
+ * L free blocks fits if it's longer than the whole blocks we need, or exactly
+ * as long and the following block starts with enough free sub-blocks */
+static size_t find_aligned(uint32_t required_subblocks) {
+    const uint32_t* free_blocks = pool_header.free_runs[SUBBLOCKS_PER_BLOCK - 1];
+    const size_t limit = pool_header.block_count;
+
+    size_t whole = required_subblocks / SUBBLOCKS_PER_BLOCK;
+    uint8_t tail = (1u << (required_subblocks % SUBBLOCKS_PER_BLOCK)) - 1;
+
+    size_t block = 0;
+    while(block < limit) {
+        size_t start = find_set(free_blocks, block, limit);
+        size_t end = find_clear(free_blocks, start, limit);
+        size_t length = end - start;
+
+        if(length > whole) {
+            return start * SUBBLOCKS_PER_BLOCK;
+        }
+
+        if(length == whole && (!tail || (end < limit && (block_free_mask(end) & tail) == tail))) {
+            return start * SUBBLOCKS_PER_BLOCK;
+        }
+
+        block = end;
+    }
+
+    return SUBBLOCK_COUNT;
+}
+
+/* First fit for any run of free sub-blocks, regardless of alignment */
+static size_t find_any(uint32_t required_subblocks) {
+    const size_t limit = pool_header.subblock_count;
+
+    size_t subblock = 0;
+    while(subblock < limit) {
+        size_t start = find_set(pool_header.free_subblocks, subblock, limit);
+        size_t end = find_clear(pool_header.free_subblocks, start, limit);
+
+        if(end - start >= required_subblocks) {
+            return start;
+        }
+
+        subblock = end;
+    }
+
+    return SUBBLOCK_COUNT;
+}
+
+static inline uint32_t size_to_subblock_count(size_t size) {
+    uint32_t required_subblocks = (size / SUBBLOCK_SIZE);
+    if(size % SUBBLOCK_SIZE) required_subblocks += 1;
+    return required_subblocks;
+}
+
+static inline size_t subblock_from_pointer(void* p) {
+    uint8_t* ptr = (uint8_t*) p;
+    return (ptr - pool_header.base_address) / SUBBLOCK_SIZE;
+}
+
+static inline void* subblock_address(size_t subblock) {
+    return pool_header.base_address + (subblock * SUBBLOCK_SIZE);
 }
 
 void* alloc_next_available_ex(void* pool, size_t required_size, size_t* start_subblock, size_t* required_subblocks);
@@ -139,94 +318,37 @@ void* alloc_next_available(void* pool, size_t required_size) {
 void* alloc_next_available_ex(void* pool, size_t required_size, size_t* start_subblock_out, size_t* required_subblocks_out) {
     (void) pool;
 
-    uint8_t* it = pool_header.block_usage;
-    uint32_t required_subblocks = (required_size / 256);
-    if(required_size % 256) required_subblocks += 1;
-
-    /* Anything gte to 2048 must be aligned to a 2048 boundary */
-    bool requires_alignment = required_size >= 2048;
+    uint32_t required_subblocks = size_to_subblock_count(required_size);
 
     if(required_subblocks_out) {
         *required_subblocks_out = required_subblocks;
     }
 
-    /* This is a fallback option. If while we're searching we find a possible slot
-     * but it's not aligned, or it's straddling a 2k boundary, then we store
-     * it here and if we reach the end of the search and find nothing better
-     * we use this instead */
-    uint8_t* poor_option = NULL;
-    size_t poor_start_subblock = 0;
-
-    uint32_t found_subblocks = 0;
-    uint32_t found_poor_subblocks = 0;
+    if(!required_subblocks || required_subblocks > pool_header.subblock_count) {
+        return NULL;
+    }
 
-    for(size_t j = 0; j < pool_header.block_count; ++j, ++it) {
-        /* We just need to find enough consecutive blocks */
-        if(found_subblocks < required_subblocks) {
-            uint8_t t = *it;
+    /* Anything gte to 2048 must be aligned to a 2048 boundary, anything
+     * smaller shouldn't straddle one */
+    size_t start = (required_size >= TWO_KILOBYTES) ?
+        find_aligned(required_subblocks) :
+        find_small(required_subblocks);
 
-            /* Optimisation only. Skip over full blocks */
-            if(t == 255) {
-                found_subblocks = 0;
-                found_poor_subblocks = 0;
-            } else {
-                /* Now let's see how many consecutive blocks we can find */
-                for(int i = 0; i < 8; ++i) {
-                    if((t & 0x80) == 0) {
-                        bool block_overflow = (
-                            required_size < 2048 && found_subblocks > 0 && i == 0
-                        );
-
-                        bool reset_subblocks = (
-                            (requires_alignment && found_subblocks == 0 && i != 0) ||
-                            block_overflow
-                        );
-
-                        if(reset_subblocks) {
-                            // Ignore this subblock, because we want the first subblock to be aligned
-                            // at a 2048 boundary and this one isn't (i != 0)
-                            found_subblocks = 0;
-                        } else {
-                            found_subblocks++;
-                        }
-
-                        /* If we reset the subblocks due to an overflow, we still
-                         * want to count this free subblock in our count */
-                        if(block_overflow) {
-                            found_subblocks++;
-                        }
-
-                        found_poor_subblocks++;
-
-                        if(found_subblocks >= required_subblocks) {
-                            /* We found space! Now calculate the address */
-                            return calc_address(it, i, required_subblocks, start_subblock_out);
-                        }
-
-                        if(!poor_option && (found_poor_subblocks >= required_subblocks)) {
-                            poor_option = calc_address(it, i, required_subblocks, &poor_start_subblock);
-                        }
-
-                    } else {
-                        found_subblocks = 0;
-                        found_poor_subblocks = 0;
-                    }
-
-                    t <<= 1;
-                }
-            }
-        }
+    /* This is a fallback option. If there's no suitably aligned slot then
+     * take the first run of free sub-blocks that's big enough */
+    if(start == SUBBLOCK_COUNT) {
+        start = find_any(required_subblocks);
     }
 
-    if(poor_option) {
-        if(start_subblock_out) {
-            *start_subblock_out = poor_start_subblock;
-        }
-
-        return poor_option;
-    } else {
+    if(start == SUBBLOCK_COUNT) {
         return NULL;
     }
+
+    if(start_subblock_out) {
+        *start_subblock_out = start;
+    }
+
+    return subblock_address(start);
 }
 
 int alloc_init(void* pool, size_t size) {
@@ -242,20 +364,28 @@ int alloc_init(void* pool, size_t size) {
 
     uint8_t* p = (uint8_t*) pool;
 
-    memset(pool_header.block_usage, 0, BLOCK_COUNT);
+    memset(&pool_header, 0, sizeof(pool_header));
     pool_header.pool = pool;
 
+    if(!LONGEST_RUN[255]) {
+        build_longest_run_table();
+    }
+
     intptr_t base_address = (intptr_t) pool_header.pool;
     base_address = round_up(base_address, 2048);
 
     pool_header.base_address = (uint8_t*) base_address;
     pool_header.block_count = ((p + size) - pool_header.base_address) / 2048;
+    pool_header.subblock_count = pool_header.block_count * SUBBLOCKS_PER_BLOCK;
 
     /* The pool size might be less than the passed size if the memory
      * wasn't aligned to 2048 */
     pool_header.pool_size = pool_header.block_count * 2048;
 
-    pool_header.allocations = NULL;
+    if(pool_header.block_count) {
+        fill_bits(pool_header.free_subblocks, 0, pool_header.subblock_count, true);
+        update_size_classes(0, pool_header.subblock_count);
+    }
 
     assert(((uintptr_t) pool_header.base_address) % 2048 == 0);
 
@@ -269,273 +399,291 @@ void alloc_shutdown(void* pool) {
         return;
     }
 
-    struct AllocEntry* it = pool_header.allocations;
-    while(it) {
-        struct AllocEntry* next = it->next;
-        free(it);
-        it = next;
-    }
-
     memset(&pool_header, 0, sizeof(pool_header));
     pool_header.pool = NULL;
 }
 
-static inline uint32_t size_to_subblock_count(size_t size) {
-    uint32_t required_subblocks = (size / 256);
-    if(size % 256) required_subblocks += 1;
-    return required_subblocks;
+static void alloc_claim_subblocks(size_t start, size_t count) {
+    DBG_MSG("Claim: sb: %d, count: %d\n", (int) start, (int) count);
+
+    fill_bits(pool_header.free_subblocks, start, count, false);
+    set_bit(pool_header.alloc_start, start);
+    update_size_classes(start, count);
 }
 
-static inline uint32_t subblock_from_pointer(void* p) {
-    uint8_t* ptr = (uint8_t*) p;
-    return (ptr - pool_header.base_address) / 256;
+static void alloc_release_subblocks(size_t start, size_t count) {
+    DBG_MSG("Release: sb: %d, count: %d\n", (int) start, (int) count);
+
+    fill_bits(pool_header.free_subblocks, start, count, true);
+    clear_bit(pool_header.alloc_start, start);
+    update_size_classes(start, count);
+
+    /* There's a new hole, so there may be something to move into it */
+    pool_header.defrag_pass_dirty = true;
+    pool_header.defrag_settled = false;
 }
 
-static inline void block_and_offset_from_subblock(size_t sb, size_t* b, uint8_t* off) {
-    *b = sb / 8;
-    *off = (sb % 8);
+/* An allocation runs until the next free sub-block or the start of the
+ * next allocation */
+static size_t alloc_subblock_count(size_t start) {
+    const size_t limit = pool_header.subblock_count;
+    size_t end = find_set(pool_header.free_subblocks, start + 1, limit);
+    size_t next = find_set(pool_header.alloc_start, start + 1, end);
+    return next - start;
 }
 
-static void* alloc_malloc_internal(void* pool, size_t size, bool for_defrag) {
-    DBG_MSG("Allocating: %d\n", size);
+void* alloc_malloc(void* pool, size_t size) {
+    GL_TRACE_FUNCTION();
+    DBG_MSG("Allocating: %d\n", (int) size);
 
     size_t start_subblock, required_subblocks;
     void* ret = alloc_next_available_ex(pool, size, &start_subblock, &required_subblocks);
 
     if(ret) {
-        size_t block;
-        uint8_t offset;
+        alloc_claim_subblocks(start_subblock, required_subblocks);
+        pool_header.allocation_count++;
+    }
 
-        block_and_offset_from_subblock(start_subblock, &block, &offset);
+    DBG_MSG("Alloc done\n");
 
-        uint8_t mask = 0;
+    return ret;
+}
 
-        DBG_MSG("Alloc: size: %d, rs: %d, sb: %d, b: %d, off: %d\n", size, required_subblocks, start_subblock, start_subblock / 8, start_subblock % 8);
+void alloc_free(void* pool, void* p) {
+    (void) pool;
 
-        /* Toggle any bits for the first block */
-        int c = (required_subblocks < 8) ? required_subblocks : 8;
-        for(int i = 0; i < c; ++i) {
-            mask |= (1 << (7 - (offset + i)));
-            required_subblocks--;
-        }
+    size_t subblock = subblock_from_pointer(p);
 
-        if(mask) {
-            pool_header.block_usage[block++] |= mask;
-        }
+    if((uint8_t*) p < pool_header.base_address ||
+        subblock >= pool_header.subblock_count ||
+        !test_bit(pool_header.alloc_start, subblock)) {
+        assert("Freed pointer not found, heap corruption?" && 0);
+        return;
+    }
 
-        /* Fill any full blocks in the middle of the allocation */
-        while(required_subblocks > 8) {
-            pool_header.block_usage[block++] = 255;
-            required_subblocks -= 8;
-        }
+    alloc_release_subblocks(subblock, alloc_subblock_count(subblock));
+    pool_header.allocation_count--;
+}
 
-        /* Fill out any trailing subblocks */
-        mask = 0;
-        for(size_t i = 0; i < required_subblocks; ++i) {
-            mask |= (1 << (7 - i));
-        }
+typedef struct {
+    size_t start;
+    size_t count;
+} DefragEntry;
 
-        if(mask) {
-            pool_header.block_usage[block++] |= mask;
-        }
+/* Larger allocations are moved first, then smaller ones */
+static int defrag_entry_compare(const void* a, const void* b) {
+    const DefragEntry* lhs = (const DefragEntry*) a;
+    const DefragEntry* rhs = (const DefragEntry*) b;
+
+    if(lhs->count != rhs->count) {
+        return (lhs->count > rhs->count) ? -1 : 1;
+    }
+
+    return (lhs->start < rhs->start) ? -1 : (lhs->start > rhs->start);
+}
+
+void alloc_run_defrag(void* pool, defrag_address_move callback, int max_iterations, void* user_data) {
+    GL_TRACE_FUNCTION();
+
+    if(!pool_header.allocation_count) {
+        return;
+    }
+
+    DefragEntry* entries = (DefragEntry*) _glScratchAlloc(
+        pool_header.allocation_count * sizeof(DefragEntry)
+    );
+
+    if(!entries) {
+        return;
+    }
+
+    for(int i = 0; i < max_iterations; ++i) {
+        bool move_occurred = false;
+
+        size_t n = 0;
+        size_t subblock = find_set(pool_header.alloc_start, 0, pool_header.subblock_count);
+        while(subblock < pool_header.subblock_count) {
+            entries[n].start = subblock;
+            entries[n].count = alloc_subblock_count(subblock);
+            ++n;
 
-        // defrag allocations don't create new entries, they reuse old ones
-        if(for_defrag) {
-            return ret;
+            subblock = find_set(pool_header.alloc_start, subblock + 1, pool_header.subblock_count);
         }
 
-        /* Insert allocations in the list by size descending so that when we
-         * defrag we can move the larger blocks before the smaller ones without
-         * much effort */
-        struct AllocEntry* new_entry = (struct AllocEntry*) malloc(sizeof(struct AllocEntry));
-        new_entry->pointer = ret;
-        new_entry->size = size;
-        new_entry->next = NULL;
+        assert(n == pool_header.allocation_count);
 
-        struct AllocEntry* it = pool_header.allocations;
-        struct AllocEntry* last = NULL;
+        qsort(entries, n, sizeof(DefragEntry), defrag_entry_compare);
 
-        if(!it) {
-            pool_header.allocations = new_entry;
-        } else {
-            while(it) {
-                if(it->size < size) {
-                    if(last) {
-                        last->next = new_entry;
-                    } else {
-                        pool_header.allocations = new_entry;
-                    }
-
-                    new_entry->next = it;
-                    break;
-                } else if(!it->next) {
-                    it->next = new_entry;
-                    new_entry->next = NULL;
-                    break;
-                }
-
-                last = it;
-                it = it->next;
+        for(size_t j = 0; j < n; ++j) {
+            DefragEntry* it = &entries[j];
+            size_t bytes = it->count * SUBBLOCK_SIZE;
+            size_t dest;
+
+            if(alloc_next_available_ex(pool, bytes, &dest, NULL) && dest < it->start) {
+                void* src_ptr = subblock_address(it->start);
+                void* dest_ptr = subblock_address(dest);
+
+                alloc_claim_subblocks(dest, it->count);
+                memcpy(dest_ptr, src_ptr, bytes);
+
+                /* Mark the old location as free again, the destination
+                 * took over the allocation */
+                alloc_release_subblocks(it->start, it->count);
+
+                callback(src_ptr, dest_ptr, user_data);
+
+                it->start = dest;
+                move_occurred = true;
             }
         }
-    }
 
-    DBG_MSG("Alloc done\n");
+        if(!move_occurred) {
+            break;
+        }
+    }
 
-    return ret;
+    _glScratchFree(entries);
 }
 
-void* alloc_malloc(void* pool, size_t size) {
-    return alloc_malloc_internal(pool, size, false);
-}
+/* The most allocations moved by a single incremental step */
+#define DEFRAG_MAX_MOVES 64
 
-static void alloc_release_blocks(struct AllocEntry* it) {
-    size_t used_subblocks = size_to_subblock_count(it->size);
-    size_t subblock = subblock_from_pointer(it->pointer);
-    size_t block;
-    uint8_t offset;
-    block_and_offset_from_subblock(subblock, &block, &offset);
+static bool defrag_already_moved(const DefragEntry* moved, size_t move_count, size_t start) {
+    for(size_t i = 0; i < move_count; ++i) {
+        if(moved[i].start == start) {
+            return true;
+        }
+    }
 
-    uint8_t mask = 0;
+    return false;
+}
 
-    DBG_MSG("Free: size: %d, us: %d, sb: %d, off: %d\n", it->size, used_subblocks, block, offset);
+size_t alloc_run_defrag_incremental(void* pool, defrag_address_move callback, size_t max_bytes, void* user_data) {
+    GL_TRACE_FUNCTION();
 
-    /* Wipe out any leading subblocks */
-    int c = (used_subblocks < 8) ? used_subblocks : 8;
-    for(int i = 0; i < c; ++i) {
-        mask |= (1 << (7 - (offset + i)));
-        used_subblocks--;
+    if(max_bytes != pool_header.defrag_budget) {
+        /* Allocations that were too big to move may fit now */
+        pool_header.defrag_budget = max_bytes;
+        pool_header.defrag_pass_dirty = true;
+        pool_header.defrag_settled = false;
     }
 
-    if(mask) {
-        pool_header.block_usage[block++] &= ~mask;
+    if(pool_header.defrag_settled || !pool_header.allocation_count) {
+        return 0;
     }
 
-    /* Clear any full blocks in the middle of the allocation */
-    while(used_subblocks > 8) {
-        pool_header.block_usage[block++] = 0;
-        used_subblocks -= 8;
-    }
+    /* Moved-from sub-blocks stay claimed until the end of the step so
+     * that nothing moved in this step overwrites data which might still
+     * be being read by a render that started before the step */
+    DefragEntry moved[DEFRAG_MAX_MOVES];
+    size_t move_count = 0;
+    size_t moved_bytes = 0;
+    bool wrapped = false;
 
-    /* Wipe out any trailing subblocks */
-    mask = 0;
-    for(size_t i = 0; i < used_subblocks; ++i) {
-        mask |= (1 << (7 - i));
-    }
+    const size_t limit = pool_header.subblock_count;
 
-    if(mask) {
-        pool_header.block_usage[block++] &= ~mask;
-    }
-}
+    while(move_count < DEFRAG_MAX_MOVES) {
+        size_t start = find_set(pool_header.alloc_start, pool_header.defrag_cursor, limit);
 
-void alloc_free(void* pool, void* p) {
-    (void) pool;
+        if(start == limit) {
+            /* End of a pass. If nothing changed during it then there's
+             * nothing to do until something is freed */
+            bool settled = !pool_header.defrag_pass_dirty;
 
-    struct AllocEntry* it = pool_header.allocations;
-    struct AllocEntry* last = NULL;
-    while(it) {
-        if(it->pointer == p) {
-            alloc_release_blocks(it);
+            pool_header.defrag_cursor = 0;
+            pool_header.defrag_pass_dirty = false;
 
-            if(last) {
-                last->next = it->next;
-            } else {
-                assert(it == pool_header.allocations);
-                pool_header.allocations = it->next;
+            if(settled) {
+                pool_header.defrag_settled = true;
+                break;
             }
 
-            DBG_MSG("Freed: size: %d, us: %d, sb: %d, off: %d\n", it->size, used_subblocks, block, offset);
-            free(it);
-            return;
-        }
-
-        last = it;
-        it = it->next;
-    }
+            if(wrapped) {
+                break;
+            }
 
-    assert("Freed pointer not found, heap corruption?" && 0);
-}
+            wrapped = true;
+            continue;
+        }
 
-void alloc_run_defrag(void* pool, defrag_address_move callback, int max_iterations, void* user_data) {
+        size_t count = alloc_subblock_count(start);
+        size_t bytes = count * SUBBLOCK_SIZE;
 
-    for(int i = 0; i < max_iterations; ++i) {
-        bool move_occurred = false;
+        if(wrapped && defrag_already_moved(moved, move_count, start)) {
+            /* The old copy of something moved earlier in this step, which
+             * stays claimed until the end of it */
+            pool_header.defrag_cursor = start + count;
+            continue;
+        }
 
-        struct AllocEntry* it = pool_header.allocations;
+        if(bytes > max_bytes) {
+            /* Can never be moved by this step, leave it for alloc_run_defrag */
+            pool_header.defrag_cursor = start + count;
+            continue;
+        }
 
-        if(!it) {
-            return;
+        if(moved_bytes + bytes > max_bytes) {
+            /* Pick up here next time */
+            break;
         }
 
-        while(it) {
-            void* potential_dest = alloc_next_available(pool, it->size);
-            if(potential_dest && potential_dest < it->pointer) {
-                potential_dest = alloc_malloc_internal(pool, it->size, true);
-                memcpy(potential_dest, it->pointer, it->size);
+        pool_header.defrag_cursor = start + count;
 
-                /* Mark this block as now free, but don't fiddle with the
-                 * allocation list */
-                alloc_release_blocks(it);
+        size_t dest;
+        if(alloc_next_available_ex(pool, bytes, &dest, NULL) && dest < start) {
+            void* src_ptr = subblock_address(start);
+            void* dest_ptr = subblock_address(dest);
 
-                callback(it->pointer, potential_dest, user_data);
+            alloc_claim_subblocks(dest, count);
+            memcpy(dest_ptr, src_ptr, bytes);
 
-                it->pointer = potential_dest;
-                move_occurred = true;
-            }
+            callback(src_ptr, dest_ptr, user_data);
 
-            it = it->next;
-        }
+            moved[move_count].start = start;
+            moved[move_count].count = count;
+            ++move_count;
 
-        if(!move_occurred) {
-            return;
+            moved_bytes += bytes;
+            pool_header.defrag_pass_dirty = true;
         }
     }
-}
 
-static inline uint8_t count_ones(uint8_t byte) {
-    static const uint8_t NIBBLE_LOOKUP [16] = {
-        0, 1, 1, 2, 1, 2, 2, 3,
-        1, 2, 2, 3, 2, 3, 3, 4
-    };
-    return NIBBLE_LOOKUP[byte & 0x0F] + NIBBLE_LOOKUP[byte >> 4];
+    for(size_t i = 0; i < move_count; ++i) {
+        alloc_release_subblocks(moved[i].start, moved[i].count);
+    }
+
+    return moved_bytes;
 }
 
 size_t alloc_count_free(void* pool) {
     (void) pool;
 
-    size_t total_used = 0;
+    size_t free_subblocks = 0;
 
-    for(size_t i = 0; i < pool_header.block_count; ++i) {
-        total_used += count_ones(pool_header.block_usage[i]) * 256;
+    for(size_t i = 0; i < BITMAP_WORDS(pool_header.subblock_count); ++i) {
+        free_subblocks += __builtin_popcount(pool_header.free_subblocks[i]);
     }
 
-    return pool_header.pool_size - total_used;
+    return free_subblocks * SUBBLOCK_SIZE;
 }
 
 size_t alloc_count_continuous(void* pool) {
     (void) pool;
 
-    size_t contiguous_free = 0;
+    const size_t limit = pool_header.subblock_count;
     size_t most_contiguous = 0;
 
-    for(size_t i = 0; i < pool_header.block_count; ++i) {
-        uint8_t t = pool_header.block_usage[i];
+    size_t subblock = 0;
+    while(subblock < limit) {
+        size_t start = find_set(pool_header.free_subblocks, subblock, limit);
+        size_t end = find_clear(pool_header.free_subblocks, start, limit);
 
-        for(int i = 7; i >= 0; --i) {
-            bool bitset = (t & (1 << i));
-            if(!bitset) {
-                ++contiguous_free;
-            } else {
-                if(contiguous_free > most_contiguous) {
-                    most_contiguous = contiguous_free;
-                }
-                contiguous_free = 0;
-            }
+        if(end - start > most_contiguous) {
+            most_contiguous = end - start;
         }
-    }
 
-    if(contiguous_free > most_contiguous) {
-        most_contiguous = contiguous_free;
+        subblock = end;
     }
-    return most_contiguous * 256;
+
+    return most_contiguous * SUBBLOCK_SIZE;
 }
@@ -17,6 +17,11 @@ void alloc_free(void* pool, void* p);
 typedef void (defrag_address_move)(void*, void*, void*);
 void alloc_run_defrag(void* pool, defrag_address_move callback, int max_iterations, void* user_data);
 
+/* Moves at most max_bytes worth of allocations towards the start of the
+ * pool, continuing from where the previous call stopped. Returns the
+ * number of bytes moved, 0 once there's nothing left to move. */
+size_t alloc_run_defrag_incremental(void* pool, defrag_address_move callback, size_t max_bytes, void* user_data);
+
 size_t alloc_count_free(void* pool);
 size_t alloc_count_continuous(void* pool);
 
@@ -570,6 +570,63 @@ static ReadAttributeFunc calcReadNormalFunc(void) {
 }
 
 
+/* Weights are read as four floats, with the units past the array's size
+ * zeroed. Integer weights are normalized. */
+#define DEF_READ_WEIGHTS(name, type, scale) \
+static void _readWeights##name(const GLubyte* __restrict__ in, GLubyte* __restrict__ out) { \
+    const type* input = (const type*) in; \
+    float* output = (float*) out; \
+    const GLint size = ATTRIB_LIST.weight.size; \
+    for(GLint i = 0; i < MAX_GLDC_VERTEX_UNITS; ++i) { \
+        output[i] = (i < size) ? (float) input[i] * (scale) : 0.0f; \
+    } \
+}
+
+DEF_READ_WEIGHTS(f, float, 1.0f)
+DEF_READ_WEIGHTS(ub, GLubyte, ONE_OVER_TWO_FIVE_FIVE)
+DEF_READ_WEIGHTS(us, GLushort, 1.0f / UINT16_MAX)
+
+static ReadAttributeFunc calcReadWeightFunc(void) {
+    switch(ATTRIB_LIST.weight.type) {
+        case GL_UNSIGNED_BYTE:
+            return _readWeightsub;
+        case GL_UNSIGNED_SHORT:
+            return _readWeightsus;
+        case GL_FLOAT:
+        default:
+            return _readWeightsf;
+    }
+}
+
+/* Matrix indices are read as four GLuints, with the units past the
+ * array's size pointing at entry 0 (their weight is zero anyway) */
+#define DEF_READ_MATRIX_INDICES(name, type) \
+static void _readMatrixIndices##name(const GLubyte* __restrict__ in, GLubyte* __restrict__ out) { \
+    const type* input = (const type*) in; \
+    GLuint* output = (GLuint*) out; \
+    const GLint size = ATTRIB_LIST.matrix_index.size; \
+    for(GLint i = 0; i < MAX_GLDC_VERTEX_UNITS; ++i) { \
+        output[i] = (i < size) ? (GLuint) input[i] % MAX_GLDC_PALETTE_MATRICES : 0; \
+    } \
+}
+
+DEF_READ_MATRIX_INDICES(ub, GLubyte)
+DEF_READ_MATRIX_INDICES(us, GLushort)
+DEF_READ_MATRIX_INDICES(ui, GLuint)
+
+static ReadAttributeFunc calcReadMatrixIndexFunc(void) {
+    switch(ATTRIB_LIST.matrix_index.type) {
+        case GL_UNSIGNED_SHORT:
+            return _readMatrixIndicesus;
+        case GL_UNSIGNED_INT:
+            return _readMatrixIndicesui;
+        case GL_UNSIGNED_BYTE:
+        default:
+            return _readMatrixIndicesub;
+    }
+}
+
+
 void APIENTRY glEnableClientState(GLenum cap) {
     TRACE();
 
@@ -586,6 +643,14 @@ void APIENTRY glEnableClientState(GLenum cap) {
         ATTRIB_LIST.enabled |= NORMAL_ENABLED_FLAG;
         ATTRIB_LIST.dirty   |= NORMAL_ENABLED_FLAG;
         break;
+    case GL_WEIGHT_ARRAY_ARB:
+        ATTRIB_LIST.enabled |= WEIGHT_ENABLED_FLAG;
+        ATTRIB_LIST.dirty   |= WEIGHT_ENABLED_FLAG;
+        break;
+    case GL_MATRIX_INDEX_ARRAY_ARB:
+        ATTRIB_LIST.enabled |= MATRIX_INDEX_ENABLED_FLAG;
+        ATTRIB_LIST.dirty   |= MATRIX_INDEX_ENABLED_FLAG;
+        break;
     case GL_TEXTURE_COORD_ARRAY:
         (ACTIVE_CLIENT_TEXTURE) ?
             (ATTRIB_LIST.enabled |= ST_ENABLED_FLAG):
@@ -616,6 +681,14 @@ void APIENTRY glDisableClientState(GLenum cap) {
         ATTRIB_LIST.enabled &= ~NORMAL_ENABLED_FLAG;
 	    ATTRIB_LIST.dirty   |=  NORMAL_ENABLED_FLAG;
         break;
+    case GL_WEIGHT_ARRAY_ARB:
+        ATTRIB_LIST.enabled &= ~WEIGHT_ENABLED_FLAG;
+        ATTRIB_LIST.dirty   |=  WEIGHT_ENABLED_FLAG;
+        break;
+    case GL_MATRIX_INDEX_ARRAY_ARB:
+        ATTRIB_LIST.enabled &= ~MATRIX_INDEX_ENABLED_FLAG;
+        ATTRIB_LIST.dirty   |=  MATRIX_INDEX_ENABLED_FLAG;
+        break;
     case GL_TEXTURE_COORD_ARRAY:
         (ACTIVE_CLIENT_TEXTURE) ?
             (ATTRIB_LIST.enabled &= ~ST_ENABLED_FLAG):
@@ -744,6 +817,67 @@ void APIENTRY glNormalPointer(GLenum type,  GLsizei stride,  const GLvoid * poin
 	ATTRIB_LIST.dirty |= NORMAL_ENABLED_FLAG;
 }
 
+void APIENTRY glWeightPointerARB(GLint size, GLenum type, GLsizei stride, const GLvoid* pointer) {
+    TRACE();
+
+    GLint validTypes[] = {
+        GL_FLOAT,
+        GL_UNSIGNED_BYTE,
+        GL_UNSIGNED_SHORT,
+        0
+    };
+
+    stride = (stride) ? stride : size * byte_size(type);
+    ATTRIB_LIST.weight.ptr = pointer;
+
+    if(_glStateUnchanged(&ATTRIB_LIST.weight, size, type, stride)) return;
+
+    if(size < 1 || size > MAX_GLDC_VERTEX_UNITS) {
+        _glKosThrowError(GL_INVALID_VALUE, __func__);
+        return;
+    }
+
+    if(_glCheckValidEnum(type, validTypes, __func__) != 0) {
+        return;
+    }
+
+    ATTRIB_LIST.weight.stride = stride;
+    ATTRIB_LIST.weight.type = type;
+    ATTRIB_LIST.weight.size = size;
+
+    ATTRIB_LIST.dirty |= WEIGHT_ENABLED_FLAG;
+}
+
+void APIENTRY glMatrixIndexPointerARB(GLint size, GLenum type, GLsizei stride, const GLvoid* pointer) {
+    TRACE();
+
+    GLint validTypes[] = {
+        GL_UNSIGNED_BYTE,
+        GL_UNSIGNED_SHORT,
+        GL_UNSIGNED_INT,
+        0
+    };
+
+    stride = (stride) ? stride : size * byte_size(type);
+    ATTRIB_LIST.matrix_index.ptr = pointer;
+
+    if(_glStateUnchanged(&ATTRIB_LIST.matrix_index, size, type, stride)) return;
+
+    if(size < 1 || size > MAX_GLDC_VERTEX_UNITS) {
+        _glKosThrowError(GL_INVALID_VALUE, __func__);
+        return;
+    }
+
+    if(_glCheckValidEnum(type, validTypes, __func__) != 0) {
+        return;
+    }
+
+    ATTRIB_LIST.matrix_index.stride = stride;
+    ATTRIB_LIST.matrix_index.type = type;
+    ATTRIB_LIST.matrix_index.size = size;
+
+    ATTRIB_LIST.dirty |= MATRIX_INDEX_ENABLED_FLAG;
+}
 
 void _glInitAttributePointers(void) {
     TRACE();
@@ -753,6 +887,8 @@ void _glInitAttributePointers(void) {
     glTexCoordPointer(2, GL_FLOAT, 0, NULL);
     glColorPointer(4, GL_FLOAT, 0, NULL);
     glNormalPointer(GL_FLOAT, 0, NULL);
+    glWeightPointerARB(1, GL_FLOAT, 0, NULL);
+    glMatrixIndexPointerARB(1, GL_UNSIGNED_BYTE, 0, NULL);
 }
 
 GL_FORCE_INLINE GLuint _glIsVertexDataFastPathCompatible(void) {
@@ -767,8 +903,15 @@ GL_FORCE_INLINE GLuint _glIsVertexDataFastPathCompatible(void) {
      *
      * When this happens we do inline straight copies of the enabled data
      * and transforms for positions and normals happen while copying.
+     *
+     * Skinned vertices need their weights and matrix indices, which the
+     * fast path doesn't read.
      */
 
+    if((ATTRIB_LIST.enabled & SKINNING_ENABLED_FLAGS)) {
+        return GL_FALSE;
+    }
+
     if((ATTRIB_LIST.enabled & VERTEX_ENABLED_FLAG)) {
         if(ATTRIB_LIST.vertex.size != 3 || ATTRIB_LIST.vertex.type != GL_FLOAT) {
             return GL_FALSE;
@@ -834,6 +977,14 @@ void _glUpdateAttributes(void) {
         ATTRIB_LIST.normal_func = calcReadNormalFunc();
     }
 
+    if(ATTRIB_LIST.dirty & WEIGHT_ENABLED_FLAG) {
+        ATTRIB_LIST.weight_func = calcReadWeightFunc();
+    }
+
+    if(ATTRIB_LIST.dirty & MATRIX_INDEX_ENABLED_FLAG) {
+        ATTRIB_LIST.matrix_index_func = calcReadMatrixIndexFunc();
+    }
+
     ATTRIB_LIST.fast_path = _glIsVertexDataFastPathCompatible();
     ATTRIB_LIST.dirty     = 0;
 }
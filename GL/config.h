@@ -1,4 +1,5 @@
 #pragma once
 
-/* This figure is derived from the needs of Quake 1 */
+/* Default for GLdcConfig::texture_count_max. This figure is derived from
+ * the needs of Quake 1 */
 #define MAX_TEXTURE_COUNT 1088
@@ -561,40 +561,108 @@ static void generateArrays(SubmissionTarget* target, const GLsizei first, const
     _readSTData(first, count, start);
 }
 
-static void generate(SubmissionTarget* target, const GLenum mode, const GLsizei first, const GLuint count,
+/* Skins the vertices generate() just read, which were left untransformed.
+ * Each vertex's palette matrices are blended by its weights and the
+ * position goes through the result in one TransformVertex, so there's
+ * still a single XMTRX load and ftrv per vertex (and neighbouring vertices
+ * on the same bones, the usual case, skip even the load). Lit vertices
+ * stay in eye space and get their normals blended too, by the upper 3x3 of
+ * the same matrix; unlit ones go straight to clip space through the
+ * palette premultiplied by the projection. This has to run before the
+ * vertices are expanded for the primitive, while output i is still source
+ * vertex first + i. */
+static void skinVertices(SubmissionTarget* target, const GLsizei first, const GLuint count,
         const GLubyte* indices, const GLenum type) {
-    /* Read from the client buffers and generate an array of ClipVertices */
-    TRACE();
+    GL_TRACE_FUNCTION();
 
-    if(ATTRIB_LIST.fast_path) {
-        if(indices) {
-            generateElementsFastPath(target, first, count, indices, type);
-        } else {
-            switch(mode) {
-                case GL_QUADS:
-                    generateArraysFastPath_QUADS(target, first, count);
-                    return;  // Don't need to do any more processing
-                case GL_TRIANGLES:
-                    if(_glGetPolygonMode() == GL_FILL) {
-                        generateArraysFastPath_TRIS(target, first, count);
-                        return; // Don't need to do any more processing
-                    }
-                    generateArraysFastPath_ALL(target, first, count);
-                    break;
-                default:
-                    generateArraysFastPath_ALL(target, first, count);
+    const GLsizei istride = index_size(type);
+    const IndexParseFunc IndexFunc = _calcParseIndexFunc(type);
+
+    const ReadAttributeFunc weight_func = ATTRIB_LIST.weight_func;
+    const GLubyte* wptr = (const GLubyte*) ATTRIB_LIST.weight.ptr;
+    const GLsizei wstride = ATTRIB_LIST.weight.stride;
+
+    const ReadAttributeFunc matrix_index_func = ATTRIB_LIST.matrix_index_func;
+    const GLubyte* mptr = (const GLubyte*) ATTRIB_LIST.matrix_index.ptr;
+    const GLsizei mstride = ATTRIB_LIST.matrix_index.stride;
+
+    const GLint units = ATTRIB_LIST.matrix_index.size;
+    const GLboolean eye_space = _glTnlIsEyeSpace();
+
+    Matrix4x4 blended __attribute__((aligned(32)));
+    GLfloat weights[MAX_GLDC_VERTEX_UNITS];
+    GLuint matrices[MAX_GLDC_VERTEX_UNITS];
+    GLfloat last_weights[MAX_GLDC_VERTEX_UNITS];
+    GLuint last_matrices[MAX_GLDC_VERTEX_UNITS];
+    GLboolean loaded = GL_FALSE;
+
+    Vertex* it = _glSubmissionTargetStart(target);
+
+    for(GLuint i = 0; i < count; ++i, ++it) {
+        const GLuint idx = (indices) ? IndexFunc(indices + ((first + i) * istride)) : (GLuint) first + i;
+
+        weight_func(wptr + (idx * wstride), (GLubyte*) weights);
+        matrix_index_func(mptr + (idx * mstride), (GLubyte*) matrices);
+
+        if(!loaded ||
+           memcmp(weights, last_weights, sizeof(weights)) != 0 ||
+           memcmp(matrices, last_matrices, sizeof(matrices)) != 0) {
+
+            const GLfloat* m = (const GLfloat*) ((eye_space) ?
+                _glGetPaletteMatrix(matrices[0]) : _glGetPaletteMatrixProjection(matrices[0]));
+
+            for(GLuint j = 0; j < 16; ++j) {
+                blended[j] = m[j] * weights[0];
+            }
+
+            for(GLint u = 1; u < units; ++u) {
+                if(weights[u] == 0.0f) {
+                    continue;
+                }
+
+                m = (const GLfloat*) ((eye_space) ?
+                    _glGetPaletteMatrix(matrices[u]) : _glGetPaletteMatrixProjection(matrices[u]));
+
+                for(GLuint j = 0; j < 16; ++j) {
+                    blended[j] += m[j] * weights[u];
+                }
             }
+
+            UploadMatrix4x4(&blended);
+            memcpy(last_weights, weights, sizeof(weights));
+            memcpy(last_matrices, matrices, sizeof(matrices));
+            loaded = GL_TRUE;
         }
-    } else {
-        if(indices) {
-            generateElements(target, first, count, indices, type);
-        } else {
-            generateArrays(target, first, count);
+
+        TransformVertex(it->xyz[0], it->xyz[1], it->xyz[2], it->w, it->xyz, &it->w);
+
+        if(eye_space) {
+            GLfloat n[3], r[3];
+            _glUnpackNormal(it->nxyz, n);
+
+            r[0] = blended[M0] * n[0] + blended[M4] * n[1] + blended[M8] * n[2];
+            r[1] = blended[M1] * n[0] + blended[M5] * n[1] + blended[M9] * n[2];
+            r[2] = blended[M2] * n[0] + blended[M6] * n[1] + blended[M10] * n[2];
+
+            /* Blending (and any scale in the palette) changes the length */
+            GLfloat length = r[0] * r[0] + r[1] * r[1] + r[2] * r[2];
+            if(length > 0.0f) {
+                length = MATH_fsrra(length);
+                r[0] *= length;
+                r[1] *= length;
+                r[2] *= length;
+            }
+
+            it->nxyz = _glPackNormal(r);
         }
     }
+}
 
+/* Sets the end-of-strip flags on the count vertices read for mode, or
+ * expands them in place (from the back) into the target->count vertices
+ * calcFinalVertices made room for */
+static void genPrimitives(SubmissionTarget* target, const GLenum mode, const GLuint count) {
     Vertex* it = _glSubmissionTargetStart(target);
-    // Drawing arrays
     switch(mode) {
     case GL_TRIANGLES:
         GLenum polygon_mode = _glGetPolygonMode();
@@ -646,6 +714,63 @@ static void generate(SubmissionTarget* target, const GLenum mode, const GLsizei
     }
 }
 
+static void generate(SubmissionTarget* target, const GLenum mode, const GLsizei first, const GLuint count,
+        const GLubyte* indices, const GLenum type) {
+    /* Read from the client buffers and generate an array of ClipVertices */
+    TRACE();
+    GL_TRACE_FUNCTION();
+
+    if(ATTRIB_LIST.fast_path) {
+        if(indices) {
+            generateElementsFastPath(target, first, count, indices, type);
+        } else {
+            switch(mode) {
+                case GL_QUADS:
+                    generateArraysFastPath_QUADS(target, first, count);
+                    return;  // Don't need to do any more processing
+                case GL_TRIANGLES:
+                    if(_glGetPolygonMode() == GL_FILL) {
+                        generateArraysFastPath_TRIS(target, first, count);
+                        return; // Don't need to do any more processing
+                    }
+                    generateArraysFastPath_ALL(target, first, count);
+                    break;
+                default:
+                    generateArraysFastPath_ALL(target, first, count);
+            }
+        }
+    } else {
+        if(indices) {
+            generateElements(target, first, count, indices, type);
+        } else {
+            generateArrays(target, first, count);
+        }
+
+        if(_glTnlIsSkinning()) {
+            skinVertices(target, first, count, indices, type);
+        }
+    }
+
+    genPrimitives(target, mode, count);
+}
+
+/* Immediate mode vertices were written straight into the list by glVertex,
+ * untransformed, as the matrix can't be relied on staying loaded while the
+ * application runs between calls (XMTRX is anyone's on the SH4). So glEnd
+ * transforms them here, in place, in one pass. */
+static void generateImmediate(SubmissionTarget* target, const GLenum mode, const GLuint count) {
+    TRACE();
+
+    Vertex* it = _glSubmissionTargetStart(target);
+
+    ITERATE(count) {
+        TransformVertex(it->xyz[0], it->xyz[1], it->xyz[2], it->w, it->xyz, &it->w);
+        ++it;
+    }
+
+    genPrimitives(target, mode, count);
+}
+
 GL_FORCE_INLINE int _calc_pvr_face_culling() {
     if(!_glIsCullingEnabled()) {
         return GPU_CULLING_SMALL;
@@ -685,75 +810,101 @@ GL_FORCE_INLINE int _calc_pvr_depth_test() {
     }
 }
 
-GL_FORCE_INLINE void apply_poly_header(PolyHeader* header, GLboolean multiTextureHeader, PolyList* activePolyList, GLshort textureUnit) {
-    TRACE();
+/* Where the last glKosDrawSprites finished, so that the next can carry on
+ * under the same sprite header. Any other header written to that list
+ * ends the run. */
+static struct {
+    PolyList* list;
+    GLuint header_offset;
+    GLuint end;
+} SPRITE_RUN = {NULL, 0, 0};
 
-    // Compile the header
-    PolyContext ctx;
-    memset(&ctx, 0, sizeof(PolyContext));
+GL_FORCE_INLINE void build_poly_context(PolyContext* ctx, GLboolean multiTextureHeader, PolyList* activePolyList, GLshort textureUnit) {
+    memset(ctx, 0, sizeof(PolyContext));
 
-    ctx.list_type = activePolyList->list_type;
-    ctx.fmt.color = GPU_CLRFMT_4FLOATS;
-    ctx.fmt.uv = GPU_UVFMT_32BIT;
-    ctx.gen.color_clamp = GPU_CLRCLAMP_ENABLE;
+    ctx->list_type = activePolyList->list_type;
+    ctx->fmt.color = GPU_CLRFMT_4FLOATS;
+    ctx->fmt.uv = GPU_UVFMT_32BIT;
+    ctx->gen.color_clamp = GPU_CLRCLAMP_ENABLE;
 
-    ctx.gen.culling = _calc_pvr_face_culling();
-    ctx.depth.comparison = _calc_pvr_depth_test();
-    ctx.depth.write = _glIsDepthWriteEnabled() ? GPU_DEPTHWRITE_ENABLE : GPU_DEPTHWRITE_DISABLE;
+    ctx->gen.culling = _calc_pvr_face_culling();
+    ctx->depth.comparison = _calc_pvr_depth_test();
+    ctx->depth.write = _glIsDepthWriteEnabled() ? GPU_DEPTHWRITE_ENABLE : GPU_DEPTHWRITE_DISABLE;
 
-    ctx.gen.shading = (_glGetShadeModel() == GL_SMOOTH) ? GPU_SHADE_GOURAUD : GPU_SHADE_FLAT;
+    ctx->gen.shading = (_glGetShadeModel() == GL_SMOOTH) ? GPU_SHADE_GOURAUD : GPU_SHADE_FLAT;
 
     if(_glIsScissorTestEnabled()) {
-        ctx.gen.clip_mode = GPU_USERCLIP_INSIDE;
+        ctx->gen.clip_mode = GPU_USERCLIP_INSIDE;
     } else {
-        ctx.gen.clip_mode = GPU_USERCLIP_DISABLE;
+        ctx->gen.clip_mode = GPU_USERCLIP_DISABLE;
     }
 
     if(_glIsFogEnabled()) {
-        ctx.gen.fog_type = GPU_FOG_TABLE;
+        ctx->gen.fog_type = GPU_FOG_TABLE;
     } else {
-        ctx.gen.fog_type = GPU_FOG_DISABLE;
+        ctx->gen.fog_type = GPU_FOG_DISABLE;
+    }
+
+    /* Texturing is always on, so the offset colour is always available */
+    if(_glIsSeparateSpecularEnabled()) {
+        ctx->gen.specular = GPU_SPECULAR_ENABLE;
+    } else {
+        ctx->gen.specular = GPU_SPECULAR_DISABLE;
     }
 
     if(_glIsBlendingEnabled() || _glIsAlphaTestEnabled()) {
-        ctx.gen.alpha = GPU_ALPHA_ENABLE;
+        ctx->gen.alpha = GPU_ALPHA_ENABLE;
     } else {
-        ctx.gen.alpha = GPU_ALPHA_DISABLE;
+        ctx->gen.alpha = GPU_ALPHA_DISABLE;
     }
 
-    if(ctx.list_type == GPU_LIST_OP_POLY) {
+    if(ctx->list_type == GPU_LIST_OP_POLY) {
         /* Opaque polys are always one/zero */
-        ctx.blend.src = GPU_BLEND_ONE;
-        ctx.blend.dst = GPU_BLEND_ZERO;
-    } else if(ctx.list_type == GPU_LIST_PT_POLY) {
+        ctx->blend.src = GPU_BLEND_ONE;
+        ctx->blend.dst = GPU_BLEND_ZERO;
+    } else if(ctx->list_type == GPU_LIST_PT_POLY) {
         /* Punch-through polys require fixed blending and depth modes */
-        ctx.blend.src = GPU_BLEND_SRCALPHA;
-        ctx.blend.dst = GPU_BLEND_INVSRCALPHA;
-        ctx.depth.comparison = GPU_DEPTHCMP_LEQUAL;
+        ctx->blend.src = GPU_BLEND_SRCALPHA;
+        ctx->blend.dst = GPU_BLEND_INVSRCALPHA;
+        ctx->depth.comparison = GPU_DEPTHCMP_LEQUAL;
     } else {
-        ctx.blend.src = _glGetGpuBlendSrcFactor();
-        ctx.blend.dst = _glGetGpuBlendDstFactor();
+        ctx->blend.src = _glGetGpuBlendSrcFactor();
+        ctx->blend.dst = _glGetGpuBlendDstFactor();
 
-        if(ctx.list_type == GPU_LIST_TR_POLY && AUTOSORT_ENABLED) {
+        if(ctx->list_type == GPU_LIST_TR_POLY && AUTOSORT_ENABLED) {
             /* Autosort mode requires this mode for transparent polys */
-            ctx.depth.comparison = GPU_DEPTHCMP_GEQUAL;
+            ctx->depth.comparison = GPU_DEPTHCMP_GEQUAL;
         }
     }
 
-    _glUpdatePVRTextureContext(&ctx, textureUnit);
+    _glTouchTexture((textureUnit == 0) ? _glGetTexture0() : _glGetTexture1());
+    _glUpdatePVRTextureContext(ctx, textureUnit);
 
     if(multiTextureHeader) {
-        gl_assert(ctx.list_type == GPU_LIST_TR_POLY);
-
-        ctx.gen.alpha = GPU_ALPHA_ENABLE;
-        ctx.txr.alpha = GPU_TXRALPHA_ENABLE;
-        ctx.blend.src = GPU_BLEND_ZERO;
-        ctx.blend.dst = GPU_BLEND_DESTCOLOR;
-        ctx.depth.comparison = GPU_DEPTHCMP_EQUAL;
+        gl_assert(ctx->list_type == GPU_LIST_TR_POLY);
+
+        ctx->gen.alpha = GPU_ALPHA_ENABLE;
+        ctx->gen.specular = GPU_SPECULAR_DISABLE;  /* Already added by the first pass */
+        ctx->txr.alpha = GPU_TXRALPHA_ENABLE;
+        ctx->blend.src = GPU_BLEND_ZERO;
+        ctx->blend.dst = GPU_BLEND_DESTCOLOR;
+        ctx->depth.comparison = GPU_DEPTHCMP_EQUAL;
     }
+}
+
+GL_FORCE_INLINE void apply_poly_header(PolyHeader* header, GLboolean multiTextureHeader, PolyList* activePolyList, GLshort textureUnit) {
+    TRACE();
+
+    // Compile the header
+    PolyContext ctx;
+    build_poly_context(&ctx, multiTextureHeader, activePolyList, textureUnit);
 
     CompilePolyHeader(header, &ctx);
 
+    if(SPRITE_RUN.list == activePolyList) {
+        SPRITE_RUN.list = NULL;
+    }
+
     /* Force bits 18 and 19 on to switch to 6 triangle strips */
     header->cmd |= 0xC0000;
 
@@ -771,22 +922,54 @@ GL_FORCE_INLINE void apply_poly_header(PolyHeader* header, GLboolean multiTextur
     */
 }
 
-GL_FORCE_INLINE void apply_strided_texture_uv_scale(SubmissionTarget* target) {
-    TextureObject* texture = _glGetTexture0();
+/* The scale and offset taking texture coordinates onto the part of texture
+ * memory the texture's image is in, if that isn't all of it */
+GL_FORCE_INLINE GLboolean texture_uv_transform(const TextureObject* texture, float* scale, float* offset) {
+    if(!texture) {
+        return GL_FALSE;
+    }
 
-    if(!texture || !texture->isStrided || !texture->pvrWidth || !texture->pvrHeight) {
-        return;
+    offset[0] = offset[1] = 0.0f;
+
+    if(texture->atlasPage) {
+        /* Atlas members map 0..1 onto their region of the page */
+        const TextureObject* page = texture->atlasPage;
+        scale[0] = (float) texture->width / (float) page->width;
+        scale[1] = (float) texture->height / (float) page->height;
+        offset[0] = (float) texture->atlasX / (float) page->width;
+        offset[1] = (float) texture->atlasY / (float) page->height;
+    } else if(texture->isStrided && texture->pvrWidth && texture->pvrHeight) {
+        scale[0] = (float) texture->logicalWidth / (float) texture->pvrWidth;
+        scale[1] = (float) texture->logicalHeight / (float) texture->pvrHeight;
+    } else {
+        return GL_FALSE;
     }
 
-    const float uScale = (float) texture->logicalWidth / (float) texture->pvrWidth;
-    const float vScale = (float) texture->logicalHeight / (float) texture->pvrHeight;
-    Vertex* it = _glSubmissionTargetStart(target);
+    return GL_TRUE;
+}
+
+GL_FORCE_INLINE void apply_texture_uv_transform(SubmissionTarget* target) {
+    float scale[2], offset[2];
+
+    Vertex* start = _glSubmissionTargetStart(target);
     Vertex* end = _glSubmissionTargetEnd(target);
 
-    while(it < end) {
-        it->uv[0] *= uScale;
-        it->uv[1] *= vScale;
-        ++it;
+    if(texture_uv_transform(_glGetTexture0(), scale, offset)) {
+        const float uScale = scale[0], vScale = scale[1];
+        const float uOffset = offset[0], vOffset = offset[1];
+
+        for(Vertex* it = start; it < end; ++it) {
+            it->uv[0] = it->uv[0] * uScale + uOffset;
+            it->uv[1] = it->uv[1] * vScale + vOffset;
+        }
+    }
+
+    /* The second unit's coordinates are in st, as half floats */
+    if(texture_uv_transform(_glGetTexture1(), scale, offset)) {
+        for(Vertex* it = start; it < end; ++it) {
+            it->st[0] = _glPackHalfFloat(_glUnpackHalfFloat(it->st[0]) * scale[0] + offset[0]);
+            it->st[1] = _glPackHalfFloat(_glUnpackHalfFloat(it->st[1]) * scale[1] + offset[1]);
+        }
     }
 }
 
@@ -830,69 +1013,136 @@ GL_FORCE_INLINE GLuint calcFinalVertices(GLenum mode, GLuint count) {
     return count;
 }
 
-GL_FORCE_INLINE void submitVertices(GLenum mode, GLsizei first, GLuint count, GLenum type, const GLvoid* indices) {
+/* Polygons are treated as triangle fans, the only time this would be a
+ * problem is if we supported glPolygonMode(..., GL_LINE) but we don't.
+ * We optimise the triangle and quad cases.
+ */
+GL_FORCE_INLINE GLenum resolvePolygonMode(GLenum mode, GLuint count) {
+    if(mode != GL_POLYGON) {
+        return mode;
+    }
+
+    switch(count) {
+        case 2:
+            return GL_LINES;
+        case 3:
+            return GL_TRIANGLES;
+        case 4:
+            return GL_QUADS;
+        default:
+            return GL_TRIANGLE_FAN;
+    }
+}
+
+/* Drops whatever glBegin and glVertex put in the list, as glEnd found
+ * nothing to draw. If that included a header, the next draw needs one. */
+static void discardImmediate(SubmissionTarget* target) {
+    if(target->start_offset != target->header_offset) {
+        _glGPUStateMarkDirty();
+    }
+
+    aligned_vector_resize(&target->output->vector, target->header_offset);
+    target->count = 0;
+}
+
+/* When immediate is set the vertices are already in the target, from
+ * _glImmediateBegin and _glImmediateVertex, and count is ignored. The
+ * frame stats for those were counted per glBegin/glEnd block. */
+GL_FORCE_INLINE void submitVertices(GLenum mode, GLsizei first, GLuint count, GLenum type, const GLvoid* indices,
+        const GLboolean immediate) {
     SubmissionTarget* const target = &SUBMISSION_TARGET;
     TRACE();
+    GL_TRACE_FUNCTION();
+
+    const GLuint written = target->count;
 
-    /* Do nothing if vertices aren't enabled */
-    if(!(ATTRIB_LIST.enabled & VERTEX_ENABLED_FLAG)) return;
-    if(ATTRIB_LIST.dirty) _glUpdateAttributes();
+    if(immediate) {
+        count = written;
+    } else {
+        /* Anything immediate mode left for later goes first */
+        _glImmediateFlush();
+
+        /* Do nothing if vertices aren't enabled */
+        if(!(ATTRIB_LIST.enabled & VERTEX_ENABLED_FLAG)) return;
+        if(ATTRIB_LIST.dirty) _glUpdateAttributes();
+    }
 
     if(mode == GL_TRIANGLES) {
         count -= (count % 3);
     }
     /* No vertices? Do nothing */
-    if(!count) return;
-
-    /* Polygons are treated as triangle fans, the only time this would be a
-     * problem is if we supported glPolygonMode(..., GL_LINE) but we don't.
-     * We optimise the triangle and quad cases.
-     */
-    if(mode == GL_POLYGON) {
-        switch(count) {
-            case 2:
-                mode = GL_LINES;
-            break;
-            case 3:
-                mode = GL_TRIANGLES;
-            break;
-            case 4:
-                mode = GL_QUADS;
-            break;
-            default:
-                mode = GL_TRIANGLE_FAN;
+    if(!count) {
+        if(immediate) {
+            discardImmediate(target);
         }
+        return;
     }
 
-    target->output = _glActivePolyList();
-    gl_assert(target->output);
+    FRAME_STATS_TIMER_START(drawStart);
+    const GLenum inputMode = mode;
 
-    uint32_t vector_size = aligned_vector_size(&target->output->vector);
+    mode = resolvePolygonMode(mode, count);
 
-    GLboolean header_required = (vector_size == 0) || _glGPUStateIsDirty();
+    GLboolean header_required;
 
-    target->count = calcFinalVertices(mode, count);
-    target->header_offset = vector_size;
-    target->start_offset = target->header_offset + (header_required ? 1 : 0);
+    if(immediate) {
+        /* glBegin already wrote any header. Trim any incomplete triangle,
+         * or make room to expand the primitive. Vertices past the end are
+         * from a block still being written, when that's the case there's
+         * nothing to trim or expand. */
+        header_required = target->start_offset != target->header_offset;
+        target->count = calcFinalVertices(mode, count);
+        if(target->count != written) {
+            aligned_vector_resize(&target->output->vector, target->start_offset + target->count);
+        }
+    } else {
+        target->output = _glActivePolyList();
+        gl_assert(target->output);
 
-    gl_assert(target->start_offset >= target->header_offset);
-    gl_assert(target->count);
+        uint32_t vector_size = aligned_vector_size(&target->output->vector);
 
-    /* Make room for the vertices and header */
-    aligned_vector_extend(&target->output->vector, target->count + (header_required));
+        header_required = (vector_size == 0) || _glGPUStateIsDirty();
 
-    if(header_required) {
-        apply_poly_header(_glSubmissionTargetHeader(target), GL_FALSE, target->output, 0);
-        _glGPUStateMarkClean();
+        target->count = calcFinalVertices(mode, count);
+        target->header_offset = vector_size;
+        target->start_offset = target->header_offset + (header_required ? 1 : 0);
+
+        gl_assert(target->start_offset >= target->header_offset);
+        gl_assert(target->count);
+
+        /* Make room for the vertices and header */
+        aligned_vector_extend(&target->output->vector, target->count + (header_required));
+
+        if(header_required) {
+            apply_poly_header(_glSubmissionTargetHeader(target), GL_FALSE, target->output, 0);
+            _glGPUStateMarkClean();
+        }
     }
 
-    _glTnlLoadMatrix();
+    if(!immediate) {
+        FRAME_STATS_ADD(draw_calls, 1);
+        FRAME_STATS_ADD(headers_emitted, header_required);
+        FRAME_STATS_ADD(headers_avoided, !header_required);
+    }
 
-    generate(target, mode, first, count, (GLubyte*) indices, type);
+    if(immediate) {
+        _glTnlLoadImmediateMatrix();
+        generateImmediate(target, mode, count);
+    } else {
+        _glTnlLoadMatrix();
+        generate(target, mode, first, count, (GLubyte*) indices, type);
+    }
 
     _glTnlApplyEffects(target);
 
-    apply_strided_texture_uv_scale(target);
+    apply_texture_uv_transform(target);
+
+    if(!immediate && inputMode <= GL_POLYGON) {
+        FRAME_STATS_ADD(vertices_in[inputMode], count);
+        FRAME_STATS_ADD(vertices_out[inputMode], target->count);
+    }
+
+    FRAME_STATS_TIMER_END(draw_time, drawStart);
 
     // /*
     //    Now, if multitexturing is enabled, we want to send exactly the same vertices again, except:
@@ -945,7 +1195,7 @@ void APIENTRY glDrawElements(GLenum mode, GLsizei count, GLenum type, const GLvo
         return;
     }
 
-    submitVertices(mode, 0, count, type, indices);
+    submitVertices(mode, 0, count, type, indices, GL_FALSE);
 }
 
 void APIENTRY glDrawArrays(GLenum mode, GLint first, GLsizei count) {
@@ -955,7 +1205,251 @@ void APIENTRY glDrawArrays(GLenum mode, GLint first, GLsizei count) {
         return;
     }
 
-    submitVertices(mode, first, count, GL_UNSIGNED_INT, NULL);
+    submitVertices(mode, first, count, GL_UNSIGNED_INT, NULL, GL_FALSE);
+}
+
+/* Immediate mode batching. glEnd leaves blocks of independent triangles
+ * or quads pending, and a following glBegin of the same mode, with nothing
+ * changed in between, carries on appending to them. The whole run is
+ * finished off (transformed, lit and so on) as one submission when
+ * something needs it done: an incompatible glBegin, another draw, the
+ * swap, or a change to state that finishing it depends on, which call
+ * _glImmediateFlush() first. Changes to the header state only need to end
+ * the batch, and glBegin sees those as the state being dirty.
+ *
+ * Only modes whose vertices are never expanded are batched, so a batch
+ * can be finished in place even with a block open after it (glMaterial
+ * inside glBegin/glEnd flushes, say). */
+GLboolean IMMEDIATE_MODE_PENDING = GL_FALSE;
+static GLenum PENDING_MODE = GL_TRIANGLES;
+static GLuint PENDING_COUNT = 0;
+static GLboolean BLOCK_HEADER = GL_FALSE;
+
+GL_FORCE_INLINE GLboolean isBatchable(GLenum mode) {
+    return mode == GL_QUADS || (mode == GL_TRIANGLES && _glGetPolygonMode() == GL_FILL);
+}
+
+void _glImmediateFlushPending(void) {
+    SubmissionTarget* const target = &SUBMISSION_TARGET;
+    const GLuint open = target->count - PENDING_COUNT;
+
+    IMMEDIATE_MODE_PENDING = GL_FALSE;
+
+    target->count = PENDING_COUNT;
+    submitVertices(PENDING_MODE, 0, 0, GL_UNSIGNED_INT, NULL, GL_TRUE);
+
+    /* Any open block carries on after the flushed vertices, under the
+     * same header */
+    target->start_offset += target->count;
+    target->header_offset = target->start_offset;
+    target->count = open;
+
+    PENDING_COUNT = 0;
+}
+
+/* glBegin: picks the list and writes the header now, so that glVertex can
+ * append to it directly */
+void _glImmediateBegin(GLenum mode) {
+    SubmissionTarget* const target = &SUBMISSION_TARGET;
+
+    if(IMMEDIATE_MODE_PENDING) {
+        if(mode == PENDING_MODE && target->output == _glActivePolyList() && !_glGPUStateIsDirty()) {
+            BLOCK_HEADER = GL_FALSE;
+            return;
+        }
+
+        _glImmediateFlushPending();
+    }
+
+    target->output = _glActivePolyList();
+    gl_assert(target->output);
+
+    uint32_t vector_size = aligned_vector_size(&target->output->vector);
+    GLboolean header_required = (vector_size == 0) || _glGPUStateIsDirty();
+
+    target->count = 0;
+    target->header_offset = vector_size;
+    target->start_offset = vector_size + (header_required ? 1 : 0);
+
+    if(header_required) {
+        aligned_vector_extend(&target->output->vector, 1);
+        apply_poly_header(_glSubmissionTargetHeader(target), GL_FALSE, target->output, 0);
+        _glGPUStateMarkClean();
+    }
+
+    BLOCK_HEADER = header_required;
+}
+
+Vertex* _glImmediateVertex(void) {
+    SubmissionTarget* const target = &SUBMISSION_TARGET;
+
+    ++target->count;
+    return (Vertex*) aligned_vector_extend(&target->output->vector, 1);
+}
+
+void _glImmediateEnd(GLenum mode) {
+    SubmissionTarget* const target = &SUBMISSION_TARGET;
+
+    /* Only whole triangles or quads, so the next block can follow on */
+    GLuint count = target->count - PENDING_COUNT;
+    if(mode == GL_TRIANGLES) {
+        count -= (count % 3);
+    } else if(mode == GL_QUADS) {
+        count &= ~3u;
+    }
+
+    target->count = PENDING_COUNT + count;
+    aligned_vector_resize(&target->output->vector, target->start_offset + target->count);
+
+    if(!count) {
+        if(!PENDING_COUNT) {
+            discardImmediate(target);
+        }
+        return;
+    }
+
+    FRAME_STATS_ADD(draw_calls, 1);
+    FRAME_STATS_ADD(headers_emitted, BLOCK_HEADER);
+    FRAME_STATS_ADD(headers_avoided, !BLOCK_HEADER);
+
+    if(mode <= GL_POLYGON) {
+        FRAME_STATS_ADD(vertices_in[mode], count);
+        FRAME_STATS_ADD(vertices_out[mode], calcFinalVertices(resolvePolygonMode(mode, count), count));
+    }
+
+    PENDING_MODE = mode;
+    PENDING_COUNT += count;
+    IMMEDIATE_MODE_PENDING = GL_TRUE;
+
+    if(!isBatchable(mode)) {
+        _glImmediateFlushPending();
+    }
+}
+
+/* Sprite corners go through the modelview and projection like any other
+ * vertex, but are finished here rather than by the backend: divided by w
+ * the same way it would, and rejected rather than clipped if behind the
+ * near plane. */
+GL_FORCE_INLINE GLboolean spriteCorner(float x, float y, float z, float* out) {
+    float xyz[3], w;
+    TransformVertex(x, y, z, 1.0f, xyz, &w);
+
+    if(xyz[2] < -w || w <= 0.0f) {
+        return GL_FALSE;
+    }
+
+    const float f = MATH_Fast_Invert(w);
+    out[0] = xyz[0] * f;
+    out[1] = xyz[1] * f;
+    out[2] = (w == 1.0f) ? MATH_Fast_Invert(1.0001f + xyz[2]) : f;
+    return GL_TRUE;
+}
+
+void APIENTRY glKosDrawSprites(const GLSpriteKOS* sprites, GLsizei count) {
+    TRACE();
+    GL_TRACE_FUNCTION();
+
+    if(_glCheckImmediateModeInactive(__func__)) {
+        return;
+    }
+
+    if((GLint) count < 0) {
+        _glKosThrowError(GL_INVALID_VALUE, __func__);
+        return;
+    }
+
+    if(!count) {
+        return;
+    }
+
+    _glImmediateFlush();
+
+    FRAME_STATS_TIMER_START(drawStart);
+
+    PolyList* list = _glActivePolyList();
+    AlignedVector* vector = &list->vector;
+
+    PolyContext ctx;
+    build_poly_context(&ctx, GL_FALSE, list, 0);
+
+    PolyHeader header;
+    CompileSpriteHeader(&header, &ctx, sprites[0].argb, 0);
+
+    float scale[2] = {1.0f, 1.0f}, offset[2] = {0.0f, 0.0f};
+    texture_uv_transform(_glGetTexture0(), scale, offset);
+
+    /* Carry on under the last sprite header if nothing has been written to
+     * the list since, and it's still the header we'd write */
+    GLboolean open = GL_FALSE;
+    GLuint header_offset = 0;
+    uint32_t argb = 0;
+
+    if(SPRITE_RUN.list == list && SPRITE_RUN.end == aligned_vector_size(vector)) {
+        const PolyHeader* last = (const PolyHeader*) aligned_vector_at(vector, SPRITE_RUN.header_offset);
+        if(last->cmd == header.cmd && last->mode1 == header.mode1 &&
+           last->mode2 == header.mode2 && last->mode3 == header.mode3) {
+            open = GL_TRUE;
+            header_offset = SPRITE_RUN.header_offset;
+            argb = last->d1;
+        }
+    }
+
+    /* At most a header per sprite, so nothing moves while writing */
+    GLuint size = aligned_vector_size(vector);
+    aligned_vector_resize(vector, size + count * 2);
+
+    _glMatrixLoadModelViewProjection();
+
+    GLuint headers = 0;
+
+    for(const GLSpriteKOS* s = sprites; s < sprites + count; ++s) {
+        float a[3], b[3], c[3], d[3];
+        if(!spriteCorner(s->x, s->y, s->z, a) ||
+           !spriteCorner(s->x + s->width, s->y, s->z, b) ||
+           !spriteCorner(s->x + s->width, s->y + s->height, s->z, c) ||
+           !spriteCorner(s->x, s->y + s->height, s->z, d)) {
+            continue;
+        }
+
+        /* The colour is part of the header, so a new one starts a new run */
+        if(!open || s->argb != argb) {
+            header.d1 = argb = s->argb;
+            header_offset = size++;
+            *((PolyHeader*) aligned_vector_at(vector, header_offset)) = header;
+            open = GL_TRUE;
+            ++headers;
+        }
+
+        SpriteVertex* sv = (SpriteVertex*) aligned_vector_at(vector, size++);
+        sv->flags = GPU_CMD_VERTEX_EOL;
+        sv->ax = a[0]; sv->ay = a[1]; sv->az = a[2];
+        sv->bx = b[0]; sv->by = b[1]; sv->bz = b[2];
+        sv->cx = c[0]; sv->cy = c[1]; sv->cz = c[2];
+        sv->dx = d[0]; sv->dy = d[1];
+        sv->padding = 0;
+
+        const float u0 = s->u0 * scale[0] + offset[0], u1 = s->u1 * scale[0] + offset[0];
+        const float v0 = s->v0 * scale[1] + offset[1], v1 = s->v1 * scale[1] + offset[1];
+        sv->auv = PackSpriteUV(u0, v0);
+        sv->buv = PackSpriteUV(u1, v0);
+        sv->cuv = PackSpriteUV(u1, v1);
+    }
+
+    aligned_vector_resize(vector, size);
+
+    if(open) {
+        SPRITE_RUN.list = list;
+        SPRITE_RUN.header_offset = header_offset;
+        SPRITE_RUN.end = size;
+
+        /* Whatever is drawn next needs a polygon header again */
+        _glGPUStateMarkDirty();
+    }
+
+    FRAME_STATS_ADD(draw_calls, 1);
+    FRAME_STATS_ADD(headers_emitted, headers);
+    FRAME_STATS_ADD(headers_avoided, headers == 0);
+    FRAME_STATS_TIMER_END(draw_time, drawStart);
 }
 
 GLuint _glGetActiveClientTexture() {
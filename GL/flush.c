@@ -1,6 +1,8 @@
 
 #include "../containers/aligned_vector.h"
 #include "private.h"
+#include "config.h"
+#include "memory.h"
 
 PolyList OP_LIST;
 PolyList PT_LIST;
@@ -17,6 +19,9 @@ PolyList TR_LIST;
 
 GLboolean AUTOSORT_ENABLED = GL_FALSE;
 
+/* See GLdcConfig::list_shrink_frames */
+static GLuint LIST_SHRINK_FRAMES = 0;
+
 PolyList* _glOpaquePolyList() {
     return &OP_LIST;
 }
@@ -29,12 +34,57 @@ PolyList *_glTransparentPolyList() {
     return &TR_LIST;
 }
 
-void APIENTRY glFlush() {
+/* Lists are only resized here, while they're empty, so nothing needs
+ * copying. A list which came within a quarter of its capacity grows to
+ * half as much again as it used. One which stays under half full for
+ * LIST_SHRINK_FRAMES frames is trimmed back towards what it used */
+static void _glEndListFrame(PolyList* list) {
+    uint32_t used = aligned_vector_size(&list->vector);
+    uint32_t capacity = aligned_vector_capacity(&list->vector);
+
+    aligned_vector_clear(&list->vector);
+
+    list->high_water = MAX(list->high_water, used);
+
+    if(used > capacity - (capacity / 4)) {
+        aligned_vector_reserve(&list->vector, used + (used / 2));
+        list->quiet_frames = list->quiet_peak = 0;
+        return;
+    }
+
+    if(!LIST_SHRINK_FRAMES || used > capacity / 2) {
+        list->quiet_frames = list->quiet_peak = 0;
+        return;
+    }
 
+    list->quiet_peak = MAX(list->quiet_peak, used);
+
+    if(++list->quiet_frames >= LIST_SHRINK_FRAMES) {
+        uint32_t target = MAX(list->min_capacity, list->quiet_peak + (list->quiet_peak / 2));
+
+        if(target < capacity) {
+            aligned_vector_set_capacity(&list->vector, target);
+        }
+
+        list->quiet_frames = list->quiet_peak = 0;
+    }
 }
 
-void APIENTRY glFinish() {
+static void _glInitPolyList(PolyList* list, GPUList type, GLuint capacity) {
+    list->list_type = type;
+    list->high_water = list->quiet_peak = list->quiet_frames = 0;
+    list->min_capacity = capacity;
 
+    aligned_vector_init(&list->vector, sizeof(Vertex));
+    aligned_vector_reserve(&list->vector, capacity);
+}
+
+void APIENTRY glFlush() {
+    _glImmediateFlush();
+}
+
+void APIENTRY glFinish() {
+    _glImmediateFlush();
 }
 
 
@@ -51,6 +101,17 @@ void APIENTRY glKosInitConfig(GLdcConfig* config) {
     config->internal_palette_format = GL_RGBA4;
 
     config->texture_twiddle = GL_TRUE;
+
+    config->texture_defrag_bytes_per_frame = 0;
+    config->texture_restore_bytes_per_frame = 256 * 1024;
+    config->texture_count_max = MAX_TEXTURE_COUNT;
+
+    config->list_shrink_frames = 600;
+
+    config->allocator.alloc = NULL;
+    config->allocator.free = NULL;
+    config->allocator.user_data = NULL;
+    config->scratch_size = 64 * 1024;
 }
 
 static bool _initialized = false;
@@ -64,6 +125,8 @@ void APIENTRY glKosInitEx(GLdcConfig* config) {
 
     TRACE();
 
+    _glInitMemory(&config->allocator, config->scratch_size);
+
     printf("\nWelcome to GLdc! Git revision: %s\n\n", GLDC_VERSION);
 
     InitGPU(config->autosort_enabled, config->fsaa_enabled);
@@ -75,28 +138,23 @@ void APIENTRY glKosInitEx(GLdcConfig* config) {
     _glInitAttributePointers();
     _glInitContext();
     _glInitLights();
-    _glInitImmediateMode(config->initial_immediate_capacity);
     _glInitFramebuffers();
 
     _glSetInternalPaletteFormat(config->internal_palette_format);
 
-    _glInitTextures();
+    _glInitTextures(config->texture_count_max);
+    _glSetDefragBytesPerFrame(config->texture_defrag_bytes_per_frame);
+    _glSetTextureRestoreBytesPerFrame(config->texture_restore_bytes_per_frame);
 
     if(config->texture_twiddle) {
         glEnable(GL_TEXTURE_TWIDDLE_KOS);
     }
 
-    OP_LIST.list_type = GPU_LIST_OP_POLY;
-    PT_LIST.list_type = GPU_LIST_PT_POLY;
-    TR_LIST.list_type = GPU_LIST_TR_POLY;
-
-    aligned_vector_init(&OP_LIST.vector, sizeof(Vertex));
-    aligned_vector_init(&PT_LIST.vector, sizeof(Vertex));
-    aligned_vector_init(&TR_LIST.vector, sizeof(Vertex));
+    _glInitPolyList(&OP_LIST, GPU_LIST_OP_POLY, config->initial_op_capacity);
+    _glInitPolyList(&PT_LIST, GPU_LIST_PT_POLY, config->initial_pt_capacity);
+    _glInitPolyList(&TR_LIST, GPU_LIST_TR_POLY, config->initial_tr_capacity);
 
-    aligned_vector_reserve(&OP_LIST.vector, config->initial_op_capacity);
-    aligned_vector_reserve(&PT_LIST.vector, config->initial_pt_capacity);
-    aligned_vector_reserve(&TR_LIST.vector, config->initial_tr_capacity);
+    LIST_SHRINK_FRAMES = config->list_shrink_frames;
 }
 
 void APIENTRY glKosShutdown() {
@@ -117,29 +175,54 @@ void APIENTRY glKosInit() {
 void APIENTRY glKosSwapBuffers() {
     TRACE();
 
+    _glImmediateFlush();
+
+    FRAME_STATS_TIMER_START(swapStart);
+
     SceneBegin();
-        if(aligned_vector_header(&OP_LIST.vector)->size > 2) {
+        /* The previous frame has finished rendering so palette RAM
+         * is free to write */
+        _glUploadDirtyPalettes();
+
+        /* Submission modifies the lists, so capture them first */
+        _glCaptureFrame();
+
+        FRAME_STATS_TIMER_START(submitStart);
+
+        if(aligned_vector_header(&OP_LIST.vector)->size > 1) {
             SceneListBegin(GPU_LIST_OP_POLY);
             SceneListSubmit((Vertex*) aligned_vector_front(&OP_LIST.vector), aligned_vector_size(&OP_LIST.vector));
             SceneListFinish();
         }
 
-        if(aligned_vector_header(&PT_LIST.vector)->size > 2) {
+        if(aligned_vector_header(&PT_LIST.vector)->size > 1) {
             SceneListBegin(GPU_LIST_PT_POLY);
             SceneListSubmit((Vertex*) aligned_vector_front(&PT_LIST.vector), aligned_vector_size(&PT_LIST.vector));
             SceneListFinish();
         }
 
-        if(aligned_vector_header(&TR_LIST.vector)->size > 2) {
+        if(aligned_vector_header(&TR_LIST.vector)->size > 1) {
             SceneListBegin(GPU_LIST_TR_POLY);
             SceneListSubmit((Vertex*) aligned_vector_front(&TR_LIST.vector), aligned_vector_size(&TR_LIST.vector));
             SceneListFinish();
         }
+
+        FRAME_STATS_TIMER_END(submit_time, submitStart);
     SceneFinish();
 
-    aligned_vector_clear(&OP_LIST.vector);
-    aligned_vector_clear(&PT_LIST.vector);
-    aligned_vector_clear(&TR_LIST.vector);
+    FRAME_STATS_RECORD_LISTS();
+
+    _glEndListFrame(&OP_LIST);
+    _glEndListFrame(&PT_LIST);
+    _glEndListFrame(&TR_LIST);
+
+    /* Nothing references texture addresses until the next frame is
+     * built, so this is the place to move textures around and start
+     * a new frame for residency tracking */
+    _glTexturesEndFrame();
 
     _glApplyScissor(true);
+
+    FRAME_STATS_TIMER_END(swap_time, swapStart);
+    FRAME_STATS_END_FRAME();
 }
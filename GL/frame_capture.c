@@ -0,0 +1,192 @@
+/*
+ * Frame capture (GL_KOS_frame_capture). glKosSwapBuffers passes the lists
+ * through _glCaptureFrame before submitting them, while they still hold
+ * exactly what SceneListSubmit is about to see. See frame_capture.h for the
+ * file layout and tools/replay.c for the other end.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "private.h"
+#include "frame_capture.h"
+
+static FILE* CAPTURE_FILE = NULL;
+static GLuint CAPTURE_FRAMES_REMAINING = 0;
+static uint32_t CAPTURE_FRAMES_WRITTEN = 0;
+
+static GLboolean _glIsPolyHeader(const Vertex* v) {
+    return (v->flags & GPU_CMD_POLYHDR) == GPU_CMD_POLYHDR || IsSpriteHeader(v);
+}
+
+static int _glCompareOffsets(const void* a, const void* b) {
+    const GLuint lhs = *(const GLuint*) a;
+    const GLuint rhs = *(const GLuint*) b;
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+/* Whether any of the sorted offsets fall in [start, start + size) */
+static GLboolean _glRangeReferenced(const GLuint* offsets, GLuint count, GLuint start, GLuint size) {
+    GLuint lo = 0, hi = count;
+
+    while(lo < hi) {
+        GLuint mid = (lo + hi) / 2;
+        if(offsets[mid] < start) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo < count && offsets[lo] < start + size;
+}
+
+/* Fills offsets with where each header's texture starts in texture memory,
+ * sorted. Returns how many there are */
+static GLuint _glCollectTextureOffsets(PolyList** lists, uint32_t textureBase, GLuint* offsets) {
+    GLuint count = 0;
+
+    for(GLuint i = 0; i < FRAME_CAPTURE_LIST_COUNT; ++i) {
+        const Vertex* v = (const Vertex*) aligned_vector_front(&lists[i]->vector);
+        const uint32_t size = aligned_vector_size(&lists[i]->vector);
+
+        for(uint32_t j = 0; j < size; ++j, ++v) {
+            if(_glIsPolyHeader(v)) {
+                uint32_t address = ((const PolyHeader*) v)->mode3 & FRAME_CAPTURE_ADDRESS_MASK;
+                offsets[count++] = ((address - textureBase) & FRAME_CAPTURE_ADDRESS_MASK) << 3;
+            }
+        }
+    }
+
+    qsort(offsets, count, sizeof(GLuint), _glCompareOffsets);
+    return count;
+}
+
+static GLboolean _glWriteFrame(FILE* file) {
+    PolyList* lists[FRAME_CAPTURE_LIST_COUNT] = {&OP_LIST, &PT_LIST, &TR_LIST};
+    GLubyte* base = (GLubyte*) _glTextureMemoryBase();
+
+    FrameCaptureFrame frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.textureBase = FRAME_CAPTURE_ENCODE_ADDRESS(base);
+    frame.paletteFormat = _glGetInternalPaletteFormat();
+
+    GLuint headers = 0;
+    for(GLuint i = 0; i < FRAME_CAPTURE_LIST_COUNT; ++i) {
+        const Vertex* v = (const Vertex*) aligned_vector_front(&lists[i]->vector);
+        frame.listSize[i] = aligned_vector_size(&lists[i]->vector);
+
+        for(uint32_t j = 0; j < frame.listSize[i]; ++j) {
+            headers += _glIsPolyHeader(v + j);
+        }
+    }
+
+    GLuint* offsets = (GLuint*) _glScratchAlloc(MAX(headers, 1u) * sizeof(GLuint));
+    uint32_t* palette = (uint32_t*) _glScratchAlloc(FRAME_CAPTURE_PALETTE_ENTRIES * sizeof(uint32_t));
+
+    if(!offsets || !palette) {
+        _glScratchFree(palette);
+        _glScratchFree(offsets);
+        return GL_FALSE;
+    }
+
+    GLuint offsetCount = _glCollectTextureOffsets(lists, frame.textureBase, offsets);
+
+    for(TextureObject* txr = _glNextTextureObject(0); txr; txr = _glNextTextureObject(txr->index + 1)) {
+        if(txr->data && _glRangeReferenced(offsets, offsetCount, (GLubyte*) txr->data - base, txr->allocatedSize)) {
+            frame.textureCount++;
+        }
+    }
+
+    GPUGetPaletteEntries(0, FRAME_CAPTURE_PALETTE_ENTRIES, palette);
+
+    GLboolean ok = fwrite(&frame, sizeof(frame), 1, file) == 1 &&
+        fwrite(palette, sizeof(uint32_t), FRAME_CAPTURE_PALETTE_ENTRIES, file) == FRAME_CAPTURE_PALETTE_ENTRIES;
+
+    for(GLuint i = 0; ok && i < FRAME_CAPTURE_LIST_COUNT; ++i) {
+        ok = fwrite(aligned_vector_front(&lists[i]->vector), sizeof(Vertex), frame.listSize[i], file) == frame.listSize[i];
+    }
+
+    for(TextureObject* txr = _glNextTextureObject(0); ok && txr; txr = _glNextTextureObject(txr->index + 1)) {
+        FrameCaptureTexture texture;
+        texture.offset = (GLubyte*) txr->data - base;
+        texture.size = txr->allocatedSize;
+
+        if(!txr->data || !_glRangeReferenced(offsets, offsetCount, texture.offset, texture.size)) {
+            continue;
+        }
+
+        ok = fwrite(&texture, sizeof(texture), 1, file) == 1 &&
+            fwrite(txr->data, 1, texture.size, file) == texture.size;
+    }
+
+    _glScratchFree(palette);
+    _glScratchFree(offsets);
+
+    return ok;
+}
+
+static void _glStopCapture() {
+    fclose(CAPTURE_FILE);
+    CAPTURE_FILE = NULL;
+    CAPTURE_FRAMES_REMAINING = 0;
+}
+
+void _glCaptureFrame() {
+    if(!CAPTURE_FILE) {
+        return;
+    }
+
+    if(!_glWriteFrame(CAPTURE_FILE)) {
+        /* Leave what was written so far as a valid capture */
+        _glStopCapture();
+        return;
+    }
+
+    /* Keep the count in the header current, so the file is usable even if
+     * the application never reaches the last frame */
+    ++CAPTURE_FRAMES_WRITTEN;
+    fseek(CAPTURE_FILE, offsetof(FrameCaptureHeader, frameCount), SEEK_SET);
+    fwrite(&CAPTURE_FRAMES_WRITTEN, sizeof(uint32_t), 1, CAPTURE_FILE);
+    fseek(CAPTURE_FILE, 0, SEEK_END);
+
+    if(--CAPTURE_FRAMES_REMAINING == 0) {
+        _glStopCapture();
+    }
+}
+
+GLAPI void APIENTRY glKosCaptureFrames(const char* filename, GLuint frames) {
+    if(CAPTURE_FILE) {
+        _glKosThrowError(GL_INVALID_OPERATION, __func__);
+        return;
+    }
+
+    if(!filename || !frames) {
+        _glKosThrowError(GL_INVALID_VALUE, __func__);
+        return;
+    }
+
+    FILE* file = fopen(filename, "wb");
+    if(!file) {
+        _glKosThrowError(GL_INVALID_VALUE, __func__);
+        return;
+    }
+
+    FrameCaptureHeader header;
+    memcpy(header.magic, FRAME_CAPTURE_MAGIC, 4);
+    header.version = FRAME_CAPTURE_VERSION;
+    header.frameCount = 0;
+    header.vertexSize = sizeof(Vertex);
+
+    if(fwrite(&header, sizeof(header), 1, file) != 1) {
+        fclose(file);
+        _glKosThrowError(GL_INVALID_VALUE, __func__);
+        return;
+    }
+
+    CAPTURE_FILE = file;
+    CAPTURE_FRAMES_REMAINING = frames;
+    CAPTURE_FRAMES_WRITTEN = 0;
+}
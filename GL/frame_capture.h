@@ -0,0 +1,63 @@
+#pragma once
+
+/*
+ * On-disk layout of a frame capture, as written by glKosCaptureFrames and
+ * replayed by tools/replay.c.
+ *
+ * A capture is a header followed by frameCount frames. Each frame is:
+ *
+ *  - a FrameCaptureFrame
+ *  - FRAME_CAPTURE_PALETTE_ENTRIES words of palette RAM
+ *  - the opaque, punch-thru and translucent lists exactly as they were
+ *    handed to SceneListSubmit, listSize[n] * vertexSize bytes each
+ *  - textureCount FrameCaptureTextures, each followed by its data
+ *
+ * Only the textures the lists' poly headers point into are included. The
+ * texture addresses in the headers are left as they were, textureBase is
+ * the start of texture memory encoded the same way so that they can be
+ * rebased. All values are little-endian.
+ */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FRAME_CAPTURE_MAGIC "GFCP"
+#define FRAME_CAPTURE_VERSION 1
+#define FRAME_CAPTURE_LIST_COUNT 3
+#define FRAME_CAPTURE_PALETTE_ENTRIES 1024
+
+/* Texture addresses in PolyHeader::mode3 are in 8 byte units, masked to
+ * 21 bits */
+#define FRAME_CAPTURE_ADDRESS_MASK 0x1FFFFF
+#define FRAME_CAPTURE_ENCODE_ADDRESS(p) ((uint32_t) (((uintptr_t) (p) & 0x00fffff8) >> 3))
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t frameCount;
+    /* sizeof(Vertex) on the capturing platform */
+    uint32_t vertexSize;
+} FrameCaptureHeader;
+
+typedef struct {
+    /* Entries (headers and vertices) in the OP, PT and TR lists */
+    uint32_t listSize[FRAME_CAPTURE_LIST_COUNT];
+    uint32_t textureCount;
+    uint32_t textureBase;
+    /* GLdcConfig::internal_palette_format */
+    uint32_t paletteFormat;
+    uint32_t reserved[2];
+} FrameCaptureFrame;
+
+typedef struct {
+    /* Bytes from the start of texture memory */
+    uint32_t offset;
+    uint32_t size;
+} FrameCaptureTexture;
+
+#ifdef __cplusplus
+}
+#endif
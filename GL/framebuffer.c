@@ -1,4 +1,7 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
 
 #include "private.h"
 
@@ -36,6 +39,13 @@ void APIENTRY glGenFramebuffersEXT(GLsizei n, GLuint* framebuffers) {
     while(n--) {
         GLuint id = 0;
         FrameBuffer* fb = (FrameBuffer*) named_array_alloc(&FRAMEBUFFERS, &id);
+
+        if(!fb) {
+            memset(framebuffers, 0, sizeof(GLuint) * (n + 1));
+            _glKosThrowError(GL_OUT_OF_MEMORY, __func__);
+            return;
+        }
+
         fb->index = id;
         fb->is_complete = GL_FALSE;
         fb->texture_id = 0;
@@ -91,166 +101,290 @@ void APIENTRY glFramebufferTexture2DEXT(GLenum target, GLenum attachment, GLenum
     ACTIVE_FRAMEBUFFER->texture_id = texture;
 }
 
-GL_FORCE_INLINE GLuint A1555(GLuint v) {
-    const GLuint MASK = (1 << 15);
-    return (v & MASK) >> 8;
+/*
+ * Mipmap generation
+ *
+ * In a twiddled texture each 2x2 block of texels is stored as four
+ * consecutive texels, and those blocks are in turn laid out in the same
+ * order as the texels of the next level down. So every level can be produced
+ * from the one above by a linear walk, reducing each group of four texels to
+ * one.
+ *
+ * Level 0 is read from VRAM exactly once and decoded by a per-format kernel
+ * into an RGBA8888 scratch buffer holding level 1. Each further level is
+ * reduced in place in that buffer, and every level is only ever written to
+ * VRAM, in the texture's format.
+ */
+
+/* The pixel format bits of a PVR texture format */
+#define PIXEL_FORMAT_MASK (7 << 27)
+
+static GLboolean MIPMAP_GAMMA_CORRECT = GL_FALSE;
+
+/* sRGB (approximated as gamma 2.2) <-> 12 bit linear intensity */
+static GLushort SRGB_TO_LINEAR[256];
+static GLubyte LINEAR_TO_SRGB[4096];
+static GLboolean GAMMA_TABLES_BUILT = GL_FALSE;
+
+GLboolean _glGetMipmapGammaCorrect() {
+    return MIPMAP_GAMMA_CORRECT;
 }
 
-GL_FORCE_INLINE GLuint R1555(GLuint v) {
-    const GLuint MASK = (31 << 10);
-    return (v & MASK) >> 7;
+void _glSetMipmapGammaCorrect(GLboolean v) {
+    MIPMAP_GAMMA_CORRECT = v;
 }
 
-GL_FORCE_INLINE GLuint G1555(GLuint v) {
-    const GLuint MASK = (31 << 5);
-    return (v & MASK) >> 2;
+static void _glBuildGammaTables() {
+    if(GAMMA_TABLES_BUILT) {
+        return;
+    }
+
+    for(GLuint i = 0; i < 256; ++i) {
+        SRGB_TO_LINEAR[i] = (GLushort) (powf(i / 255.0f, 2.2f) * 4095.0f + 0.5f);
+    }
+
+    for(GLuint i = 0; i < 4096; ++i) {
+        LINEAR_TO_SRGB[i] = (GLubyte) (powf(i / 4095.0f, 1.0f / 2.2f) * 255.0f + 0.5f);
+    }
+
+    GAMMA_TABLES_BUILT = GL_TRUE;
 }
 
-GL_FORCE_INLINE GLuint B1555(GLuint v) {
-    const GLuint MASK = (31 << 0);
-    return (v & MASK) << 3;
+typedef struct {
+    /* RGBA8888 palette entries, paletted textures only */
+    const GLubyte* palette;
+    GLuint paletteCount;
+    GLboolean gamma;
+} MipmapContext;
+
+/* Averages four consecutive RGBA8888 texels */
+GL_FORCE_INLINE void average4(const GLubyte* t, GLubyte* out, GLboolean gamma) {
+    if(gamma) {
+        for(GLubyte c = 0; c < 3; ++c) {
+            GLuint l = SRGB_TO_LINEAR[t[c]] + SRGB_TO_LINEAR[t[c + 4]] +
+                       SRGB_TO_LINEAR[t[c + 8]] + SRGB_TO_LINEAR[t[c + 12]];
+            out[c] = LINEAR_TO_SRGB[(l + 2) >> 2];
+        }
+    } else {
+        out[0] = (t[0] + t[4] + t[8] + t[12] + 2) >> 2;
+        out[1] = (t[1] + t[5] + t[9] + t[13] + 2) >> 2;
+        out[2] = (t[2] + t[6] + t[10] + t[14] + 2) >> 2;
+    }
+
+    /* Coverage is linear, whatever the colour space */
+    out[3] = (t[3] + t[7] + t[11] + t[15] + 2) >> 2;
 }
 
-GL_FORCE_INLINE GLuint A4444(GLuint v) {
-    const GLuint MASK = (0xF << 12);
-    return (v & MASK) >> 12;
+GL_FORCE_INLINE void decode565(GLushort v, GLubyte* out) {
+    GLubyte r = (v >> 11) & 0x1F, g = (v >> 5) & 0x3F, b = v & 0x1F;
+    out[0] = (r << 3) | (r >> 2);
+    out[1] = (g << 2) | (g >> 4);
+    out[2] = (b << 3) | (b >> 2);
+    out[3] = 255;
 }
 
-GL_FORCE_INLINE GLuint R4444(GLuint v) {
-    const GLuint MASK = (0xF << 8);
-    return (v & MASK) >> 8;
+GL_FORCE_INLINE void decode4444(GLushort v, GLubyte* out) {
+    out[0] = ((v >> 8) & 0xF) * 17;
+    out[1] = ((v >> 4) & 0xF) * 17;
+    out[2] = (v & 0xF) * 17;
+    out[3] = ((v >> 12) & 0xF) * 17;
 }
 
-GL_FORCE_INLINE GLuint G4444(GLuint v) {
-    const GLuint MASK = (0xF << 4);
-    return (v & MASK) >> 4;
+GL_FORCE_INLINE void decode1555(GLushort v, GLubyte* out) {
+    GLubyte r = (v >> 10) & 0x1F, g = (v >> 5) & 0x1F, b = v & 0x1F;
+    out[0] = (r << 3) | (r >> 2);
+    out[1] = (g << 3) | (g >> 2);
+    out[2] = (b << 3) | (b >> 2);
+    out[3] = (v & 0x8000) ? 255 : 0;
 }
 
-GL_FORCE_INLINE GLuint B4444(GLuint v) {
-    const GLuint MASK = (0xF << 0);
-    return (v & MASK) >> 0;
+#define SCALE_TO(v, max) ((((GLuint) (v)) * (max) + 127) / 255)
+
+GL_FORCE_INLINE GLushort encode565(const GLubyte* c) {
+    return (SCALE_TO(c[0], 31) << 11) | (SCALE_TO(c[1], 63) << 5) | SCALE_TO(c[2], 31);
 }
 
-GL_FORCE_INLINE GLuint R565(GLuint v) {
-    const GLuint MASK = (31 << 11);
-    return (v & MASK) >> 8;
+GL_FORCE_INLINE GLushort encode4444(const GLubyte* c) {
+    return (SCALE_TO(c[3], 15) << 12) | (SCALE_TO(c[0], 15) << 8) | (SCALE_TO(c[1], 15) << 4) | SCALE_TO(c[2], 15);
 }
 
-GL_FORCE_INLINE GLuint G565(GLuint v) {
-    const GLuint MASK = (63 << 5);
-    return (v & MASK) >> 3;
+GL_FORCE_INLINE GLushort encode1555(const GLubyte* c) {
+    return ((c[3] >= 128) ? 0x8000 : 0) | (SCALE_TO(c[0], 31) << 10) | (SCALE_TO(c[1], 31) << 5) | SCALE_TO(c[2], 31);
 }
 
-GL_FORCE_INLINE GLuint B565(GLuint v) {
-    const GLuint MASK = (31 << 0);
-    return (v & MASK) << 3;
+/* Level 0 -> level 1 reduction kernels, one per source format. count is the
+ * number of texels in level 1 */
+#define DEFINE_REDUCE_KERNEL(name, type, DECODE) \
+    static void name(const GLubyte* src, GLuint count, GLubyte* dst, const MipmapContext* ctx) { \
+        const type* in = (const type*) src; \
+        GLubyte t[16]; \
+        for(GLuint j = 0; j < count; ++j, in += 4, dst += 4) { \
+            DECODE(in[0], t); \
+            DECODE(in[1], t + 4); \
+            DECODE(in[2], t + 8); \
+            DECODE(in[3], t + 12); \
+            average4(t, dst, ctx->gamma); \
+        } \
+    }
+
+#define DECODE_PALETTED(v, out) memcpy((out), ctx->palette + ((v) * 4), 4)
+
+DEFINE_REDUCE_KERNEL(reduce565, GLushort, decode565)
+DEFINE_REDUCE_KERNEL(reduce4444, GLushort, decode4444)
+DEFINE_REDUCE_KERNEL(reduce1555, GLushort, decode1555)
+DEFINE_REDUCE_KERNEL(reducePaletted8, GLubyte, DECODE_PALETTED)
+
+#undef DECODE_PALETTED
+#undef DEFINE_REDUCE_KERNEL
+
+static void encodeLevel16(GLuint pvrFormat, const GLubyte* src, GLuint count, GLubyte* dst) {
+    GLushort* out = (GLushort*) dst;
+
+    switch(pvrFormat & PIXEL_FORMAT_MASK) {
+        case GPU_TXRFMT_RGB565:
+            for(GLuint j = 0; j < count; ++j, src += 4) {
+                *out++ = encode565(src);
+            }
+        break;
+        case GPU_TXRFMT_ARGB4444:
+            for(GLuint j = 0; j < count; ++j, src += 4) {
+                *out++ = encode4444(src);
+            }
+        break;
+        case GPU_TXRFMT_ARGB1555:
+            for(GLuint j = 0; j < count; ++j, src += 4) {
+                *out++ = encode1555(src);
+            }
+        break;
+        default:
+            /* glGenerateMipmap rejects everything else */
+            gl_assert(0);
+    }
 }
 
-static GL_NO_INSTRUMENT GLboolean _glCalculateAverageTexel(GLuint pvrFormat, const GLubyte* src1, const GLubyte* src2, const GLubyte* src3, const GLubyte* src4, GLubyte* t) {
-    GLuint a, r, g, b;
-
-    GLubyte format = ((pvrFormat & (1 << 27)) | (pvrFormat & (1 << 26))) >> 26;
-
-    const GLubyte ARGB1555 = 0;
-    const GLubyte ARGB4444 = 1;
-    const GLubyte RGB565 = 2;
-
-    if((pvrFormat & GPU_TXRFMT_PAL8BPP) == GPU_TXRFMT_PAL8BPP) {
-        /* Paletted... all we can do really is just pick one of the
-         * 4 texels.. unless we want to change the palette (bad) or
-         * pick the closest available colour (slow, and probably bad)
-         */
-        *t = *src1;
-    } else if(format == RGB565) {
-        GLushort* s1 = (GLushort*) src1;
-        GLushort* s2 = (GLushort*) src2;
-        GLushort* s3 = (GLushort*) src3;
-        GLushort* s4 = (GLushort*) src4;
-        GLushort* d1 = (GLushort*) t;
-
-        r = R565(*s1) + R565(*s2) + R565(*s3) + R565(*s4);
-        g = G565(*s1) + G565(*s2) + G565(*s3) + G565(*s4);
-        b = B565(*s1) + B565(*s2) + B565(*s3) + B565(*s4);
-
-        r /= 4;
-        g /= 4;
-        b /= 4;
-
-        *d1 = PACK_RGB565(r, g, b);
-    } else if(format == ARGB4444) {
-        GLushort* s1 = (GLushort*) src1;
-        GLushort* s2 = (GLushort*) src2;
-        GLushort* s3 = (GLushort*) src3;
-        GLushort* s4 = (GLushort*) src4;
-        GLushort* d1 = (GLushort*) t;
-
-        a = A4444(*s1) + A4444(*s2) + A4444(*s3) + A4444(*s4);
-        r = R4444(*s1) + R4444(*s2) + R4444(*s3) + R4444(*s4);
-        g = G4444(*s1) + G4444(*s2) + G4444(*s3) + G4444(*s4);
-        b = B4444(*s1) + B4444(*s2) + B4444(*s3) + B4444(*s4);
-
-        a /= 4;
-        r /= 4;
-        g /= 4;
-        b /= 4;
-
-        *d1 = PACK_ARGB4444(a, r, g, b);
-    } else {
-        gl_assert(format == ARGB1555);
+static void encodeLevelPaletted8(const GLubyte* src, GLuint count, GLubyte* dst, const MipmapContext* ctx) {
+    /* Neighbouring texels are very often the same colour, so remember the
+     * last palette search */
+    uint32_t lastColour = 0;
+    GLubyte lastIndex = 0;
+    GLboolean haveLast = GL_FALSE;
+
+    for(GLuint j = 0; j < count; ++j, src += 4) {
+        uint32_t colour;
+        memcpy(&colour, src, 4);
+
+        if(!haveLast || colour != lastColour) {
+            lastIndex = _glNearestPaletteIndex(ctx->palette, ctx->paletteCount, src, NULL);
+            lastColour = colour;
+            haveLast = GL_TRUE;
+        }
 
-        GLushort* s1 = (GLushort*) src1;
-        GLushort* s2 = (GLushort*) src2;
-        GLushort* s3 = (GLushort*) src3;
-        GLushort* s4 = (GLushort*) src4;
-        GLushort* d1 = (GLushort*) t;
+        dst[j] = lastIndex;
+    }
+}
 
-        a = A1555(*s1) + A1555(*s2) + A1555(*s3) + A1555(*s4);
-        r = R1555(*s1) + R1555(*s2) + R1555(*s3) + R1555(*s4);
-        g = G1555(*s1) + G1555(*s2) + G1555(*s3) + G1555(*s4);
-        b = B1555(*s1) + B1555(*s2) + B1555(*s3) + B1555(*s4);
+/* Reduces an RGBA8888 level in place, count is the number of output texels */
+static void reduceRGBA(GLubyte* data, GLuint count, GLboolean gamma) {
+    const GLubyte* in = data;
+    for(GLuint j = 0; j < count; ++j, in += 16) {
+        GLubyte t[16];
+        memcpy(t, in, 16);
+        average4(t, data + (j * 4), gamma);
+    }
+}
 
-        a /= 4;
-        r /= 4;
-        g /= 4;
-        b /= 4;
+/* Paletted textures with no palette to search can only pick a texel */
+static void reduceIndexes(const GLubyte* src, GLuint count, GLubyte* dst) {
+    for(GLuint j = 0; j < count; ++j) {
+        dst[j] = src[j * 4];
+    }
+}
 
-        *d1 = PACK_ARGB1555((GLubyte) a, (GLubyte) r, (GLubyte) g, (GLubyte) b);
+static const TexturePalette* _glMipmapPalette(const TextureObject* tex) {
+    if(_glIsSharedTexturePaletteEnabled()) {
+        return _glGetSharedPalette(tex->shared_bank);
     }
 
-    return GL_TRUE;
+    return tex->palette;
 }
 
-GLboolean _glGenerateMipmapTwiddled(const GLuint pvrFormat, const GLubyte* prevData, GLuint thisWidth, GLuint thisHeight, GLubyte* thisData) {
-    uint32_t lastWidth = thisWidth * 2;
-    uint32_t lastHeight = thisHeight * 2;
+/* Generates every level below 0. Returns GL_FALSE if we ran out of memory */
+static GLboolean _glGenerateMipmapsTwiddled(TextureObject* tex) {
+    const GLuint pvrFormat = tex->color;
+    const GLuint levels = _glGetMipmapLevelCount(tex);
+    const GLboolean paletted = (pvrFormat & GPU_TXRFMT_PAL8BPP) == GPU_TXRFMT_PAL8BPP;
 
-    uint32_t i, j;
-    uint32_t stride = 0;
+    MipmapContext ctx;
+    ctx.palette = NULL;
+    ctx.paletteCount = 0;
+    ctx.gamma = MIPMAP_GAMMA_CORRECT;
 
-    if((pvrFormat & GPU_TXRFMT_PAL8BPP) == GPU_TXRFMT_PAL8BPP) {
-        stride = 1;
-    } else {
-        stride = 2;
+    if(ctx.gamma) {
+        _glBuildGammaTables();
     }
 
-    for(i = 0, j = 0; i < lastWidth * lastHeight; i += 4, j++) {
+    if(paletted) {
+        const TexturePalette* palette = _glMipmapPalette(tex);
 
-        /* In a twiddled texture, the neighbouring texels
-         * are next to each other. By averaging them we just basically shrink
-         * the reverse Ns so each reverse N becomes the next level down... if that makes sense!? */
+        if(!palette || !palette->data || !palette->width) {
+            for(GLuint i = 1; i < levels; ++i) {
+                GLuint count = (tex->width >> i) * (tex->height >> i);
+                reduceIndexes(_glGetMipmapLocation(tex, i - 1), count, _glGetMipmapLocation(tex, i));
+                tex->mipmap |= (1 << i);
+            }
 
-        const GLubyte* s1 = &prevData[i * stride];
-        const GLubyte* s2 = s1 + stride;
-        const GLubyte* s3 = s2 + stride;
-        const GLubyte* s4 = s3 + stride;
-        GLubyte* t = &thisData[j * stride];
+            return GL_TRUE;
+        }
+
+        ctx.palette = palette->data;
+        ctx.paletteCount = palette->width;
+    }
+
+    GLuint count = (tex->width >> 1) * (tex->height >> 1);
+    GLubyte* scratch = (GLubyte*) _glScratchAlloc(count * 4);
+
+    if(!scratch) {
+        return GL_FALSE;
+    }
+
+    const GLubyte* base = _glGetMipmapLocation(tex, 0);
+
+    if(paletted) {
+        reducePaletted8(base, count, scratch, &ctx);
+    } else {
+        switch(pvrFormat & PIXEL_FORMAT_MASK) {
+            case GPU_TXRFMT_RGB565:
+                reduce565(base, count, scratch, &ctx);
+            break;
+            case GPU_TXRFMT_ARGB4444:
+                reduce4444(base, count, scratch, &ctx);
+            break;
+            case GPU_TXRFMT_ARGB1555:
+                reduce1555(base, count, scratch, &ctx);
+            break;
+            default:
+                gl_assert(0);
+        }
+    }
+
+    for(GLuint i = 1; i < levels; ++i) {
+        if(i > 1) {
+            count /= 4;
+            reduceRGBA(scratch, count, ctx.gamma);
+        }
+
+        GLubyte* dst = _glGetMipmapLocation(tex, i);
 
-        gl_assert(s4 < prevData + (lastHeight * lastWidth * stride));
-        gl_assert(t < thisData + (thisHeight * thisWidth * stride));
+        if(paletted) {
+            encodeLevelPaletted8(scratch, count, dst, &ctx);
+        } else {
+            encodeLevel16(pvrFormat, scratch, count, dst);
+        }
 
-        _glCalculateAverageTexel(pvrFormat, s1, s2, s3, s4, t);
+        tex->mipmap |= (1 << i);
     }
 
+    _glScratchFree(scratch);
     return GL_TRUE;
 }
 
@@ -262,6 +396,11 @@ void APIENTRY glGenerateMipmap(GLenum target) {
 
     TextureObject* tex = _glGetBoundTexture();
 
+    if(!_glMakeTextureResident(tex)) {
+        _glKosThrowError(GL_OUT_OF_MEMORY, __func__);
+        return;
+    }
+
     if(!tex || !tex->data || !tex->mipmapCount) {
         _glKosThrowError(GL_INVALID_OPERATION, __func__);
         return;
@@ -279,6 +418,18 @@ void APIENTRY glGenerateMipmap(GLenum target) {
         return;
     }
 
+    switch(tex->color & PIXEL_FORMAT_MASK) {
+        case GPU_TXRFMT_RGB565:
+        case GPU_TXRFMT_ARGB4444:
+        case GPU_TXRFMT_ARGB1555:
+        case GPU_TXRFMT_PAL8BPP:
+        break;
+        default:
+            fprintf(stderr, "[GL ERROR] Mipmap generation not supported for this texture format\n");
+            _glKosThrowError(GL_INVALID_OPERATION, __func__);
+            return;
+    }
+
     if((tex->color & GPU_TXRFMT_NONTWIDDLED) == GPU_TXRFMT_NONTWIDDLED) {
         /* glTexImage2D should twiddle internally textures in nearly all cases
          * so this error is unlikely */
@@ -300,26 +451,12 @@ void APIENTRY glGenerateMipmap(GLenum target) {
         return;
     }
 
-    GLuint i;
-    GLuint prevWidth = tex->width;
-    GLuint prevHeight = tex->height;
-
     /* Make sure there is room for the mipmap data on the texture object */
     _glAllocateSpaceForMipmaps(tex);
 
-    for(i = 1; i < _glGetMipmapLevelCount(tex); ++i) {
-        GLubyte* prevData = _glGetMipmapLocation(tex, i - 1);
-        GLubyte* thisData = _glGetMipmapLocation(tex, i);
-
-        GLuint thisWidth = (prevWidth > 1) ? prevWidth / 2 : 1;
-        GLuint thisHeight = (prevHeight > 1) ? prevHeight / 2 : 1;
-
-        _glGenerateMipmapTwiddled(tex->color, prevData, thisWidth, thisHeight, thisData);
-
-        tex->mipmap |= (1 << i);
-
-        prevWidth = thisWidth;
-        prevHeight = thisHeight;
+    if(!_glGenerateMipmapsTwiddled(tex)) {
+        _glKosThrowError(GL_OUT_OF_MEMORY, __func__);
+        return;
     }
 
     gl_assert(_glIsMipmapComplete(tex));
@@ -1,10 +1,11 @@
 /*
- * This implements immediate mode over the top of glDrawArrays
- * current problems:
- *
- * 1. Calling glNormal(); glVertex(); glVertex(); glVertex(); will break.
- * 2. Mixing with glXPointer stuff will break badly
- * 3. This is entirely untested.
+ * Immediate mode writes each glVertex straight into the active poly list,
+ * as a finished Vertex other than its transform. glBegin emits the header
+ * (so state changes between glBegin and glEnd, which GL doesn't allow,
+ * won't take effect) and the vertices are then transformed in place,
+ * expanded for the primitive and lit and so on, just as glDrawArrays would
+ * have done with them. For triangles and quads that's put off so that a
+ * run of glBegin/glEnd blocks is done in one go, see _glImmediateBegin.
  */
 
 #include <string.h>
@@ -16,54 +17,24 @@
 GLboolean IMMEDIATE_MODE_ACTIVE = GL_FALSE;
 static GLenum ACTIVE_POLYGON_MODE = GL_TRIANGLES;
 
-static AlignedVector VERTICES;
-static AttribPointerList IM_ATTRIBS;
-
-typedef struct __attribute__((aligned(32))) {
-    GLfloat x;
-    GLfloat y;
-    GLfloat z;
-    GLfloat u;
-    GLfloat v;
-    GLfloat s;
-    GLfloat t;
-    GLfloat argb[4];
-    GLfloat nx;
-    GLfloat ny;
-    GLfloat nz;
-    GLuint padding[2];
-} IMVertex;
-
-
-void _glInitImmediateMode(GLuint initial_size) {
-    aligned_vector_init(&VERTICES, sizeof(IMVertex));
-    aligned_vector_reserve(&VERTICES, initial_size);
-    IM_ATTRIBS.fast_path = GL_TRUE;
-
-    IM_ATTRIBS.vertex.ptr = aligned_vector_front(&VERTICES);
-    IM_ATTRIBS.vertex.size = 3;
-    IM_ATTRIBS.vertex.type = GL_FLOAT;
-    IM_ATTRIBS.vertex.stride = sizeof(IMVertex);
-
-    IM_ATTRIBS.uv.ptr = IM_ATTRIBS.vertex.ptr + offsetof(IMVertex, u);
-    IM_ATTRIBS.uv.stride = sizeof(IMVertex);
-    IM_ATTRIBS.uv.type = GL_FLOAT;
-    IM_ATTRIBS.uv.size = 2;
-
-    IM_ATTRIBS.st.ptr = IM_ATTRIBS.vertex.ptr + offsetof(IMVertex, s);
-    IM_ATTRIBS.st.stride = sizeof(IMVertex);
-    IM_ATTRIBS.st.type = GL_FLOAT;
-    IM_ATTRIBS.st.size = 2;
-
-    IM_ATTRIBS.colour.ptr = IM_ATTRIBS.vertex.ptr + offsetof(IMVertex, argb);
-    IM_ATTRIBS.colour.size = 4;
-    IM_ATTRIBS.colour.type = GL_FLOAT;
-    IM_ATTRIBS.colour.stride = sizeof(IMVertex);
-
-    IM_ATTRIBS.normal.ptr = IM_ATTRIBS.vertex.ptr + offsetof(IMVertex, nx);
-    IM_ATTRIBS.normal.stride = sizeof(IMVertex);
-    IM_ATTRIBS.normal.type = GL_FLOAT;
-    IM_ATTRIBS.normal.size = 3;
+/* The current normal, normalised if need be and packed, ready to copy into
+ * each vertex */
+static GLuint PACKED_NORMAL;
+
+static void packNormal(void) {
+    float n[3];
+    memcpy(n, _glCurrentNormal(), sizeof(n));
+
+    if(_glIsNormalizeEnabled()) {
+        float temp = n[0] * n[0] + n[1] * n[1] + n[2] * n[2];
+
+        float ilength = MATH_fsrra(temp);
+        n[0] *= ilength;
+        n[1] *= ilength;
+        n[2] *= ilength;
+    }
+
+    PACKED_NORMAL = _glPackNormal(n);
 }
 
 void APIENTRY glBegin(GLenum mode) {
@@ -74,11 +45,14 @@ void APIENTRY glBegin(GLenum mode) {
 
     IMMEDIATE_MODE_ACTIVE = GL_TRUE;
     ACTIVE_POLYGON_MODE = mode;
+
+    /* GL_NORMALIZE may have changed since the last glNormal */
+    packNormal();
+
+    _glImmediateBegin(mode);
 }
 
 void APIENTRY glColor4f(GLfloat r, GLfloat g, GLfloat b, GLfloat a) {
-    IM_ATTRIBS.enabled |= COLOR_ENABLED_FLAG;
-
     float* COLOR = _glCurrentColor();
 
     COLOR[A8IDX] = a;
@@ -88,8 +62,6 @@ void APIENTRY glColor4f(GLfloat r, GLfloat g, GLfloat b, GLfloat a) {
 }
 
 void APIENTRY glColor4ub(GLubyte r, GLubyte  g, GLubyte b, GLubyte a) {
-    IM_ATTRIBS.enabled |= COLOR_ENABLED_FLAG;
-
     const float m = 1.0f / 255.0f;
 
     float* COLOR = _glCurrentColor();
@@ -100,8 +72,6 @@ void APIENTRY glColor4ub(GLubyte r, GLubyte  g, GLubyte b, GLubyte a) {
 }
 
 void APIENTRY glColor4ubv(const GLubyte *v) {
-    IM_ATTRIBS.enabled |= COLOR_ENABLED_FLAG;
-
     const float m = 1.0f / 255.0f;
 
     float* COLOR = _glCurrentColor();
@@ -113,8 +83,6 @@ void APIENTRY glColor4ubv(const GLubyte *v) {
 }
 
 void APIENTRY glColor4fv(const GLfloat* v) {
-    IM_ATTRIBS.enabled |= COLOR_ENABLED_FLAG;
-
     float* COLOR = _glCurrentColor();
 
     COLOR[R8IDX] = v[0];
@@ -124,8 +92,6 @@ void APIENTRY glColor4fv(const GLfloat* v) {
 }
 
 void APIENTRY glColor3f(GLfloat r, GLfloat g, GLfloat b) {
-    IM_ATTRIBS.enabled |= COLOR_ENABLED_FLAG;
-
     float* COLOR = _glCurrentColor();
 
     COLOR[B8IDX] = b;
@@ -135,8 +101,6 @@ void APIENTRY glColor3f(GLfloat r, GLfloat g, GLfloat b) {
 }
 
 void APIENTRY glColor3ub(GLubyte red, GLubyte green, GLubyte blue) {
-    IM_ATTRIBS.enabled |= COLOR_ENABLED_FLAG;
-
     const float m = 1.0f / 255.0f;
 
     float* COLOR = _glCurrentColor();
@@ -148,8 +112,6 @@ void APIENTRY glColor3ub(GLubyte red, GLubyte green, GLubyte blue) {
 }
 
 void APIENTRY glColor3ubv(const GLubyte *v) {
-    IM_ATTRIBS.enabled |= COLOR_ENABLED_FLAG;
-
     const float m = 1.0f / 255.0f;
 
     float* COLOR = _glCurrentColor();
@@ -161,8 +123,6 @@ void APIENTRY glColor3ubv(const GLubyte *v) {
 }
 
 void APIENTRY glColor3fv(const GLfloat* v) {
-    IM_ATTRIBS.enabled |= COLOR_ENABLED_FLAG;
-
     float* COLOR = _glCurrentColor();
 
     COLOR[A8IDX] = 1.0f;
@@ -171,39 +131,38 @@ void APIENTRY glColor3fv(const GLfloat* v) {
     COLOR[B8IDX] = v[2];
 }
 
-typedef union punned {
-    GLubyte*   byte;
-    GLfloat*   flt;
-    uint32_t*  u32;
-    void*      vptr;
-    uintptr_t  uptr;
-} punned_t;
-
-void APIENTRY glVertex3f(GLfloat x, GLfloat y, GLfloat z) {
-    IM_ATTRIBS.enabled |= VERTEX_ENABLED_FLAG;
-
-    IMVertex* vert = aligned_vector_extend(&VERTICES, 1);
+void APIENTRY glVertex4f(GLfloat x, GLfloat y, GLfloat z, GLfloat w) {
+    /* There's no list to write to outside of glBegin/glEnd */
+    if(!IMMEDIATE_MODE_ACTIVE) {
+        return;
+    }
 
-    float* COLOR = _glCurrentColor();
-    float* UV_COORD = _glCurrentTexCoord0();
-    float* ST_COORD = _glCurrentTexCoord1();
-    float* NORMAL = _glCurrentNormal();
+    Vertex* vert = _glImmediateVertex();
+
+    const float* COLOR = _glCurrentColor();
+    const float* UV_COORD = _glCurrentTexCoord0();
+    const float* ST_COORD = _glCurrentTexCoord1();
+
+    vert->flags = GPU_CMD_VERTEX;
+    vert->xyz[0] = x;
+    vert->xyz[1] = y;
+    vert->xyz[2] = z;
+    vert->w = w;
+    vert->uv[0] = UV_COORD[0];
+    vert->uv[1] = UV_COORD[1];
+    vert->st[0] = _glPackHalfFloat(ST_COORD[0]);
+    vert->st[1] = _glPackHalfFloat(ST_COORD[1]);
+    vert->nxyz = PACKED_NORMAL;
+
+    /* The current colour is kept in the vertex's order */
+    vert->argb[0] = COLOR[0];
+    vert->argb[1] = COLOR[1];
+    vert->argb[2] = COLOR[2];
+    vert->argb[3] = COLOR[3];
+}
 
-    punned_t dest = { .flt = &vert->x };
-    *(dest.flt++) = x;
-    *(dest.flt++) = y;
-    *(dest.flt++) = z;
-    *(dest.flt++) = UV_COORD[0];
-    *(dest.flt++) = UV_COORD[1];
-    *(dest.flt++) = ST_COORD[0];
-    *(dest.flt++) = ST_COORD[1];
-    *(dest.flt++) = COLOR[0];
-    *(dest.flt++) = COLOR[1];
-    *(dest.flt++) = COLOR[2];
-    *(dest.flt++) = COLOR[3];
-    *(dest.flt++) = NORMAL[0];
-    *(dest.flt++) = NORMAL[1];
-    *(dest.flt++) = NORMAL[2];
+void APIENTRY glVertex3f(GLfloat x, GLfloat y, GLfloat z) {
+    glVertex4f(x, y, z, 1.0f);
 }
 
 void APIENTRY glVertex3fv(const GLfloat* v) {
@@ -218,11 +177,6 @@ void APIENTRY glVertex2fv(const GLfloat* v) {
     glVertex2f(v[0], v[1]);
 }
 
-void APIENTRY glVertex4f(GLfloat x, GLfloat y, GLfloat z, GLfloat w) {
-    _GL_UNUSED(w);
-    glVertex3f(x, y, z);
-}
-
 void APIENTRY glVertex4fv(const GLfloat* v) {
     glVertex4f(v[0], v[1], v[2], v[3]);
 }
@@ -232,11 +186,9 @@ void APIENTRY glMultiTexCoord2fARB(GLenum target, GLfloat s, GLfloat t) {
     float* ST_COORD = _glCurrentTexCoord1();
 
     if(target == GL_TEXTURE0) {
-        IM_ATTRIBS.enabled |= UV_ENABLED_FLAG;
         UV_COORD[0] = s;
         UV_COORD[1] = t;
     } else if(target == GL_TEXTURE1) {
-        IM_ATTRIBS.enabled |= ST_ENABLED_FLAG;
         ST_COORD[0] = s;
         ST_COORD[1] = t;
     } else {
@@ -246,7 +198,6 @@ void APIENTRY glMultiTexCoord2fARB(GLenum target, GLfloat s, GLfloat t) {
 }
 
 void APIENTRY glTexCoord1f(GLfloat u) {
-    IM_ATTRIBS.enabled |= UV_ENABLED_FLAG;
     float* UV_COORD = _glCurrentTexCoord0();
 
     UV_COORD[0] = u;
@@ -258,7 +209,6 @@ void APIENTRY glTexCoord1fv(const GLfloat* v) {
 }
 
 void APIENTRY glTexCoord2f(GLfloat u, GLfloat v) {
-    IM_ATTRIBS.enabled |= UV_ENABLED_FLAG;
     float* UV_COORD = _glCurrentTexCoord0();
 
     UV_COORD[0] = u;
@@ -270,12 +220,13 @@ void APIENTRY glTexCoord2fv(const GLfloat* v) {
 }
 
 void APIENTRY glNormal3f(GLfloat x, GLfloat y, GLfloat z) {
-    IM_ATTRIBS.enabled |= NORMAL_ENABLED_FLAG;
     float* NORMAL = _glCurrentNormal();
 
     NORMAL[0] = x;
     NORMAL[1] = y;
     NORMAL[2] = z;
+
+    packNormal();
 }
 
 void APIENTRY glNormal3fv(const GLfloat* v) {
@@ -283,24 +234,14 @@ void APIENTRY glNormal3fv(const GLfloat* v) {
 }
 
 void APIENTRY glEnd() {
-    IMMEDIATE_MODE_ACTIVE = GL_FALSE;
-
-    /* Resizing could've invalidated the pointers */
-    IM_ATTRIBS.vertex.ptr = VERTICES.data;
-    IM_ATTRIBS.uv.ptr     = IM_ATTRIBS.vertex.ptr + offsetof(IMVertex, u);
-    IM_ATTRIBS.st.ptr     = IM_ATTRIBS.vertex.ptr + offsetof(IMVertex, s);
-    IM_ATTRIBS.colour.ptr = IM_ATTRIBS.vertex.ptr + offsetof(IMVertex, argb);
-    IM_ATTRIBS.normal.ptr = IM_ATTRIBS.vertex.ptr + offsetof(IMVertex, nx);
-
-    /* Redirect attrib state */
-    AttribPointerList stashed_state = ATTRIB_LIST;
-    ATTRIB_LIST = IM_ATTRIBS;
-
-    glDrawArrays(ACTIVE_POLYGON_MODE, 0, aligned_vector_header(&VERTICES)->size);
+    if(!IMMEDIATE_MODE_ACTIVE) {
+        _glKosThrowError(GL_INVALID_OPERATION, __func__);
+        return;
+    }
 
-    ATTRIB_LIST = stashed_state;
+    IMMEDIATE_MODE_ACTIVE = GL_FALSE;
 
-    aligned_vector_clear(&VERTICES);
+    _glImmediateEnd(ACTIVE_POLYGON_MODE);
 }
 
 void APIENTRY glRectf(GLfloat x1, GLfloat y1, GLfloat x2, GLfloat y2) {
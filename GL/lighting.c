@@ -22,6 +22,30 @@
 /* PI constant for spotlight calculations */
 #define GL_PI 3.14159265358979323846f
 
+/* With GL_BOUNDING_SPHERE_KOS, point lights further than this many radii
+ * from the sphere are lit as directional lights for the draw */
+#define DIRECTIONAL_LIGHT_RATIO 32.0f
+
+static GLfloat BOUNDING_SPHERE[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+
+/* Power table results below this are less than one step of an 8-bit
+ * colour channel */
+#define POWER_TABLE_THRESHOLD (1.0f / 256.0f)
+
+static PowerTable SPOT_POWER[MAX_GLDC_LIGHTS];
+
+static void buildPowerTable(PowerTable* table, GLfloat exponent) {
+    for(GLuint i = 0; i <= POWER_TABLE_SIZE; ++i) {
+        table->values[i] = powf((float) i / POWER_TABLE_SIZE, exponent);
+    }
+
+    table->values[POWER_TABLE_SIZE + 1] = table->values[POWER_TABLE_SIZE];
+
+    /* With a zero exponent anything above zero raises to one */
+    table->cutoff = (exponent > 0.0f) ?
+        powf(POWER_TABLE_THRESHOLD, 1.0f / exponent) : 0.0f;
+}
+
 
 void _glPrecalcLightingValues(GLuint mask) {
     /* Pre-calculate lighting values */
@@ -88,6 +112,7 @@ void _glInitLights() {
     memcpy(material->specular, ZERO, sizeof(GLfloat) * 4);
     memcpy(material->emissive, ZERO, sizeof(GLfloat) * 4);
     material->exponent = 0.0f;
+    buildPowerTable(&material->specularPower, 0.0f);
 
     GLubyte i;
     for(i = 0; i < MAX_GLDC_LIGHTS; ++i) {
@@ -111,6 +136,8 @@ void _glInitLights() {
         light->spot_direction[2] = -1.0f;
 
         light->spot_exponent = 0.0f;
+        light->spotPower = &SPOT_POWER[i];
+        buildPowerTable(&SPOT_POWER[i], 0.0f);
         light->spot_cutoff = 180.0f;
         light->spot_cutoff_cos = -1.0f;  /* cos(180°) = -1.0 */
 
@@ -133,6 +160,8 @@ void APIENTRY glLightModeli(GLenum pname, const GLint param) {
 }
 
 void APIENTRY glLightModelfv(GLenum pname, const GLfloat *params) {
+    _glImmediateFlush();
+
     switch(pname) {
         case GL_LIGHT_MODEL_AMBIENT: {
             if(memcmp(_glGetLightModelSceneAmbient(), params, sizeof(float) * 4) != 0) {
@@ -143,6 +172,10 @@ void APIENTRY glLightModelfv(GLenum pname, const GLfloat *params) {
         case GL_LIGHT_MODEL_LOCAL_VIEWER:
             _glSetLightModelViewerInEyeCoordinates((*params) ? GL_TRUE : GL_FALSE);
         break;
+        case GL_LIGHT_MODEL_COLOR_CONTROL: {
+            const GLint mode = (GLint) *params;
+            glLightModeliv(pname, &mode);
+        } break;
     case GL_LIGHT_MODEL_TWO_SIDE:
         /* Not implemented */
     default:
@@ -151,8 +184,15 @@ void APIENTRY glLightModelfv(GLenum pname, const GLfloat *params) {
 }
 
 void APIENTRY glLightModeliv(GLenum pname, const GLint* params) {
+    _glImmediateFlush();
+
     switch(pname) {
         case GL_LIGHT_MODEL_COLOR_CONTROL:
+            if(*params != GL_SINGLE_COLOR && *params != GL_SEPARATE_SPECULAR_COLOR) {
+                _glKosThrowError(GL_INVALID_ENUM, __func__);
+                return;
+            }
+
             _glSetLightModelColorControl(*params);
         break;
         case GL_LIGHT_MODEL_LOCAL_VIEWER:
@@ -164,6 +204,8 @@ void APIENTRY glLightModeliv(GLenum pname, const GLint* params) {
 }
 
 void APIENTRY glLightfv(GLenum light, GLenum pname, const GLfloat *params) {
+    _glImmediateFlush();
+
     GLubyte idx = light & 0xF;
 
     if(idx >= MAX_GLDC_LIGHTS) {
@@ -235,6 +277,8 @@ void APIENTRY glLightfv(GLenum light, GLenum pname, const GLfloat *params) {
 }
 
 void APIENTRY glLightf(GLenum light, GLenum pname, GLfloat param) {
+    _glImmediateFlush();
+
     GLubyte idx = light & 0xF;
 
     if(idx >= MAX_GLDC_LIGHTS) {
@@ -254,7 +298,10 @@ void APIENTRY glLightf(GLenum light, GLenum pname, GLfloat param) {
             l->quadratic_attenuation = param;
         break;
         case GL_SPOT_EXPONENT:
-            l->spot_exponent = param;
+            if(l->spot_exponent != param) {
+                l->spot_exponent = param;
+                buildPowerTable(&SPOT_POWER[idx], param);
+            }
         break;
         case GL_SPOT_CUTOFF: {
             /* Validate spot_cutoff per GL spec: [0, 90] or 180 */
@@ -279,12 +326,20 @@ void APIENTRY glLightf(GLenum light, GLenum pname, GLfloat param) {
 }
 
 void APIENTRY glMaterialf(GLenum face, GLenum pname, const GLfloat param) {
+    _glImmediateFlush();
+
     if(face == GL_BACK || pname != GL_SHININESS) {
         _glKosThrowError(GL_INVALID_ENUM, __func__);
         return;
     }
 
-    _glActiveMaterial()->exponent = _MIN(param, 128);  /* 128 is the max according to the GL spec */
+    Material* material = _glActiveMaterial();
+    const GLfloat exponent = _MIN(param, 128);  /* 128 is the max according to the GL spec */
+
+    if(material->exponent != exponent) {
+        material->exponent = exponent;
+        buildPowerTable(&material->specularPower, exponent);
+    }
 }
 
 void APIENTRY glMateriali(GLenum face, GLenum pname, const GLint param) {
@@ -292,6 +347,8 @@ void APIENTRY glMateriali(GLenum face, GLenum pname, const GLint param) {
 }
 
 void APIENTRY glMaterialfv(GLenum face, GLenum pname, const GLfloat *params) {
+    _glImmediateFlush();
+
     if(face == GL_BACK) {
         _glKosThrowError(GL_INVALID_ENUM, __func__);
         return;
@@ -360,6 +417,8 @@ void APIENTRY glMaterialfv(GLenum face, GLenum pname, const GLfloat *params) {
 }
 
 void APIENTRY glColorMaterial(GLenum face, GLenum mode) {
+    _glImmediateFlush();
+
     if(face != GL_FRONT_AND_BACK) {
         _glKosThrowError(GL_INVALID_ENUM, __func__);
         return;
@@ -435,49 +494,48 @@ GL_FORCE_INLINE GLboolean isSpecularColorMaterial() {
     return (mode == GL_SPECULAR);
 }
 
-/*
- * Implementation from here (MIT):
- * https://github.com/appleseedhq/appleseed/blob/master/src/appleseed/foundation/math/fastmath.h
- */
-GL_FORCE_INLINE float faster_pow2(const float p) {
-    // Underflow of exponential is common practice in numerical routines, so handle it here.
-    const float clipp = p < -126.0f ? -126.0f : p;
-    const union { uint32_t i; float f; } v =
-    {
-        (uint32_t) ((1 << 23) * (clipp + 126.94269504f))
-    };
-
-    return v.f;
-}
+/* Linearly interpolates x^exponent from the table, for x above the
+ * table's cutoff. Fast normalization can leave x a little over one. */
+GL_FORCE_INLINE float lookupPower(const PowerTable* table, float x) {
+    if(x > 1.0f) x = 1.0f;
 
-GL_FORCE_INLINE float faster_log2(const float x) {
-    gl_assert(x >= 0.0f);
+    const float f = x * POWER_TABLE_SIZE;
+    const uint32_t i = (uint32_t) f;
+    const float t = f - (float) i;
+    const float a = table->values[i];
 
-    const union { float f; uint32_t i; } vx = { x };
-    const float y = (float) (vx.i) * 1.1920928955078125e-7f;
-
-    return y - 126.94269504f;
-}
-
-GL_FORCE_INLINE float faster_pow(const float x, const float p) {
-    return faster_pow2(p * faster_log2(x));
+    return a + (table->values[i + 1] - a) * t;
 }
 
-/* Compute the specular term based on NdotH and material shininess */
-GL_FORCE_INLINE float computeSpecular(float NdotH, GLfloat exponent) {
-    if(exponent > 0.0f) {
-        return faster_pow(NdotH, exponent);
-    }
-    /* When shininess is 0, specular is 1.0 if NdotH > 0, otherwise 0.0 */
-    return (NdotH > 0.0f) ? 1.0f : 0.0f;
+/* Compute the specular term based on NdotH and material shininess. With a
+ * shininess of 0 it's 1.0 if NdotH > 0, otherwise 0.0. */
+GL_FORCE_INLINE float computeSpecular(float NdotH, const PowerTable* power) {
+    return (NdotH > power->cutoff) ? lookupPower(power, NdotH) : 0.0f;
 }
 
-/* Apply lighting contribution to the final colour */
-#define _PROCESS_LIGHTING_COMPONENT(final, X, LdotN, NdotH, FI, light, isPoint, att) \
+/* What happens to the specular term, from the enabled lights and
+ * GL_LIGHT_MODEL_COLOR_CONTROL */
+enum {
+    SPECULAR_NONE,      /* No enabled light has one */
+    SPECULAR_SUM,       /* Added to the primary colour */
+    SPECULAR_SEPARATE,  /* Written to the offset colour */
+    SPECULAR_MODE_COUNT
+};
+
+/* The colour being accumulated is the primary ARGB followed by the offset
+ * RGB, which only SPECULAR_SEPARATE touches */
+#define OFFSET_COLOUR 4
+
+/* Apply lighting contribution to the final colour. The specular term is
+ * left out entirely when no enabled light has one. */
+#define _PROCESS_LIGHTING_COMPONENT(final, X, LdotN, NdotH, FI, light, isPoint, att, hasSpecular) \
     do { \
         float diffuseAmbient = LdotN * (light)->diffuseMaterial[X] + (light)->ambientMaterial[X]; \
-        float specular = FI * (light)->specularMaterial[X]; \
-        if(isPoint) { \
+        float specular = (hasSpecular) ? FI * (light)->specularMaterial[X] : 0.0f; \
+        if((hasSpecular) == SPECULAR_SEPARATE) { \
+            (final)[X] += (isPoint) ? diffuseAmbient * (att) : diffuseAmbient; \
+            (final)[OFFSET_COLOUR + X] += (isPoint) ? specular * (att) : specular; \
+        } else if(isPoint) { \
             (final)[X] += (diffuseAmbient + specular) * (att); \
         } else { \
             (final)[X] += diffuseAmbient + specular; \
@@ -490,13 +548,14 @@ GL_FORCE_INLINE void accumulateDirectionalLight(
     LightSource* light,
     float LdotN,
     float NdotH,
-    GLfloat exponent
+    const PowerTable* power,
+    const int SPECULAR
 ) {
-    float FI = computeSpecular(NdotH, exponent);
+    float FI = (SPECULAR) ? computeSpecular(NdotH, power) : 0.0f;
 
-    _PROCESS_LIGHTING_COMPONENT(finalColour, 0, LdotN, NdotH, FI, light, 0, 0);
-    _PROCESS_LIGHTING_COMPONENT(finalColour, 1, LdotN, NdotH, FI, light, 0, 0);
-    _PROCESS_LIGHTING_COMPONENT(finalColour, 2, LdotN, NdotH, FI, light, 0, 0);
+    _PROCESS_LIGHTING_COMPONENT(finalColour, 0, LdotN, NdotH, FI, light, 0, 0, SPECULAR);
+    _PROCESS_LIGHTING_COMPONENT(finalColour, 1, LdotN, NdotH, FI, light, 0, 0, SPECULAR);
+    _PROCESS_LIGHTING_COMPONENT(finalColour, 2, LdotN, NdotH, FI, light, 0, 0, SPECULAR);
 }
 
 /* Process point/spot light contribution */
@@ -505,14 +564,15 @@ GL_FORCE_INLINE void accumulatePointLight(
     LightSource* light,
     float LdotN,
     float NdotH,
-    GLfloat exponent,
-    float attenuation
+    const PowerTable* power,
+    float attenuation,
+    const int SPECULAR
 ) {
-    float FI = computeSpecular(NdotH, exponent);
+    float FI = (SPECULAR) ? computeSpecular(NdotH, power) : 0.0f;
 
-    _PROCESS_LIGHTING_COMPONENT(finalColour, 0, LdotN, NdotH, FI, light, 1, attenuation);
-    _PROCESS_LIGHTING_COMPONENT(finalColour, 1, LdotN, NdotH, FI, light, 1, attenuation);
-    _PROCESS_LIGHTING_COMPONENT(finalColour, 2, LdotN, NdotH, FI, light, 1, attenuation);
+    _PROCESS_LIGHTING_COMPONENT(finalColour, 0, LdotN, NdotH, FI, light, 1, attenuation, SPECULAR);
+    _PROCESS_LIGHTING_COMPONENT(finalColour, 1, LdotN, NdotH, FI, light, 1, attenuation, SPECULAR);
+    _PROCESS_LIGHTING_COMPONENT(finalColour, 2, LdotN, NdotH, FI, light, 1, attenuation, SPECULAR);
 }
 
 #undef _PROCESS_LIGHTING_COMPONENT
@@ -543,7 +603,8 @@ GL_FORCE_INLINE float computeSpotFactor(
 
     /* spot_factor = (-L · spot_direction)^spot_exponent */
     if(light->spot_exponent > 0.0f) {
-        return faster_pow(spotDot, light->spot_exponent);
+        const PowerTable* power = light->spotPower;
+        return (spotDot > power->cutoff) ? lookupPower(power, spotDot) : 0.0f;
     }
 
     return 1.0f;
@@ -576,181 +637,445 @@ GL_FORCE_INLINE void computeViewVector(
     }
 }
 
-/* Compute light direction vector L from vertex to light source.
- * Returns 1 if directional (no normalization needed), 0 if point/spot. */
-GL_FORCE_INLINE int computeLightVector(
-    const LightSource* light,
-    const Vertex* vertex,
-    float* outLx, float* outLy, float* outLz
+/* The enabled light set is classified once per draw and the matching
+ * kernel lights the whole batch, so the per-vertex loop doesn't branch on
+ * light type, viewer model, colour material or a zero specular term. */
+enum {
+    LIGHTS_DIRECTIONAL,  /* Every enabled light is directional */
+    LIGHTS_POSITIONAL,   /* Every enabled light is a point light (no spot) */
+    LIGHTS_MIXED,        /* Anything else, each light checks its own type */
+    LIGHTS_KIND_COUNT
+};
+
+typedef struct {
+    const Material* material;
+    LightSource** lights;
+    GLuint count;
+    void (*colorMaterialFunc)(const float*);
+
+    /* Per-draw values for directional lights, by enabled index. L is the
+     * normalized direction towards the light and H the half vector for an
+     * infinite viewer, both constant across the batch. A distant point
+     * light can be lit as directional, its contribution scaled by the
+     * attenuation at the bounding sphere's centre. The light's own
+     * products are used, so colour material updates still reach it. */
+    GLboolean directional[MAX_GLDC_LIGHTS];
+    float attenuation[MAX_GLDC_LIGHTS];
+    float L[MAX_GLDC_LIGHTS][3];
+    float H[MAX_GLDC_LIGHTS][3];
+} LightingSetup;
+
+typedef void (*LightingKernel)(Vertex*, uint32_t, const LightingSetup*);
+
+/* Add one light's contribution given the normalized L. Directional lights
+ * with an infinite viewer use the precomputed half vector. */
+GL_FORCE_INLINE void accumulateLight(
+    float* finalColour,
+    LightSource* light,
+    float Nx, float Ny, float Nz,
+    float Lx, float Ly, float Lz,
+    float Vx, float Vy, float Vz,
+    const float* H,
+    const PowerTable* power,
+    const int POINT,
+    float attenuation,
+    const int SPECULAR
 ) {
-    if(light->isDirectional) {
-        /* Directional lights: position is a direction vector (w=0).
-         * L = -light->position (direction from vertex to light at infinity) */
-        *outLx = -light->position[0];
-        *outLy = -light->position[1];
-        *outLz = -light->position[2];
-        
-        /* Ensure normalized (should already be if set up correctly) */
-        float lenSq = (*outLx)*(*outLx) + (*outLy)*(*outLy) + (*outLz)*(*outLz);
-        if(lenSq > 0.0f && lenSq != 1.0f) {
-            float invLen = MATH_fsrra(lenSq);
-            *outLx *= invLen;
-            *outLy *= invLen;
-            *outLz *= invLen;
+    float LdotN;
+    VEC3_DOT(Nx, Ny, Nz, Lx, Ly, Lz, LdotN);
+    if(LdotN < 0.0f) LdotN = 0.0f;
+
+    float NdotH = 0.0f;
+
+    if(SPECULAR) {
+        /* Half-vector: H = (L + V) / |L + V| */
+        float Hx, Hy, Hz;
+        if(H) {
+            Hx = H[0]; Hy = H[1]; Hz = H[2];
+        } else {
+            Hx = Lx + Vx;
+            Hy = Ly + Vy;
+            Hz = Lz + Vz;
+            VEC3_NORMALIZE(Hx, Hy, Hz);
         }
-        return 1; /* Directional */
+
+        VEC3_DOT(Nx, Ny, Nz, Hx, Hy, Hz, NdotH);
+        if(NdotH < 0.0f) NdotH = 0.0f;
+    }
+
+    if(POINT) {
+        accumulatePointLight(finalColour, light, LdotN, NdotH, power, attenuation, SPECULAR);
     } else {
-        /* Point/spot light: L = light position - vertex position */
-        *outLx = light->position[0] - vertex->xyz[0];
-        *outLy = light->position[1] - vertex->xyz[1];
-        *outLz = light->position[2] - vertex->xyz[2];
-        return 0; /* Point/spot */
+        accumulateDirectionalLight(finalColour, light, LdotN, NdotH, power, SPECULAR);
     }
 }
 
-/* Process a single vertex through the lighting pipeline */
-GL_FORCE_INLINE void _glProcessVertex(
-    Vertex* vertex,
+/* Point/spot light contribution, L is the unnormalized vertex to light
+ * vector. Lights out of range or attenuated to nothing are skipped. */
+GL_FORCE_INLINE void accumulatePositionalLight(
     float* finalColour,
-    const Material* material,
-    LightSource** enabledLights,
-    const GLuint enabledCount,
-    void (*colorMaterialFunc)(const float*),
-    GLboolean localViewer
+    LightSource* light,
+    float Nx, float Ny, float Nz,
+    float Lx, float Ly, float Lz,
+    float Vx, float Vy, float Vz,
+    const PowerTable* power,
+    const int SPOT,
+    const int SPECULAR
 ) {
-    /* Update color material if function provided */
-    if(colorMaterialFunc) {
-        colorMaterialFunc(vertex->argb);
+    float D;
+    VEC3_LENGTH(Lx, Ly, Lz, D);
+
+    /* Early-out: skip distant lights */
+    if(D > MAX_LIGHT_RANGE) {
+        return;
+    }
+
+    float spotFactor = 1.0f;
+    if(SPOT) {
+        spotFactor = computeSpotFactor(light, Lx, Ly, Lz);
+        if(spotFactor <= 0.0f) {
+            return;
+        }
+    }
+
+    /* Compute combined attenuation with spotlight */
+    float att = light->constant_attenuation +
+               light->linear_attenuation * D +
+               light->quadratic_attenuation * D * D;
+    float combinedAtt = (SPOT) ? att / spotFactor : att;
+
+    if(combinedAtt < ATTENUATION_THRESHOLD) {
+        combinedAtt = MATH_Fast_Invert(combinedAtt);
+
+        /* Normalize L for dot products */
+        VEC3_NORMALIZE(Lx, Ly, Lz);
+
+        accumulateLight(
+            finalColour, light, Nx, Ny, Nz, Lx, Ly, Lz, Vx, Vy, Vz,
+            NULL, power, 1, combinedAtt, SPECULAR
+        );
     }
+}
+
+/* The body of every kernel. KIND, LOCAL_VIEWER, COLOR_MATERIAL and
+ * SPECULAR are constants at each call site so the branches on them fold
+ * away. */
+GL_FORCE_INLINE void lightVertices(
+    Vertex* vertex,
+    uint32_t count,
+    const LightingSetup* setup,
+    const int KIND,
+    const int LOCAL_VIEWER,
+    const int COLOR_MATERIAL,
+    const int SPECULAR
+) {
+    const Material* material = setup->material;
+    LightSource** lights = setup->lights;
+    const GLuint lightCount = setup->count;
+
+    float finalColour[OFFSET_COLOUR + 3];
 
-    /* Prefetch next vertex while processing current */
+    for(; count; --count, ++vertex) {
+        /* Update color material if function provided */
+        if(COLOR_MATERIAL) {
+            setup->colorMaterialFunc(vertex->argb);
+        }
+
+        /* Prefetch next vertex while processing current */
 #ifdef _arch_dreamcast
-    PREFETCH(vertex + 1);
+        PREFETCH(vertex + 1);
 #endif
 
-    /* Unpack normal */
-    float Nx, Ny, Nz;
-    unpackNormal(vertex->nxyz, &Nx, &Ny, &Nz);
+        float Nx, Ny, Nz;
+        unpackNormal(vertex->nxyz, &Nx, &Ny, &Nz);
 
-    /* Compute view vector */
-    float Vx, Vy, Vz;
-    computeViewVector(vertex, localViewer, &Vx, &Vy, &Vz);
+        float Vx, Vy, Vz;
+        computeViewVector(vertex, LOCAL_VIEWER, &Vx, &Vy, &Vz);
 
-    /* Copy base colour */
-    vec4cpy(finalColour, material->baseColour);
+        vec4cpy(finalColour, material->baseColour);
 
-    const GLfloat exponent = material->exponent;
+        if(SPECULAR == SPECULAR_SEPARATE) {
+            finalColour[OFFSET_COLOUR + 0] = 0.0f;
+            finalColour[OFFSET_COLOUR + 1] = 0.0f;
+            finalColour[OFFSET_COLOUR + 2] = 0.0f;
+        }
 
-    /* Light loop */
-    for(GLubyte li = 0; li < enabledCount; ++li) {
-        LightSource* light = enabledLights[li];
+        const PowerTable* power = &material->specularPower;
 
-        /* Compute light direction */
-        float Lx, Ly, Lz;
-        int isDirectional = computeLightVector(light, vertex, &Lx, &Ly, &Lz);
+        for(GLuint li = 0; li < lightCount; ++li) {
+            LightSource* light = lights[li];
 
-        if(isDirectional) {
-            /* Directional light: no attenuation */
-            /* Half-vector: H = (L + V) / |L + V| */
-            float Hx = Lx + Vx;
-            float Hy = Ly + Vy;
-            float Hz = Lz + Vz;
-            VEC3_NORMALIZE(Hx, Hy, Hz);
+            const int directional = (KIND == LIGHTS_DIRECTIONAL) ||
+                (KIND == LIGHTS_MIXED && setup->directional[li]);
 
-            float LdotN, NdotH;
-            VEC3_DOT(Nx, Ny, Nz, Lx, Ly, Lz, LdotN);
-            VEC3_DOT(Nx, Ny, Nz, Hx, Hy, Hz, NdotH);
+            if(directional) {
+                accumulateLight(
+                    finalColour, light, Nx, Ny, Nz,
+                    setup->L[li][0], setup->L[li][1], setup->L[li][2],
+                    Vx, Vy, Vz, (LOCAL_VIEWER) ? NULL : setup->H[li],
+                    power, 1, setup->attenuation[li], SPECULAR
+                );
+            } else {
+                accumulatePositionalLight(
+                    finalColour, light, Nx, Ny, Nz,
+                    light->position[0] - vertex->xyz[0],
+                    light->position[1] - vertex->xyz[1],
+                    light->position[2] - vertex->xyz[2],
+                    Vx, Vy, Vz, power, KIND == LIGHTS_MIXED, SPECULAR
+                );
+            }
+        }
 
-            /* Clamp to zero */
-            if(LdotN < 0.0f) LdotN = 0.0f;
-            if(NdotH < 0.0f) NdotH = 0.0f;
+        vertex->argb[R8IDX] = finalColour[0];
+        vertex->argb[G8IDX] = finalColour[1];
+        vertex->argb[B8IDX] = finalColour[2];
+        vertex->argb[A8IDX] = finalColour[3];
 
-            accumulateDirectionalLight(finalColour, light, LdotN, NdotH, exponent);
-        } else {
-            /* Point/spot light: compute distance */
-            float D;
-            VEC3_LENGTH(Lx, Ly, Lz, D);
+        if(SPECULAR == SPECULAR_SEPARATE) {
+            vertex->offset_rgb[0] = finalColour[OFFSET_COLOUR + 0];
+            vertex->offset_rgb[1] = finalColour[OFFSET_COLOUR + 1];
+            vertex->offset_rgb[2] = finalColour[OFFSET_COLOUR + 2];
+        }
+    }
+}
 
-            /* Early-out: skip distant lights */
-            if(D > MAX_LIGHT_RANGE) {
-                continue;
-            }
+#define DEF_LIGHTING_KERNEL(kind, local, cm, spec) \
+static void lightVertices_##kind##_##local##cm##spec( \
+    Vertex* vertex, uint32_t count, const LightingSetup* setup) { \
+    lightVertices(vertex, count, setup, LIGHTS_##kind, local, cm, spec); \
+}
 
-            /* Compute spotlight factor */
-            float spotFactor = computeSpotFactor(light, Lx, Ly, Lz);
-            if(spotFactor <= 0.0f) {
-                continue;
-            }
+#define DEF_LIGHTING_KERNELS(kind) \
+    DEF_LIGHTING_KERNEL(kind, 0, 0, 0) \
+    DEF_LIGHTING_KERNEL(kind, 0, 0, 1) \
+    DEF_LIGHTING_KERNEL(kind, 0, 0, 2) \
+    DEF_LIGHTING_KERNEL(kind, 0, 1, 0) \
+    DEF_LIGHTING_KERNEL(kind, 0, 1, 1) \
+    DEF_LIGHTING_KERNEL(kind, 0, 1, 2) \
+    DEF_LIGHTING_KERNEL(kind, 1, 0, 0) \
+    DEF_LIGHTING_KERNEL(kind, 1, 0, 1) \
+    DEF_LIGHTING_KERNEL(kind, 1, 0, 2) \
+    DEF_LIGHTING_KERNEL(kind, 1, 1, 0) \
+    DEF_LIGHTING_KERNEL(kind, 1, 1, 1) \
+    DEF_LIGHTING_KERNEL(kind, 1, 1, 2)
+
+DEF_LIGHTING_KERNELS(DIRECTIONAL)
+DEF_LIGHTING_KERNELS(POSITIONAL)
+DEF_LIGHTING_KERNELS(MIXED)
+
+#define LIGHTING_KERNEL_TABLE(kind) { \
+    {{lightVertices_##kind##_000, lightVertices_##kind##_001, lightVertices_##kind##_002}, \
+     {lightVertices_##kind##_010, lightVertices_##kind##_011, lightVertices_##kind##_012}}, \
+    {{lightVertices_##kind##_100, lightVertices_##kind##_101, lightVertices_##kind##_102}, \
+     {lightVertices_##kind##_110, lightVertices_##kind##_111, lightVertices_##kind##_112}} \
+}
+
+/* Indexed by [kind][local viewer][colour material][specular mode] */
+static const LightingKernel LIGHTING_KERNELS[LIGHTS_KIND_COUNT][2][2][SPECULAR_MODE_COUNT] = {
+    LIGHTING_KERNEL_TABLE(DIRECTIONAL),
+    LIGHTING_KERNEL_TABLE(POSITIONAL),
+    LIGHTING_KERNEL_TABLE(MIXED)
+};
+
+#undef LIGHTING_KERNEL_TABLE
+#undef DEF_LIGHTING_KERNELS
+#undef DEF_LIGHTING_KERNEL
+
+void APIENTRY glKosBoundingSphere(GLfloat x, GLfloat y, GLfloat z, GLfloat radius) {
+    _glImmediateFlush();
+
+    if(radius < 0.0f) {
+        _glKosThrowError(GL_INVALID_VALUE, __func__);
+        return;
+    }
+
+    BOUNDING_SPHERE[0] = x;
+    BOUNDING_SPHERE[1] = y;
+    BOUNDING_SPHERE[2] = z;
+    BOUNDING_SPHERE[3] = radius;
+}
 
-            /* Compute combined attenuation with spotlight */
-            float att = light->constant_attenuation +
-                       light->linear_attenuation * D +
-                       light->quadratic_attenuation * D * D;
-            float combinedAtt = att / spotFactor;
+/* The bounding sphere in eye space. The radius is scaled by the largest
+ * axis scale of the modelview so the sphere still contains the object. */
+static void eyeSpaceBoundingSphere(float* out) {
+    const float* m = *_glGetModelViewMatrix();
+    const float x = BOUNDING_SPHERE[0];
+    const float y = BOUNDING_SPHERE[1];
+    const float z = BOUNDING_SPHERE[2];
+
+    out[0] = m[0] * x + m[4] * y + m[8] * z + m[12];
+    out[1] = m[1] * x + m[5] * y + m[9] * z + m[13];
+    out[2] = m[2] * x + m[6] * y + m[10] * z + m[14];
+
+    float scale = m[0] * m[0] + m[1] * m[1] + m[2] * m[2];
+    float sy = m[4] * m[4] + m[5] * m[5] + m[6] * m[6];
+    float sz = m[8] * m[8] + m[9] * m[9] + m[10] * m[10];
+    if(sy > scale) scale = sy;
+    if(sz > scale) scale = sz;
+
+    out[3] = BOUNDING_SPHERE[3] * sqrtf(scale);
+}
 
-            if(combinedAtt < ATTENUATION_THRESHOLD) {
-                combinedAtt = MATH_Fast_Invert(combinedAtt);
+/* Drops the positional lights which can't reach any vertex inside the
+ * sphere: every vertex would hit the range or attenuation early-out, or
+ * fall outside the spot cone. Distant point lights are lit as directional
+ * with the attenuation at the sphere's centre, their direction going into
+ * setup->L. Returns the number of lights written to out. */
+static GLuint cullLights(
+    LightSource** lights, GLuint count, const float* sphere,
+    LightSource** out, LightingSetup* setup
+) {
+    GLuint kept = 0;
 
-                /* Normalize L for dot products */
-                VEC3_NORMALIZE(Lx, Ly, Lz);
+    for(GLuint i = 0; i < count; ++i) {
+        LightSource* light = lights[i];
 
-                /* Half-vector: H = (L + V) / |L + V| */
-                float Hx = Lx + Vx;
-                float Hy = Ly + Vy;
-                float Hz = Lz + Vz;
-                VEC3_NORMALIZE(Hx, Hy, Hz);
+        setup->directional[kept] = light->isDirectional;
+        setup->attenuation[kept] = 1.0f;
+
+        if(light->isDirectional) {
+            out[kept++] = light;
+            continue;
+        }
+
+        float Lx = light->position[0] - sphere[0];
+        float Ly = light->position[1] - sphere[1];
+        float Lz = light->position[2] - sphere[2];
+
+        float D;
+        VEC3_LENGTH(Lx, Ly, Lz, D);
+
+        float nearest = D - sphere[3];
+        if(nearest < 0.0f) {
+            nearest = 0.0f;
+        }
 
-                float LdotN, NdotH;
-                VEC3_DOT(Nx, Ny, Nz, Lx, Ly, Lz, LdotN);
-                VEC3_DOT(Nx, Ny, Nz, Hx, Hy, Hz, NdotH);
+        if(nearest > MAX_LIGHT_RANGE) {
+            continue;
+        }
+
+        float att = light->constant_attenuation +
+                   light->linear_attenuation * nearest +
+                   light->quadratic_attenuation * nearest * nearest;
+
+        if(att >= ATTENUATION_THRESHOLD) {
+            continue;
+        }
+
+        if(light->spot_cutoff < 179.0f) {
+            if(D > sphere[3]) {
+                /* The cone misses the sphere if the angle between the spot
+                 * direction and the centre is more than the cutoff plus
+                 * the sphere's angular radius */
+                float Sx = light->spot_direction[0];
+                float Sy = light->spot_direction[1];
+                float Sz = light->spot_direction[2];
+                VEC3_NORMALIZE(Sx, Sy, Sz);
+
+                float cosAngle;
+                VEC3_DOT(Lx, Ly, Lz, Sx, Sy, Sz, cosAngle);
+                cosAngle = -cosAngle / D;
+                if(cosAngle > 1.0f) cosAngle = 1.0f;
+                if(cosAngle < -1.0f) cosAngle = -1.0f;
+
+                const float angle = acosf(cosAngle) - asinf(sphere[3] / D);
+                if(angle > light->spot_cutoff * (GL_PI / 180.0f)) {
+                    continue;
+                }
+            }
+
+            out[kept++] = light;
+            continue;
+        }
 
-                /* Clamp to zero */
-                if(LdotN < 0.0f) LdotN = 0.0f;
-                if(NdotH < 0.0f) NdotH = 0.0f;
+        if(D > sphere[3] * DIRECTIONAL_LIGHT_RATIO) {
+            float centreAtt = light->constant_attenuation +
+                light->linear_attenuation * D +
+                light->quadratic_attenuation * D * D;
 
-                accumulatePointLight(finalColour, light, LdotN, NdotH, exponent, combinedAtt);
+            if(centreAtt >= ATTENUATION_THRESHOLD) {
+                continue;
             }
+
+            const float invD = MATH_Fast_Invert(D);
+
+            setup->directional[kept] = GL_TRUE;
+            setup->attenuation[kept] = MATH_Fast_Invert(centreAtt);
+            setup->L[kept][0] = Lx * invD;
+            setup->L[kept][1] = Ly * invD;
+            setup->L[kept][2] = Lz * invD;
+
+            out[kept++] = light;
+            continue;
         }
+
+        out[kept++] = light;
     }
 
-    /* Write final colour */
-    vertex->argb[R8IDX] = finalColour[0];
-    vertex->argb[G8IDX] = finalColour[1];
-    vertex->argb[B8IDX] = finalColour[2];
-    vertex->argb[A8IDX] = finalColour[3];
+    return kept;
+}
+
+/* Separate specular sets the header's specular bit, so every lit vertex
+ * needs an offset colour even when there's no specular to put in it */
+static void clearOffsetColour(Vertex* vertex, uint32_t count) {
+    for(; count; --count, ++vertex) {
+        vertex->offset_rgb[0] = vertex->offset_rgb[1] = vertex->offset_rgb[2] = 0.0f;
+    }
 }
 
 void _glPerformLighting(Vertex* vertices, const uint32_t count) {
+    const GLboolean separateSpecular = _glIsSeparateSpecularEnabled();
+
     if(!_glEnabledLightCount()) {
+        if(separateSpecular) {
+            clearOffsetColour(vertices, count);
+        }
+
         return;
     }
 
-    const Material* material = _glActiveMaterial();
-    LightSource** enabledLights = _glEnabledLightCache();
-    const GLuint enabledCount = _glEnabledLightCount();
+    GL_TRACE_FUNCTION();
+
+    LightingSetup setup;
+    setup.material = _glActiveMaterial();
+    setup.lights = _glEnabledLightCache();
+    setup.count = _glEnabledLightCount();
+    setup.colorMaterialFunc = NULL;
+
+    LightSource* culled[MAX_GLDC_LIGHTS];
 
-    /* Reuse finalColour outside the vertex loop */
-    float finalColour[4];
+    /* Skinned vertices are placed by the palette matrices rather than the
+     * modelview, so there's no telling where the sphere ends up */
+    if(_glIsBoundingSphereEnabled() && !_glTnlIsSkinning()) {
+        float sphere[4];
+        eyeSpaceBoundingSphere(sphere);
+        setup.count = cullLights(setup.lights, setup.count, sphere, culled, &setup);
+        setup.lights = culled;
+    } else {
+        for(GLuint i = 0; i < setup.count; ++i) {
+            setup.directional[i] = setup.lights[i]->isDirectional;
+            setup.attenuation[i] = 1.0f;
+        }
+    }
 
     /* Read LOCAL_VIEWER setting once */
-    GLboolean localViewer = _glGetLightModelViewerInEyeCoordinates();
+    const GLboolean localViewer = _glGetLightModelViewerInEyeCoordinates();
 
     /* Select the appropriate color material function */
-    void (*colorMaterialFunc)(const float*) = NULL;
     if(_glIsColorMaterialEnabled()) {
         GLenum mode = _glColorMaterialMode();
         switch(mode) {
             case GL_AMBIENT:
-                colorMaterialFunc = _glUpdateColourMaterialA;
+                setup.colorMaterialFunc = _glUpdateColourMaterialA;
             break;
             case GL_DIFFUSE:
-                colorMaterialFunc = _glUpdateColourMaterialD;
+                setup.colorMaterialFunc = _glUpdateColourMaterialD;
             break;
             case GL_EMISSION:
-                colorMaterialFunc = _glUpdateColourMaterialE;
+                setup.colorMaterialFunc = _glUpdateColourMaterialE;
             break;
             case GL_AMBIENT_AND_DIFFUSE:
-                colorMaterialFunc = _glUpdateColourMaterialAD;
+                setup.colorMaterialFunc = _glUpdateColourMaterialAD;
             break;
             default:
                 /* No color material update for specular or other modes */
@@ -758,19 +1083,78 @@ void _glPerformLighting(Vertex* vertices, const uint32_t count) {
         }
     }
 
-    /* Process all vertices */
-    Vertex* vertex = vertices;
-    for(uint32_t j = 0; j < count; ++j, ++vertex) {
-        _glProcessVertex(
-            vertex,
-            finalColour,
-            material,
-            enabledLights,
-            enabledCount,
-            colorMaterialFunc,
-            localViewer
+    GLuint directional = 0;
+    GLboolean spot = GL_FALSE;
+    GLboolean specular = GL_FALSE;
+
+    for(GLuint i = 0; i < setup.count; ++i) {
+        const LightSource* light = setup.lights[i];
+
+        /* Colour material never touches the specular term, so a light
+         * with no specular contribution has none for the whole batch */
+        specular |= (
+            light->specularMaterial[0] != 0.0f ||
+            light->specularMaterial[1] != 0.0f ||
+            light->specularMaterial[2] != 0.0f
         );
+
+        if(!setup.directional[i]) {
+            spot |= light->spot_cutoff < 179.0f;
+            continue;
+        }
+
+        ++directional;
+
+        /* Point lights lit as directional already have L from cullLights */
+        if(light->isDirectional) {
+            /* Directional lights: position is a direction vector (w=0).
+             * L = -light->position (direction from vertex to light at infinity) */
+            float Lx = -light->position[0];
+            float Ly = -light->position[1];
+            float Lz = -light->position[2];
+
+            /* Ensure normalized (should already be if set up correctly) */
+            float lenSq = Lx * Lx + Ly * Ly + Lz * Lz;
+            if(lenSq > 0.0f && lenSq != 1.0f) {
+                float invLen = MATH_fsrra(lenSq);
+                Lx *= invLen;
+                Ly *= invLen;
+                Lz *= invLen;
+            }
+
+            setup.L[i][0] = Lx;
+            setup.L[i][1] = Ly;
+            setup.L[i][2] = Lz;
+        }
+
+        const float Lx = setup.L[i][0];
+        const float Ly = setup.L[i][1];
+        const float Lz = setup.L[i][2];
+
+        /* Infinite viewer: V = (0, 0, 1) */
+        float Hx = Lx;
+        float Hy = Ly;
+        float Hz = Lz + 1.0f;
+        VEC3_NORMALIZE(Hx, Hy, Hz);
+
+        setup.H[i][0] = Hx;
+        setup.H[i][1] = Hy;
+        setup.H[i][2] = Hz;
     }
-}
 
-#undef LIGHT_COMPONENT
+    const int kind = (directional == setup.count) ? LIGHTS_DIRECTIONAL :
+                     (directional == 0 && !spot) ? LIGHTS_POSITIONAL :
+                     LIGHTS_MIXED;
+
+    const int specularMode = (!specular) ? SPECULAR_NONE :
+                             (separateSpecular) ? SPECULAR_SEPARATE :
+                             SPECULAR_SUM;
+
+    LIGHTING_KERNELS[kind][localViewer ? 1 : 0][setup.colorMaterialFunc ? 1 : 0][specularMode](
+        vertices, count, &setup
+    );
+
+    if(separateSpecular && !specular) {
+        clearOffsetColour(vertices, count);
+    }
+}
@@ -15,12 +15,39 @@ GLfloat DEPTH_RANGE_MULTIPLIER_H = (0 + 1) / 2;
 
 static Stack __attribute__((aligned(32))) MATRIX_STACKS[4]; // modelview, projection, texture
 static Matrix4x4 __attribute__((aligned(32))) NORMAL_MATRIX;
+static Matrix4x4 __attribute__((aligned(32))) INVERSE_MODELVIEW_MATRIX;
 static Matrix4x4 __attribute__((aligned(32))) VIEWPORT_MATRIX;
 static Matrix4x4 __attribute__((aligned(32))) PROJECTION_MATRIX;
+static Matrix4x4 __attribute__((aligned(32))) MODELVIEW_PROJECTION_MATRIX;
 
 static GLenum MATRIX_MODE = GL_MODELVIEW;
 static Stack* MATRIX_CUR;
-static GLboolean NORMAL_DIRTY, PROJECTION_DIRTY;
+
+/* ARB_matrix_palette. Each entry has its own (shallow) stack and stands in
+ * for the modelview when skinning. The entries premultiplied by the
+ * projection are cached the same way as the MVP, per entry. */
+static Stack __attribute__((aligned(32))) PALETTE_STACKS[MAX_GLDC_PALETTE_MATRICES];
+static Matrix4x4 __attribute__((aligned(32))) PALETTE_PROJECTION_MATRICES[MAX_GLDC_PALETTE_MATRICES];
+static GLuint PALETTE_GENERATIONS[MAX_GLDC_PALETTE_MATRICES];
+static GLuint PALETTE_PROJECTION_PALETTE_GENERATIONS[MAX_GLDC_PALETTE_MATRICES];
+static GLuint PALETTE_PROJECTION_PROJECTION_GENERATIONS[MAX_GLDC_PALETTE_MATRICES];
+static GLint CURRENT_PALETTE_MATRIX = 0;
+
+/* Bumped whenever the top of the matching stack changes (including a push
+ * or pop), the projection's also when the viewport changes. The derived
+ * matrices below remember the generations they were built from, and are
+ * only rebuilt when those move on. Generations start at 1 so that nothing
+ * is considered up to date at init. */
+static GLuint MATRIX_GENERATIONS[4] = {1, 1, 1, 1};
+
+#define MODELVIEW_GENERATION MATRIX_GENERATIONS[GL_MODELVIEW & 0xF]
+#define PROJECTION_GENERATION MATRIX_GENERATIONS[GL_PROJECTION & 0xF]
+
+static GLuint NORMAL_MATRIX_GENERATION = 0;
+static GLuint INVERSE_MODELVIEW_GENERATION = 0;
+static GLuint PROJECTION_MATRIX_GENERATION = 0;
+static GLuint MVP_MODELVIEW_GENERATION = 0;
+static GLuint MVP_PROJECTION_GENERATION = 0;
 
 static const Matrix4x4 __attribute__((aligned(32))) IDENTITY = {
     1.0f, 0.0f, 0.0f, 0.0f,
@@ -51,6 +78,10 @@ GLenum _glGetMatrixMode() {
     return MATRIX_MODE;
 }
 
+GLint _glGetCurrentPaletteMatrix() {
+    return CURRENT_PALETTE_MATRIX;
+}
+
 GLboolean _glIsIdentity(const Matrix4x4* m) {
     return memcmp(m, IDENTITY, sizeof(Matrix4x4)) == 0;
 }
@@ -66,9 +97,25 @@ void _glInitMatrices() {
     stack_push(&MATRIX_STACKS[2], IDENTITY);
     stack_push(&MATRIX_STACKS[3], IDENTITY);
 
+    for(GLuint i = 0; i < MAX_GLDC_PALETTE_MATRICES; ++i) {
+        init_stack(&PALETTE_STACKS[i], sizeof(Matrix4x4), MAX_GLDC_PALETTE_STACK_DEPTH + 1);
+        stack_push(&PALETTE_STACKS[i], IDENTITY);
+    }
+
     MEMCPY4(NORMAL_MATRIX, IDENTITY, sizeof(Matrix4x4));
 
+    /* Anything cached from before a re-init is stale */
+    for(GLuint i = 0; i < 4; ++i) {
+        ++MATRIX_GENERATIONS[i];
+    }
+
+    for(GLuint i = 0; i < MAX_GLDC_PALETTE_MATRICES; ++i) {
+        ++PALETTE_GENERATIONS[i];
+    }
+
+    MATRIX_MODE = GL_MODELVIEW;
     MATRIX_CUR = MATRIX_STACKS + (GL_MODELVIEW & 0xF);
+    CURRENT_PALETTE_MATRIX = 0;
 
     const VideoMode* vid_mode = GetVideoMode();
 
@@ -104,6 +151,58 @@ static void inverse(GLfloat* m) {
     m[14] = -(f12 * m[2]  +  f13 * m[6]  +  f14 * m[10]);
 }
 
+/* Unlike inverse() this handles any matrix, scaled or projective, by
+ * cofactor expansion. Returns GL_FALSE (leaving out alone) when m is
+ * singular. */
+static GLboolean generalInverse(const GLfloat* m, GLfloat* out) {
+    GLfloat inv[16];
+
+    inv[0] = m[5] * m[10] * m[15] - m[5] * m[11] * m[14] - m[9] * m[6] * m[15] +
+             m[9] * m[7] * m[14] + m[13] * m[6] * m[11] - m[13] * m[7] * m[10];
+    inv[4] = -m[4] * m[10] * m[15] + m[4] * m[11] * m[14] + m[8] * m[6] * m[15] -
+             m[8] * m[7] * m[14] - m[12] * m[6] * m[11] + m[12] * m[7] * m[10];
+    inv[8] = m[4] * m[9] * m[15] - m[4] * m[11] * m[13] - m[8] * m[5] * m[15] +
+             m[8] * m[7] * m[13] + m[12] * m[5] * m[11] - m[12] * m[7] * m[9];
+    inv[12] = -m[4] * m[9] * m[14] + m[4] * m[10] * m[13] + m[8] * m[5] * m[14] -
+              m[8] * m[6] * m[13] - m[12] * m[5] * m[10] + m[12] * m[6] * m[9];
+    inv[1] = -m[1] * m[10] * m[15] + m[1] * m[11] * m[14] + m[9] * m[2] * m[15] -
+             m[9] * m[3] * m[14] - m[13] * m[2] * m[11] + m[13] * m[3] * m[10];
+    inv[5] = m[0] * m[10] * m[15] - m[0] * m[11] * m[14] - m[8] * m[2] * m[15] +
+             m[8] * m[3] * m[14] + m[12] * m[2] * m[11] - m[12] * m[3] * m[10];
+    inv[9] = -m[0] * m[9] * m[15] + m[0] * m[11] * m[13] + m[8] * m[1] * m[15] -
+             m[8] * m[3] * m[13] - m[12] * m[1] * m[11] + m[12] * m[3] * m[9];
+    inv[13] = m[0] * m[9] * m[14] - m[0] * m[10] * m[13] - m[8] * m[1] * m[14] +
+              m[8] * m[2] * m[13] + m[12] * m[1] * m[10] - m[12] * m[2] * m[9];
+    inv[2] = m[1] * m[6] * m[15] - m[1] * m[7] * m[14] - m[5] * m[2] * m[15] +
+             m[5] * m[3] * m[14] + m[13] * m[2] * m[7] - m[13] * m[3] * m[6];
+    inv[6] = -m[0] * m[6] * m[15] + m[0] * m[7] * m[14] + m[4] * m[2] * m[15] -
+             m[4] * m[3] * m[14] - m[12] * m[2] * m[7] + m[12] * m[3] * m[6];
+    inv[10] = m[0] * m[5] * m[15] - m[0] * m[7] * m[13] - m[4] * m[1] * m[15] +
+              m[4] * m[3] * m[13] + m[12] * m[1] * m[7] - m[12] * m[3] * m[5];
+    inv[14] = -m[0] * m[5] * m[14] + m[0] * m[6] * m[13] + m[4] * m[1] * m[14] -
+              m[4] * m[2] * m[13] - m[12] * m[1] * m[6] + m[12] * m[2] * m[5];
+    inv[3] = -m[1] * m[6] * m[11] + m[1] * m[7] * m[10] + m[5] * m[2] * m[11] -
+             m[5] * m[3] * m[10] - m[9] * m[2] * m[7] + m[9] * m[3] * m[6];
+    inv[7] = m[0] * m[6] * m[11] - m[0] * m[7] * m[10] - m[4] * m[2] * m[11] +
+             m[4] * m[3] * m[10] + m[8] * m[2] * m[7] - m[8] * m[3] * m[6];
+    inv[11] = -m[0] * m[5] * m[11] + m[0] * m[7] * m[9] + m[4] * m[1] * m[11] -
+              m[4] * m[3] * m[9] - m[8] * m[1] * m[7] + m[8] * m[3] * m[5];
+    inv[15] = m[0] * m[5] * m[10] - m[0] * m[6] * m[9] - m[4] * m[1] * m[10] +
+              m[4] * m[2] * m[9] + m[8] * m[1] * m[6] - m[8] * m[2] * m[5];
+
+    GLfloat det = m[0] * inv[0] + m[1] * inv[4] + m[2] * inv[8] + m[3] * inv[12];
+    if(det == 0.0f) {
+        return GL_FALSE;
+    }
+
+    det = 1.0f / det;
+    for(GLuint i = 0; i < 16; ++i) {
+        out[i] = inv[i] * det;
+    }
+
+    return GL_TRUE;
+}
+
 static void transpose(GLfloat* m) {
     swap(m[1], m[4]);
     swap(m[2], m[8]);
@@ -115,7 +214,7 @@ static void transpose(GLfloat* m) {
 
 /* When projection matrix changes, need to pre-multiply with viewport transform matrix */
 static void UpdateProjectionMatrix() {
-    PROJECTION_DIRTY = false;
+    PROJECTION_MATRIX_GENERATION = PROJECTION_GENERATION;
     UploadMatrix4x4(&VIEWPORT_MATRIX);
     MultiplyMatrix4x4(stack_top(MATRIX_STACKS + (GL_PROJECTION & 0xF)));
     DownloadMatrix4x4(&PROJECTION_MATRIX);
@@ -123,20 +222,45 @@ static void UpdateProjectionMatrix() {
 
 /* When modelview matrix changes, need to re-compute normal matrix */
 static void UpdateNormalMatrix() {
-    NORMAL_DIRTY = false;
+    NORMAL_MATRIX_GENERATION = MODELVIEW_GENERATION;
     MEMCPY4(NORMAL_MATRIX, stack_top(MATRIX_STACKS + (GL_MODELVIEW & 0xF)), sizeof(Matrix4x4));
     inverse((GLfloat*) NORMAL_MATRIX);
     transpose((GLfloat*) NORMAL_MATRIX);
 }
 
+/* Texture generation needs the full inverse, as object planes are taken
+ * back through a modelview that may well be scaled */
+static void UpdateInverseModelViewMatrix() {
+    INVERSE_MODELVIEW_GENERATION = MODELVIEW_GENERATION;
+    if(!generalInverse(stack_top(MATRIX_STACKS + (GL_MODELVIEW & 0xF)), (GLfloat*) INVERSE_MODELVIEW_MATRIX)) {
+        MEMCPY4(INVERSE_MODELVIEW_MATRIX, IDENTITY, sizeof(Matrix4x4));
+    }
+}
+
+/* Either matrix changing invalidates the combined one too */
+static void UpdateModelViewProjectionMatrix() {
+    if(PROJECTION_MATRIX_GENERATION != PROJECTION_GENERATION) {
+        UpdateProjectionMatrix();
+    }
+
+    MVP_MODELVIEW_GENERATION = MODELVIEW_GENERATION;
+    MVP_PROJECTION_GENERATION = PROJECTION_GENERATION;
+
+    UploadMatrix4x4(&PROJECTION_MATRIX);
+    MultiplyMatrix4x4((const Matrix4x4*) stack_top(MATRIX_STACKS + (GL_MODELVIEW & 0xF)));
+    DownloadMatrix4x4(&MODELVIEW_PROJECTION_MATRIX);
+}
+
 static void OnMatrixChanged() {
+    if(MATRIX_MODE == GL_MATRIX_PALETTE_ARB) {
+        /* GL_MATRIX_PALETTE_ARB & 0xF would alias the modelview */
+        ++PALETTE_GENERATIONS[CURRENT_PALETTE_MATRIX];
+        return;
+    }
+
+    ++MATRIX_GENERATIONS[MATRIX_MODE & 0xF];
+
     switch (MATRIX_MODE) {
-    case GL_MODELVIEW:
-         NORMAL_DIRTY = true;
-         return;
-    case GL_PROJECTION:
-         PROJECTION_DIRTY = true;
-         return;
     case GL_TEXTURE:
          _glTnlUpdateTextureMatrix();
          return;
@@ -149,12 +273,34 @@ static void OnMatrixChanged() {
 
 void APIENTRY glMatrixMode(GLenum mode) {
     MATRIX_MODE = mode;
-    MATRIX_CUR  = MATRIX_STACKS + (mode & 0xF);
+    MATRIX_CUR  = (mode == GL_MATRIX_PALETTE_ARB) ?
+        &PALETTE_STACKS[CURRENT_PALETTE_MATRIX] :
+        MATRIX_STACKS + (mode & 0xF);
+}
+
+void APIENTRY glCurrentPaletteMatrixARB(GLint index) {
+    if(index < 0 || index >= MAX_GLDC_PALETTE_MATRICES) {
+        _glKosThrowError(GL_INVALID_VALUE, __func__);
+        return;
+    }
+
+    CURRENT_PALETTE_MATRIX = index;
+
+    if(MATRIX_MODE == GL_MATRIX_PALETTE_ARB) {
+        MATRIX_CUR = &PALETTE_STACKS[index];
+    }
 }
 
 void APIENTRY glPushMatrix() {
     void* top = stack_top(MATRIX_CUR);
     assert(top);
+
+    if(MATRIX_MODE == GL_MATRIX_PALETTE_ARB && MATRIX_CUR->size == MAX_GLDC_PALETTE_STACK_DEPTH) {
+        /* The palette stacks are shallow enough that an app can hit this */
+        _glKosThrowError(GL_STACK_OVERFLOW, __func__);
+        return;
+    }
+
     void* ret = stack_push(MATRIX_CUR, top);
     (void) ret;
     assert(ret);
@@ -162,16 +308,22 @@ void APIENTRY glPushMatrix() {
 }
 
 void APIENTRY glPopMatrix() {
+    _glImmediateFlush();
+
     stack_pop(MATRIX_CUR);
     OnMatrixChanged();
 }
 
 void APIENTRY glLoadIdentity() {
+    _glImmediateFlush();
+
     stack_replace(MATRIX_CUR, IDENTITY);
     OnMatrixChanged();
 }
 
 void GL_FORCE_INLINE _glMultMatrix(const Matrix4x4* mat) {
+    _glImmediateFlush();
+
     void* top = stack_top(MATRIX_CUR);
 
     UploadMatrix4x4(top);
@@ -247,6 +399,8 @@ void APIENTRY glRotatef(GLfloat angle, GLfloat x, GLfloat  y, GLfloat z) {
 void APIENTRY glLoadMatrixf(const GLfloat *m) {
     static Matrix4x4 __attribute__((aligned(32))) TEMP;
 
+    _glImmediateFlush();
+
     memcpy(TEMP, m, sizeof(float) * 16);
     stack_replace(MATRIX_CUR, TEMP);
     OnMatrixChanged();
@@ -337,6 +491,7 @@ void glLoadTransposeMatrixf(const GLfloat *m) {
     TEMP[M14] = m[11];
     TEMP[M15] = m[15];
 
+    _glImmediateFlush();
     stack_replace(MATRIX_CUR, TEMP);
     OnMatrixChanged();
 }
@@ -370,6 +525,8 @@ void glMultTransposeMatrixf(const GLfloat *m) {
 
 /* Set the GL viewport */
 void APIENTRY glViewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+    _glImmediateFlush();
+
     VIEWPORT_MATRIX[M0]  =  width *  0.5f;
     VIEWPORT_MATRIX[M5]  = height * -0.5f;
     VIEWPORT_MATRIX[M10] = 1.0f;
@@ -377,7 +534,7 @@ void APIENTRY glViewport(GLint x, GLint y, GLsizei width, GLsizei height) {
     
     VIEWPORT_MATRIX[M12] = x + width * 0.5f;
     VIEWPORT_MATRIX[M13] = GetVideoMode()->height - (y + height * 0.5f);
-    PROJECTION_DIRTY = true;
+    ++PROJECTION_GENERATION;
 }
 
 /* Set the depth range */
@@ -420,6 +577,8 @@ GL_FORCE_INLINE void vec3f_normalize_sh4(float *v){
 void gluLookAt(GLdouble eyex, GLdouble eyey, GLdouble eyez, GLdouble centerx,
                GLdouble centery, GLdouble centerz, GLdouble upx, GLdouble upy,
                GLdouble upz) {
+    _glImmediateFlush();
+
     GLfloat m [16] __attribute__((aligned(32)));
     GLfloat f [3];
     GLfloat u [3];
@@ -459,6 +618,33 @@ void gluLookAt(GLdouble eyex, GLdouble eyey, GLdouble eyez, GLdouble centerx,
     MultiplyMatrix4x4((const Matrix4x4*) &trn);
     MultiplyMatrix4x4(stack_top(MATRIX_STACKS + (GL_MODELVIEW & 0xF)));
     DownloadMatrix4x4(stack_top(MATRIX_STACKS + (GL_MODELVIEW & 0xF)));
+    ++MODELVIEW_GENERATION;
+}
+
+void _glMatrixLoadIdentity() {
+    UploadMatrix4x4(&IDENTITY);
+}
+
+const Matrix4x4* _glGetPaletteMatrix(GLuint index) {
+    return (const Matrix4x4*) stack_top(&PALETTE_STACKS[index]);
+}
+
+const Matrix4x4* _glGetPaletteMatrixProjection(GLuint index) {
+    if(PROJECTION_MATRIX_GENERATION != PROJECTION_GENERATION) {
+        UpdateProjectionMatrix();
+    }
+
+    if(PALETTE_PROJECTION_PALETTE_GENERATIONS[index] != PALETTE_GENERATIONS[index] ||
+       PALETTE_PROJECTION_PROJECTION_GENERATIONS[index] != PROJECTION_GENERATION) {
+        PALETTE_PROJECTION_PALETTE_GENERATIONS[index] = PALETTE_GENERATIONS[index];
+        PALETTE_PROJECTION_PROJECTION_GENERATIONS[index] = PROJECTION_GENERATION;
+
+        UploadMatrix4x4(&PROJECTION_MATRIX);
+        MultiplyMatrix4x4(_glGetPaletteMatrix(index));
+        DownloadMatrix4x4(&PALETTE_PROJECTION_MATRICES[index]);
+    }
+
+    return (const Matrix4x4*) &PALETTE_PROJECTION_MATRICES[index];
 }
 
 void _glMatrixLoadModelView() {
@@ -466,17 +652,36 @@ void _glMatrixLoadModelView() {
 }
 
 void _glMatrixLoadProjection() {
-    if (PROJECTION_DIRTY) UpdateProjectionMatrix();
+    if(PROJECTION_MATRIX_GENERATION != PROJECTION_GENERATION) {
+        UpdateProjectionMatrix();
+    }
+
     UploadMatrix4x4(&PROJECTION_MATRIX);
 }
 
 void _glMatrixLoadModelViewProjection() {
-    if (PROJECTION_DIRTY) UpdateProjectionMatrix();
-    UploadMatrix4x4(&PROJECTION_MATRIX);
-    MultiplyMatrix4x4((const Matrix4x4*) stack_top(MATRIX_STACKS + (GL_MODELVIEW & 0xF)));
+    if(MVP_MODELVIEW_GENERATION != MODELVIEW_GENERATION ||
+       MVP_PROJECTION_GENERATION != PROJECTION_GENERATION) {
+        /* Leaves the result loaded */
+        UpdateModelViewProjectionMatrix();
+        return;
+    }
+
+    UploadMatrix4x4(&MODELVIEW_PROJECTION_MATRIX);
+}
+
+const Matrix4x4* _glGetInverseModelViewMatrix() {
+    if(INVERSE_MODELVIEW_GENERATION != MODELVIEW_GENERATION) {
+        UpdateInverseModelViewMatrix();
+    }
+
+    return (const Matrix4x4*) &INVERSE_MODELVIEW_MATRIX;
 }
 
 void _glMatrixLoadNormal() {
-    if (NORMAL_DIRTY) UpdateNormalMatrix();
+    if(NORMAL_MATRIX_GENERATION != MODELVIEW_GENERATION) {
+        UpdateNormalMatrix();
+    }
+
     UploadMatrix4x4((const Matrix4x4*) &NORMAL_MATRIX);
 }
@@ -0,0 +1,133 @@
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(__APPLE__) && !defined(__WIN32__)
+#include <malloc.h>
+#endif
+
+#include "memory.h"
+
+#define SCRATCH_ALIGNMENT 32
+#define SCRATCH_MAX_DEPTH 8
+
+static void* _glDefaultAlloc(size_t size, size_t alignment, void* user_data) {
+    (void) user_data;
+
+#if defined(__APPLE__) || defined(__WIN32__)
+    (void) alignment;
+    return malloc(size);
+#elif defined(__XBOX__)
+    return aligned_alloc(alignment, size);
+#else
+    return memalign(alignment, size);
+#endif
+}
+
+static void _glDefaultFree(void* ptr, void* user_data) {
+    (void) user_data;
+    free(ptr);
+}
+
+static GLdcAllocator ALLOCATOR = {_glDefaultAlloc, _glDefaultFree, NULL};
+
+typedef struct {
+    unsigned char* ptr;
+    size_t end;
+    GLboolean released;
+} ScratchEntry;
+
+static unsigned char* SCRATCH = NULL;
+static size_t SCRATCH_SIZE = 0;
+static size_t SCRATCH_USED = 0;
+
+static ScratchEntry SCRATCH_ENTRIES[SCRATCH_MAX_DEPTH];
+static GLuint SCRATCH_DEPTH = 0;
+
+void _glInitMemory(const GLdcAllocator* allocator, size_t scratchSize) {
+    _glFree(SCRATCH);
+    SCRATCH = NULL;
+    SCRATCH_SIZE = SCRATCH_USED = 0;
+    SCRATCH_DEPTH = 0;
+
+    if(allocator->alloc && allocator->free) {
+        ALLOCATOR = *allocator;
+    } else {
+        ALLOCATOR.alloc = _glDefaultAlloc;
+        ALLOCATOR.free = _glDefaultFree;
+        ALLOCATOR.user_data = NULL;
+    }
+
+    if(scratchSize) {
+        SCRATCH = (unsigned char*) _glMemalign(SCRATCH_ALIGNMENT, scratchSize);
+        SCRATCH_SIZE = (SCRATCH) ? scratchSize : 0;
+    }
+}
+
+void* _glMalloc(size_t size) {
+    return ALLOCATOR.alloc(size, 8, ALLOCATOR.user_data);
+}
+
+void* _glMemalign(size_t alignment, size_t size) {
+    return ALLOCATOR.alloc(size, alignment, ALLOCATOR.user_data);
+}
+
+void* _glCalloc(size_t count, size_t size) {
+    void* ptr = _glMalloc(count * size);
+
+    if(ptr) {
+        memset(ptr, 0, count * size);
+    }
+
+    return ptr;
+}
+
+void _glFree(void* ptr) {
+    if(ptr) {
+        ALLOCATOR.free(ptr, ALLOCATOR.user_data);
+    }
+}
+
+void* _glScratchAlloc(size_t size) {
+    /* Zero sized requests still need a distinct pointer */
+    size = (size) ? size : 1;
+    size = (size + SCRATCH_ALIGNMENT - 1) & ~(size_t) (SCRATCH_ALIGNMENT - 1);
+
+    if(SCRATCH_DEPTH == SCRATCH_MAX_DEPTH || size > SCRATCH_SIZE - SCRATCH_USED) {
+        return _glMemalign(SCRATCH_ALIGNMENT, size);
+    }
+
+    ScratchEntry* entry = &SCRATCH_ENTRIES[SCRATCH_DEPTH++];
+    entry->ptr = SCRATCH + SCRATCH_USED;
+    entry->released = GL_FALSE;
+
+    SCRATCH_USED += size;
+    entry->end = SCRATCH_USED;
+
+    return entry->ptr;
+}
+
+void _glScratchFree(void* ptr) {
+    unsigned char* p = (unsigned char*) ptr;
+
+    if(!p) {
+        return;
+    }
+
+    if(p < SCRATCH || p >= SCRATCH + SCRATCH_SIZE) {
+        _glFree(p);
+        return;
+    }
+
+    for(GLuint i = SCRATCH_DEPTH; i--;) {
+        if(SCRATCH_ENTRIES[i].ptr == p) {
+            SCRATCH_ENTRIES[i].released = GL_TRUE;
+            break;
+        }
+    }
+
+    while(SCRATCH_DEPTH && SCRATCH_ENTRIES[SCRATCH_DEPTH - 1].released) {
+        --SCRATCH_DEPTH;
+    }
+
+    SCRATCH_USED = (SCRATCH_DEPTH) ? SCRATCH_ENTRIES[SCRATCH_DEPTH - 1].end : 0;
+}
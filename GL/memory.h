@@ -0,0 +1,34 @@
+#pragma once
+
+/*
+ * Every heap allocation GLdc makes goes through here so that applications
+ * can supply their own allocator (GLdcConfig::allocator). Texture data in
+ * VRAM is managed separately by alloc/alloc.c.
+ */
+
+#include <stddef.h>
+
+#include "../include/GL/glkos.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void _glInitMemory(const GLdcAllocator* allocator, size_t scratchSize);
+
+void* _glMalloc(size_t size);
+void* _glMemalign(size_t alignment, size_t size);
+void* _glCalloc(size_t count, size_t size);
+void _glFree(void* ptr);
+
+/* Short lived, 32 byte aligned buffers (conversion and bounce buffers and
+ * the like) which are carved out of a block reserved at init rather than
+ * allocated each time. Requests which don't fit go to the allocator. They
+ * should be released in roughly the reverse order they were taken, space
+ * is only reclaimed from the most recent backwards */
+void* _glScratchAlloc(size_t size);
+void _glScratchFree(void* ptr);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,328 @@
+/*
+ * Colour quantisation for the GL_COLOR_INDEX4_AUTO_KOS and
+ * GL_COLOR_INDEX8_AUTO_KOS internal formats.
+ *
+ * True-colour RGBA8888 images are reduced to 16 or 256 colours with a
+ * median cut, then mapped onto the resulting (or an existing, shared)
+ * palette with optional Floyd-Steinberg dithering.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "private.h"
+
+typedef struct {
+    GLuint start;
+    GLuint count;
+    GLubyte min[4];
+    GLubyte max[4];
+} ColourBox;
+
+/* Channel c of a colour packed by packColour() */
+#define CHANNEL(v, c) (((v) >> ((c) * 8)) & 0xFF)
+
+GL_FORCE_INLINE uint32_t packColour(const GLubyte* rgba) {
+    /* Fully transparent texels all look the same, so collapse them
+     * together rather than wasting palette entries on them */
+    if(rgba[3] == 0) {
+        return 0;
+    }
+
+    return rgba[0] | (rgba[1] << 8) | (rgba[2] << 16) | ((uint32_t) rgba[3] << 24);
+}
+
+static void calcBoxBounds(ColourBox* box, const uint32_t* colours) {
+    memset(box->min, 0xFF, sizeof(box->min));
+    memset(box->max, 0x00, sizeof(box->max));
+
+    const uint32_t* it = colours + box->start;
+    const uint32_t* end = it + box->count;
+
+    for(; it < end; ++it) {
+        for(GLubyte c = 0; c < 4; ++c) {
+            GLubyte v = CHANNEL(*it, c);
+            if(v < box->min[c]) box->min[c] = v;
+            if(v > box->max[c]) box->max[c] = v;
+        }
+    }
+}
+
+/* Returns the channel with the widest range in the box, and its extent */
+static GLubyte widestChannel(const ColourBox* box, GLuint* extent) {
+    GLubyte channel = 0;
+    *extent = 0;
+
+    for(GLubyte c = 0; c < 4; ++c) {
+        GLuint e = box->max[c] - box->min[c];
+        if(e > *extent) {
+            *extent = e;
+            channel = c;
+        }
+    }
+
+    return channel;
+}
+
+/* Stable counting sort of a box's colours on a single channel */
+static void sortBox(const ColourBox* box, uint32_t* colours, uint32_t* temp, GLubyte channel) {
+    GLuint offsets[256];
+    memset(offsets, 0, sizeof(offsets));
+
+    uint32_t* src = colours + box->start;
+
+    for(GLuint i = 0; i < box->count; ++i) {
+        offsets[CHANNEL(src[i], channel)]++;
+    }
+
+    GLuint total = 0;
+    for(GLuint i = 0; i < 256; ++i) {
+        GLuint n = offsets[i];
+        offsets[i] = total;
+        total += n;
+    }
+
+    for(GLuint i = 0; i < box->count; ++i) {
+        temp[offsets[CHANNEL(src[i], channel)]++] = src[i];
+    }
+
+    memcpy(src, temp, box->count * sizeof(uint32_t));
+}
+
+GLuint _glQuantiseRGBA8888(const GLubyte* rgba, GLuint count, GLuint maxColours, GLubyte* palette) {
+    gl_assert(maxColours > 0 && maxColours <= 256);
+
+    if(!count) {
+        return 0;
+    }
+
+    uint32_t* colours = (uint32_t*) _glScratchAlloc(count * sizeof(uint32_t));
+    uint32_t* temp = (uint32_t*) _glScratchAlloc(count * sizeof(uint32_t));
+
+    if(!colours || !temp) {
+        _glScratchFree(colours);
+        _glScratchFree(temp);
+        return 0;
+    }
+
+    for(GLuint i = 0; i < count; ++i) {
+        colours[i] = packColour(rgba + (i * 4));
+    }
+
+    ColourBox boxes[256];
+    GLuint boxCount = 1;
+
+    boxes[0].start = 0;
+    boxes[0].count = count;
+    calcBoxBounds(&boxes[0], colours);
+
+    while(boxCount < maxColours) {
+        /* Split the box which covers the most colour space, weighted
+         * by the number of texels that fall in it */
+        GLint best = -1;
+        GLubyte bestChannel = 0;
+        uint64_t bestScore = 0;
+
+        for(GLuint i = 0; i < boxCount; ++i) {
+            GLuint extent;
+            GLubyte channel = widestChannel(&boxes[i], &extent);
+            uint64_t score = (uint64_t) extent * boxes[i].count;
+
+            if(score > bestScore) {
+                bestScore = score;
+                best = i;
+                bestChannel = channel;
+            }
+        }
+
+        if(best < 0) {
+            /* Every box holds a single colour, we're done */
+            break;
+        }
+
+        ColourBox* box = &boxes[best];
+        sortBox(box, colours, temp, bestChannel);
+
+        /* Split at the median, nudged to the nearest point where the
+         * channel value changes so that no colour straddles both halves */
+        const uint32_t* c = colours + box->start;
+        GLuint median = box->count / 2;
+        GLuint lo = median, hi = median;
+
+        while(lo > 0 && CHANNEL(c[lo - 1], bestChannel) == CHANNEL(c[lo], bestChannel)) {
+            --lo;
+        }
+
+        while(hi < box->count && CHANNEL(c[hi - 1], bestChannel) == CHANNEL(c[hi], bestChannel)) {
+            ++hi;
+        }
+
+        GLuint split = (lo == 0) ? hi :
+                       (hi == box->count) ? lo :
+                       ((median - lo) <= (hi - median)) ? lo : hi;
+
+        gl_assert(split > 0 && split < box->count);
+
+        ColourBox* other = &boxes[boxCount++];
+        other->start = box->start + split;
+        other->count = box->count - split;
+        box->count = split;
+
+        calcBoxBounds(box, colours);
+        calcBoxBounds(other, colours);
+    }
+
+    for(GLuint i = 0; i < boxCount; ++i) {
+        uint32_t sum[4] = {0, 0, 0, 0};
+        const uint32_t* it = colours + boxes[i].start;
+        const uint32_t* end = it + boxes[i].count;
+
+        for(; it < end; ++it) {
+            sum[0] += CHANNEL(*it, 0);
+            sum[1] += CHANNEL(*it, 1);
+            sum[2] += CHANNEL(*it, 2);
+            sum[3] += CHANNEL(*it, 3);
+        }
+
+        const GLuint n = boxes[i].count;
+        GLubyte* out = palette + (i * 4);
+        out[0] = (sum[0] + n / 2) / n;
+        out[1] = (sum[1] + n / 2) / n;
+        out[2] = (sum[2] + n / 2) / n;
+        out[3] = (sum[3] + n / 2) / n;
+    }
+
+    _glScratchFree(colours);
+    _glScratchFree(temp);
+
+    return boxCount;
+}
+
+GLuint _glNearestPaletteIndex(const GLubyte* palette, GLuint paletteCount, const GLubyte* rgba, GLuint* distance) {
+    GLuint best = 0;
+    GLuint bestDistance = ~0u;
+
+    for(GLuint i = 0; i < paletteCount; ++i) {
+        const GLubyte* p = palette + (i * 4);
+        GLint dr = (GLint) p[0] - rgba[0];
+        GLint dg = (GLint) p[1] - rgba[1];
+        GLint db = (GLint) p[2] - rgba[2];
+        GLint da = (GLint) p[3] - rgba[3];
+        GLuint d = dr * dr + dg * dg + db * db + da * da;
+
+        if(d < bestDistance) {
+            bestDistance = d;
+            best = i;
+
+            if(!d) {
+                break;
+            }
+        }
+    }
+
+    if(distance) {
+        *distance = bestDistance;
+    }
+
+    return best;
+}
+
+#define NEAREST_CACHE_SIZE 256
+
+typedef struct {
+    uint32_t colour;
+    GLint index;
+} NearestCacheEntry;
+
+GL_FORCE_INLINE GLubyte cachedNearest(NearestCacheEntry* cache, const GLubyte* palette, GLuint paletteCount, const GLubyte* rgba) {
+    uint32_t colour = rgba[0] | (rgba[1] << 8) | (rgba[2] << 16) | ((uint32_t) rgba[3] << 24);
+    NearestCacheEntry* entry = &cache[(colour * 2654435761u) >> 24];
+
+    if(entry->index < 0 || entry->colour != colour) {
+        entry->colour = colour;
+        entry->index = _glNearestPaletteIndex(palette, paletteCount, rgba, NULL);
+    }
+
+    return (GLubyte) entry->index;
+}
+
+GL_FORCE_INLINE GLubyte clampChannel(GLint v) {
+    return (v < 0) ? 0 : (v > 255) ? 255 : v;
+}
+
+void _glMapToPalette(const GLubyte* rgba, GLuint width, GLuint height,
+                     const GLubyte* palette, GLuint paletteCount,
+                     GLboolean dither, GLubyte* indices) {
+
+    NearestCacheEntry cache[NEAREST_CACHE_SIZE];
+    for(GLuint i = 0; i < NEAREST_CACHE_SIZE; ++i) {
+        cache[i].index = -1;
+    }
+
+    GLint* errors = NULL;
+
+    if(dither) {
+        /* Two rows of RGB error, with a texel of padding either side */
+        errors = (GLint*) _glScratchAlloc((width + 2) * 2 * 3 * sizeof(GLint));
+        if(errors) {
+            memset(errors, 0, (width + 2) * 2 * 3 * sizeof(GLint));
+        }
+    }
+
+    if(!errors) {
+        for(GLuint i = 0; i < width * height; ++i) {
+            GLubyte texel[4];
+            const GLubyte* src = rgba + (i * 4);
+
+            if(src[3] == 0) {
+                memset(texel, 0, sizeof(texel));
+                src = texel;
+            }
+
+            indices[i] = cachedNearest(cache, palette, paletteCount, src);
+        }
+
+        return;
+    }
+
+    /* Floyd-Steinberg error diffusion. Alpha isn't dithered as that
+     * makes a mess of punch-through and alpha tested edges */
+    for(GLuint y = 0; y < height; ++y) {
+        GLint* thisRow = errors + (((y & 1) ? (width + 2) : 0) * 3) + 3;
+        GLint* nextRow = errors + (((y & 1) ? 0 : (width + 2)) * 3) + 3;
+
+        memset(nextRow - 3, 0, (width + 2) * 3 * sizeof(GLint));
+
+        for(GLuint x = 0; x < width; ++x) {
+            const GLubyte* src = rgba + ((y * width + x) * 4);
+            GLubyte texel[4];
+
+            if(src[3] == 0) {
+                memset(texel, 0, sizeof(texel));
+            } else {
+                for(GLubyte c = 0; c < 3; ++c) {
+                    texel[c] = clampChannel(src[c] + thisRow[x * 3 + c] / 16);
+                }
+                texel[3] = src[3];
+            }
+
+            GLubyte idx = cachedNearest(cache, palette, paletteCount, texel);
+            indices[y * width + x] = idx;
+
+            if(src[3] == 0) {
+                continue;
+            }
+
+            const GLubyte* chosen = palette + (idx * 4);
+            for(GLubyte c = 0; c < 3; ++c) {
+                GLint e = (GLint) texel[c] - chosen[c];
+                thisRow[(x + 1) * 3 + c] += e * 7;
+                nextRow[((GLint) x - 1) * 3 + c] += e * 3;
+                nextRow[x * 3 + c] += e * 5;
+                nextRow[(x + 1) * 3 + c] += e;
+            }
+        }
+    }
+
+    _glScratchFree(errors);
+}
@@ -3,6 +3,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 
 #include "gl_assert.h"
 #include "types.h"
@@ -102,6 +103,11 @@ typedef enum GPUUVClamp {
     GPU_UVCLAMP_UV = 3
 } GPUUVClamp;
 
+typedef enum GPUSpecular {
+    GPU_SPECULAR_DISABLE = 0,
+    GPU_SPECULAR_ENABLE = 1
+} GPUSpecular;
+
 typedef enum GPUColorClamp {
     GPU_CLRCLAMP_DISABLE = 0,
     GPU_CLRCLAMP_ENABLE = 1
@@ -273,8 +279,43 @@ enum GPUCommand {
     GPU_CMD_SPRITE = 0xA0000000
 };
 
+/* A textured sprite, which follows a sprite header in place of a vertex.
+ * The corners are in screen space, a to d around the quad, with d's depth
+ * implied by the other three. Texture coordinates are packed as the top
+ * halves of the u and v floats, and the colour comes from the header. */
+typedef struct {
+    uint32_t flags;
+    float ax, ay, az;
+    float bx, by, bz;
+    float cx, cy, cz;
+    float dx, dy;
+    uint32_t padding;
+    uint32_t auv;
+    uint32_t buv;
+    uint32_t cuv;
+} SpriteVertex;
+
+static inline uint32_t PackSpriteUV(float u, float v) {
+    uint32_t iu, iv;
+    memcpy(&iu, &u, sizeof(float));
+    memcpy(&iv, &v, sizeof(float));
+    return (iu & 0xFFFF0000) | (iv >> 16);
+}
+
+static inline void UnpackSpriteUV(uint32_t uv, float* u, float* v) {
+    const uint32_t iu = uv & 0xFFFF0000;
+    const uint32_t iv = uv << 16;
+    memcpy(u, &iu, sizeof(float));
+    memcpy(v, &iv, sizeof(float));
+}
+
 typedef float Matrix4x4[16];
 
+#ifdef __cplusplus
+/* The benchmarks drive the backend directly from C++ */
+extern "C" {
+#endif
+
 void SceneBegin();
 
 void SceneListBegin(GPUList list);
@@ -283,6 +324,12 @@ void SceneListFinish();
 
 void SceneFinish();
 
+#ifdef __cplusplus
+}
+#endif
+
+#define GPU_TA_CMD_PARA_MASK        0xE0000000
+
 #define GPU_TA_CMD_TYPE_SHIFT       24
 #define GPU_TA_CMD_TYPE_MASK        (7 << GPU_TA_CMD_TYPE_SHIFT)
 
@@ -492,6 +539,24 @@ static inline void CompilePolyHeader(PolyHeader *dst, const PolyContext *src) {
     dst->d3 = dst->d4 = 0xffffffff;
 }
 
+/* Compile a polygon context into a sprite header. Sprites have no shading
+ * or per-vertex colour, argb and oargb are the base and offset colours of
+ * every sprite until the next header, and their UVs are always 16-bit. */
+static inline void CompileSpriteHeader(PolyHeader *dst, const PolyContext *src, uint32_t argb, uint32_t oargb) {
+    CompilePolyHeader(dst, src);
+
+    dst->cmd &= (GPU_TA_CMD_TYPE_MASK | GPU_TA_CMD_USERCLIP_MASK | GPU_TA_CMD_SPECULAR_MASK | (1 << 3));
+    dst->cmd |= GPU_CMD_SPRITE;
+    dst->cmd |= (GPU_UVFMT_16BIT << GPU_TA_CMD_UVFMT_SHIFT) & GPU_TA_CMD_UVFMT_MASK;
+
+    dst->d1 = argb;
+    dst->d2 = oargb;
+}
+
+static inline bool IsSpriteHeader(const void* v) {
+    return ((*(const uint32_t*) v) & GPU_TA_CMD_PARA_MASK) == GPU_CMD_SPRITE;
+}
+
 #ifdef _arch_dreamcast
 #include "platforms/sh4.h"
 #else
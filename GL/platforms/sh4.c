@@ -133,6 +133,10 @@ static inline void _glClipEdge(const Vertex* const v1, const Vertex* const v2, V
     vout->argb[1] = invt * v1->argb[1] + t * v2->argb[1];
     vout->argb[2] = invt * v1->argb[2] + t * v2->argb[2];
     vout->argb[3] = invt * v1->argb[3] + t * v2->argb[3];
+
+    vout->offset_rgb[0] = invt * v1->offset_rgb[0] + t * v2->offset_rgb[0];
+    vout->offset_rgb[1] = invt * v1->offset_rgb[1] + t * v2->offset_rgb[1];
+    vout->offset_rgb[2] = invt * v1->offset_rgb[2] + t * v2->offset_rgb[2];
 }
 
 #define SPAN_SORT_CFG 0x005F8030
@@ -156,9 +160,11 @@ static inline bool is_header(Vertex* v) {
 
 void SceneListSubmit(Vertex* vertices, int n) {
     TRACE();
+    GL_TRACE_FUNCTION();
 
-    /* You need at least a header, and 3 vertices to render anything */
-    if(n < 4) {
+    /* You need at least a header, and a sprite or 3 vertices to render
+     * anything */
+    if(n < 2) {
         return;
     }
 
@@ -208,6 +214,15 @@ void SceneListSubmit(Vertex* vertices, int n) {
 
             _glPushHeader(v0, 1);
             visible_mask = 0;
+
+            /* Sprites are already in screen space, so go as they are */
+            if(IsSpriteHeader(v0)) {
+                while(i + 1 < n && !is_header(v0 + 1)) {
+                    ++i;
+                    ++v0;
+                    _glPushVertex(v0, 1);
+                }
+            }
             continue;
         }
 
@@ -251,6 +266,9 @@ void SceneListSubmit(Vertex* vertices, int n) {
             (v2->xyz[2] >= -v2->w) << 2
         );
 
+        FRAME_STATS_ADD(triangles_culled, visible_mask == NONE_VISIBLE);
+        FRAME_STATS_ADD(triangles_clipped, visible_mask != NONE_VISIBLE && visible_mask != ALL_VISIBLE);
+
         /* If we've gone behind the plane, we finish the strip
         otherwise we submit however it was */
         if(visible_mask == NONE_VISIBLE) {
@@ -175,6 +175,24 @@ static inline void GPUSetPaletteEntry(uint32_t idx, uint32_t value) {
     pvr_set_pal_entry(idx, value);
 }
 
+/* Palette RAM sits in the PVR register block, which only takes single 32
+ * bit writes, so there's no bulk path; this just avoids a call per entry */
+static inline void GPUSetPaletteEntries(uint32_t offset, uint32_t count, const uint32_t* data) {
+    volatile uint32_t* dst = &PVR_GET(PVR_PALETTE_TABLE_BASE + (offset * 4));
+
+    while(count--) {
+        *dst++ = *data++;
+    }
+}
+
+static inline void GPUGetPaletteEntries(uint32_t offset, uint32_t count, uint32_t* data) {
+    volatile uint32_t* src = &PVR_GET(PVR_PALETTE_TABLE_BASE + (offset * 4));
+
+    while(count--) {
+        *data++ = *src++;
+    }
+}
+
 static inline void GPUSetBackgroundColour(float r, float g, float b) {
     pvr_set_bg_color(r, g, b);
 }
@@ -19,6 +19,7 @@ static SDL_Window* WINDOW = NULL;
 static SDL_Renderer* RENDERER = NULL;
 
 static uint8_t BACKGROUND_COLOR[3] = {0, 0, 0};
+static uint32_t PALETTE_RAM[1024];
 
 GPUCulling CULL_MODE = GPU_CULLING_CCW;
 
@@ -144,11 +145,81 @@ GL_FORCE_INLINE void _glClipEdge(const Vertex* v1, const Vertex* v2, Vertex* vou
     vout->argb[1] = invt * v1->argb[1] + t * v2->argb[1];
     vout->argb[2] = invt * v1->argb[2] + t * v2->argb[2];
     vout->argb[3] = invt * v1->argb[3] + t * v2->argb[3];
+
+    vout->offset_rgb[0] = invt * v1->offset_rgb[0] + t * v2->offset_rgb[0];
+    vout->offset_rgb[1] = invt * v1->offset_rgb[1] + t * v2->offset_rgb[1];
+    vout->offset_rgb[2] = invt * v1->offset_rgb[2] + t * v2->offset_rgb[2];
+}
+
+static void _glUnpackColour(uint32_t c, float* argb) {
+    const float o = 1.0f / 255.0f;
+    argb[A8IDX] = (float) ((c >> 24) & 0xFF) * o;
+    argb[R8IDX] = (float) ((c >> 16) & 0xFF) * o;
+    argb[G8IDX] = (float) ((c >> 8) & 0xFF) * o;
+    argb[B8IDX] = (float) ((c >> 0) & 0xFF) * o;
+}
+
+/* There's no sprite primitive here, so each sprite following a sprite
+ * header becomes a strip of two triangles under an equivalent polygon
+ * header, coloured as the header says. The sprites are already in screen
+ * space. Returns the number of sprites used. */
+static int _glExpandSprites(const Vertex* header, int n) {
+    const PolyHeader* h = (const PolyHeader*) header;
+
+    Vertex poly = *header;
+    poly.flags = (poly.flags & ~GPU_TA_CMD_PARA_MASK) | GPU_CMD_POLYHDR;
+    _glPushHeaderOrVertex(&poly);
+
+    Vertex corner;
+    memset(&corner, 0, sizeof(Vertex));
+    corner.w = 1.0f;
+    _glUnpackColour(h->d1, corner.argb);
+
+    float offset[4];
+    _glUnpackColour(h->d2, offset);
+    corner.offset_rgb[0] = offset[R8IDX];
+    corner.offset_rgb[1] = offset[G8IDX];
+    corner.offset_rgb[2] = offset[B8IDX];
+
+    int i = 0;
+    for(const Vertex* v = header + 1; i < n && glIsVertex(v->flags); ++i, ++v) {
+        const SpriteVertex* s = (const SpriteVertex*) v;
+
+        float au, av, bu, bv, cu, cv;
+        UnpackSpriteUV(s->auv, &au, &av);
+        UnpackSpriteUV(s->buv, &bu, &bv);
+        UnpackSpriteUV(s->cuv, &cu, &cv);
+
+        /* a, b, d, c as a strip. d's depth and UV are implied by the
+         * other three corners. */
+        corner.flags = GPU_CMD_VERTEX;
+        corner.xyz[0] = s->ax; corner.xyz[1] = s->ay; corner.xyz[2] = s->az;
+        corner.uv[0] = au; corner.uv[1] = av;
+        _glPushHeaderOrVertex(&corner);
+
+        corner.xyz[0] = s->bx; corner.xyz[1] = s->by; corner.xyz[2] = s->bz;
+        corner.uv[0] = bu; corner.uv[1] = bv;
+        _glPushHeaderOrVertex(&corner);
+
+        corner.xyz[0] = s->dx; corner.xyz[1] = s->dy; corner.xyz[2] = s->az + s->cz - s->bz;
+        corner.uv[0] = au + cu - bu; corner.uv[1] = av + cv - bv;
+        _glPushHeaderOrVertex(&corner);
+
+        corner.flags = GPU_CMD_VERTEX_EOL;
+        corner.xyz[0] = s->cx; corner.xyz[1] = s->cy; corner.xyz[2] = s->cz;
+        corner.uv[0] = cu; corner.uv[1] = cv;
+        _glPushHeaderOrVertex(&corner);
+    }
+
+    return i;
 }
 
 void SceneListSubmit(Vertex* v2, int n) {
-    /* You need at least a header, and 3 vertices to render anything */
-    if(n < 4) {
+    GL_TRACE_FUNCTION();
+
+    /* You need at least a header, and a sprite or 3 vertices to render
+     * anything */
+    if(n < 2) {
         return;
     }
 
@@ -171,7 +242,13 @@ void SceneListSubmit(Vertex* v2, int n) {
                 }
             break;
             default:
-                _glPushHeaderOrVertex(v2);
+                if(IsSpriteHeader(v2)) {
+                    const int sprites = _glExpandSprites(v2, n - i - 1);
+                    i += sprites;
+                    v2 += sprites;
+                } else {
+                    _glPushHeaderOrVertex(v2);
+                }
                 counter = 0;
                 continue;
         };
@@ -186,6 +263,9 @@ void SceneListSubmit(Vertex* v2, int n) {
             (counter == 0) << 3
         );
 
+        FRAME_STATS_ADD(triangles_culled, (visible_mask & 7) == 0);
+        FRAME_STATS_ADD(triangles_clipped, (visible_mask & 7) != 0 && (visible_mask & 7) != 7);
+
         switch(visible_mask) {
         case 15: /* All visible, but final vertex in strip */
         {
@@ -441,8 +521,28 @@ void SceneListSubmit(Vertex* v2, int n) {
     _glFlushBuffer();
 }
 
+/* The PVR adds the offset colour after texturing when the header's specular
+ * bit is set. Nothing is textured here, so it's summed straight into the
+ * vertex colour. */
+static SDL_Vertex _glToSDLVertex(const Vertex* v, bool specular) {
+    SDL_Vertex sv = {
+        {v->xyz[0], v->xyz[1]},
+        {v->argb[2], v->argb[1], v->argb[0], v->argb[3]},
+        {v->uv[0], v->uv[1]}
+    };
+
+    if(specular) {
+        sv.color.r = MIN(sv.color.r + v->offset_rgb[0], 1.0f);
+        sv.color.g = MIN(sv.color.g + v->offset_rgb[1], 1.0f);
+        sv.color.b = MIN(sv.color.b + v->offset_rgb[2], 1.0f);
+    }
+
+    return sv;
+}
+
 void SceneListFinish() {
     uint32_t vidx = 0;
+    bool specular = false;
     const uint32_t* flags = (const uint32_t*) BUFFER;
     uint32_t step = sizeof(Vertex) / sizeof(uint32_t);
 
@@ -455,6 +555,8 @@ void SceneListFinish() {
             uint32_t mask = mode1 & GPU_TA_PM1_CULLING_MASK;
             CULL_MODE = mask >> GPU_TA_PM1_CULLING_SHIFT;
 
+            specular = (*flags & GPU_TA_CMD_SPECULAR_MASK) != 0;
+
         } else {
             switch(*flags) {
             case GPU_CMD_VERTEX_EOL:
@@ -471,23 +573,9 @@ void SceneListFinish() {
             Vertex* v1 = (Vertex*) (flags - step);
             Vertex* v2 = (Vertex*) (flags);
 
-            SDL_Vertex sv0 = {
-                {v0->xyz[0], v0->xyz[1]},
-                {v0->argb[2], v0->argb[1], v0->argb[0], v0->argb[3]},
-                {v0->uv[0], v0->uv[1]}
-            };
-
-            SDL_Vertex sv1 = {
-                {v1->xyz[0], v1->xyz[1]},
-                {v1->argb[2], v1->argb[1], v1->argb[0], v1->argb[3]},
-                {v1->uv[0], v1->uv[1]}
-            };
-
-            SDL_Vertex sv2 = {
-                {v2->xyz[0], v2->xyz[1]},
-                {v2->argb[2], v2->argb[1], v2->argb[0], v2->argb[3]},
-                {v2->uv[0], v2->uv[1]}
-            };
+            SDL_Vertex sv0 = _glToSDLVertex(v0, specular);
+            SDL_Vertex sv1 = _glToSDLVertex(v1, specular);
+            SDL_Vertex sv2 = _glToSDLVertex(v2, specular);
 
             aligned_vector_push_back(&vbuffer, &sv0, 1);
             aligned_vector_push_back(&vbuffer, &sv1, 1);
@@ -574,7 +662,15 @@ void GPUSetPaletteFormat(GPUPaletteFormat format) {
 }
 
 void GPUSetPaletteEntry(uint32_t idx, uint32_t value) {
+    PALETTE_RAM[idx] = value;
+}
+
+void GPUSetPaletteEntries(uint32_t offset, uint32_t count, const uint32_t* data) {
+    memcpy(PALETTE_RAM + offset, data, count * sizeof(uint32_t));
+}
 
+void GPUGetPaletteEntries(uint32_t offset, uint32_t count, uint32_t* data) {
+    memcpy(data, PALETTE_RAM + offset, count * sizeof(uint32_t));
 }
 
 void GPUSetBackgroundColour(float r, float g, float b) {
@@ -64,6 +64,8 @@ size_t GPUMemoryAvailable();
 void* GPUMemoryAlloc(size_t size);
 void GPUSetPaletteFormat(GPUPaletteFormat format);
 void GPUSetPaletteEntry(uint32_t idx, uint32_t value);
+void GPUSetPaletteEntries(uint32_t offset, uint32_t count, const uint32_t* data);
+void GPUGetPaletteEntries(uint32_t offset, uint32_t count, uint32_t* data);
 
 void GPUSetBackgroundColour(float r, float g, float b);
 void GPUSetAlphaCutOff(uint8_t v);
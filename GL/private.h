@@ -8,6 +8,8 @@
 #include "gl_assert.h"
 #include "platform.h"
 #include "types.h"
+#include "memory.h"
+#include "trace.h"
 
 #include "../include/GL/gl.h"
 #include "../include/GL/glext.h"
@@ -52,6 +54,10 @@ extern void* memcpy4 (void *dest, const void *src, size_t count);
 #define COLOR_ENABLED_FLAG    (1 << 3)
 #define NORMAL_ENABLED_FLAG     (1 << 4)
 #define S_COLOR_ENABLED_FLAG    (1 << 5)
+#define WEIGHT_ENABLED_FLAG     (1 << 6)
+#define MATRIX_INDEX_ENABLED_FLAG (1 << 7)
+
+#define SKINNING_ENABLED_FLAGS  (WEIGHT_ENABLED_FLAG | MATRIX_INDEX_ENABLED_FLAG)
 
 #define MAX_TEXTURE_SIZE 1024
 
@@ -85,6 +91,11 @@ typedef struct {
 typedef struct {
     unsigned int list_type;
     AlignedVector vector;
+    /* Capacity management, see _glEndListFrame */
+    uint32_t high_water;    /* Most vertices submitted in one frame */
+    uint32_t quiet_peak;    /* Most vertices since quiet_frames started */
+    uint32_t quiet_frames;  /* Consecutive frames using under half the capacity */
+    uint32_t min_capacity;  /* Never shrink below the configured capacity */
 } PolyList;
 
 typedef struct {
@@ -95,9 +106,15 @@ typedef struct {
     GLushort     size;   /* The size of the bank (16 or 256) */
     GLenum      format;
     GLshort      bank;
+    /* Number of textures sharing an automatically generated palette,
+     * zero for palettes uploaded with glColorTableEXT */
+    GLushort    refcount;
+    /* Entries [dirtyStart, dirtyEnd) still need writing to palette RAM */
+    GLushort    dirtyStart;
+    GLushort    dirtyEnd;
 } TexturePalette;
 
-typedef struct {
+typedef struct TextureObject {
     //0
     GLuint   index;
     GLuint   color; /* This is the PVR texture format */
@@ -140,8 +157,35 @@ typedef struct {
     GLushort pvrHeight;
     GLushort strideWidth;
     GLboolean isStrided;
+
+    /* Residency management (GL_TEXTURE_EVICTABLE_KOS) */
+    GLboolean isEvictable;
+    GLuint allocatedSize; /* Bytes of VRAM allocated for data */
+    GLuint lastUsedFrame;
+    GLuint evictedFrame;
+    GLvoid* evictedData; /* Copy of data in RAM while evicted from VRAM */
+
+    /* Atlas members (GL_KOS_texture_atlas) have no data of their own, they
+     * sample the width x height region at atlasX, atlasY of atlasPage */
+    struct TextureObject* atlasPage;
+    GLushort atlasX;
+    GLushort atlasY;
+    GLubyte atlasIndex;
+    GLubyte atlasPageIndex;
 } __attribute__((aligned(32))) TextureObject;
 
+/* x^exponent sampled at POWER_TABLE_SIZE + 1 even steps over [0, 1], plus
+ * a repeat of the last entry so interpolating at 1 stays in bounds. Built
+ * when the exponent changes, so the lighting loop only interpolates. */
+#define POWER_TABLE_SIZE 256
+
+typedef struct {
+    /* Inputs at or below this raise to less than a colour step, so the
+     * term is skipped */
+    GLfloat cutoff;
+    GLfloat values[POWER_TABLE_SIZE + 2];
+} PowerTable;
+
 typedef struct {
     GLfloat emissive[4];
     GLfloat ambient[4];
@@ -151,6 +195,9 @@ typedef struct {
     /* Valid values are 0-128 */
     GLfloat exponent;
 
+    /* NdotH ^ exponent */
+    PowerTable specularPower;
+
     /* Base ambient + emission colour for
      * the current material + light */
     GLfloat baseColour[4];
@@ -165,6 +212,10 @@ typedef struct {
     GLfloat linear_attenuation;
     GLfloat quadratic_attenuation;
     GLfloat spot_exponent;
+
+    /* spotDot ^ spot_exponent, out of line so a LightSource stays cheap to
+     * copy */
+    const PowerTable* spotPower;
     GLfloat diffuse[4];
     GLfloat specular[4];
     GLfloat ambient[4];
@@ -269,6 +320,13 @@ typedef struct __attribute__((aligned(32))) {
 Vertex* _glSubmissionTargetStart(SubmissionTarget* target);
 Vertex* _glSubmissionTargetEnd(SubmissionTarget* target);
 
+/* Immediate mode writes its vertices into the active list as they come,
+ * and they're finished off in place like any other draw, either at glEnd
+ * or, batched with the blocks that follow, at _glImmediateFlush */
+void _glImmediateBegin(GLenum mode);
+Vertex* _glImmediateVertex(void);
+void _glImmediateEnd(GLenum mode);
+
 typedef enum {
     CLIP_RESULT_ALL_IN_FRONT,
     CLIP_RESULT_ALL_BEHIND,
@@ -294,7 +352,6 @@ PolyList *_glTransparentPolyList();
 void _glInitAttributePointers();
 void _glInitContext();
 void _glInitLights();
-void _glInitImmediateMode(GLuint initial_size);
 void _glInitMatrices();
 void _glInitFramebuffers();
 void _glInitSubmissionTarget();
@@ -303,12 +360,27 @@ void _glMatrixLoadNormal();
 void _glMatrixLoadModelView();
 void _glMatrixLoadProjection();
 void _glMatrixLoadModelViewProjection();
+void _glMatrixLoadIdentity();
+
+/* ARB_matrix_palette */
+#define MAX_GLDC_PALETTE_MATRICES 32
+#define MAX_GLDC_PALETTE_STACK_DEPTH 4
+#define MAX_GLDC_VERTEX_UNITS 4
+
+GLint _glGetCurrentPaletteMatrix();
+
+/* The palette entry in eye space, or premultiplied by the projection
+ * (and viewport) for going straight to clip space */
+const Matrix4x4* _glGetPaletteMatrix(GLuint index);
+const Matrix4x4* _glGetPaletteMatrixProjection(GLuint index);
 
 extern GLfloat DEPTH_RANGE_MULTIPLIER_L;
 extern GLfloat DEPTH_RANGE_MULTIPLIER_H;
 
 Matrix4x4* _glGetProjectionMatrix();
 Matrix4x4* _glGetModelViewMatrix();
+/* Cached until the modelview changes; identity if it can't be inverted */
+const Matrix4x4* _glGetInverseModelViewMatrix();
 Matrix4x4* _glGetTextureMatrix();
 Matrix4x4* _glGetColorMatrix();
 GLenum _glGetMatrixMode();
@@ -316,7 +388,7 @@ GLboolean _glIsIdentity(const Matrix4x4* m);
 
 void _glWipeTextureOnFramebuffers(GLuint texture);
 
-GLubyte _glInitTextures();
+GLubyte _glInitTextures(GLuint maxTextures);
 
 void _glUpdatePVRTextureContext(PolyContext* context, GLshort textureUnit);
 void _glAllocateSpaceForMipmaps(TextureObject* active);
@@ -336,6 +408,8 @@ typedef struct {
     AttribPointer uv; // 64
     AttribPointer st; // 80
     AttribPointer normal; // 96
+    AttribPointer weight; // 112
+    AttribPointer matrix_index; // 128
 
     GLuint enabled; // list of currently enabled/used attributes
     GLuint dirty;   // list of attributes that need state recalculating
@@ -347,6 +421,8 @@ typedef struct {
     ReadAttributeFunc uv_func;
     ReadAttributeFunc st_func;
     ReadAttributeFunc normal_func;
+    ReadAttributeFunc weight_func;
+    ReadAttributeFunc matrix_index_func;
 } AttribPointerList;
 
 extern AttribPointerList ATTRIB_LIST;
@@ -373,9 +449,21 @@ void _glSetTextureTwiddle(GLboolean v);
 GLuint _glGetActiveClientTexture();
 TexturePalette* _glGetSharedPalette(GLshort bank);
 void _glSetInternalPaletteFormat(GLenum val);
+GLenum _glGetInternalPaletteFormat();
 
 GLboolean _glIsSharedTexturePaletteEnabled();
-void _glApplyColorTable(TexturePalette *palette);
+void _glUploadDirtyPalettes();
+
+GLboolean _glGetAutoPaletteDither();
+void _glSetAutoPaletteDither(GLboolean v);
+
+/* Median cut quantisation of count RGBA8888 texels into at most maxColours
+ * RGBA8888 palette entries. Returns the number of entries written. */
+GLuint _glQuantiseRGBA8888(const GLubyte* rgba, GLuint count, GLuint maxColours, GLubyte* palette);
+GLuint _glNearestPaletteIndex(const GLubyte* palette, GLuint paletteCount, const GLubyte* rgba, GLuint* distance);
+void _glMapToPalette(const GLubyte* rgba, GLuint width, GLuint height,
+                     const GLubyte* palette, GLuint paletteCount,
+                     GLboolean dither, GLubyte* indices);
 
 GLboolean _glIsBlendingEnabled();
 GLboolean _glIsAlphaTestEnabled();
@@ -410,14 +498,42 @@ GL_FORCE_INLINE PolyList* _glActivePolyList() {
 GLboolean _glIsMipmapComplete(const TextureObject* obj);
 GLubyte* _glGetMipmapLocation(const TextureObject* obj, GLuint level);
 GLuint _glGetMipmapLevelCount(const TextureObject* obj);
+GLboolean _glGetMipmapGammaCorrect();
+void _glSetMipmapGammaCorrect(GLboolean v);
 GLboolean _glIsLightingEnabled();
 
 void _glEnableLight(GLubyte light, GLboolean value);
 GLboolean _glIsColorMaterialEnabled();
 
 GLboolean _glIsNormalizeEnabled();
+GLboolean _glIsMatrixPaletteEnabled();
+GLboolean _glIsBoundingSphereEnabled();
+
+/* Texture coordinate generation, for S (0) and T (1) of the first unit */
+typedef struct {
+    GLboolean enabled;
+    GLenum mode;
+    GLfloat objectPlane[4];
+    GLfloat eyePlane[4];
+} TexGenCoord;
+
+const TexGenCoord* _glGetTexGen(GLuint coord);
+void _glSetTexGenEnabled(GLuint coord, GLboolean value);
+GLboolean _glIsTexGenEnabled(GLuint coord);
 
 extern GLboolean IMMEDIATE_MODE_ACTIVE;
+extern GLboolean IMMEDIATE_MODE_PENDING;
+
+void _glImmediateFlushPending(void);
+
+/* Call before changing anything that finishing off immediate mode vertices
+ * reads, so that any batch still pending is finished with what was set
+ * when it was drawn */
+GL_FORCE_INLINE void _glImmediateFlush(void) {
+    if(IMMEDIATE_MODE_PENDING) {
+        _glImmediateFlushPending();
+    }
+}
 
 GL_NO_INLINE void _glKosThrowError(GLenum error, const char *function);
 
@@ -436,10 +552,90 @@ extern void _glPerformLighting(Vertex* vertices, const uint32_t count);
 unsigned char _glIsClippingEnabled();
 void _glEnableClipping(unsigned char v);
 
+/* Start and size of the pool texture data is allocated from */
+void* _glTextureMemoryBase();
+GLuint _glMaxTextureMemory();
+
+/* The first texture object named id or above, or NULL */
+TextureObject* _glNextTextureObject(GLuint id);
+
+/* Writes the lists to the active frame capture, if there is one */
+void _glCaptureFrame();
+
 GLuint _glFreeTextureMemory();
 GLuint _glUsedTextureMemory();
 GLuint _glFreeContiguousTextureMemory();
 
+void _glSetDefragBytesPerFrame(GLuint bytes);
+void _glSetTextureRestoreBytesPerFrame(GLuint bytes);
+void _glTexturesEndFrame();
+
+/* Marks the texture as used this frame and brings it back into VRAM if it
+ * was evicted (and the per-frame restore budget allows) */
+void _glTouchTexture(TextureObject* txr);
+
+/* Restores an evicted texture regardless of the budget, for anything which
+ * needs to read or modify its data */
+GLboolean _glMakeTextureResident(TextureObject* txr);
+
+GLenum _glTextureSetStorage(TextureObject* active, GLenum internalFormat,
+                            GLsizei width, GLsizei height,
+                            GLboolean mipmapped, GLuint dataSize);
+
+/* Converts a level 0 image into txr's format and writes it at x, y,
+ * repeating its edge texels border texels outwards. 16bpp formats only */
+GLboolean _glTextureWriteRegion(TextureObject* txr, GLuint x, GLuint y,
+                                GLsizei width, GLsizei height, GLuint border,
+                                GLenum format, GLenum type, const GLvoid* data);
+
+GLboolean _glTextureRegionFormatSupported(GLenum internalFormat, GLenum format, GLenum type);
+
+/* Texture atlases (GL_KOS_texture_atlas) */
+TextureObject* _glGetTextureObject(GLuint id);
+
+/* Turns txr into a member of page, sampling width x height texels at x, y */
+void _glTextureSetAtlasRegion(TextureObject* txr, TextureObject* page,
+                              GLuint x, GLuint y, GLsizei width, GLsizei height);
+void _glReleaseAtlasRegion(TextureObject* txr);
+
+typedef struct {
+    GLuint evictions;
+    GLuint restores;
+    /* Restores of textures which were evicted within the last
+     * TEXTURE_THRASH_FRAMES frames */
+    GLuint thrashes;
+    GLuint evictedBytes;
+} TextureResidencyStats;
+
+const TextureResidencyStats* _glGetTextureResidencyStats();
+
+/* Per-frame counters for glKosGetFrameStats (see stats.c). These all
+ * compile away unless GLDC_FRAME_STATS is defined */
+extern GLdcFrameStats FRAME_STATS;
+extern GLdcFrameStatsClock FRAME_STATS_CLOCK;
+
+#ifdef GLDC_FRAME_STATS
+void _glFrameStatsRecordLists();
+void _glFrameStatsEndFrame();
+
+GL_FORCE_INLINE GLuint _glFrameStatsTime() {
+    return (FRAME_STATS_CLOCK) ? FRAME_STATS_CLOCK() : 0;
+}
+
+#define FRAME_STATS_ADD(field, n) (FRAME_STATS.field += (n))
+#define FRAME_STATS_TIMER_START(t) const GLuint t = _glFrameStatsTime()
+#define FRAME_STATS_TIMER_END(field, t) (FRAME_STATS.field += _glFrameStatsTime() - (t))
+#define FRAME_STATS_RECORD_LISTS() _glFrameStatsRecordLists()
+#define FRAME_STATS_END_FRAME() _glFrameStatsEndFrame()
+#else
+/* sizeof keeps variables only used for the stats from being unused */
+#define FRAME_STATS_ADD(field, n) ((void) sizeof(n))
+#define FRAME_STATS_TIMER_START(t) ((void) 0)
+#define FRAME_STATS_TIMER_END(field, t) ((void) 0)
+#define FRAME_STATS_RECORD_LISTS() ((void) 0)
+#define FRAME_STATS_END_FRAME() ((void) 0)
+#endif
+
 void _glApplyScissor(bool force);
 void _glSetColorMaterialMask(GLenum mask);
 void _glSetColorMaterialMode(GLenum mode);
@@ -450,6 +646,10 @@ void _glSetLightModelViewerInEyeCoordinates(GLboolean v);
 GLboolean _glGetLightModelViewerInEyeCoordinates(void);
 void _glSetLightModelSceneAmbient(const GLfloat* v);
 void _glSetLightModelColorControl(GLint v);
+
+/* Lighting with GL_SEPARATE_SPECULAR_COLOR: specular goes to the offset
+ * colour and the header enables it */
+GLboolean _glIsSeparateSpecularEnabled();
 GLuint _glEnabledLightCount();
 LightSource** _glEnabledLightCache();
 void _glRecalcEnabledLights();
@@ -468,11 +668,18 @@ LightSource* _glLightAt(GLuint i);
 
 
 void _glTnlLoadMatrix(void);
+void _glTnlLoadImmediateMatrix(void);
 void _glTnlApplyEffects(SubmissionTarget* target);
 
 void _glTnlUpdateLighting(void);
 void _glTnlUpdateTextureMatrix(void);
 void _glTnlUpdateColorMatrix(void);
+GLboolean _glTnlIsSkinning(void);
+void _glTnlUpdateTexGen(void);
+
+/* True when vertices come out of _glTnlLoadMatrix (and skinning) in eye
+ * space, and _glTnlApplyEffects finishes the projection */
+GLboolean _glTnlIsEyeSpace(void);
 
 uint32_t _glPackNormal(const GLfloat* nxyz);
 void _glUnpackNormal(uint32_t packed, float* nxyz);
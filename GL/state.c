@@ -27,6 +27,8 @@ static struct {
     GLboolean fog_enabled;
     GLboolean depth_mask_enabled;
     GLboolean secondary_color_enabled;
+    GLboolean matrix_palette_enabled;
+    GLboolean bounding_sphere_enabled;
 
     struct {
         GLint x;
@@ -256,7 +258,15 @@ GLfloat* _glGetLightModelSceneAmbient() {
 }
 
 void _glSetLightModelColorControl(GLint v) {
-    GPUState.color_control = v;
+    if(GPUState.color_control != (GLenum) v) {
+        GPUState.color_control = v;
+        GPUState.is_dirty = GL_TRUE;
+    }
+}
+
+GLboolean _glIsSeparateSpecularEnabled() {
+    return GPUState.lighting_enabled &&
+        GPUState.color_control == GL_SEPARATE_SPECULAR_COLOR;
 }
 
 GLenum _glColorMaterialMask() {
@@ -289,6 +299,14 @@ GLboolean _glIsNormalizeEnabled() {
     return GPUState.normalize_enabled;
 }
 
+GLboolean _glIsMatrixPaletteEnabled() {
+    return GPUState.matrix_palette_enabled;
+}
+
+GLboolean _glIsBoundingSphereEnabled() {
+    return GPUState.bounding_sphere_enabled;
+}
+
 GLenum _glGetGpuBlendSrcFactor() {
     switch(GPUState.blend_sfactor) {
     case GL_ZERO:
@@ -363,12 +381,15 @@ GLboolean TEXTURES_ENABLED [] = {GL_FALSE, GL_FALSE};
 void _glUpdatePVRTextureContext(PolyContext *context, GLshort textureUnit) {
     const TextureObject *tx1 = (textureUnit == 0) ? _glGetTexture0() : _glGetTexture1();
 
+    /* Atlas members use their own sampling parameters with the page's data */
+    const TextureObject *storage = (tx1 && tx1->atlasPage) ? tx1->atlasPage : tx1;
+
     /* Disable all texturing to start with */
     context->txr.enable = GPU_TEXTURE_DISABLE;
     context->txr2.enable = GPU_TEXTURE_DISABLE;
     context->txr2.alpha = GPU_TXRALPHA_DISABLE;
 
-    if(!TEXTURES_ENABLED[textureUnit] || !tx1 || !tx1->data) {
+    if(!TEXTURES_ENABLED[textureUnit] || !tx1 || !storage->data) {
         context->txr.base = NULL;
         return;
     }
@@ -396,7 +417,7 @@ void _glUpdatePVRTextureContext(PolyContext *context, GLshort textureUnit) {
         enableMipmaps = GL_TRUE;
     }
 
-    if(tx1->height != tx1->width){
+    if(tx1->height != tx1->width || tx1->atlasPage){
         enableMipmaps = GL_FALSE;
     }
 
@@ -425,27 +446,27 @@ void _glUpdatePVRTextureContext(PolyContext *context, GLshort textureUnit) {
         return;
     }
 
-    if(tx1->data) {
+    if(storage->data) {
         context->txr.enable = GPU_TEXTURE_ENABLE;
         context->txr.filter = filter;
-        context->txr.width = tx1->pvrWidth ? tx1->pvrWidth : tx1->width;
-        context->txr.height = tx1->pvrHeight ? tx1->pvrHeight : tx1->height;
+        context->txr.width = storage->pvrWidth ? storage->pvrWidth : storage->width;
+        context->txr.height = storage->pvrHeight ? storage->pvrHeight : storage->height;
         context->txr.mipmap = enableMipmaps;
         context->txr.mipmap_bias = tx1->mipmap_bias;
 
         if(enableMipmaps) {
-            context->txr.base = tx1->data;
+            context->txr.base = storage->data;
         } else {
-            context->txr.base = tx1->data + tx1->baseDataOffset;
+            context->txr.base = storage->data + storage->baseDataOffset;
         }
 
-        context->txr.format = tx1->color;
-        context->txr.is_strided = tx1->isStrided;
-        context->txr.stride_width = tx1->strideWidth;
-        context->txr.uv_scale_u = tx1->isStrided ? ((float) tx1->logicalWidth / (float) tx1->pvrWidth) : 1.0f;
-        context->txr.uv_scale_v = tx1->isStrided ? ((float) tx1->logicalHeight / (float) tx1->pvrHeight) : 1.0f;
+        context->txr.format = storage->color;
+        context->txr.is_strided = storage->isStrided;
+        context->txr.stride_width = storage->strideWidth;
+        context->txr.uv_scale_u = storage->isStrided ? ((float) storage->logicalWidth / (float) storage->pvrWidth) : 1.0f;
+        context->txr.uv_scale_v = storage->isStrided ? ((float) storage->logicalHeight / (float) storage->pvrHeight) : 1.0f;
 
-        if(tx1->isStrided) {
+        if(storage->isStrided) {
             context->txr.format |= GPU_TXRFMT_X32_STRIDE;
         }
 
@@ -518,6 +539,8 @@ void _glInitContext() {
 }
 
 GLAPI void APIENTRY glEnable(GLenum cap) {
+    _glImmediateFlush();
+
     switch(cap) {
         case GL_COLOR_SUM:
             if(GPUState.secondary_color_enabled != GL_TRUE) {
@@ -560,6 +583,9 @@ GLAPI void APIENTRY glEnable(GLenum cap) {
             if(GPUState.lighting_enabled != GL_TRUE) {
                 GPUState.lighting_enabled = GL_TRUE;
                 _glTnlUpdateLighting();
+
+                /* The header's specular bit follows lighting */
+                GPUState.is_dirty = GL_TRUE;
             }
         } break;
         case GL_FOG:
@@ -622,9 +648,25 @@ GLAPI void APIENTRY glEnable(GLenum cap) {
                 GPUState.is_dirty = GL_TRUE;
             }
         break;
+        case GL_MATRIX_PALETTE_ARB:
+            GPUState.matrix_palette_enabled = GL_TRUE;
+        break;
+        case GL_BOUNDING_SPHERE_KOS:
+            GPUState.bounding_sphere_enabled = GL_TRUE;
+        break;
+        case GL_TEXTURE_GEN_S:
+        case GL_TEXTURE_GEN_T:
+            _glSetTexGenEnabled(cap & 0x1, GL_TRUE);
+        break;
         case GL_TEXTURE_TWIDDLE_KOS:
             _glSetTextureTwiddle(GL_TRUE);
         break;
+        case GL_TEXTURE_AUTO_PALETTE_DITHER_KOS:
+            _glSetAutoPaletteDither(GL_TRUE);
+        break;
+        case GL_GENERATE_MIPMAP_GAMMA_CORRECT_KOS:
+            _glSetMipmapGammaCorrect(GL_TRUE);
+        break;
         case GL_MULTISAMPLE:
             // Not supported, but not an error
             break;
@@ -635,6 +677,8 @@ GLAPI void APIENTRY glEnable(GLenum cap) {
 }
 
 GLAPI void APIENTRY glDisable(GLenum cap) {
+    _glImmediateFlush();
+
     switch(cap) {
         case GL_COLOR_SUM:
             if(GPUState.secondary_color_enabled != GL_FALSE) {
@@ -677,6 +721,9 @@ GLAPI void APIENTRY glDisable(GLenum cap) {
             if(GPUState.lighting_enabled != GL_FALSE) {
                 GPUState.lighting_enabled = GL_FALSE;
                 _glTnlUpdateLighting();
+
+                /* The header's specular bit follows lighting */
+                GPUState.is_dirty = GL_TRUE;
             }
         } break;
         case GL_FOG:
@@ -714,6 +761,7 @@ GLAPI void APIENTRY glDisable(GLenum cap) {
         case GL_LIGHT7:
             if(GPUState.lights[cap & 0xF].isEnabled) {
                 _glEnableLight(cap & 0xF, GL_FALSE);
+                _glRecalcEnabledLights();
                 GPUState.is_dirty = GL_TRUE;
             }
         break;
@@ -737,9 +785,25 @@ GLAPI void APIENTRY glDisable(GLenum cap) {
                 GPUState.is_dirty = GL_TRUE;
             }
         break;
+        case GL_MATRIX_PALETTE_ARB:
+            GPUState.matrix_palette_enabled = GL_FALSE;
+        break;
+        case GL_BOUNDING_SPHERE_KOS:
+            GPUState.bounding_sphere_enabled = GL_FALSE;
+        break;
+        case GL_TEXTURE_GEN_S:
+        case GL_TEXTURE_GEN_T:
+            _glSetTexGenEnabled(cap & 0x1, GL_FALSE);
+        break;
         case GL_TEXTURE_TWIDDLE_KOS:
             _glSetTextureTwiddle(GL_FALSE);
         break;
+        case GL_TEXTURE_AUTO_PALETTE_DITHER_KOS:
+            _glSetAutoPaletteDither(GL_FALSE);
+        break;
+        case GL_GENERATE_MIPMAP_GAMMA_CORRECT_KOS:
+            _glSetMipmapGammaCorrect(GL_FALSE);
+        break;
         case GL_MULTISAMPLE:
             // Not supported, but not an error
             break;
@@ -815,6 +879,8 @@ GLAPI void APIENTRY glHint(GLenum target, GLenum mode) {
 
 /* Polygon Rasterization Mode */
 GLAPI void APIENTRY glPolygonMode(GLenum face, GLenum mode) {
+    _glImmediateFlush();
+
     GLint validModes[] = {
         GL_FILL,
         GL_LINE,
@@ -1048,12 +1114,23 @@ GLboolean APIENTRY glIsEnabled(GLenum cap) {
         return GPUState.culling_enabled;
     case GL_LIGHTING:
         return GPUState.lighting_enabled;
+    case GL_MATRIX_PALETTE_ARB:
+        return GPUState.matrix_palette_enabled;
+    case GL_BOUNDING_SPHERE_KOS:
+        return GPUState.bounding_sphere_enabled;
+    case GL_TEXTURE_GEN_S:
+    case GL_TEXTURE_GEN_T:
+        return _glIsTexGenEnabled(cap & 0x1);
     case GL_BLEND:
         return GPUState.blend_enabled;
     case GL_POLYGON_OFFSET_POINT:
     case GL_POLYGON_OFFSET_LINE:
     case GL_POLYGON_OFFSET_FILL:
         return GPUState.polygon_offset_enabled;
+    case GL_TEXTURE_AUTO_PALETTE_DITHER_KOS:
+        return _glGetAutoPaletteDither();
+    case GL_GENERATE_MIPMAP_GAMMA_CORRECT_KOS:
+        return _glGetMipmapGammaCorrect();
     }
 
     return GL_FALSE;
@@ -1134,6 +1211,18 @@ void APIENTRY glGetIntegerv(GLenum pname, GLint *params) {
         case GL_MATRIX_MODE:
             *params = _glGetMatrixMode();
         break;
+        case GL_MAX_PALETTE_MATRICES_ARB:
+            *params = MAX_GLDC_PALETTE_MATRICES;
+        break;
+        case GL_MAX_MATRIX_PALETTE_STACK_DEPTH_ARB:
+            *params = MAX_GLDC_PALETTE_STACK_DEPTH;
+        break;
+        case GL_MAX_VERTEX_UNITS_ARB:
+            *params = MAX_GLDC_VERTEX_UNITS;
+        break;
+        case GL_CURRENT_PALETTE_MATRIX_ARB:
+            *params = _glGetCurrentPaletteMatrix();
+        break;
         case GL_TEXTURE_BINDING_2D:
             *params = (_glGetBoundTexture()) ? _glGetBoundTexture()->index : 0;
             break;
@@ -1177,6 +1266,27 @@ void APIENTRY glGetIntegerv(GLenum pname, GLint *params) {
         case GL_FREE_CONTIGUOUS_TEXTURE_MEMORY_KOS:
             *params = _glFreeContiguousTextureMemory();
         break;
+        case GL_TEXTURE_EVICTION_COUNT_KOS:
+            *params = _glGetTextureResidencyStats()->evictions;
+        break;
+        case GL_TEXTURE_RESTORE_COUNT_KOS:
+            *params = _glGetTextureResidencyStats()->restores;
+        break;
+        case GL_TEXTURE_THRASH_COUNT_KOS:
+            *params = _glGetTextureResidencyStats()->thrashes;
+        break;
+        case GL_EVICTED_TEXTURE_MEMORY_KOS:
+            *params = _glGetTextureResidencyStats()->evictedBytes;
+        break;
+        case GL_OP_LIST_HIGH_WATER_KOS:
+            *params = OP_LIST.high_water;
+        break;
+        case GL_PT_LIST_HIGH_WATER_KOS:
+            *params = PT_LIST.high_water;
+        break;
+        case GL_TR_LIST_HIGH_WATER_KOS:
+            *params = TR_LIST.high_water;
+        break;
         case GL_TEXTURE_INTERNAL_FORMAT_KOS:
             *params = _glGetTextureInternalFormat();
         break;
@@ -1205,7 +1315,7 @@ const GLubyte *glGetString(GLenum name) {
             return (const GLubyte*) "1.2 (partial) - GLdc 1.1";
 
         case GL_EXTENSIONS:
-            return (const GLubyte*)"GL_ARB_framebuffer_object, GL_ARB_multitexture, GL_ARB_texture_rg, GL_OES_compressed_paletted_texture, GL_EXT_paletted_texture, GL_EXT_shared_texture_palette, GL_KOS_multiple_shared_palette, GL_ARB_vertex_array_bgra, GL_ARB_vertex_type_2_10_10_10_rev, GL_KOS_texture_memory_management, GL_KOS_texture_non_power_of_two, GL_ATI_meminfo";
+            return (const GLubyte*)"GL_ARB_framebuffer_object, GL_ARB_multitexture, GL_ARB_texture_rg, GL_OES_compressed_paletted_texture, GL_EXT_paletted_texture, GL_EXT_shared_texture_palette, GL_KOS_multiple_shared_palette, GL_ARB_vertex_array_bgra, GL_ARB_vertex_type_2_10_10_10_rev, GL_KOS_texture_memory_management, GL_KOS_texture_non_power_of_two, GL_KOS_texture_auto_palette, GL_KOS_texture_residency, GL_KOS_texture_pack, GL_KOS_texture_atlas, GL_ATI_meminfo";
     }
 
     return (const GLubyte*) "GL_KOS_ERROR: ENUM Unsupported\n";
@@ -0,0 +1,69 @@
+/*
+ * Per-frame counters (GL_KOS_frame_stats). The instrumentation in the rest
+ * of the library goes through the FRAME_STATS_* macros in private.h, which
+ * compile to nothing unless GLDC_FRAME_STATS is defined.
+ */
+
+#include <string.h>
+
+#include "private.h"
+
+GLdcFrameStats FRAME_STATS;
+GLdcFrameStatsClock FRAME_STATS_CLOCK = NULL;
+
+#ifdef GLDC_FRAME_STATS
+
+static GLdcFrameStats LAST_FRAME_STATS;
+
+/* Capacity of each list at the start of the frame, anything larger at
+ * the end means it was reallocated mid-frame */
+static GLuint LIST_CAPACITY[3];
+
+static void _glRecordList(GLuint i, PolyList* list) {
+    GLuint capacity = aligned_vector_capacity(&list->vector);
+
+    FRAME_STATS.list_vertices[i] = aligned_vector_size(&list->vector);
+
+    /* Nothing to compare against before the first frame */
+    if(LIST_CAPACITY[i] && capacity > LIST_CAPACITY[i]) {
+        FRAME_STATS.list_reallocations++;
+    }
+}
+
+void _glFrameStatsRecordLists() {
+    _glRecordList(0, &OP_LIST);
+    _glRecordList(1, &PT_LIST);
+    _glRecordList(2, &TR_LIST);
+}
+
+void _glFrameStatsEndFrame() {
+    /* The lists may have been resized at the end of the frame */
+    LIST_CAPACITY[0] = aligned_vector_capacity(&OP_LIST.vector);
+    LIST_CAPACITY[1] = aligned_vector_capacity(&PT_LIST.vector);
+    LIST_CAPACITY[2] = aligned_vector_capacity(&TR_LIST.vector);
+
+    FRAME_STATS.vram_free = _glFreeTextureMemory();
+    FRAME_STATS.vram_contiguous = _glFreeContiguousTextureMemory();
+
+    LAST_FRAME_STATS = FRAME_STATS;
+    memset(&FRAME_STATS, 0, sizeof(FRAME_STATS));
+}
+
+#endif
+
+GLAPI void APIENTRY glKosGetFrameStats(GLdcFrameStats* stats) {
+    if(!stats) {
+        _glKosThrowError(GL_INVALID_VALUE, __func__);
+        return;
+    }
+
+#ifdef GLDC_FRAME_STATS
+    *stats = LAST_FRAME_STATS;
+#else
+    memset(stats, 0, sizeof(GLdcFrameStats));
+#endif
+}
+
+GLAPI void APIENTRY glKosSetFrameStatsClock(GLdcFrameStatsClock clock) {
+    FRAME_STATS_CLOCK = clock;
+}
@@ -0,0 +1,163 @@
+/* glTexGen and glGetTexGen. Only S and T are generated, for the first
+ * texture unit, as the vertex has no R or Q; GL_R and GL_Q raise
+ * GL_INVALID_ENUM. */
+
+#include <string.h>
+#include "private.h"
+
+/* S and T, for the first texture unit. The eye planes are kept as they
+ * were transformed by the inverse of the modelview at the time they were
+ * set, so they can be applied directly to eye-space vertices. */
+static TexGenCoord TEXGEN[2] = {
+    {GL_FALSE, GL_EYE_LINEAR, {1.0f, 0.0f, 0.0f, 0.0f}, {1.0f, 0.0f, 0.0f, 0.0f}},
+    {GL_FALSE, GL_EYE_LINEAR, {0.0f, 1.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f, 0.0f}}
+};
+
+const TexGenCoord* _glGetTexGen(GLuint coord) {
+    return &TEXGEN[coord];
+}
+
+void _glSetTexGenEnabled(GLuint coord, GLboolean value) {
+    if(TEXGEN[coord].enabled != value) {
+        TEXGEN[coord].enabled = value;
+        _glTnlUpdateTexGen();
+    }
+}
+
+GLboolean _glIsTexGenEnabled(GLuint coord) {
+    return TEXGEN[coord].enabled;
+}
+
+static TexGenCoord* texGenCoord(GLenum coord, const char* func) {
+    switch(coord) {
+        case GL_S:
+            return &TEXGEN[0];
+        case GL_T:
+            return &TEXGEN[1];
+        default:
+            _glKosThrowError(GL_INVALID_ENUM, func);
+            return NULL;
+    }
+}
+
+static void setTexGenMode(GLenum coord, GLenum mode, const char* func) {
+    _glImmediateFlush();
+
+    TexGenCoord* gen = texGenCoord(coord, func);
+    if(!gen) {
+        return;
+    }
+
+    switch(mode) {
+        case GL_EYE_LINEAR:
+        case GL_OBJECT_LINEAR:
+        case GL_SPHERE_MAP:
+        case GL_REFLECTION_MAP_ARB:
+            if(gen->mode != mode) {
+                gen->mode = mode;
+                _glTnlUpdateTexGen();
+            }
+        break;
+        default:
+            _glKosThrowError(GL_INVALID_ENUM, func);
+    }
+}
+
+void APIENTRY glTexGeni(GLenum coord, GLenum pname, GLint param) {
+    if(pname != GL_TEXTURE_GEN_MODE) {
+        _glKosThrowError(GL_INVALID_ENUM, __func__);
+        return;
+    }
+
+    setTexGenMode(coord, (GLenum) param, __func__);
+}
+
+void APIENTRY glTexGenf(GLenum coord, GLenum pname, GLfloat param) {
+    glTexGeni(coord, pname, (GLint) param);
+}
+
+void APIENTRY glTexGenfv(GLenum coord, GLenum pname, const GLfloat* params) {
+    _glImmediateFlush();
+
+    TexGenCoord* gen;
+
+    switch(pname) {
+        case GL_TEXTURE_GEN_MODE:
+            setTexGenMode(coord, (GLenum) params[0], __func__);
+        break;
+        case GL_OBJECT_PLANE:
+            if((gen = texGenCoord(coord, __func__))) {
+                memcpy(gen->objectPlane, params, sizeof(GLfloat) * 4);
+            }
+        break;
+        case GL_EYE_PLANE:
+            if((gen = texGenCoord(coord, __func__))) {
+                /* p' = p * M^-1 so that p' . eye == p . object */
+                const GLfloat* m = *_glGetInverseModelViewMatrix();
+                for(GLuint j = 0; j < 4; ++j) {
+                    gen->eyePlane[j] =
+                        params[0] * m[j * 4 + 0] + params[1] * m[j * 4 + 1] +
+                        params[2] * m[j * 4 + 2] + params[3] * m[j * 4 + 3];
+                }
+            }
+        break;
+        default:
+            _glKosThrowError(GL_INVALID_ENUM, __func__);
+    }
+}
+
+void APIENTRY glTexGeniv(GLenum coord, GLenum pname, const GLint* params) {
+    if(pname == GL_TEXTURE_GEN_MODE) {
+        setTexGenMode(coord, (GLenum) params[0], __func__);
+        return;
+    }
+
+    const GLfloat values[4] = {
+        (GLfloat) params[0], (GLfloat) params[1], (GLfloat) params[2], (GLfloat) params[3]
+    };
+
+    glTexGenfv(coord, pname, values);
+}
+
+void APIENTRY glGetTexGenfv(GLenum coord, GLenum pname, GLfloat* params) {
+    const TexGenCoord* gen = texGenCoord(coord, __func__);
+    if(!gen) {
+        return;
+    }
+
+    switch(pname) {
+        case GL_TEXTURE_GEN_MODE:
+            params[0] = (GLfloat) gen->mode;
+        break;
+        case GL_OBJECT_PLANE:
+            memcpy(params, gen->objectPlane, sizeof(GLfloat) * 4);
+        break;
+        case GL_EYE_PLANE:
+            /* Already in eye coordinates, which is what's returned */
+            memcpy(params, gen->eyePlane, sizeof(GLfloat) * 4);
+        break;
+        default:
+            _glKosThrowError(GL_INVALID_ENUM, __func__);
+    }
+}
+
+void APIENTRY glGetTexGeniv(GLenum coord, GLenum pname, GLint* params) {
+    const TexGenCoord* gen = texGenCoord(coord, __func__);
+    if(!gen) {
+        return;
+    }
+
+    if(pname == GL_TEXTURE_GEN_MODE) {
+        params[0] = (GLint) gen->mode;
+        return;
+    }
+
+    GLfloat values[4];
+    glGetTexGenfv(coord, pname, values);
+
+    if(pname == GL_OBJECT_PLANE || pname == GL_EYE_PLANE) {
+        for(GLuint i = 0; i < 4; ++i) {
+            params[i] = (GLint) values[i];
+        }
+    }
+}
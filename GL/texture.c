@@ -33,8 +33,41 @@ static GLboolean BANKS_USED[MAX_GLDC_PALETTE_SLOTS];  // Each time a 256 colour
 static GLboolean SUBBANKS_USED[MAX_GLDC_PALETTE_SLOTS][MAX_GLDC_4BPP_PALETTE_SLOTS]; // 4 counts of the used 16 colour banks within the 256 ones
 
 static GLenum INTERNAL_PALETTE_FORMAT = GL_RGBA4;
+
+/* The palette occupying each 16 colour block of palette RAM. A 256 colour
+ * palette is recorded against its first block only */
+static TexturePalette* PALETTE_RAM_OWNERS[MAX_GLDC_SHARED_PALETTES];
+
+static uint32_t _packPaletteARGB8888(const GLubyte* c) {
+    return PACK_ARGB8888(c[3], c[0], c[1], c[2]);
+}
+
+static uint32_t _packPaletteARGB4444(const GLubyte* c) {
+    return PACK_ARGB4444(c[3], c[0], c[1], c[2]);
+}
+
+static uint32_t _packPaletteARGB1555(const GLubyte* c) {
+    return PACK_ARGB1555(c[3], c[0], c[1], c[2]);
+}
+
+static uint32_t _packPaletteRGB565(const GLubyte* c) {
+    return PACK_RGB565(c[0], c[1], c[2]);
+}
+
+/* Picked when the palette format changes rather than per colour */
+static uint32_t (*PACK_PALETTE_ENTRY)(const GLubyte*) = _packPaletteARGB4444;
+
 static GLboolean TEXTURE_TWIDDLE_ENABLED = GL_FALSE;
 
+/* Palettes generated by the GL_COLOR_INDEXx_AUTO_KOS formats. These are shared
+ * between textures, so are refcounted rather than owned by a single texture */
+static TexturePalette* AUTO_PALETTES[MAX_GLDC_SHARED_PALETTES];
+static GLboolean AUTO_PALETTE_DITHER_ENABLED = GL_FALSE;
+
+/* Two colours are considered the same when merging automatic palettes if
+ * the squared RGBA distance between them is within this (8 per channel) */
+#define AUTO_PALETTE_MERGE_DISTANCE (8 * 8 * 4)
+
 #define STRINGIFY(x) #x
 #define TOSTRING(x) STRINGIFY(x)
 #define INFO_MSG(x) fprintf(stderr, "%s:%s > %s\n", __FILE__, TOSTRING(__LINE__), x)
@@ -42,6 +75,30 @@ static GLboolean TEXTURE_TWIDDLE_ENABLED = GL_FALSE;
 static void* ALLOC_BASE = NULL;
 static size_t ALLOC_SIZE = 0;
 
+/* Bytes of texture memory glKosSwapBuffers may defragment each frame */
+static GLuint DEFRAG_BYTES_PER_FRAME = 0;
+
+/* Reverse map from texture data to the texture that owns it so that
+ * moving an allocation during defrag doesn't need to search every texture.
+ * Open addressing keyed on the data pointer, each slot holds the texture
+ * index + 1 (0 is empty). Sized at init to a power of two larger than the
+ * texture count ceiling, and never smaller than DATA_OWNER_MIN_SLOTS */
+#define DATA_OWNER_MIN_SLOTS 2048
+static GLuint* DATA_OWNERS = NULL;
+static GLuint DATA_OWNER_SLOTS = 0;
+static GLuint DATA_OWNER_SHIFT = 0;
+
+/* Residency management. TEXTURE_FRAME counts calls to glKosSwapBuffers
+ * and is what lastUsedFrame is compared against */
+static GLuint TEXTURE_FRAME = 1;
+static GLuint RESTORE_BYTES_PER_FRAME = 256 * 1024;
+static GLuint RESTORED_BYTES_THIS_FRAME = 0;
+static TextureResidencyStats RESIDENCY_STATS;
+
+/* A texture restored within this many frames of being evicted is thrashing */
+#define TEXTURE_THRASH_FRAMES 60
+
+
 #define GL_KOS_MAX_STRIDE_WIDTH 992
 
 static GLuint _glNextPowerOfTwo(GLuint v) {
@@ -150,6 +207,79 @@ static inline uint32_t twid_compute_index(uint32_t x, uint32_t y, uint32_t maskX
 }
 
 
+static inline GLuint _glDataOwnerHome(const void* data) {
+    /* Allocations are at least 256 byte aligned */
+    uint32_t v = (uint32_t) (((uintptr_t) data) >> 8);
+    return (v * 2654435761u) >> DATA_OWNER_SHIFT;
+}
+
+static inline TextureObject* _glDataOwnerTexture(GLuint slot) {
+    return (TextureObject*) named_array_get(&TEXTURE_OBJECTS, DATA_OWNERS[slot] - 1);
+}
+
+static GLint _glFindDataOwnerSlot(const void* data) {
+    GLuint slot = _glDataOwnerHome(data);
+
+    while(DATA_OWNERS[slot]) {
+        if(_glDataOwnerTexture(slot)->data == data) {
+            return slot;
+        }
+
+        slot = (slot + 1) & (DATA_OWNER_SLOTS - 1);
+    }
+
+    return -1;
+}
+
+static void _glAddDataOwner(TextureObject* txr) {
+    GLuint slot = _glDataOwnerHome(txr->data);
+
+    while(DATA_OWNERS[slot]) {
+        slot = (slot + 1) & (DATA_OWNER_SLOTS - 1);
+    }
+
+    DATA_OWNERS[slot] = txr->index + 1;
+}
+
+/* Must be called while txr->data still holds the old pointer */
+static void _glRemoveDataOwner(TextureObject* txr) {
+    GLint found = _glFindDataOwnerSlot(txr->data);
+    gl_assert(found >= 0);
+
+    if(found < 0) {
+        return;
+    }
+
+    /* Backward shift deletion, so no tombstones are needed */
+    GLuint hole = found;
+    GLuint slot = hole;
+    DATA_OWNERS[hole] = 0;
+
+    for(;;) {
+        slot = (slot + 1) & (DATA_OWNER_SLOTS - 1);
+
+        if(!DATA_OWNERS[slot]) {
+            break;
+        }
+
+        GLuint home = _glDataOwnerHome(_glDataOwnerTexture(slot)->data);
+
+        /* Can the entry at slot move back into the hole? Only if its
+         * home isn't cyclically between the hole and where it is now */
+        GLboolean between = (hole <= slot) ?
+            (home > hole && home <= slot) :
+            (home > hole || home <= slot);
+
+        if(!between) {
+            DATA_OWNERS[hole] = DATA_OWNERS[slot];
+            DATA_OWNERS[slot] = 0;
+            hole = slot;
+        }
+    }
+}
+
+static GLboolean _glEvictLeastRecentlyUsed();
+
 static void* alloc_malloc_and_defrag(size_t size) {
     void* ret = alloc_malloc(ALLOC_BASE, size);
 
@@ -161,13 +291,191 @@ static void* alloc_malloc_and_defrag(size_t size) {
         ret = alloc_malloc(ALLOC_BASE, size);
     }
 
+    /* Still no room, push evictable textures out to RAM until there is */
+    while(!ret && _glEvictLeastRecentlyUsed()) {
+        ret = alloc_malloc(ALLOC_BASE, size);
+
+        if(!ret && alloc_count_free(ALLOC_BASE) >= size) {
+            glDefragmentTextureMemory_KOS();
+            ret = alloc_malloc(ALLOC_BASE, size);
+        }
+    }
+
     gl_assert(ret && "Out of PVR memory!");
 
     return ret;
 }
 
+/* Allocation for restoring evicted textures, which happens while a frame
+ * is being built. Defragmenting would move textures that poly headers
+ * already in the lists point at, so this only evicts textures which
+ * haven't been used this frame, and returns NULL if that isn't enough. */
+static void* alloc_malloc_no_defrag(size_t size) {
+    void* ret = alloc_malloc(ALLOC_BASE, size);
+
+    while(!ret && _glEvictLeastRecentlyUsed()) {
+        ret = alloc_malloc(ALLOC_BASE, size);
+    }
+
+    return ret;
+}
+
+static void _glTextureFreeData(TextureObject* txr) {
+    if(txr->atlasPage) {
+        _glReleaseAtlasRegion(txr);
+    }
+
+    if(txr->evictedData) {
+        _glFree(txr->evictedData);
+        txr->evictedData = NULL;
+        RESIDENCY_STATS.evictedBytes -= txr->allocatedSize;
+    }
+
+    if(!txr->data) {
+        return;
+    }
+
+    _glRemoveDataOwner(txr);
+    alloc_free(ALLOC_BASE, txr->data);
+    txr->data = NULL;
+}
+
+static void _glTextureAllocData(TextureObject* txr, size_t size) {
+    gl_assert(!txr->data);
+
+    txr->data = alloc_malloc_and_defrag(size);
+    txr->allocatedSize = (txr->data) ? size : 0;
+
+    if(txr->data) {
+        _glAddDataOwner(txr);
+    }
+}
+
+/* Copies a texture's data out to RAM and releases its VRAM. The texture
+ * behaves as if it has no data until it's restored */
+static GLboolean _glEvictTexture(TextureObject* txr) {
+    gl_assert(txr->data && !txr->evictedData);
+
+    GLvoid* copy = _glMalloc(txr->allocatedSize);
+    if(!copy) {
+        return GL_FALSE;
+    }
+
+    memcpy(copy, txr->data, txr->allocatedSize);
+
+    _glRemoveDataOwner(txr);
+    alloc_free(ALLOC_BASE, txr->data);
+    txr->data = NULL;
+
+    txr->evictedData = copy;
+    txr->evictedFrame = TEXTURE_FRAME;
+
+    RESIDENCY_STATS.evictions++;
+    RESIDENCY_STATS.evictedBytes += txr->allocatedSize;
+
+    /* In case it's bound, the poly header needs to stop pointing at it */
+    _glGPUStateMarkDirty();
+
+    return GL_TRUE;
+}
+
+/* Evicts the evictable texture which was used longest ago. Textures used
+ * this frame are referenced by the vertex lists, so they are never picked */
+static GLboolean _glEvictLeastRecentlyUsed() {
+    TextureObject* victim = NULL;
+
+    GLuint id = named_array_next_used(&TEXTURE_OBJECTS, 0);
+
+    for(; id < TEXTURE_OBJECTS.max_element_count; id = named_array_next_used(&TEXTURE_OBJECTS, id + 1)) {
+        TextureObject* txr = (TextureObject*) named_array_get(&TEXTURE_OBJECTS, id);
+
+        if(!txr || !txr->isEvictable || !txr->data || txr->lastUsedFrame == TEXTURE_FRAME) {
+            continue;
+        }
+
+        if(!victim || txr->lastUsedFrame < victim->lastUsedFrame) {
+            victim = txr;
+        }
+    }
+
+    return victim && _glEvictTexture(victim);
+}
+
+static GLboolean _glRestoreTexture(TextureObject* txr) {
+    gl_assert(!txr->data && txr->evictedData);
+
+    GLuint size = txr->allocatedSize;
+    GLvoid* copy = txr->evictedData;
+
+    /* Make sure this texture can't be chosen to make room for itself */
+    txr->lastUsedFrame = TEXTURE_FRAME;
+
+    /* If there's no room the texture stays evicted, and draws untextured
+     * until a later frame can bring it back */
+    txr->data = alloc_malloc_no_defrag(size);
+
+    if(!txr->data) {
+        return GL_FALSE;
+    }
+
+    _glAddDataOwner(txr);
+
+    memcpy(txr->data, copy, size);
+    _glFree(copy);
+    FRAME_STATS_ADD(texture_bytes_uploaded, size);
+    txr->evictedData = NULL;
+
+    RESIDENCY_STATS.restores++;
+    RESIDENCY_STATS.evictedBytes -= size;
+    RESTORED_BYTES_THIS_FRAME += size;
+
+    if(TEXTURE_FRAME - txr->evictedFrame < TEXTURE_THRASH_FRAMES) {
+        RESIDENCY_STATS.thrashes++;
+    }
+
+    _glGPUStateMarkDirty();
+
+    return GL_TRUE;
+}
+
+/* Called before anything reads or modifies the texture data outside of
+ * rendering, which can't wait for the restore budget. Returns GL_FALSE if
+ * the texture is still evicted because there wasn't room for it */
+GLboolean _glMakeTextureResident(TextureObject* txr) {
+    if(txr && txr->evictedData) {
+        return _glRestoreTexture(txr);
+    }
+
+    return GL_TRUE;
+}
+
+void _glTouchTexture(TextureObject* txr) {
+    if(!txr) {
+        return;
+    }
+
+    if(txr->atlasPage) {
+        txr = txr->atlasPage;
+    }
+
+    txr->lastUsedFrame = TEXTURE_FRAME;
+
+    if(txr->evictedData) {
+        /* Always allow one restore per frame, so that textures bigger than
+         * the budget eventually come back */
+        if(!RESTORED_BYTES_THIS_FRAME ||
+            RESTORED_BYTES_THIS_FRAME + txr->allocatedSize <= RESTORE_BYTES_PER_FRAME) {
+            _glRestoreTexture(txr);
+        }
+    }
+}
+
+const TextureResidencyStats* _glGetTextureResidencyStats() {
+    return &RESIDENCY_STATS;
+}
+
 static TexturePalette* _initTexturePalette() {
-    TexturePalette* palette = (TexturePalette*) malloc(sizeof(TexturePalette));
+    TexturePalette* palette = (TexturePalette*) _glMalloc(sizeof(TexturePalette));
     gl_assert(palette);
 
     MEMSET4(palette, 0x0, sizeof(TexturePalette));
@@ -238,6 +546,8 @@ static void _glReleasePaletteSlot(GLshort slot, GLushort size)
 
     gl_assert(size == 16 || size == 256);
 
+    PALETTE_RAM_OWNERS[(slot * size) / 16] = NULL;
+
     if (size == 16) {
         GLushort bank = slot / MAX_GLDC_4BPP_PALETTE_SLOTS;
         GLushort subbank = slot % MAX_GLDC_4BPP_PALETTE_SLOTS;
@@ -263,6 +573,194 @@ static void _glReleasePaletteSlot(GLshort slot, GLushort size)
     }
 }
 
+static void _glAssignPaletteBank(TexturePalette* palette, GLshort bank) {
+    palette->bank = bank;
+
+    if(bank > -1) {
+        PALETTE_RAM_OWNERS[(bank * palette->size) / 16] = palette;
+    }
+}
+
+/* Queues colours for upload to palette RAM at the start of the next frame.
+ * Repeated edits between frames are merged into a single range */
+static void _glMarkPaletteDirty(TexturePalette* palette, GLushort start, GLushort count) {
+    GLushort end = start + count;
+
+    if(palette->dirtyStart < palette->dirtyEnd) {
+        start = MIN(start, palette->dirtyStart);
+        end = MAX(end, palette->dirtyEnd);
+    }
+
+    palette->dirtyStart = start;
+    palette->dirtyEnd = end;
+}
+
+void _glUploadDirtyPalettes() {
+    uint32_t packed[256] __attribute__((aligned(32)));
+
+    for(GLuint i = 0; i < MAX_GLDC_SHARED_PALETTES; ++i) {
+        TexturePalette* palette = PALETTE_RAM_OWNERS[i];
+
+        if(!palette || !palette->data) {
+            continue;
+        }
+
+        GLushort start = palette->dirtyStart;
+        GLushort end = MIN(palette->dirtyEnd, palette->width);
+
+        palette->dirtyStart = palette->dirtyEnd = 0;
+
+        if(start >= end) {
+            continue;
+        }
+
+        const GLubyte* src = palette->data + (start * 4);
+        for(GLushort j = start; j < end; ++j, src += 4) {
+            packed[j - start] = PACK_PALETTE_ENTRY(src);
+        }
+
+        GPUSetPaletteEntries((i * 16) + start, end - start, packed);
+    }
+}
+
+/* Drops the texture's reference to its palette, freeing the palette and its
+ * bank once no textures are using it */
+static void _glReleaseTexturePalette(TextureObject* txr) {
+    TexturePalette* palette = txr->palette;
+    txr->palette = NULL;
+
+    if(!palette) {
+        return;
+    }
+
+    if(palette->refcount > 1) {
+        palette->refcount--;
+        return;
+    }
+
+    for(GLubyte i = 0; i < MAX_GLDC_SHARED_PALETTES; ++i) {
+        if(AUTO_PALETTES[i] == palette) {
+            AUTO_PALETTES[i] = NULL;
+        }
+    }
+
+    if(palette->data && palette->bank > -1) {
+        _glReleasePaletteSlot(palette->bank, palette->size);
+    }
+
+    _glFree(palette->data);
+    _glFree(palette);
+}
+
+/* Try to fold colours into an existing automatic palette. Colours which
+ * aren't already (near enough) present are appended to the unused entries,
+ * which leaves the indices of any textures sharing the palette untouched */
+static GLboolean _glMergeAutoPalette(TexturePalette* palette, const GLubyte* colours, GLuint count) {
+    GLubyte extra[256 * 4];
+    GLuint extraCount = 0;
+
+    for(GLuint i = 0; i < count; ++i) {
+        const GLubyte* c = colours + (i * 4);
+        GLuint distance;
+
+        _glNearestPaletteIndex(palette->data, palette->width, c, &distance);
+
+        if(distance > AUTO_PALETTE_MERGE_DISTANCE) {
+            if(palette->width + extraCount >= palette->size) {
+                return GL_FALSE;
+            }
+
+            memcpy(extra + (extraCount * 4), c, 4);
+            extraCount++;
+        }
+    }
+
+    memcpy(palette->data + (palette->width * 4), extra, extraCount * 4);
+    _glMarkPaletteDirty(palette, palette->width, extraCount);
+    palette->width += extraCount;
+    return GL_TRUE;
+}
+
+/* Attach an automatic palette holding (near enough) the given colours to
+ * the texture, reusing the bank of an existing one where possible. Returns
+ * NULL and sets error if the storage a new palette might need can't be
+ * allocated, in which case the texture is left as it was, or if a new one
+ * is needed and there's no free bank for it. */
+static TexturePalette* _glShareAutoPalette(TextureObject* txr, const GLubyte* colours, GLuint count, GLushort size, GLenum* error) {
+    /* Allocated up front so that running out of memory changes nothing */
+    TexturePalette* spare = (TexturePalette*) _glMalloc(sizeof(TexturePalette));
+    GLubyte* spareData = (GLubyte*) _glMalloc(size * 4);
+
+    if(!spare || !spareData) {
+        _glFree(spare);
+        _glFree(spareData);
+        *error = GL_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    _glReleaseTexturePalette(txr);
+
+    TexturePalette* palette = NULL;
+    GLshort freeEntry = -1;
+
+    for(GLubyte i = 0; i < MAX_GLDC_SHARED_PALETTES; ++i) {
+        TexturePalette* candidate = AUTO_PALETTES[i];
+
+        if(!candidate) {
+            if(freeEntry < 0) {
+                freeEntry = i;
+            }
+            continue;
+        }
+
+        if(candidate->size == size && _glMergeAutoPalette(candidate, colours, count)) {
+            palette = candidate;
+            break;
+        }
+    }
+
+    if(!palette) {
+        /* There are never more automatic palettes than 16 colour banks */
+        gl_assert(freeEntry > -1);
+
+        GLshort bank = _glGenPaletteSlot(size);
+        if(bank < 0) {
+            _glFree(spare);
+            _glFree(spareData);
+            *error = GL_INVALID_OPERATION;
+            return NULL;
+        }
+
+        palette = spare;
+        MEMSET4(palette, 0x0, sizeof(TexturePalette));
+        palette->data = spareData;
+        palette->format = GL_RGBA8;
+        palette->width = count;
+        palette->size = size;
+        _glAssignPaletteBank(palette, bank);
+        memcpy(palette->data, colours, count * 4);
+        _glMarkPaletteDirty(palette, 0, count);
+
+        AUTO_PALETTES[freeEntry] = palette;
+    } else {
+        _glFree(spare);
+        _glFree(spareData);
+    }
+
+    palette->refcount++;
+    txr->palette = palette;
+
+    return palette;
+}
+
+GLboolean _glGetAutoPaletteDither() {
+    return AUTO_PALETTE_DITHER_ENABLED;
+}
+
+void _glSetAutoPaletteDither(GLboolean v) {
+    AUTO_PALETTE_DITHER_ENABLED = v;
+}
+
 GLboolean _glGetTextureTwiddle() {
     return TEXTURE_TWIDDLE_ENABLED;
 }
@@ -275,51 +773,39 @@ TexturePalette* _glGetSharedPalette(GLshort bank) {
     gl_assert(bank >= 0 && bank < MAX_GLDC_SHARED_PALETTES);
     return SHARED_PALETTES[bank];
 }
+GLenum _glGetInternalPaletteFormat() {
+    return INTERNAL_PALETTE_FORMAT;
+}
+
 void _glSetInternalPaletteFormat(GLenum val) {
     INTERNAL_PALETTE_FORMAT = val;
 
     switch(INTERNAL_PALETTE_FORMAT){
         case GL_RGBA8:
             GPUSetPaletteFormat(GPU_PAL_ARGB8888);
+            PACK_PALETTE_ENTRY = _packPaletteARGB8888;
             break;
         case GL_RGBA4:
             GPUSetPaletteFormat(GPU_PAL_ARGB4444);
+            PACK_PALETTE_ENTRY = _packPaletteARGB4444;
             break;
          case GL_RGB5_A1:
             GPUSetPaletteFormat(GPU_PAL_ARGB1555);
+            PACK_PALETTE_ENTRY = _packPaletteARGB1555;
             break;
          case  GL_RGB565_KOS:
              GPUSetPaletteFormat(GPU_PAL_RGB565);
+            PACK_PALETTE_ENTRY = _packPaletteRGB565;
             break;
          default:
             gl_assert(0);
 
     }
-}
-void _glApplyColorTable(TexturePalette* src) {
-    if(!src || !src->data) {
-        return;
-    }
 
-    GLushort i;
-    GLushort offset = src->size * src->bank;
-    for(i = 0; i < src->width; ++i) {
-        GLubyte* entry = &src->data[i * 4];
-
-        switch(INTERNAL_PALETTE_FORMAT)
-        {
-            case GL_RGBA8:
-                GPUSetPaletteEntry(offset + i, PACK_ARGB8888(entry[3], entry[0], entry[1], entry[2]));
-                break;
-            case GL_RGBA4:
-                GPUSetPaletteEntry(offset + i, PACK_ARGB4444(entry[3], entry[0], entry[1], entry[2]));
-                break;
-            case GL_RGB5_A1:
-                GPUSetPaletteEntry(offset + i, PACK_ARGB1555(entry[3], entry[0], entry[1], entry[2]));
-                break;
-             case GL_RGB565_KOS:
-                GPUSetPaletteEntry(offset + i, PACK_RGB565(entry[0], entry[1], entry[2]));
-                break;
+    /* Everything in palette RAM is now in the wrong format */
+    for(GLuint i = 0; i < MAX_GLDC_SHARED_PALETTES; ++i) {
+        if(PALETTE_RAM_OWNERS[i]) {
+            _glMarkPaletteDirty(PALETTE_RAM_OWNERS[i], 0, PALETTE_RAM_OWNERS[i]->width);
         }
     }
 }
@@ -547,6 +1033,7 @@ void _glResetSharedPalettes()
 
     memset((void*) BANKS_USED, 0x0, sizeof(BANKS_USED));
     memset((void*) SUBBANKS_USED, 0x0, sizeof(SUBBANKS_USED));
+    memset((void*) PALETTE_RAM_OWNERS, 0x0, sizeof(PALETTE_RAM_OWNERS));
 
 }
 
@@ -562,6 +1049,12 @@ static void _glInitializeTextureObject(TextureObject* txr, unsigned int id) {
     txr->env = GPU_TXRENV_MODULATEALPHA;
     txr->data = NULL;
     txr->mipmapCount = 0;
+    txr->isEvictable = GL_FALSE;
+    txr->allocatedSize = 0;
+    txr->lastUsedFrame = 0;
+    txr->evictedFrame = 0;
+    txr->evictedData = NULL;
+    txr->atlasPage = NULL;
     txr->minFilter = GL_NEAREST;
     txr->magFilter = GL_NEAREST;
     txr->palette = NULL;
@@ -576,8 +1069,8 @@ static void _glInitializeTextureObject(TextureObject* txr, unsigned int id) {
     txr->shared_bank = 0;
 }
 
-GLubyte _glInitTextures() {
-    named_array_init(&TEXTURE_OBJECTS, sizeof(TextureObject), MAX_TEXTURE_COUNT);
+GLubyte _glInitTextures(GLuint maxTextures) {
+    named_array_init(&TEXTURE_OBJECTS, sizeof(TextureObject), maxTextures);
 
     // Reserve zero so that it is never given to anyone as an ID!
     named_array_reserve(&TEXTURE_OBJECTS, 0);
@@ -608,6 +1101,17 @@ GLubyte _glInitTextures() {
 
     alloc_init(ALLOC_BASE, ALLOC_SIZE);
 
+    DATA_OWNER_SLOTS = DATA_OWNER_MIN_SLOTS;
+    DATA_OWNER_SHIFT = 21;
+    while(DATA_OWNER_SLOTS <= maxTextures) {
+        DATA_OWNER_SLOTS <<= 1;
+        DATA_OWNER_SHIFT--;
+    }
+
+    _glFree(DATA_OWNERS);
+    DATA_OWNERS = (GLuint*) _glCalloc(DATA_OWNER_SLOTS, sizeof(GLuint));
+    gl_assert(DATA_OWNERS);
+
     gl_assert(TEXTURE_OBJECTS.element_size > 0);
     return 1;
 }
@@ -626,6 +1130,10 @@ TextureObject* _glGetBoundTexture() {
     return TEXTURE_UNITS[ACTIVE_TEXTURE];
 }
 
+TextureObject* _glGetTextureObject(GLuint id) {
+    return (TextureObject*) named_array_get(&TEXTURE_OBJECTS, id);
+}
+
 GLint _glGetTextureInternalFormat() {
     TextureObject* obj = _glGetBoundTexture();
     if(!obj) {
@@ -661,7 +1169,14 @@ void APIENTRY glGenTextures(GLsizei n, GLuint *textures) {
     for(GLsizei i = 0; i < n; ++i) {
         GLuint id = 0;
         TextureObject* txr = (TextureObject*) named_array_alloc(&TEXTURE_OBJECTS, &id);
-        gl_assert(txr);
+
+        if(!txr) {
+            /* Hit the texture count ceiling (GLdcConfig::texture_count_max) */
+            memset(textures + i, 0, sizeof(GLuint) * (n - i));
+            _glKosThrowError(GL_OUT_OF_MEMORY, __func__);
+            break;
+        }
+
         gl_assert(id);  // Generated IDs must never be zero
 
         _glInitializeTextureObject(txr, id);
@@ -702,24 +1217,8 @@ void APIENTRY glDeleteTextures(GLsizei n, GLuint *textures) {
                 }
             }
 
-            if(txr->data) {
-                alloc_free(ALLOC_BASE, txr->data);
-                txr->data = NULL;
-            }
-
-            if(txr->palette && txr->palette->data) {
-                if (txr->palette->bank > -1) {
-                    _glReleasePaletteSlot(txr->palette->bank, txr->palette->size);
-                    txr->palette->bank = -1;
-                }
-                free(txr->palette->data);
-                txr->palette->data = NULL;
-            }
-
-            if(txr->palette) {
-                free(txr->palette);
-                txr->palette = NULL;
-            }
+            _glTextureFreeData(txr);
+            _glReleaseTexturePalette(txr);
 
             named_array_release(&TEXTURE_OBJECTS, id);
         }
@@ -728,9 +1227,17 @@ void APIENTRY glDeleteTextures(GLsizei n, GLuint *textures) {
     gl_assert(TEXTURE_OBJECTS.element_size > 0);
 }
 
+static GLboolean _glTexturesShareHeader(const TextureObject* a, const TextureObject* b) {
+    return a && b && a->atlasPage && a->atlasPage == b->atlasPage &&
+        a->minFilter == b->minFilter && a->magFilter == b->magFilter &&
+        a->env == b->env && a->uv_wrap == b->uv_wrap;
+}
+
 void APIENTRY glBindTexture(GLenum  target, GLuint texture) {
     TRACE();
 
+    _glImmediateFlush();
+
     GLint target_values [] = {GL_TEXTURE_2D, 0};
 
     if(_glCheckValidEnum(target, target_values, __func__) != 0) {
@@ -742,17 +1249,30 @@ void APIENTRY glBindTexture(GLenum  target, GLuint texture) {
     /* If this didn't come from glGenTextures, then we should initialize the
         * texture the first time it's bound */
     if(!txr) {
-        TextureObject* txr = named_array_reserve(&TEXTURE_OBJECTS, texture);
+        txr = (TextureObject*) named_array_reserve(&TEXTURE_OBJECTS, texture);
+
+        if(!txr) {
+            _glKosThrowError(GL_OUT_OF_MEMORY, __func__);
+            return;
+        }
+
         _glInitializeTextureObject(txr, texture);
     }
 
     gl_assert(ACTIVE_TEXTURE < MAX_GLDC_TEXTURE_UNITS);
+    TextureObject* previous = TEXTURE_UNITS[ACTIVE_TEXTURE];
     TEXTURE_UNITS[ACTIVE_TEXTURE] = txr;
     gl_assert(TEXTURE_UNITS[ACTIVE_TEXTURE]->index == texture);
 
+    _glTouchTexture(txr);
+
     gl_assert(TEXTURE_OBJECTS.element_size > 0);
 
-    _glGPUStateMarkDirty();
+    /* Members of the same atlas page only differ in their texture
+     * coordinates, so the current poly header can carry on being used */
+    if(!_glTexturesShareHeader(previous, txr)) {
+        _glGPUStateMarkDirty();
+    }
 }
 
 void APIENTRY glTexEnvi(GLenum target, GLenum pname, GLint param) {
@@ -954,11 +1474,8 @@ void APIENTRY glCompressedTexImage2DARB(GLenum target,
     active->isCompressed = GL_TRUE;
 
     /* Odds are slim new data is same size as old, so free always */
-    if(active->data) {
-        alloc_free(ALLOC_BASE, active->data);
-    }
-
-    active->data = alloc_malloc_and_defrag(imageSize);
+    _glTextureFreeData(active);
+    _glTextureAllocData(active, imageSize);
 
     gl_assert(active->data);  // Debug assert
 
@@ -969,6 +1486,7 @@ void APIENTRY glCompressedTexImage2DARB(GLenum target,
 
     if(data) {
         FASTCPY(active->data, data, imageSize);
+        FRAME_STATS_ADD(texture_bytes_uploaded, imageSize);
     }
 
     gl_assert(original_id == active->index);
@@ -1020,6 +1538,7 @@ void APIENTRY glCompressedTexSubImage2DARB(GLenum target,
     // Copy the compressed data directly to the texture
     if (data) {
         FASTCPY(targetData + (yoffset * active->width + xoffset), src, imageSize);
+        FRAME_STATS_ADD(texture_bytes_uploaded, imageSize);
     }
 
     _glGPUStateMarkDirty();
@@ -1485,18 +2004,17 @@ void _glAllocateSpaceForMipmaps(TextureObject* active) {
     /* Copy the data out of the pvr and back to ram */
     GLubyte* temp = NULL;
     if(active->data) {
-        temp = (GLubyte*) malloc(size);
+        temp = (GLubyte*) _glScratchAlloc(size);
         memcpy(temp, active->data, size);
 
         /* Free the PVR data */
-        alloc_free(ALLOC_BASE, active->data);
-        active->data = NULL;
+        _glTextureFreeData(active);
     }
 
     /* Figure out how much room to allocate for mipmaps */
     GLuint bytes = _glGetMipmapDataSize(active);
 
-    active->data = alloc_malloc_and_defrag(bytes);
+    _glTextureAllocData(active, bytes);
 
     gl_assert(active->data);
 
@@ -1505,7 +2023,7 @@ void _glAllocateSpaceForMipmaps(TextureObject* active) {
         memcpy(_glGetMipmapLocation(active, 0), temp, size);
 
         /* We no longer need this */
-        free(temp);
+        _glScratchFree(temp);
     }
 
     /* Set the data offset depending on whether or not this is a
@@ -1529,6 +2047,84 @@ static bool _glValidTextureSize(GLuint size) {
     }
 }
 
+/* Gives the texture uninitialised storage for data which is already in
+ * internalFormat's layout, as used by texture packs. Only the formats the
+ * PVR samples directly are accepted (no VQ), and dataSize must match the
+ * size GLdc would have allocated, including mipmaps if requested. 4bpp
+ * textures can't be mipmapped. Returns GL_NO_ERROR, or the error the caller
+ * should raise */
+GLenum _glTextureSetStorage(TextureObject* active, GLenum internalFormat,
+                            GLsizei width, GLsizei height,
+                            GLboolean mipmapped, GLuint dataSize) {
+
+    switch(internalFormat) {
+        case GL_RGB565_KOS:
+        case GL_ARGB4444_KOS:
+        case GL_ARGB1555_KOS:
+        case GL_RGB565_TWID_KOS:
+        case GL_ARGB4444_TWID_KOS:
+        case GL_ARGB1555_TWID_KOS:
+        case GL_COLOR_INDEX8_EXT:
+        case GL_COLOR_INDEX4_EXT:
+        case GL_COLOR_INDEX8_TWID_KOS:
+        case GL_COLOR_INDEX4_TWID_KOS:
+            break;
+        default:
+            return GL_INVALID_VALUE;
+    }
+
+    if(!_glValidTextureSize(width) || !_glValidTextureSize(height) ||
+        (mipmapped && width != height)) {
+        return GL_INVALID_VALUE;
+    }
+
+    /* The mipmap offsets are only known for 8bpp and up */
+    if(mipmapped && (internalFormat == GL_COLOR_INDEX4_EXT || internalFormat == GL_COLOR_INDEX4_TWID_KOS)) {
+        return GL_INVALID_OPERATION;
+    }
+
+    GLint destStride = _determineStrideInternal(internalFormat);
+
+    _glTextureFreeData(active);
+
+    active->width = active->logicalWidth = active->pvrWidth = width;
+    active->height = active->logicalHeight = active->pvrHeight = height;
+    active->isStrided = GL_FALSE;
+    active->strideWidth = 0;
+    active->color = _determinePVRFormat(internalFormat);
+    active->internalFormat = internalFormat;
+    active->mipmapCount = _glGetMipmapLevelCount(active);
+    active->mipmap_bias = GL_KOS_INTERNAL_DEFAULT_MIPMAP_LOD_BIAS;
+    active->dataStride = destStride;
+    active->baseDataSize = width * height * destStride;
+    active->isCompressed = GL_FALSE;
+    active->isPaletted = (destStride == 1);
+
+    if(internalFormat == GL_COLOR_INDEX4_EXT || internalFormat == GL_COLOR_INDEX4_TWID_KOS) {
+        active->baseDataSize /= 2;
+    }
+
+    if(mipmapped) {
+        active->mipmap = (1 << active->mipmapCount) - 1;
+        active->baseDataOffset = _glGetMipmapDataOffset(active, 0);
+    } else {
+        active->mipmap = 1;
+        active->baseDataOffset = 0;
+    }
+
+    GLuint expectedSize = (mipmapped) ? _glGetMipmapDataSize(active) : active->baseDataSize;
+
+    if(expectedSize != dataSize) {
+        active->mipmap = 0;
+        return GL_INVALID_VALUE;
+    }
+
+    _glTextureAllocData(active, dataSize);
+    _glGPUStateMarkDirty();
+
+    return (active->data) ? GL_NO_ERROR : GL_OUT_OF_MEMORY;
+}
+
 static GLboolean _glTextureSizeIsNPOT(GLsizei width, GLsizei height) {
     return (!_glValidTextureSize((GLuint) width) || !_glValidTextureSize((GLuint) height)) ? GL_TRUE : GL_FALSE;
 }
@@ -1725,53 +2321,172 @@ static bool _glTexSubImage2DValidate(GLenum target, GLint level, GLint xoffset,
         return false;
     }
 
-    // Validate type
-    if (format != GL_COLOR_INDEX4_EXT && format != GL_COLOR_INDEX4_TWID_KOS) {
-        /* Use determineStride to see if type is valid */
-        if (_determineStride(GL_RGBA, type) == -1) {
-            INFO_MSG("Invalid pixel data type.");
-            _glKosThrowError(GL_INVALID_ENUM, __func__);
-            return false;
+    // Validate type
+    if (format != GL_COLOR_INDEX4_EXT && format != GL_COLOR_INDEX4_TWID_KOS) {
+        /* Use determineStride to see if type is valid */
+        if (_determineStride(GL_RGBA, type) == -1) {
+            INFO_MSG("Invalid pixel data type.");
+            _glKosThrowError(GL_INVALID_ENUM, __func__);
+            return false;
+        }
+    }
+
+    // Validate offsets and dimensions using the underlying texture size
+    if (xoffset < 0 || yoffset < 0 ||
+        (xoffset + width) > textureWidth ||
+        (yoffset + height) > textureHeight) {
+        INFO_MSG("Subimage exceeds the dimensions of the texture.");
+        _glKosThrowError(GL_INVALID_VALUE, __func__);
+        return false;
+    }
+
+    if (level < 0) {
+        INFO_MSG("Invalid mipmap level.");
+        _glKosThrowError(GL_INVALID_VALUE, __func__);
+        return false;
+    }
+
+    // Ensure no border (since glTexSubImage2D doesn't allow it)
+    GLint border = 0; // No border allowed
+    if (border != 0) {
+        INFO_MSG("Border must be zero for glTexSubImage2D.");
+        _glKosThrowError(GL_INVALID_VALUE, __func__);
+        return false;
+    }
+
+    return true;
+}
+
+static inline GLboolean is4BPPFormat(GLenum format) {
+    return format == GL_COLOR_INDEX4_EXT || format == GL_COLOR_INDEX4_TWID_KOS;
+}
+
+static GLuint _glGetUnpackRowPitch(GLsizei width, GLint sourceStride, GLenum format) {
+    GLint rowLength = _glGetUnpackRowLength();
+    GLint unpackAlignment = _glGetUnpackAlignment();
+    GLuint rowPixels = (rowLength > 0) ? (GLuint) rowLength : (GLuint) width;
+    GLuint rowBytes = is4BPPFormat(format) ? ((rowPixels + 1) / 2) : (rowPixels * (GLuint) sourceStride);
+
+    return (rowBytes + (GLuint) unpackAlignment - 1) & ~((GLuint) unpackAlignment - 1);
+}
+
+/* Implements GL_COLOR_INDEX4_AUTO_KOS and GL_COLOR_INDEX8_AUTO_KOS. The true
+ * colour data is quantised to a (possibly shared) palette and the resulting
+ * indexes are uploaded as a regular paletted texture */
+static void _glTexImage2DAutoPalette(TextureObject* active, GLenum target, GLint level, GLint internalFormat,
+                                     GLsizei width, GLsizei height, GLint border,
+                                     GLenum format, GLenum type, const GLvoid* data) {
+
+    const GLboolean is4BPP = (internalFormat == GL_COLOR_INDEX4_AUTO_KOS);
+    const GLenum indexFormat = (is4BPP) ? GL_COLOR_INDEX4_EXT : GL_COLOR_INDEX8_EXT;
+    const GLenum sourceFormat = (is4BPP) ? GL_COLOR_INDEX4_EXT : GL_COLOR_INDEX;
+    const GLushort paletteSize = (is4BPP) ? 16 : 256;
+
+    GLboolean useStridedNpot = _glTextureSizeIsNPOT(width, height);
+    GLint cleanInternalFormat = _cleanInternalFormatForTexture(indexFormat, useStridedNpot);
+
+    if(!_glTexImage2DValidate(active, target, level, indexFormat, cleanInternalFormat, width, height, border, format, type)) {
+        return;
+    }
+
+    TextureConversionFunc convert = NULL;
+    if(_determineConversion(GL_RGBA8, format, type, &convert) < 0) {
+        INFO_MSG("Automatic palettes require GL_RGB or GL_RGBA byte data");
+        _glKosThrowError(GL_INVALID_OPERATION, __func__);
+        return;
+    }
+
+    GLint rowLength = _glGetUnpackRowLength();
+    GLint alignment = _glGetUnpackAlignment();
+
+    GLuint texels = (GLuint) width * (GLuint) height;
+    GLubyte* rgba = NULL;
+    GLubyte* indices = NULL;
+
+    if(data) {
+        GLint sourceStride = _determineStride(format, type);
+        GLuint sourcePitch = _glGetUnpackRowPitch(width, sourceStride, format);
+
+        rgba = (GLubyte*) _glScratchAlloc(texels * 4);
+        indices = (GLubyte*) _glScratchAlloc(texels);
+
+        if(!rgba || !indices) {
+            _glScratchFree(rgba);
+            _glScratchFree(indices);
+            _glKosThrowError(GL_OUT_OF_MEMORY, __func__);
+            return;
+        }
+
+        for(GLuint y = 0; y < (GLuint) height; ++y) {
+            const GLubyte* src = ((const GLubyte*) data) + (sourcePitch * y);
+            GLubyte* dst = rgba + (y * width * 4);
+
+            for(GLuint x = 0; x < (GLuint) width; ++x) {
+                if(convert) {
+                    convert(src, dst);
+                } else {
+                    memcpy(dst, src, 4);
+                }
+
+                src += sourceStride;
+                dst += 4;
+            }
+        }
+
+        TexturePalette* palette = NULL;
+
+        if(level > 0) {
+            /* Mipmap levels have to use the palette generated for the base level */
+            palette = active->palette;
+
+            if(!palette || !palette->data || palette->size != paletteSize) {
+                INFO_MSG("Upload level 0 of an automatic palette texture before its mipmaps");
+                _glKosThrowError(GL_INVALID_OPERATION, __func__);
+                _glScratchFree(rgba);
+                _glScratchFree(indices);
+                return;
+            }
+        } else {
+            GLubyte colours[256 * 4];
+            GLuint count = _glQuantiseRGBA8888(rgba, texels, paletteSize, colours);
+            GLenum error = GL_OUT_OF_MEMORY;
+
+            /* Nothing quantised from some texels means the quantiser
+             * couldn't allocate its buffers */
+            palette = (count || !texels) ? _glShareAutoPalette(active, colours, count, paletteSize, &error) : NULL;
+
+            if(!palette) {
+                /* Out of memory, or we ran out of slots! */
+                _glKosThrowError(error, __func__);
+                _glScratchFree(rgba);
+                _glScratchFree(indices);
+                return;
+            }
         }
-    }
 
-    // Validate offsets and dimensions using the underlying texture size
-    if (xoffset < 0 || yoffset < 0 ||
-        (xoffset + width) > textureWidth ||
-        (yoffset + height) > textureHeight) {
-        INFO_MSG("Subimage exceeds the dimensions of the texture.");
-        _glKosThrowError(GL_INVALID_VALUE, __func__);
-        return false;
-    }
+        _glMapToPalette(rgba, width, height, palette->data, palette->width, AUTO_PALETTE_DITHER_ENABLED, indices);
 
-    if (level < 0) {
-        INFO_MSG("Invalid mipmap level.");
-        _glKosThrowError(GL_INVALID_VALUE, __func__);
-        return false;
-    }
+        if(is4BPP) {
+            /* Pack two indexes per byte, first texel in the high nibble */
+            for(GLuint i = 0; i < texels; ++i) {
+                GLubyte idx = indices[i];
+                indices[i / 2] = (i % 2 == 0) ? (idx << 4) : (indices[i / 2] | (idx & 0xF));
+            }
+        }
 
-    // Ensure no border (since glTexSubImage2D doesn't allow it)
-    GLint border = 0; // No border allowed
-    if (border != 0) {
-        INFO_MSG("Border must be zero for glTexSubImage2D.");
-        _glKosThrowError(GL_INVALID_VALUE, __func__);
-        return false;
+        _glScratchFree(rgba);
     }
 
-    return true;
-}
+    /* The indexes are tightly packed, whatever the caller's unpack state */
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
-static inline GLboolean is4BPPFormat(GLenum format) {
-    return format == GL_COLOR_INDEX4_EXT || format == GL_COLOR_INDEX4_TWID_KOS;
-}
+    glTexImage2D(target, level, indexFormat, width, height, border, sourceFormat, GL_UNSIGNED_BYTE, indices);
 
-static GLuint _glGetUnpackRowPitch(GLsizei width, GLint sourceStride, GLenum format) {
-    GLint rowLength = _glGetUnpackRowLength();
-    GLint unpackAlignment = _glGetUnpackAlignment();
-    GLuint rowPixels = (rowLength > 0) ? (GLuint) rowLength : (GLuint) width;
-    GLuint rowBytes = is4BPPFormat(format) ? ((rowPixels + 1) / 2) : (rowPixels * (GLuint) sourceStride);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, rowLength);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
 
-    return (rowBytes + (GLuint) unpackAlignment - 1) & ~((GLuint) unpackAlignment - 1);
+    _glScratchFree(indices);
 }
 
 void APIENTRY glTexImage2D(GLenum target, GLint level, GLint internalFormat,
@@ -1779,6 +2494,7 @@ void APIENTRY glTexImage2D(GLenum target, GLint level, GLint internalFormat,
                            GLenum format, GLenum type, const GLvoid *data) {
 
     TRACE();
+    GL_TRACE_FUNCTION();
     gl_assert(ACTIVE_TEXTURE < MAX_GLDC_TEXTURE_UNITS);
     TextureObject* active = TEXTURE_UNITS[ACTIVE_TEXTURE];
 
@@ -1788,6 +2504,11 @@ void APIENTRY glTexImage2D(GLenum target, GLint level, GLint internalFormat,
         return;
     }
 
+    if(internalFormat == GL_COLOR_INDEX4_AUTO_KOS || internalFormat == GL_COLOR_INDEX8_AUTO_KOS) {
+        _glTexImage2DAutoPalette(active, target, level, internalFormat, width, height, border, format, type, data);
+        return;
+    }
+
     GLboolean useStridedNpot = _glTextureSizeIsNPOT(width, height);
     GLenum cleanInternalFormat = _cleanInternalFormatForTexture(internalFormat, useStridedNpot);
 
@@ -1795,6 +2516,12 @@ void APIENTRY glTexImage2D(GLenum target, GLint level, GLint internalFormat,
         return;
     }
 
+    /* Other levels are kept, so they need to be back in VRAM */
+    if(level > 0 && !_glMakeTextureResident(active)) {
+        _glKosThrowError(GL_OUT_OF_MEMORY, __func__);
+        return;
+    }
+
     GLboolean isPaletted = (
         internalFormat == GL_COLOR_INDEX8_EXT ||
         internalFormat == GL_COLOR_INDEX4_EXT ||
@@ -1809,16 +2536,22 @@ void APIENTRY glTexImage2D(GLenum target, GLint level, GLint internalFormat,
     GLuint pvrWidth = isStrided ? _glNextPowerOfTwo((GLuint) width) : (GLuint) width;
     GLuint pvrHeight = isStrided ? _glNextPowerOfTwo((GLuint) height) : (GLuint) height;
 
-    if(active->data && (level == 0)) {
-        /* pre-existing texture - check if changed */
-        if(active->width != width ||
+    /* Re-specifying an atlas member turns it back into a normal texture */
+    if(active->atlasPage) {
+        _glReleaseAtlasRegion(active);
+    }
+
+    if((active->data || active->evictedData) && (level == 0)) {
+        /* pre-existing texture - check if changed. An evicted image is
+         * dropped rather than restored only to be overwritten */
+        if(active->evictedData ||
+           active->width != width ||
            active->height != height ||
            active->internalFormat != cleanInternalFormat ||
            active->isStrided != isStrided ||
            active->strideWidth != (isStrided ? texturePitch : 0)) {
             /* changed - free old texture memory */
-            alloc_free(ALLOC_BASE, active->data);
-            active->data = NULL;
+            _glTextureFreeData(active);
             active->mipmap = 0;
             active->mipmapCount = 0;
             active->mipmap_bias = GL_KOS_INTERNAL_DEFAULT_MIPMAP_LOD_BIAS;
@@ -1842,12 +2575,6 @@ void APIENTRY glTexImage2D(GLenum target, GLint level, GLint internalFormat,
     TextureConversionFunc conversion = NULL;
     int needs_conversion = _determineConversion(cleanInternalFormat, format, type, &conversion);
 
-    // Hack: If we're doing a 4bpp source (via glCompressedTexture...)
-    // halve the srcBytes
-    if(format == GL_COLOR_INDEX4_EXT || format == GL_COLOR_INDEX4_TWID_KOS) {
-        srcBytes /= 2;
-    }
-
     /* If we're packing stuff, then the dest size is half what it would be */
     if((needs_conversion & CONVERSION_TYPE_PACK) == CONVERSION_TYPE_PACK) {
         destBytes /= 2;
@@ -1884,7 +2611,7 @@ void APIENTRY glTexImage2D(GLenum target, GLint level, GLint internalFormat,
             /* If we're uploading a mipmap level, we need to allocate the full amount of space */
             _glAllocateSpaceForMipmaps(active);
         } else {
-            active->data = alloc_malloc_and_defrag(active->baseDataSize);
+            _glTextureAllocData(active, active->baseDataSize);
         }
 
         active->isCompressed = GL_FALSE;
@@ -2031,6 +2758,8 @@ void APIENTRY glTexImage2D(GLenum target, GLint level, GLint internalFormat,
         gl_assert(active->index == originalId);
     }
 
+    FRAME_STATS_ADD(texture_bytes_uploaded, destBytes);
+
     gl_assert(active->index == originalId);
     _glGPUStateMarkDirty();
 }
@@ -2134,6 +2863,13 @@ void APIENTRY glTexParameteri(GLenum target, GLenum pname, GLint param) {
             case GL_SHARED_TEXTURE_BANK_KOS:
                 active->shared_bank = param;
                 break;
+            case GL_TEXTURE_EVICTABLE_KOS:
+                active->isEvictable = (param) ? GL_TRUE : GL_FALSE;
+
+                if(!active->isEvictable) {
+                    _glMakeTextureResident(active);
+                }
+                break;
             default:
                 break;
         }
@@ -2146,32 +2882,12 @@ void APIENTRY glTexParameterf(GLenum target, GLenum pname, GLfloat param) {
     glTexParameteri(target, pname, (GLint) param);
 }
 
-GLAPI void APIENTRY glColorTableEXT(GLenum target, GLenum internalFormat, GLsizei width, GLenum format, GLenum type, const GLvoid *data) {
-
-    GLint validTargets[] = {
-        GL_TEXTURE_2D,
-        GL_SHARED_TEXTURE_PALETTE_EXT,
-        GL_SHARED_TEXTURE_PALETTE_0_KOS,GL_SHARED_TEXTURE_PALETTE_1_KOS,GL_SHARED_TEXTURE_PALETTE_2_KOS,GL_SHARED_TEXTURE_PALETTE_3_KOS,GL_SHARED_TEXTURE_PALETTE_4_KOS,GL_SHARED_TEXTURE_PALETTE_5_KOS,GL_SHARED_TEXTURE_PALETTE_6_KOS,GL_SHARED_TEXTURE_PALETTE_7_KOS,GL_SHARED_TEXTURE_PALETTE_8_KOS,GL_SHARED_TEXTURE_PALETTE_9_KOS,
-        GL_SHARED_TEXTURE_PALETTE_10_KOS,GL_SHARED_TEXTURE_PALETTE_11_KOS,GL_SHARED_TEXTURE_PALETTE_12_KOS,GL_SHARED_TEXTURE_PALETTE_13_KOS,GL_SHARED_TEXTURE_PALETTE_14_KOS,GL_SHARED_TEXTURE_PALETTE_15_KOS,GL_SHARED_TEXTURE_PALETTE_16_KOS,GL_SHARED_TEXTURE_PALETTE_17_KOS,GL_SHARED_TEXTURE_PALETTE_18_KOS,GL_SHARED_TEXTURE_PALETTE_19_KOS,
-        GL_SHARED_TEXTURE_PALETTE_20_KOS,GL_SHARED_TEXTURE_PALETTE_21_KOS,GL_SHARED_TEXTURE_PALETTE_22_KOS,GL_SHARED_TEXTURE_PALETTE_23_KOS,GL_SHARED_TEXTURE_PALETTE_24_KOS,GL_SHARED_TEXTURE_PALETTE_25_KOS,GL_SHARED_TEXTURE_PALETTE_26_KOS,GL_SHARED_TEXTURE_PALETTE_27_KOS,GL_SHARED_TEXTURE_PALETTE_28_KOS,GL_SHARED_TEXTURE_PALETTE_29_KOS,
-        GL_SHARED_TEXTURE_PALETTE_30_KOS,GL_SHARED_TEXTURE_PALETTE_31_KOS,GL_SHARED_TEXTURE_PALETTE_32_KOS,GL_SHARED_TEXTURE_PALETTE_33_KOS,GL_SHARED_TEXTURE_PALETTE_34_KOS,GL_SHARED_TEXTURE_PALETTE_35_KOS,GL_SHARED_TEXTURE_PALETTE_36_KOS,GL_SHARED_TEXTURE_PALETTE_37_KOS,GL_SHARED_TEXTURE_PALETTE_38_KOS,GL_SHARED_TEXTURE_PALETTE_39_KOS,
-        GL_SHARED_TEXTURE_PALETTE_40_KOS,GL_SHARED_TEXTURE_PALETTE_41_KOS,GL_SHARED_TEXTURE_PALETTE_42_KOS,GL_SHARED_TEXTURE_PALETTE_43_KOS,GL_SHARED_TEXTURE_PALETTE_44_KOS,GL_SHARED_TEXTURE_PALETTE_45_KOS,GL_SHARED_TEXTURE_PALETTE_46_KOS,GL_SHARED_TEXTURE_PALETTE_47_KOS,GL_SHARED_TEXTURE_PALETTE_48_KOS,GL_SHARED_TEXTURE_PALETTE_49_KOS,
-        GL_SHARED_TEXTURE_PALETTE_50_KOS,GL_SHARED_TEXTURE_PALETTE_51_KOS,GL_SHARED_TEXTURE_PALETTE_52_KOS,GL_SHARED_TEXTURE_PALETTE_53_KOS,GL_SHARED_TEXTURE_PALETTE_54_KOS,GL_SHARED_TEXTURE_PALETTE_55_KOS,GL_SHARED_TEXTURE_PALETTE_56_KOS,GL_SHARED_TEXTURE_PALETTE_57_KOS,GL_SHARED_TEXTURE_PALETTE_58_KOS,GL_SHARED_TEXTURE_PALETTE_59_KOS,
-        GL_SHARED_TEXTURE_PALETTE_60_KOS,GL_SHARED_TEXTURE_PALETTE_61_KOS,GL_SHARED_TEXTURE_PALETTE_62_KOS,GL_SHARED_TEXTURE_PALETTE_63_KOS,
-        0};
-
-    GLint validInternalFormats[] = {GL_RGB8, GL_RGBA8, GL_RGBA4, 0};
+/* Resolves the colours passed to glColorTableEXT or glColorSubTableEXT,
+ * raising an error against the caller if they can't be converted */
+static GLboolean _glPaletteSourceFormat(GLenum format, GLenum type, GLint* stride, TextureConversionFunc* convert, const char* func) {
     GLint validFormats[] = {GL_RGB, GL_RGBA,GL_RGB5_A1, GL_RGB5_A1, GL_RGB565_KOS, GL_RGBA4, 0};
     GLint validTypes[] = {GL_UNSIGNED_BYTE, GL_BYTE, GL_UNSIGNED_SHORT, GL_SHORT, 0};
 
-    if(_glCheckValidEnum(target, validTargets, __func__) != 0) {
-        return;
-    }
-
-    if(_glCheckValidEnum(internalFormat, validInternalFormats, __func__) != 0) {
-        return;
-    }
-
     switch(format){
         case GL_PALETTE4_RGBA8_OES:
         case GL_PALETTE8_RGBA8_OES:
@@ -2199,59 +2915,100 @@ GLAPI void APIENTRY glColorTableEXT(GLenum target, GLenum internalFormat, GLsize
 
     }
 
-    if(_glCheckValidEnum(format, validFormats, __func__) != 0) {
-        return;
+    if(_glCheckValidEnum(format, validFormats, func) != 0) {
+        return GL_FALSE;
     }
 
-    if(_glCheckValidEnum(type, validTypes, __func__) != 0) {
-        return;
+    if(_glCheckValidEnum(type, validTypes, func) != 0) {
+        return GL_FALSE;
     }
 
-    /* Only allow up to 256 colours in a palette */
-    if(width > 256 || width == 0) {
-        _glKosThrowError(GL_INVALID_VALUE, __func__);
-        return;
+    *stride = _determineStride(format, type);
+    gl_assert(*stride > -1);
+
+    if(_determineConversion(GL_RGBA8, format, type, convert) < 0) {
+        _glKosThrowError(GL_INVALID_OPERATION, func);
+        return GL_FALSE;
     }
 
-    GLint sourceStride = _determineStride(format, type);
+    return GL_TRUE;
+}
 
-    /* We always store the palette in RAM in RGBA8888. We pack when we set
-     * the individual colours in the PVR */
-    GLint destStride = 4;
+/* We always store the palette in RAM in RGBA8888 and pack when the colours
+ * are uploaded to the PVR */
+static void _glConvertPaletteEntries(const GLubyte* src, GLubyte* dst, GLuint count, GLint sourceStride, TextureConversionFunc convert) {
+    for(GLuint i = 0; i < count; ++i) {
+        if(convert) {
+            convert(src, dst);
+            dst += 4;
+        } else {
+            memcpy(dst, src, sourceStride);
+            dst += sourceStride;
+        }
 
-    gl_assert(sourceStride > -1);
+        src += sourceStride;
+    }
+}
 
-    TextureConversionFunc convert;
-    int ret = _determineConversion(
-        GL_RGBA8,
-        format,
-        type,
-        &convert
-    );
+static TexturePalette* _glSharedPaletteForTarget(GLenum target) {
+    if(target == GL_SHARED_TEXTURE_PALETTE_EXT) {
+        return SHARED_PALETTES[0];
+    }
 
-    if(ret < 0) {
-        _glKosThrowError(GL_INVALID_OPERATION, __func__);
-        return;
+    if(target >= GL_SHARED_TEXTURE_PALETTE_0_KOS &&
+        target < GL_SHARED_TEXTURE_PALETTE_0_KOS + MAX_GLDC_SHARED_PALETTES) {
+        return SHARED_PALETTES[target - GL_SHARED_TEXTURE_PALETTE_0_KOS];
     }
 
-    TexturePalette* palette = NULL;
+    return NULL;
+}
+
+GLAPI void APIENTRY glColorTableEXT(GLenum target, GLenum internalFormat, GLsizei width, GLenum format, GLenum type, const GLvoid *data) {
+
+    GLint validTargets[] = {
+        GL_TEXTURE_2D,
+        GL_SHARED_TEXTURE_PALETTE_EXT,
+        GL_SHARED_TEXTURE_PALETTE_0_KOS,GL_SHARED_TEXTURE_PALETTE_1_KOS,GL_SHARED_TEXTURE_PALETTE_2_KOS,GL_SHARED_TEXTURE_PALETTE_3_KOS,GL_SHARED_TEXTURE_PALETTE_4_KOS,GL_SHARED_TEXTURE_PALETTE_5_KOS,GL_SHARED_TEXTURE_PALETTE_6_KOS,GL_SHARED_TEXTURE_PALETTE_7_KOS,GL_SHARED_TEXTURE_PALETTE_8_KOS,GL_SHARED_TEXTURE_PALETTE_9_KOS,
+        GL_SHARED_TEXTURE_PALETTE_10_KOS,GL_SHARED_TEXTURE_PALETTE_11_KOS,GL_SHARED_TEXTURE_PALETTE_12_KOS,GL_SHARED_TEXTURE_PALETTE_13_KOS,GL_SHARED_TEXTURE_PALETTE_14_KOS,GL_SHARED_TEXTURE_PALETTE_15_KOS,GL_SHARED_TEXTURE_PALETTE_16_KOS,GL_SHARED_TEXTURE_PALETTE_17_KOS,GL_SHARED_TEXTURE_PALETTE_18_KOS,GL_SHARED_TEXTURE_PALETTE_19_KOS,
+        GL_SHARED_TEXTURE_PALETTE_20_KOS,GL_SHARED_TEXTURE_PALETTE_21_KOS,GL_SHARED_TEXTURE_PALETTE_22_KOS,GL_SHARED_TEXTURE_PALETTE_23_KOS,GL_SHARED_TEXTURE_PALETTE_24_KOS,GL_SHARED_TEXTURE_PALETTE_25_KOS,GL_SHARED_TEXTURE_PALETTE_26_KOS,GL_SHARED_TEXTURE_PALETTE_27_KOS,GL_SHARED_TEXTURE_PALETTE_28_KOS,GL_SHARED_TEXTURE_PALETTE_29_KOS,
+        GL_SHARED_TEXTURE_PALETTE_30_KOS,GL_SHARED_TEXTURE_PALETTE_31_KOS,GL_SHARED_TEXTURE_PALETTE_32_KOS,GL_SHARED_TEXTURE_PALETTE_33_KOS,GL_SHARED_TEXTURE_PALETTE_34_KOS,GL_SHARED_TEXTURE_PALETTE_35_KOS,GL_SHARED_TEXTURE_PALETTE_36_KOS,GL_SHARED_TEXTURE_PALETTE_37_KOS,GL_SHARED_TEXTURE_PALETTE_38_KOS,GL_SHARED_TEXTURE_PALETTE_39_KOS,
+        GL_SHARED_TEXTURE_PALETTE_40_KOS,GL_SHARED_TEXTURE_PALETTE_41_KOS,GL_SHARED_TEXTURE_PALETTE_42_KOS,GL_SHARED_TEXTURE_PALETTE_43_KOS,GL_SHARED_TEXTURE_PALETTE_44_KOS,GL_SHARED_TEXTURE_PALETTE_45_KOS,GL_SHARED_TEXTURE_PALETTE_46_KOS,GL_SHARED_TEXTURE_PALETTE_47_KOS,GL_SHARED_TEXTURE_PALETTE_48_KOS,GL_SHARED_TEXTURE_PALETTE_49_KOS,
+        GL_SHARED_TEXTURE_PALETTE_50_KOS,GL_SHARED_TEXTURE_PALETTE_51_KOS,GL_SHARED_TEXTURE_PALETTE_52_KOS,GL_SHARED_TEXTURE_PALETTE_53_KOS,GL_SHARED_TEXTURE_PALETTE_54_KOS,GL_SHARED_TEXTURE_PALETTE_55_KOS,GL_SHARED_TEXTURE_PALETTE_56_KOS,GL_SHARED_TEXTURE_PALETTE_57_KOS,GL_SHARED_TEXTURE_PALETTE_58_KOS,GL_SHARED_TEXTURE_PALETTE_59_KOS,
+        GL_SHARED_TEXTURE_PALETTE_60_KOS,GL_SHARED_TEXTURE_PALETTE_61_KOS,GL_SHARED_TEXTURE_PALETTE_62_KOS,GL_SHARED_TEXTURE_PALETTE_63_KOS,
+        0};
+
+    GLint validInternalFormats[] = {GL_RGB8, GL_RGBA8, GL_RGBA4, 0};
+
+    if(_glCheckValidEnum(target, validTargets, __func__) != 0) {
+        return;
+    }
 
-    GLboolean sharedPaletteUsed = GL_FALSE;
+    if(_glCheckValidEnum(internalFormat, validInternalFormats, __func__) != 0) {
+        return;
+    }
 
-    /* Custom extension - allow uploading to one of 4 custom palettes */
-    if(target == GL_SHARED_TEXTURE_PALETTE_EXT || target == GL_SHARED_TEXTURE_PALETTE_0_KOS) {
-        palette = SHARED_PALETTES[0];
-        sharedPaletteUsed = GL_TRUE;
+    /* Only allow up to 256 colours in a palette */
+    if(width > 256 || width == 0) {
+        _glKosThrowError(GL_INVALID_VALUE, __func__);
+        return;
     }
 
-    for (GLubyte i = 1; i < MAX_GLDC_SHARED_PALETTES; ++i) {
-        if (target == GL_SHARED_TEXTURE_PALETTE_0_KOS + i) {
-            palette = SHARED_PALETTES[i];
-            sharedPaletteUsed = GL_TRUE;
-        }
+    GLint sourceStride;
+    TextureConversionFunc convert;
+    if(!_glPaletteSourceFormat(format, type, &sourceStride, &convert, __func__)) {
+        return;
     }
-    if (sharedPaletteUsed == GL_FALSE){
+
+    /* Custom extension - allow uploading to one of the shared palettes */
+    TexturePalette* palette = _glSharedPaletteForTarget(target);
+
+    if(!palette) {
         TextureObject* active = _glGetBoundTexture();
+        if(active->palette && active->palette->refcount) {
+            /* Don't overwrite an automatic palette other textures may share */
+            _glReleaseTexturePalette(active);
+        }
+
         if(!active->palette) {
             active->palette = _initTexturePalette();
         }
@@ -2261,7 +3018,7 @@ GLAPI void APIENTRY glColorTableEXT(GLenum target, GLenum internalFormat, GLsize
     gl_assert(palette);
 
     if(target) {
-        free(palette->data);
+        _glFree(palette->data);
         palette->data = NULL;
     }
 
@@ -2270,56 +3027,72 @@ GLAPI void APIENTRY glColorTableEXT(GLenum target, GLenum internalFormat, GLsize
         palette->bank = -1;
     }
 
-    palette->data = (GLubyte*) malloc(width * destStride);
+    palette->data = (GLubyte*) _glMalloc(width * 4);
     palette->format = internalFormat;
     palette->width = width;
     palette->size = (width > 16) ? 256 : 16;
     gl_assert(palette->size == 16 || palette->size == 256);
 
-    palette->bank = _glGenPaletteSlot(palette->size);
+    _glAssignPaletteBank(palette, _glGenPaletteSlot(palette->size));
 
     if(palette->bank < 0) {
         /* We ran out of slots! */
         _glKosThrowError(GL_INVALID_OPERATION, __func__);
 
-        free(palette->data);
+        _glFree(palette->data);
+        palette->data = NULL;
         palette->format = palette->width = palette->size = 0;
         return;
     }
 
-    GLubyte* src = (GLubyte*) data;
-    GLubyte* dst = (GLubyte*) palette->data;
-
-    gl_assert(src);
-    gl_assert(dst);
-
-    /* Transform and copy the source palette to the texture */
-    GLushort i = 0;
-    for(; i < width; ++i) {
-        if(convert) {
-            convert(src, dst);
-            src += sourceStride;
-            dst += destStride;
-        } else {
-            for(int j = 0; j < sourceStride; ++j) {
-                *dst++ = *src++;
-            }
-        }
-    }
+    gl_assert(data);
 
-    _glApplyColorTable(palette);
+    _glConvertPaletteEntries((const GLubyte*) data, palette->data, width, sourceStride, convert);
+    _glMarkPaletteDirty(palette, 0, width);
 
     _glGPUStateMarkDirty();
 }
 
 GLAPI void APIENTRY glColorSubTableEXT(GLenum target, GLsizei start, GLsizei count, GLenum format, GLenum type, const GLvoid *data) {
-    _GL_UNUSED(target);
-    _GL_UNUSED(start);
-    _GL_UNUSED(count);
-    _GL_UNUSED(format);
-    _GL_UNUSED(type);
-    _GL_UNUSED(data);
-    _glKosThrowError(GL_INVALID_OPERATION, __func__);
+    TexturePalette* palette = _glSharedPaletteForTarget(target);
+
+    if(target == GL_TEXTURE_2D) {
+        TextureObject* active = _glGetBoundTexture();
+        palette = (active) ? active->palette : NULL;
+    } else if(!palette) {
+        _glKosThrowError(GL_INVALID_ENUM, __func__);
+        return;
+    }
+
+    GLint sourceStride;
+    TextureConversionFunc convert;
+    if(!_glPaletteSourceFormat(format, type, &sourceStride, &convert, __func__)) {
+        return;
+    }
+
+    /* Automatic palettes are shared behind the application's back, so
+     * editing one would change unrelated textures */
+    if(!palette || !palette->data || palette->refcount) {
+        _glKosThrowError(GL_INVALID_OPERATION, __func__);
+        return;
+    }
+
+    if((GLint) start < 0 || (GLint) count < 0) {
+        _glKosThrowError(GL_INVALID_VALUE, __func__);
+        return;
+    }
+
+    if(!data || count > palette->width || start > palette->width - count) {
+        _glKosThrowError(GL_INVALID_VALUE, __func__);
+        return;
+    }
+
+    if(!count) {
+        return;
+    }
+
+    _glConvertPaletteEntries((const GLubyte*) data, palette->data + (start * 4), count, sourceStride, convert);
+    _glMarkPaletteDirty(palette, start, count);
 }
 
 GLAPI void APIENTRY glGetColorTableEXT(GLenum target, GLenum format, GLenum type, GLvoid *data) {
@@ -2352,6 +3125,11 @@ void APIENTRY glTexSubImage2D(GLenum target, GLint level, GLint xoffset, GLint y
     gl_assert(ACTIVE_TEXTURE < MAX_GLDC_TEXTURE_UNITS);
     TextureObject* active = TEXTURE_UNITS[ACTIVE_TEXTURE];
 
+    if(!_glMakeTextureResident(active)) {
+        _glKosThrowError(GL_OUT_OF_MEMORY, __func__);
+        return;
+    }
+
     if (!active || !active->data) {
         INFO_MSG("Called glTexSubImage2D on unbound or uninitialized texture");
         _glKosThrowError(GL_INVALID_OPERATION, __func__);
@@ -2385,7 +3163,6 @@ void APIENTRY glTexSubImage2D(GLenum target, GLint level, GLint xoffset, GLint y
 
     GLuint sourceRowWidth = is4BPPFormat(format) ? (((GLuint) width + 1) / 2) : ((GLuint) width * (GLuint) sourceStride);
     GLuint sourcePitch = _glGetUnpackRowPitch(width, sourceStride, format);
-    GLuint srcBytes = height ? (sourcePitch * ((GLuint) height - 1) + sourceRowWidth) : 0;
 
     // Calculate destination stride (this accounts for both POT and NPOT)
     GLint destStride = _determineStrideInternal(cleanInternalFormat);
@@ -2393,18 +3170,18 @@ void APIENTRY glTexSubImage2D(GLenum target, GLint level, GLint xoffset, GLint y
     // Calculate destBytes using the texture's full dimensions
     GLuint destBytes = (texturePitch * textureHeight * destStride);
 
+    // Bytes of the region being replaced, for the frame stats
+    GLuint regionBytes = ((GLuint) width * (GLuint) height * destStride);
+
     TextureConversionFunc conversion = NULL;
     int needs_conversion = _determineConversion(cleanInternalFormat, format, type, &conversion);
 
-    // Adjust source bytes for 4bpp formats
-    if (format == GL_COLOR_INDEX4_EXT || format == GL_COLOR_INDEX4_TWID_KOS) {
-        srcBytes /= 2;
-    }
-
     if ((needs_conversion & CONVERSION_TYPE_PACK) == CONVERSION_TYPE_PACK) {
         destBytes /= 2;
+        regionBytes /= 2;
     } else if (active->internalFormat == GL_COLOR_INDEX4_EXT || active->internalFormat == GL_COLOR_INDEX4_TWID_KOS) {
         destBytes /= 2;
+        regionBytes /= 2;
     }
 
     if (needs_conversion < 0) {
@@ -2416,7 +3193,7 @@ void APIENTRY glTexSubImage2D(GLenum target, GLint level, GLint xoffset, GLint y
     // Calculate the starting point for the subregion in the texture data
     GLubyte* targetData = active->data;
     if (needs_conversion > 0) {
-        GLubyte* conversionBuffer = (GLubyte*) memalign(32, destBytes);
+        GLubyte* conversionBuffer = (GLubyte*) _glScratchAlloc(destBytes);
 
         const GLubyte* src = data;
         GLubyte* dst = conversionBuffer;
@@ -2478,7 +3255,7 @@ void APIENTRY glTexSubImage2D(GLenum target, GLint level, GLint xoffset, GLint y
         // Copy the converted data to the texture
         FASTCPY(targetData, conversionBuffer, destBytes);
 
-        free(conversionBuffer);
+        _glScratchFree(conversionBuffer);
     } else {
         // No conversion necessary, we can update data directly
         if (xoffset == 0 &&
@@ -2487,6 +3264,7 @@ void APIENTRY glTexSubImage2D(GLenum target, GLint level, GLint xoffset, GLint y
             sourceStride == destStride &&
             sourcePitch == textureWidth * destStride) {
             FASTCPY(targetData, data, height * sourcePitch);
+            FRAME_STATS_ADD(texture_bytes_uploaded, regionBytes);
             _glGPUStateMarkDirty();
             return;
         }
@@ -2497,6 +3275,95 @@ void APIENTRY glTexSubImage2D(GLenum target, GLint level, GLint xoffset, GLint y
         }
     }
 
+    FRAME_STATS_ADD(texture_bytes_uploaded, regionBytes);
+    _glGPUStateMarkDirty();
+}
+
+GLboolean _glTextureRegionFormatSupported(GLenum internalFormat, GLenum format, GLenum type) {
+    TextureConversionFunc conversion = NULL;
+    int needs_conversion = _determineConversion(internalFormat, format, type, &conversion);
+
+    return needs_conversion >= 0 &&
+        !(needs_conversion & CONVERSION_TYPE_PACK) &&
+        _determineStrideInternal(internalFormat) == 2;
+}
+
+GLboolean _glTextureWriteRegion(TextureObject* txr, GLuint x, GLuint y,
+                                GLsizei width, GLsizei height, GLuint border,
+                                GLenum format, GLenum type, const GLvoid* data) {
+
+    if(!txr->data || !_glTextureRegionFormatSupported(txr->internalFormat, format, type)) {
+        return GL_FALSE;
+    }
+
+    TextureConversionFunc conversion = NULL;
+    int needs_conversion = _determineConversion(txr->internalFormat, format, type, &conversion);
+
+    GLint sourceStride = _determineStride(format, type);
+    GLuint sourcePitch = _glGetUnpackRowPitch(width, sourceStride, format);
+
+    uint32_t maskX = 0, maskY = 0;
+    if(needs_conversion & CONVERSION_TYPE_TWIDDLE) {
+        calc_twiddle_factors(txr->width, txr->height, &maskX, &maskY);
+    }
+
+    GLushort* dst = (GLushort*) txr->data;
+    const GLint w = (GLint) width;
+    const GLint h = (GLint) height;
+
+    /* Texels outside the image repeat its nearest edge, so that filtering
+     * at the edges doesn't pick up the neighbouring data */
+    for(GLint ty = -(GLint) border; ty < h + (GLint) border; ++ty) {
+        const GLubyte* row = (const GLubyte*) data + CLAMP(ty, 0, h - 1) * sourcePitch;
+        GLuint py = y + ty;
+
+        for(GLint tx = -(GLint) border; tx < w + (GLint) border; ++tx) {
+            const GLubyte* src = row + CLAMP(tx, 0, w - 1) * sourceStride;
+            GLuint px = x + tx;
+            GLushort texel;
+
+            if(conversion) {
+                conversion(src, (GLubyte*) &texel);
+            } else {
+                memcpy(&texel, src, sizeof(texel));
+            }
+
+            if(needs_conversion & CONVERSION_TYPE_TWIDDLE) {
+                dst[twid_compute_index(px, py, maskX, maskY)] = texel;
+            } else {
+                dst[py * txr->width + px] = texel;
+            }
+        }
+    }
+
+    FRAME_STATS_ADD(texture_bytes_uploaded, (w + border * 2) * (h + border * 2) * sizeof(GLushort));
+    _glGPUStateMarkDirty();
+    return GL_TRUE;
+}
+
+void _glTextureSetAtlasRegion(TextureObject* txr, TextureObject* page,
+                              GLuint x, GLuint y, GLsizei width, GLsizei height) {
+    _glTextureFreeData(txr);
+    _glReleaseTexturePalette(txr);
+
+    txr->width = txr->logicalWidth = txr->pvrWidth = width;
+    txr->height = txr->logicalHeight = txr->pvrHeight = height;
+    txr->isStrided = GL_FALSE;
+    txr->strideWidth = 0;
+    txr->color = page->color;
+    txr->internalFormat = page->internalFormat;
+    txr->dataStride = page->dataStride;
+    txr->mipmap = 1;
+    txr->mipmapCount = 1;
+    txr->baseDataOffset = 0;
+    txr->baseDataSize = 0;
+    txr->isCompressed = GL_FALSE;
+    txr->isPaletted = GL_FALSE;
+
+    txr->atlasPage = page;
+    txr->atlasX = x;
+    txr->atlasY = y;
+
     _glGPUStateMarkDirty();
 }
 
@@ -2555,6 +3422,20 @@ GLAPI void APIENTRY glReadPixels(GLint x, GLint y, GLsizei width, GLsizei height
     _GL_UNUSED(pixels);
     gl_assert(0 && "Not Implemented");
 }
+void* _glTextureMemoryBase() {
+    return ALLOC_BASE;
+}
+
+TextureObject* _glNextTextureObject(GLuint id) {
+    id = named_array_next_used(&TEXTURE_OBJECTS, id);
+
+    if(id >= TEXTURE_OBJECTS.max_element_count) {
+        return NULL;
+    }
+
+    return (TextureObject*) named_array_get(&TEXTURE_OBJECTS, id);
+}
+
 GLuint _glMaxTextureMemory() {
     return ALLOC_SIZE;
 }
@@ -2573,13 +3454,16 @@ GLuint _glFreeContiguousTextureMemory() {
 
 static void update_data_pointer(void* src, void* dst, void* data) {
     _GL_UNUSED(data);
-    for(size_t id = 0; id < MAX_TEXTURE_COUNT; id++){
-        TextureObject* txr = (TextureObject*) named_array_get(&TEXTURE_OBJECTS, id);
-        if(txr && txr->data == src) {
-            gl_assert(txr->index == id);
-            txr->data = dst;
-            return;
-        }
+
+    GLint slot = _glFindDataOwnerSlot(src);
+    gl_assert(slot >= 0);
+
+    if(slot >= 0) {
+        TextureObject* txr = _glDataOwnerTexture(slot);
+        _glRemoveDataOwner(txr);
+        txr->data = dst;
+        _glAddDataOwner(txr);
+        FRAME_STATS_ADD(defrag_moves, 1);
     }
 }
 
@@ -2587,6 +3471,31 @@ GLAPI GLvoid APIENTRY glDefragmentTextureMemory_KOS(void) {
     alloc_run_defrag(ALLOC_BASE, update_data_pointer, 5, NULL);
 }
 
+GLAPI GLuint APIENTRY glDefragmentTextureMemoryStep_KOS(GLuint maxBytes) {
+    return (GLuint) alloc_run_defrag_incremental(
+        ALLOC_BASE, update_data_pointer, maxBytes, NULL
+    );
+}
+
+void _glSetDefragBytesPerFrame(GLuint bytes) {
+    DEFRAG_BYTES_PER_FRAME = bytes;
+}
+
+void _glSetTextureRestoreBytesPerFrame(GLuint bytes) {
+    RESTORE_BYTES_PER_FRAME = bytes;
+}
+
+void _glTexturesEndFrame() {
+    if(DEFRAG_BYTES_PER_FRAME) {
+        alloc_run_defrag_incremental(
+            ALLOC_BASE, update_data_pointer, DEFRAG_BYTES_PER_FRAME, NULL
+        );
+    }
+
+    TEXTURE_FRAME++;
+    RESTORED_BYTES_THIS_FRAME = 0;
+}
+
 GLAPI void APIENTRY glGetTexImage(GLenum tex, GLint lod, GLenum format, GLenum type, GLvoid* img) {
     _GL_UNUSED(tex);
     _GL_UNUSED(lod);
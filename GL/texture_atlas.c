@@ -0,0 +1,319 @@
+/*
+ * Runtime texture atlases (GL_KOS_texture_atlas).
+ *
+ * Small images are packed into shared power-of-two pages with a skyline
+ * packer. Every member texture is a normal texture name, but it has no data
+ * of its own: binding it samples its page, and submission remaps its
+ * texture coordinates into its region of the page. Consecutive draws with
+ * members of the same page can then share a single poly header.
+ *
+ * Regions are only reclaimed when every member of a page has been deleted,
+ * at which point the whole page is released.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "private.h"
+#include "platform.h"
+
+#define MAX_GLDC_TEXTURE_ATLASES 8
+#define ATLAS_MAX_PAGES 16
+#define SKYLINE_MAX_NODES 64
+
+/* Texels of repeated edge around every member */
+#define ATLAS_BORDER 1
+
+typedef struct {
+    GLushort x;
+    GLushort y;
+    GLushort width;
+} SkylineNode;
+
+typedef struct {
+    GLuint texture; /* Zero if the page doesn't exist */
+    GLuint members;
+    GLuint nodeCount;
+    SkylineNode nodes[SKYLINE_MAX_NODES];
+} AtlasPage;
+
+typedef struct {
+    GLenum internalFormat;
+    GLuint pageSize;
+    AtlasPage pages[ATLAS_MAX_PAGES];
+} TextureAtlas;
+
+static TextureAtlas* ATLASES[MAX_GLDC_TEXTURE_ATLASES];
+
+static TextureAtlas* _glGetAtlas(GLuint atlas) {
+    if(atlas == 0 || atlas > MAX_GLDC_TEXTURE_ATLASES) {
+        return NULL;
+    }
+
+    return ATLASES[atlas - 1];
+}
+
+/* Returns the y a width x height rectangle would sit at with its left edge
+ * on node i, or -1 if it doesn't fit there */
+static GLint _glSkylineFit(const AtlasPage* page, GLuint size, GLuint i, GLuint width, GLuint height) {
+    GLuint x = page->nodes[i].x;
+    GLuint y = 0;
+    GLint remaining = width;
+
+    if(x + width > size) {
+        return -1;
+    }
+
+    while(remaining > 0) {
+        gl_assert(i < page->nodeCount);
+
+        y = MAX(y, page->nodes[i].y);
+        if(y + height > size) {
+            return -1;
+        }
+
+        remaining -= page->nodes[i].width;
+        ++i;
+    }
+
+    return y;
+}
+
+/* Bottom-left placement, preferring the lowest top edge then the
+ * narrowest node. Returns the node index or -1 */
+static GLint _glSkylineFind(const AtlasPage* page, GLuint size, GLuint width, GLuint height, GLuint* y) {
+    GLint best = -1;
+    GLuint bestTop = ~0u;
+    GLuint bestWidth = ~0u;
+
+    if(page->nodeCount >= SKYLINE_MAX_NODES) {
+        return -1;
+    }
+
+    for(GLuint i = 0; i < page->nodeCount; ++i) {
+        GLint fit = _glSkylineFit(page, size, i, width, height);
+
+        if(fit < 0) {
+            continue;
+        }
+
+        GLuint top = fit + height;
+        if(top < bestTop || (top == bestTop && page->nodes[i].width < bestWidth)) {
+            best = i;
+            bestTop = top;
+            bestWidth = page->nodes[i].width;
+            *y = fit;
+        }
+    }
+
+    return best;
+}
+
+static void _glSkylineRemove(AtlasPage* page, GLuint i) {
+    memmove(page->nodes + i, page->nodes + i + 1, sizeof(SkylineNode) * (page->nodeCount - i - 1));
+    --page->nodeCount;
+}
+
+static void _glSkylineInsert(AtlasPage* page, GLuint index, GLuint y, GLuint width, GLuint height) {
+    SkylineNode node = {page->nodes[index].x, y + height, width};
+
+    memmove(page->nodes + index + 1, page->nodes + index, sizeof(SkylineNode) * (page->nodeCount - index));
+    page->nodes[index] = node;
+    ++page->nodeCount;
+
+    /* Trim the nodes now underneath the new one */
+    for(GLuint i = index + 1; i < page->nodeCount;) {
+        GLuint previousEnd = page->nodes[i - 1].x + page->nodes[i - 1].width;
+
+        if(page->nodes[i].x >= previousEnd) {
+            break;
+        }
+
+        GLuint shrink = previousEnd - page->nodes[i].x;
+        if(page->nodes[i].width <= shrink) {
+            _glSkylineRemove(page, i);
+            continue;
+        }
+
+        page->nodes[i].x += shrink;
+        page->nodes[i].width -= shrink;
+        break;
+    }
+
+    for(GLuint i = 0; i + 1 < page->nodeCount;) {
+        if(page->nodes[i].y == page->nodes[i + 1].y) {
+            page->nodes[i].width += page->nodes[i + 1].width;
+            _glSkylineRemove(page, i + 1);
+        } else {
+            ++i;
+        }
+    }
+}
+
+static GLboolean _glCreateAtlasPage(TextureAtlas* atlas, AtlasPage* page) {
+    GLuint bytes = atlas->pageSize * atlas->pageSize * 2;
+
+    glGenTextures(1, &page->texture);
+    TextureObject* txr = _glGetTextureObject(page->texture);
+
+    if(_glTextureSetStorage(txr, atlas->internalFormat, atlas->pageSize, atlas->pageSize, GL_FALSE, bytes) != GL_NO_ERROR) {
+        glDeleteTextures(1, &page->texture);
+        page->texture = 0;
+        return GL_FALSE;
+    }
+
+    MEMSET4(txr->data, 0, bytes);
+
+    page->members = 0;
+    page->nodeCount = 1;
+    page->nodes[0].x = 0;
+    page->nodes[0].y = 0;
+    page->nodes[0].width = atlas->pageSize;
+
+    return GL_TRUE;
+}
+
+void _glReleaseAtlasRegion(TextureObject* txr) {
+    gl_assert(txr->atlasPage);
+
+    TextureAtlas* atlas = ATLASES[txr->atlasIndex];
+    AtlasPage* page = &atlas->pages[txr->atlasPageIndex];
+
+    txr->atlasPage = NULL;
+    txr->mipmap = 0;
+
+    gl_assert(page->members);
+    if(--page->members == 0) {
+        glDeleteTextures(1, &page->texture);
+        page->texture = 0;
+    }
+}
+
+GLAPI GLuint APIENTRY glKosGenTextureAtlas(GLenum internalFormat, GLsizei pageSize) {
+    switch(internalFormat) {
+        case GL_RGB565_KOS:
+        case GL_ARGB4444_KOS:
+        case GL_ARGB1555_KOS:
+        case GL_RGB565_TWID_KOS:
+        case GL_ARGB4444_TWID_KOS:
+        case GL_ARGB1555_TWID_KOS:
+            break;
+        default:
+            _glKosThrowError(GL_INVALID_ENUM, __func__);
+            return 0;
+    }
+
+    if(pageSize < 8 || pageSize > 1024 || (pageSize & (pageSize - 1))) {
+        _glKosThrowError(GL_INVALID_VALUE, __func__);
+        return 0;
+    }
+
+    for(GLuint i = 0; i < MAX_GLDC_TEXTURE_ATLASES; ++i) {
+        if(ATLASES[i]) {
+            continue;
+        }
+
+        ATLASES[i] = (TextureAtlas*) _glCalloc(1, sizeof(TextureAtlas));
+        if(!ATLASES[i]) {
+            break;
+        }
+
+        ATLASES[i]->internalFormat = internalFormat;
+        ATLASES[i]->pageSize = pageSize;
+        return i + 1;
+    }
+
+    _glKosThrowError(GL_OUT_OF_MEMORY, __func__);
+    return 0;
+}
+
+GLAPI void APIENTRY glKosDeleteTextureAtlas(GLuint atlas) {
+    TextureAtlas* obj = _glGetAtlas(atlas);
+
+    if(!obj) {
+        _glKosThrowError(GL_INVALID_VALUE, __func__);
+        return;
+    }
+
+    for(GLuint i = 0; i < ATLAS_MAX_PAGES; ++i) {
+        if(obj->pages[i].texture) {
+            _glKosThrowError(GL_INVALID_OPERATION, __func__);
+            return;
+        }
+    }
+
+    _glFree(obj);
+    ATLASES[atlas - 1] = NULL;
+}
+
+GLAPI void APIENTRY glKosTexImageAtlas(GLuint atlas, GLsizei width, GLsizei height,
+                                       GLenum format, GLenum type, const GLvoid* data) {
+    TRACE();
+
+    TextureAtlas* obj = _glGetAtlas(atlas);
+    TextureObject* active = _glGetBoundTexture();
+
+    if(!obj || !data || width < 1 || height < 1 ||
+        width + ATLAS_BORDER * 2 > obj->pageSize ||
+        height + ATLAS_BORDER * 2 > obj->pageSize) {
+        _glKosThrowError(GL_INVALID_VALUE, __func__);
+        return;
+    }
+
+    if(!_glTextureRegionFormatSupported(obj->internalFormat, format, type)) {
+        _glKosThrowError(GL_INVALID_ENUM, __func__);
+        return;
+    }
+
+    if(!active) {
+        _glKosThrowError(GL_INVALID_OPERATION, __func__);
+        return;
+    }
+
+    /* Give up the texture's current region first, it may make room */
+    if(active->atlasPage) {
+        _glReleaseAtlasRegion(active);
+    }
+
+    const GLuint paddedWidth = width + ATLAS_BORDER * 2;
+    const GLuint paddedHeight = height + ATLAS_BORDER * 2;
+
+    AtlasPage* page = NULL;
+    GLint node = -1;
+    GLuint y = 0;
+
+    for(GLuint i = 0; i < ATLAS_MAX_PAGES && node < 0; ++i) {
+        if(obj->pages[i].texture) {
+            page = &obj->pages[i];
+            node = _glSkylineFind(page, obj->pageSize, paddedWidth, paddedHeight, &y);
+        }
+    }
+
+    for(GLuint i = 0; i < ATLAS_MAX_PAGES && node < 0; ++i) {
+        if(!obj->pages[i].texture) {
+            page = &obj->pages[i];
+
+            if(!_glCreateAtlasPage(obj, page)) {
+                break;
+            }
+
+            node = _glSkylineFind(page, obj->pageSize, paddedWidth, paddedHeight, &y);
+        }
+    }
+
+    if(node < 0) {
+        _glKosThrowError(GL_OUT_OF_MEMORY, __func__);
+        return;
+    }
+
+    GLuint x = page->nodes[node].x;
+    TextureObject* pageTexture = _glGetTextureObject(page->texture);
+
+    _glTextureWriteRegion(pageTexture, x + ATLAS_BORDER, y + ATLAS_BORDER, width, height, ATLAS_BORDER, format, type, data);
+    _glSkylineInsert(page, node, y, paddedWidth, paddedHeight);
+
+    _glTextureSetAtlasRegion(active, pageTexture, x + ATLAS_BORDER, y + ATLAS_BORDER, width, height);
+    active->atlasIndex = atlas - 1;
+    active->atlasPageIndex = page - obj->pages;
+    ++page->members;
+}
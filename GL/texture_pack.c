@@ -0,0 +1,221 @@
+/*
+ * Loading of pre-baked texture packs (see texture_pack.h and
+ * tools/texpack.c). Payloads are already in the PVR's format so they are
+ * copied straight into texture memory without any conversion.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "private.h"
+#include "platform.h"
+#include "texture_pack.h"
+
+/* Streaming reads go through this much 32 byte aligned RAM, VRAM can't be
+ * written a byte at a time so we can't fread straight into it */
+#define TEXTURE_PACK_BOUNCE_SIZE (16 * 1024)
+
+static GLboolean _glValidatePackHeader(const TexturePackHeader* header, GLuint size) {
+    if(size < sizeof(TexturePackHeader) ||
+        memcmp(header->magic, TEXTURE_PACK_MAGIC, 4) != 0 ||
+        header->version != TEXTURE_PACK_VERSION) {
+        return GL_FALSE;
+    }
+
+    return (header->count <= (size - sizeof(TexturePackHeader)) / sizeof(TexturePackEntry));
+}
+
+static GLboolean _glValidatePackEntry(const TexturePackEntry* entry, GLuint size) {
+    if(entry->dataOffset % TEXTURE_PACK_ALIGNMENT ||
+        entry->dataOffset > size || entry->dataSize > size - entry->dataOffset) {
+        return GL_FALSE;
+    }
+
+    if(entry->paletteCount > 256 || entry->paletteOffset > size ||
+        entry->paletteCount * 4 > size - entry->paletteOffset) {
+        return GL_FALSE;
+    }
+
+    return GL_TRUE;
+}
+
+/* Binds the texture and gives it storage for the entry. Returns
+ * GL_NO_ERROR, or the error to raise */
+static GLenum _glPrepareTexture(GLuint id, const TexturePackEntry* entry, TextureObject** out) {
+    glBindTexture(GL_TEXTURE_2D, id);
+
+    TextureObject* active = _glGetBoundTexture();
+
+    GLenum error = _glTextureSetStorage(
+        active, entry->internalFormat, entry->width, entry->height,
+        (entry->flags & TEXTURE_PACK_FLAG_MIPMAPPED) ? GL_TRUE : GL_FALSE,
+        entry->dataSize
+    );
+
+    if(error == GL_NO_ERROR && active->isPaletted && !entry->paletteCount) {
+        error = GL_INVALID_VALUE;
+    }
+
+    *out = active;
+    return error;
+}
+
+static void _glSetPackPalette(const TexturePackEntry* entry, const GLvoid* colours) {
+    if(entry->paletteCount) {
+        glColorTableEXT(GL_TEXTURE_2D, GL_RGBA8, entry->paletteCount, GL_RGBA, GL_UNSIGNED_BYTE, colours);
+    }
+}
+
+/* Releases the names which weren't loaded and rebinds the previous texture */
+static GLsizei _glFinishPackLoad(GLsizei loaded, GLsizei n, GLuint* textures, GLuint previous, GLenum error, const char* function) {
+    if(loaded < n) {
+        glDeleteTextures(n - loaded, textures + loaded);
+        memset(textures + loaded, 0, sizeof(GLuint) * (n - loaded));
+        _glKosThrowError(error, function);
+    }
+
+    glBindTexture(GL_TEXTURE_2D, previous);
+    return loaded;
+}
+
+static GLuint _glBoundTextureName() {
+    TextureObject* bound = _glGetBoundTexture();
+    return (bound) ? bound->index : 0;
+}
+
+static GLenum _glLoadPackEntry(const GLubyte* pack, GLuint size, GLuint index, GLuint id) {
+    const TexturePackEntry* entry = ((const TexturePackEntry*) (pack + sizeof(TexturePackHeader))) + index;
+
+    if(!_glValidatePackEntry(entry, size)) {
+        return GL_INVALID_VALUE;
+    }
+
+    TextureObject* active;
+    GLenum error = _glPrepareTexture(id, entry, &active);
+    if(error != GL_NO_ERROR) {
+        return error;
+    }
+
+    FASTCPY(active->data, pack + entry->dataOffset, entry->dataSize);
+    FRAME_STATS_ADD(texture_bytes_uploaded, entry->dataSize);
+    _glSetPackPalette(entry, pack + entry->paletteOffset);
+
+    return GL_NO_ERROR;
+}
+
+GLAPI GLsizei APIENTRY glKosLoadTexturePack(const GLvoid* pack, GLuint size, GLsizei n, GLuint* textures) {
+    const TexturePackHeader* header = (const TexturePackHeader*) pack;
+
+    if(!pack || !_glValidatePackHeader(header, size)) {
+        _glKosThrowError(GL_INVALID_VALUE, __func__);
+        return 0;
+    }
+
+    if(n > header->count) {
+        n = header->count;
+    }
+
+    GLuint previous = _glBoundTextureName();
+    GLenum error = GL_NO_ERROR;
+
+    glGenTextures(n, textures);
+
+    GLsizei i;
+    for(i = 0; i < n; ++i) {
+        error = _glLoadPackEntry((const GLubyte*) pack, size, i, textures[i]);
+        if(error != GL_NO_ERROR) {
+            break;
+        }
+    }
+
+    return _glFinishPackLoad(i, n, textures, previous, error, __func__);
+}
+
+static GLboolean _glReadPackBytes(FILE* file, GLuint offset, GLvoid* dst, GLuint bytes) {
+    return fseek(file, offset, SEEK_SET) == 0 && fread(dst, 1, bytes, file) == bytes;
+}
+
+static GLenum _glLoadPackEntryFromFile(FILE* file, GLuint size, GLuint index, GLuint id, GLubyte* bounce) {
+    TexturePackEntry entry;
+    GLuint entryOffset = sizeof(TexturePackHeader) + index * sizeof(TexturePackEntry);
+
+    if(!_glReadPackBytes(file, entryOffset, &entry, sizeof(entry)) ||
+        !_glValidatePackEntry(&entry, size)) {
+        return GL_INVALID_VALUE;
+    }
+
+    TextureObject* active;
+    GLenum error = _glPrepareTexture(id, &entry, &active);
+    if(error != GL_NO_ERROR) {
+        return error;
+    }
+
+    GLuint done = 0;
+    while(done < entry.dataSize) {
+        GLuint chunk = MIN(entry.dataSize - done, (GLuint) TEXTURE_PACK_BOUNCE_SIZE);
+        if(!_glReadPackBytes(file, entry.dataOffset + done, bounce, chunk)) {
+            return GL_INVALID_VALUE;
+        }
+
+        FASTCPY(active->data + done, bounce, chunk);
+        done += chunk;
+    }
+
+    FRAME_STATS_ADD(texture_bytes_uploaded, entry.dataSize);
+
+    if(entry.paletteCount) {
+        if(!_glReadPackBytes(file, entry.paletteOffset, bounce, entry.paletteCount * 4)) {
+            return GL_INVALID_VALUE;
+        }
+
+        _glSetPackPalette(&entry, bounce);
+    }
+
+    return GL_NO_ERROR;
+}
+
+GLAPI GLsizei APIENTRY glKosLoadTexturePackFile(const char* filename, GLsizei n, GLuint* textures) {
+    FILE* file = fopen(filename, "rb");
+    if(!file) {
+        _glKosThrowError(GL_INVALID_VALUE, __func__);
+        return 0;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long fileSize = ftell(file);
+
+    TexturePackHeader header;
+    GLubyte* bounce = (GLubyte*) _glScratchAlloc(TEXTURE_PACK_BOUNCE_SIZE);
+
+    if(!bounce || fileSize <= 0 ||
+        !_glReadPackBytes(file, 0, &header, sizeof(header)) ||
+        !_glValidatePackHeader(&header, (GLuint) fileSize)) {
+        _glScratchFree(bounce);
+        fclose(file);
+        _glKosThrowError(GL_INVALID_VALUE, __func__);
+        return 0;
+    }
+
+    if(n > header.count) {
+        n = header.count;
+    }
+
+    GLuint previous = _glBoundTextureName();
+    GLenum error = GL_NO_ERROR;
+
+    glGenTextures(n, textures);
+
+    GLsizei i;
+    for(i = 0; i < n; ++i) {
+        error = _glLoadPackEntryFromFile(file, (GLuint) fileSize, i, textures[i], bounce);
+        if(error != GL_NO_ERROR) {
+            break;
+        }
+    }
+
+    _glScratchFree(bounce);
+    fclose(file);
+
+    return _glFinishPackLoad(i, n, textures, previous, error, __func__);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+/*
+ * On-disk layout of a GLdc texture pack, as written by tools/texpack.c and
+ * read by glKosLoadTexturePack / glKosLoadTexturePackFile.
+ *
+ * A pack is a header, an array of entries, then the texture payloads.
+ * Payloads are stored exactly as the PVR samples them (already converted,
+ * twiddled and with mipmaps laid out in GLdc's order) so loading is a
+ * straight copy into VRAM. Every payload starts on a 32 byte boundary so it
+ * can be store-queue copied. All values are little-endian.
+ */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TEXTURE_PACK_MAGIC "GTPK"
+#define TEXTURE_PACK_VERSION 1
+#define TEXTURE_PACK_ALIGNMENT 32
+
+/* The payload contains every mipmap level, not just level 0 */
+#define TEXTURE_PACK_FLAG_MIPMAPPED (1 << 0)
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t count;
+    uint32_t reserved;
+} TexturePackHeader;
+
+typedef struct {
+    /* One of the internal formats GLdc stores textures in, e.g.
+     * GL_RGB565_TWID_KOS or GL_COLOR_INDEX4_TWID_KOS */
+    uint32_t internalFormat;
+    uint16_t width;
+    uint16_t height;
+    uint32_t flags;
+    /* Byte offsets are from the start of the pack */
+    uint32_t dataOffset;
+    uint32_t dataSize;
+    /* Paletted formats only, paletteCount RGBA8888 colours */
+    uint32_t paletteOffset;
+    uint32_t paletteCount;
+    uint32_t reserved;
+} TexturePackEntry;
+
+#ifdef __cplusplus
+}
+#endif
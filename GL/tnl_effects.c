@@ -9,29 +9,58 @@
 #include "private.h"
 #include "platform.h"
 
-static int TNL_EFFECTS, TNL_LIGHTING, TNL_TEXTURE, TNL_COLOR;
+static int TNL_EFFECTS, TNL_LIGHTING, TNL_TEXTURE, TNL_COLOR, TNL_SKINNING;
+
+/* TNL_TEXGEN is set when S or T is generated; the others when either uses
+ * a mode that reflects the eye vector, and needs eye-space normals */
+static int TNL_TEXGEN, TNL_TEXGEN_REFLECTION, TNL_TEXGEN_SPHERE;
 
 #define ITERATE(count) \
     GLuint i = count; \
     while(i--)
 
-void _glTnlLoadMatrix(void) {
-    /* If we're lighting, then we need to do some work in
-     * eye-space, so we only transform vertices by the modelview
-     * matrix, and then later multiply by projection.
+static void loadMatrix(void) {
+    /* If we're lighting (or generating texture coordinates), then we need
+     * to do some work in eye-space, so we only transform vertices by the
+     * modelview matrix, and then later multiply by projection.
      *
      * If we're not doing lighting though we can optimise by taking
-     * vertices straight to clip-space */
-
-    if(TNL_LIGHTING) {
+     * vertices straight to clip-space.
+     *
+     * Skinned vertices are read untransformed; the palette matrices are
+     * applied per vertex once the weights are known. */
+    if(TNL_SKINNING) {
+        _glMatrixLoadIdentity();
+    } else if(TNL_LIGHTING || TNL_TEXGEN) {
         _glMatrixLoadModelView();
     } else {
         _glMatrixLoadModelViewProjection();
     }
 }
 
+void _glTnlLoadMatrix(void) {
+    TNL_SKINNING = _glIsMatrixPaletteEnabled() &&
+        (ATTRIB_LIST.enabled & SKINNING_ENABLED_FLAGS) == SKINNING_ENABLED_FLAGS;
+
+    loadMatrix();
+}
+
+/* Immediate mode has no weights, whatever the client arrays say */
+void _glTnlLoadImmediateMatrix(void) {
+    TNL_SKINNING = 0;
+    loadMatrix();
+}
+
+GLboolean _glTnlIsSkinning(void) {
+    return TNL_SKINNING;
+}
+
+GLboolean _glTnlIsEyeSpace(void) {
+    return TNL_LIGHTING || TNL_TEXGEN;
+}
+
 static void updateEffects(void) {
-    TNL_EFFECTS = TNL_LIGHTING | TNL_TEXTURE | TNL_COLOR;
+    TNL_EFFECTS = TNL_LIGHTING | TNL_TEXTURE | TNL_COLOR | TNL_TEXGEN;
 }
 
 static void transformVertices(SubmissionTarget* target) {
@@ -59,14 +88,17 @@ static void mat_transform_normal3(Vertex* v, const uint32_t count) {
     }
 }
 
+static void normalEffect(SubmissionTarget* target) {
+    /* Skinning already left the normals in eye space */
+    if(!TNL_SKINNING) {
+        _glMatrixLoadNormal();
+        mat_transform_normal3(_glSubmissionTargetStart(target), target->count);
+    }
+}
+
 static void lightingEffect(SubmissionTarget* target) {
     /* Perform lighting calculations and manipulate the colour */
-    Vertex* vertex = _glSubmissionTargetStart(target);
-
-    _glMatrixLoadNormal();
-    mat_transform_normal3(vertex, target->count);
-
-    _glPerformLighting(vertex, target->count);
+    _glPerformLighting(_glSubmissionTargetStart(target), target->count);
 }
 
 void _glTnlUpdateLighting(void) {
@@ -98,6 +130,123 @@ void _glTnlUpdateTextureMatrix(void) {
 }
 
 
+/* The plane a linear mode is evaluated against, in eye space. Object planes
+ * are taken back through the inverse modelview once per draw, rather than
+ * keeping the object-space position of every vertex around. */
+static void texgenPlane(const TexGenCoord* gen, float* plane) {
+    if(gen->mode == GL_OBJECT_LINEAR) {
+        const float* m = *_glGetInverseModelViewMatrix();
+        const float* p = gen->objectPlane;
+        for(GLuint j = 0; j < 4; ++j) {
+            plane[j] = p[0] * m[j * 4 + 0] + p[1] * m[j * 4 + 1] +
+                       p[2] * m[j * 4 + 2] + p[3] * m[j * 4 + 3];
+        }
+    } else {
+        memcpy(plane, gen->eyePlane, sizeof(float) * 4);
+    }
+}
+
+/* Generates S and T from the eye-space position and normal left by the
+ * modelview (and by lighting, which shares them), then applies the texture
+ * matrix in the same pass so it doesn't need one of its own */
+static void texgenEffect(SubmissionTarget* target) {
+    const TexGenCoord* gen[2] = {_glGetTexGen(0), _glGetTexGen(1)};
+    float planes[2][4];
+
+    for(GLuint c = 0; c < 2; ++c) {
+        if(gen[c]->enabled) {
+            texgenPlane(gen[c], planes[c]);
+        }
+    }
+
+    if(TNL_TEXTURE) {
+        UploadMatrix4x4(_glGetTextureMatrix());
+    }
+
+    Vertex* it     = _glSubmissionTargetStart(target);
+    uint32_t count = target->count;
+
+    ITERATE(count) {
+        float r[3], sphere = 0.0f;
+
+        if(TNL_TEXGEN_REFLECTION) {
+            /* r = u - 2(n.u)n, u being the unit vector to the vertex */
+            float n[3];
+            _glUnpackNormal(it->nxyz, n);
+
+            float u[3] = {it->xyz[0], it->xyz[1], it->xyz[2]};
+            float l = u[0] * u[0] + u[1] * u[1] + u[2] * u[2];
+            if(l > 0.0f) {
+                l = MATH_fsrra(l);
+                u[0] *= l;
+                u[1] *= l;
+                u[2] *= l;
+            }
+
+            float d = 2.0f * (n[0] * u[0] + n[1] * u[1] + n[2] * u[2]);
+            r[0] = u[0] - d * n[0];
+            r[1] = u[1] - d * n[1];
+            r[2] = u[2] - d * n[2];
+
+            if(TNL_TEXGEN_SPHERE) {
+                /* 1 / m, where m = 2 * sqrt(rx^2 + ry^2 + (rz + 1)^2) */
+                float m = r[0] * r[0] + r[1] * r[1] + (r[2] + 1.0f) * (r[2] + 1.0f);
+                sphere = (m > 0.0f) ? 0.5f * MATH_fsrra(m) : 0.0f;
+            }
+        }
+
+        for(GLuint c = 0; c < 2; ++c) {
+            if(!gen[c]->enabled) {
+                continue;
+            }
+
+            switch(gen[c]->mode) {
+                case GL_SPHERE_MAP:
+                    it->uv[c] = r[c] * sphere + 0.5f;
+                break;
+                case GL_REFLECTION_MAP_ARB:
+                    it->uv[c] = r[c];
+                break;
+                default: {
+                    const float* p = planes[c];
+                    it->uv[c] = p[0] * it->xyz[0] + p[1] * it->xyz[1] +
+                                p[2] * it->xyz[2] + p[3] * it->w;
+                }
+            }
+        }
+
+        if(TNL_TEXTURE) {
+            float coords[4];
+            TransformVertex(it->uv[0], it->uv[1], 0.0f, 1.0f, coords, &coords[3]);
+            it->uv[0] = coords[0];
+            it->uv[1] = coords[1];
+        }
+
+        it++;
+    }
+}
+
+void _glTnlUpdateTexGen(void) {
+    TNL_TEXGEN = TNL_TEXGEN_REFLECTION = TNL_TEXGEN_SPHERE = 0;
+
+    for(GLuint c = 0; c < 2; ++c) {
+        const TexGenCoord* gen = _glGetTexGen(c);
+        if(!gen->enabled) {
+            continue;
+        }
+
+        TNL_TEXGEN = 1;
+        if(gen->mode == GL_SPHERE_MAP) {
+            TNL_TEXGEN_REFLECTION = TNL_TEXGEN_SPHERE = 1;
+        } else if(gen->mode == GL_REFLECTION_MAP_ARB) {
+            TNL_TEXGEN_REFLECTION = 1;
+        }
+    }
+
+    updateEffects();
+}
+
+
 static void colorEffect(SubmissionTarget* target) {
     Matrix4x4* m = _glGetColorMatrix();
     UploadMatrix4x4(m);
@@ -126,14 +275,22 @@ void _glTnlUpdateColorMatrix(void) {
 void _glTnlApplyEffects(SubmissionTarget* target) {
     if (!TNL_EFFECTS) return;
 
+    GL_TRACE_FUNCTION();
+
+    /* Normals are brought into eye space once, for lighting and
+     * texgen alike */
+    if (TNL_LIGHTING || TNL_TEXGEN_REFLECTION)
+        normalEffect(target);
     if (TNL_LIGHTING)
         lightingEffect(target);
-    if (TNL_TEXTURE)
+    if (TNL_TEXGEN)
+        texgenEffect(target);
+    else if (TNL_TEXTURE)
         textureEffect(target);
     if (TNL_COLOR)
         colorEffect(target);
 
-    if (TNL_LIGHTING) {
+    if (TNL_LIGHTING || TNL_TEXGEN) {
         /* OK eye-space work done, now move into clip space */
         _glMatrixLoadProjection();
         transformVertices(target);
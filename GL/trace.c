@@ -0,0 +1,94 @@
+/*
+ * Ring buffer behind the GL_TRACE_SCOPE markers (see trace.h). Writers
+ * claim a slot with an atomic increment of the head so recording never
+ * takes a lock, once the buffer is full the oldest events are overwritten.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "private.h"
+#include "trace.h"
+
+#ifdef GLDC_TRACE
+
+/* Must be a power of two */
+#ifndef GLDC_TRACE_EVENTS
+#define GLDC_TRACE_EVENTS 16384
+#endif
+
+typedef struct {
+    const char* name;
+    uint64_t timestamp; /* Microseconds */
+    char phase;         /* 'B'egin or 'E'nd */
+} TraceEvent;
+
+static TraceEvent TRACE_EVENTS[GLDC_TRACE_EVENTS];
+static uint32_t TRACE_HEAD = 0;
+
+static uint64_t _glTraceTime() {
+#ifdef _arch_dreamcast
+    return timer_us_gettime64();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000u + now.tv_nsec / 1000;
+#endif
+}
+
+void _glTraceEvent(const char* name, char phase) {
+    uint32_t i = __atomic_fetch_add(&TRACE_HEAD, 1, __ATOMIC_RELAXED);
+    TraceEvent* event = &TRACE_EVENTS[i & (GLDC_TRACE_EVENTS - 1)];
+
+    event->name = name;
+    event->timestamp = _glTraceTime();
+    event->phase = phase;
+}
+
+#endif
+
+GLAPI GLboolean APIENTRY glKosWriteTrace(const char* filename) {
+#ifdef GLDC_TRACE
+    /* Finish any batched immediate mode blocks, so their draws are in
+     * the trace */
+    _glImmediateFlush();
+
+    FILE* file = fopen(filename, "w");
+
+    if(!file) {
+        _glKosThrowError(GL_INVALID_VALUE, __func__);
+        return GL_FALSE;
+    }
+
+    uint32_t end = __atomic_load_n(&TRACE_HEAD, __ATOMIC_ACQUIRE);
+    uint32_t start = (end > GLDC_TRACE_EVENTS) ? end - GLDC_TRACE_EVENTS : 0;
+
+    fprintf(file, "{\"traceEvents\":[\n");
+
+    for(uint32_t i = start; i < end; ++i) {
+        const TraceEvent* event = &TRACE_EVENTS[i & (GLDC_TRACE_EVENTS - 1)];
+
+        fprintf(
+            file, "{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%llu,\"pid\":1,\"tid\":1}%s\n",
+            event->name, event->phase, (unsigned long long) event->timestamp,
+            (i + 1 < end) ? "," : ""
+        );
+    }
+
+    fprintf(file, "],\"displayTimeUnit\":\"ms\"}\n");
+
+    GLboolean ok = !ferror(file);
+    fclose(file);
+    return ok;
+#else
+    _GL_UNUSED(filename);
+    return GL_FALSE;
+#endif
+}
+
+GLAPI void APIENTRY glKosClearTrace() {
+#ifdef GLDC_TRACE
+    __atomic_store_n(&TRACE_HEAD, 0, __ATOMIC_RELEASE);
+#endif
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+/*
+ * Scoped trace markers (GL_KOS_trace). GL_TRACE_SCOPE(name) records a begin
+ * event where it appears and the matching end event when the enclosing
+ * block is left, however that happens. Events go into a ring buffer which
+ * glKosWriteTrace dumps as Chrome trace JSON.
+ *
+ * Unless GLDC_TRACE is defined the markers compile to nothing.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef GLDC_TRACE
+
+void _glTraceEvent(const char* name, char phase);
+
+static inline void _glTraceEndScope(const char** name) {
+    _glTraceEvent(*name, 'E');
+}
+
+/* name must outlive the trace, i.e. be a string literal or __func__ */
+#define GL_TRACE_SCOPE(name) \
+    const char* _glTraceScopeName __attribute__((cleanup(_glTraceEndScope))) = (name); \
+    _glTraceEvent(_glTraceScopeName, 'B')
+
+#else
+
+#define GL_TRACE_SCOPE(name) ((void) 0)
+
+#endif
+
+#define GL_TRACE_FUNCTION() GL_TRACE_SCOPE(__func__)
+
+#ifdef __cplusplus
+}
+#endif
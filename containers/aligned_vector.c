@@ -10,6 +10,7 @@
 #define FASTCPY memcpy
 #endif
 
+#include "../GL/memory.h"
 #include "aligned_vector.h"
 
 extern inline void* aligned_vector_resize(AlignedVector* vector, const uint32_t element_count);
@@ -45,16 +46,12 @@ void* aligned_vector_reserve(AlignedVector* vector, uint32_t element_count) {
     uint32_t new_byte_size = (element_count * hdr->element_size);
     uint8_t* original_data = vector->data;
 
-    #ifdef __XBOX__
-            vector->data = (unsigned char*) aligned_alloc(0x20, new_byte_size);
-    #else
-            vector->data = (unsigned char*) memalign(0x20, new_byte_size);
-    #endif
+    vector->data = (unsigned char*) _glMemalign(0x20, new_byte_size);
 
     assert(vector->data);
 
     AV_MEMCPY4(vector->data, original_data, original_byte_size);
-    free(original_data);
+    _glFree(original_data);
 
     hdr->capacity = element_count;
     return vector->data + original_byte_size;
@@ -64,7 +61,7 @@ void aligned_vector_shrink_to_fit(AlignedVector* vector) {
     AlignedVectorHeader* const hdr = &vector->hdr;
     if(hdr->size == 0) {
         uint32_t element_size = hdr->element_size;
-        free(vector->data);
+        _glFree(vector->data);
 
         /* Reallocate the header */
         vector->data = NULL;
@@ -73,19 +70,38 @@ void aligned_vector_shrink_to_fit(AlignedVector* vector) {
     } else {
         uint32_t new_byte_size = (hdr->size * hdr->element_size);
         uint8_t* original_data = vector->data;
-#ifdef __XBOX__
-        vector->data = (unsigned char*) aligned_alloc(0x20, new_byte_size);
-#else
-        vector->data = (unsigned char*) memalign(0x20, new_byte_size);
-#endif
+        vector->data = (unsigned char*) _glMemalign(0x20, new_byte_size);
         if(original_data) {
             FASTCPY(vector->data, original_data, new_byte_size);
-            free(original_data);
+            _glFree(original_data);
         }
         hdr->capacity = hdr->size;
     }
 }
 
+void aligned_vector_set_capacity(AlignedVector* vector, uint32_t element_count) {
+    AlignedVectorHeader* const hdr = &vector->hdr;
+
+    assert(element_count >= hdr->size);
+
+    element_count = ROUND_TO_CHUNK_SIZE(element_count);
+    if(element_count == hdr->capacity) {
+        return;
+    }
+
+    uint32_t byte_size = (hdr->size * hdr->element_size);
+    uint8_t* original_data = vector->data;
+
+    vector->data = (unsigned char*) _glMemalign(0x20, element_count * hdr->element_size);
+
+    assert(vector->data);
+
+    AV_MEMCPY4(vector->data, original_data, byte_size);
+    _glFree(original_data);
+
+    hdr->capacity = element_count;
+}
+
 void aligned_vector_cleanup(AlignedVector* vector) {
     aligned_vector_clear(vector);
     aligned_vector_shrink_to_fit(vector);
@@ -129,9 +129,11 @@ AV_FORCE_INLINE void* aligned_vector_resize(AlignedVector* vector, const uint32_
     AlignedVectorHeader* hdr = &vector->hdr;
     uint32_t previous_count = hdr->size;
     if(hdr->capacity <= element_count) {
-        /* If we didn't have capacity, increase capacity (slow) */
+        /* If we didn't have capacity, increase capacity (slow). Grow by at
+         * least half so that a run of push backs doesn't copy every time */
+        uint32_t growth = hdr->capacity + (hdr->capacity / 2);
 
-        aligned_vector_reserve(vector, element_count);
+        aligned_vector_reserve(vector, (element_count > growth) ? element_count : growth);
         hdr->size = element_count;
 
         ret = aligned_vector_at(vector, previous_count);
@@ -189,6 +191,11 @@ AV_FORCE_INLINE void aligned_vector_clear(AlignedVector* vector){
 }
 
 void aligned_vector_shrink_to_fit(AlignedVector* vector);
+
+/* Reallocates the backing array to hold element_count elements (rounded up
+ * to the chunk size), which may be less than the current capacity but not
+ * less than the size */
+void aligned_vector_set_capacity(AlignedVector* vector, uint32_t element_count);
 void aligned_vector_cleanup(AlignedVector* vector);
 
 AV_FORCE_INLINE void* aligned_vector_back(AlignedVector* vector){
@@ -4,61 +4,103 @@
 #include <string.h>
 #include <assert.h>
 
-#ifndef __APPLE__
-#include <malloc.h>
+#include "../GL/memory.h"
+#include "named_array.h"
+
+static void* named_array_malloc(size_t size) {
+#ifdef _arch_dreamcast
+    // Use 32-bit aligned memory on the Dreamcast
+    return _glMemalign(0x20, size);
 #else
-/* Linux + Kos define this, OSX does not, so just use malloc there */
-#define memalign(x, size) malloc((size))
+    return _glMalloc(size);
 #endif
+}
 
-#include "named_array.h"
+static unsigned int named_array_page_count(unsigned int max_elements) {
+    return (max_elements + NAMED_ARRAY_PAGE_SIZE - 1) / NAMED_ARRAY_PAGE_SIZE;
+}
 
 void named_array_init(NamedArray* array, unsigned int element_size, unsigned int max_elements) {
+    unsigned int page_count = named_array_page_count(max_elements);
+
     array->element_size = element_size;
     array->max_element_count = max_elements;
+    array->marker_count = (max_elements + 32 - 1) / 32;
+    array->free_hint = 0;
 
-    array->marker_count = (unsigned char)((max_elements+8-1)/8);
+    array->used_markers = (uint32_t*) named_array_malloc(sizeof(uint32_t) * array->marker_count);
+    array->pages = (unsigned char**) named_array_malloc(sizeof(unsigned char*) * page_count);
 
-#ifdef _arch_dreamcast
-    // Use 32-bit aligned memory on the Dreamcast
-    array->elements = (unsigned char*) memalign(0x20, element_size * max_elements);
-    array->used_markers = (unsigned char*) memalign(0x20, array->marker_count);
-#else
-    array->elements = (unsigned char*) malloc(element_size * max_elements);
-    array->used_markers = (unsigned char*) malloc(array->marker_count);
-#endif
-    memset(array->used_markers, 0, sizeof(unsigned char) * array->marker_count);
+    memset(array->used_markers, 0, sizeof(uint32_t) * array->marker_count);
+    memset(array->pages, 0, sizeof(unsigned char*) * page_count);
+}
+
+/* Returns the element for id, allocating its page the first time an ID in
+ * it is used. The last page is trimmed to max_element_count */
+static unsigned char* named_array_element(NamedArray* array, unsigned int id) {
+    unsigned int page = id >> NAMED_ARRAY_PAGE_SHIFT;
+
+    if(!array->pages[page]) {
+        unsigned int first = page << NAMED_ARRAY_PAGE_SHIFT;
+        unsigned int count = array->max_element_count - first;
+
+        if(count > NAMED_ARRAY_PAGE_SIZE) {
+            count = NAMED_ARRAY_PAGE_SIZE;
+        }
+
+        array->pages[page] = (unsigned char*) named_array_malloc(array->element_size * count);
+        if(!array->pages[page]) {
+            return NULL;
+        }
+    }
+
+    return array->pages[page] + (id & (NAMED_ARRAY_PAGE_SIZE - 1)) * array->element_size;
+}
+
+static void* named_array_claim(NamedArray* array, unsigned int id) {
+    unsigned char* ptr = named_array_element(array, id);
+    if(!ptr) {
+        return NULL;
+    }
+
+    array->used_markers[id / 32] |= (uint32_t) 1 << (id % 32);
+    memset(ptr, 0, array->element_size);
+    return ptr;
 }
 
 void* named_array_alloc(NamedArray* array, unsigned int* new_id) {
-    unsigned int i = 0, j = 0;
-    for(i = 0; i < array->marker_count; ++i) {
-        for(j = 0; j < 8; ++j) {
-            unsigned int id = (i * 8) + j;
-            if(!named_array_used(array, id)) {
-                array->used_markers[i] |= (unsigned char) 1 << j;
-                *new_id = id;
-                unsigned char* ptr = &array->elements[id * array->element_size];
-                memset(ptr, 0, array->element_size);
-                return ptr;
+    unsigned int i;
+
+    for(i = array->free_hint; i < array->marker_count; ++i) {
+        uint32_t available = ~array->used_markers[i];
+
+        if(available) {
+            unsigned int id = (i * 32) + __builtin_ctz(available);
+
+            array->free_hint = i;
+
+            if(id >= array->max_element_count) {
+                /* Only the unused tail of the last word was free */
+                break;
             }
+
+            *new_id = id;
+            return named_array_claim(array, id);
         }
     }
 
+    array->free_hint = array->marker_count;
     return NULL;
 }
 
 void* named_array_reserve(NamedArray* array, unsigned int id) {
-    if(!named_array_used(array, id)) {
-        unsigned int j = (id % 8);
-        unsigned int i = id / 8;
-
-        assert(!named_array_used(array, id));
-        array->used_markers[i] |= (unsigned char) 1 << j;
-        assert(named_array_used(array, id));
+    if(id >= array->max_element_count) {
+        return NULL;
+    }
 
-        unsigned char* ptr = &array->elements[id * array->element_size];
-        memset(ptr, 0, array->element_size);
+    if(!named_array_used(array, id)) {
+        void* ptr = named_array_claim(array, id);
+        assert(!ptr || named_array_used(array, id));
         return ptr;
     }
 
@@ -66,9 +108,16 @@ void* named_array_reserve(NamedArray* array, unsigned int id) {
 }
 
 void named_array_release(NamedArray* array, unsigned int new_id) {
-    unsigned int i = new_id / 8;
-    unsigned int j = new_id % 8;
-    array->used_markers[i] &= (unsigned char) ~(1 << j);
+    if(new_id >= array->max_element_count) {
+        return;
+    }
+
+    unsigned int i = new_id / 32;
+    array->used_markers[i] &= ~((uint32_t) 1 << (new_id % 32));
+
+    if(i < array->free_hint) {
+        array->free_hint = i;
+    }
 }
 
 void* named_array_get(NamedArray* array, unsigned int id) {
@@ -76,15 +125,45 @@ void* named_array_get(NamedArray* array, unsigned int id) {
         return NULL;
     }
 
-    return &array->elements[id * array->element_size];
+    return array->pages[id >> NAMED_ARRAY_PAGE_SHIFT] +
+        (id & (NAMED_ARRAY_PAGE_SIZE - 1)) * array->element_size;
+}
+
+unsigned int named_array_next_used(const NamedArray* array, unsigned int id) {
+    unsigned int i = id / 32;
+
+    if(id >= array->max_element_count) {
+        return array->max_element_count;
+    }
+
+    /* Ignore the IDs before id in the first word */
+    uint32_t used = array->used_markers[i] & (~(uint32_t) 0 << (id % 32));
+
+    for(;;) {
+        if(used) {
+            return (i * 32) + __builtin_ctz(used);
+        }
+
+        if(++i >= array->marker_count) {
+            return array->max_element_count;
+        }
+
+        used = array->used_markers[i];
+    }
 }
 
 void named_array_cleanup(NamedArray* array) {
-    free(array->elements);
-    free(array->used_markers);
-    array->elements = NULL;
+    unsigned int page_count = named_array_page_count(array->max_element_count);
+
+    for(unsigned int i = 0; i < page_count; ++i) {
+        _glFree(array->pages[i]);
+    }
+
+    _glFree(array->pages);
+    _glFree(array->used_markers);
+    array->pages = NULL;
     array->used_markers = NULL;
     array->element_size = array->max_element_count = 0;
     array->marker_count = 0;
+    array->free_hint = 0;
 }
-
@@ -3,25 +3,34 @@
 #ifndef NAMED_ARRAY_H
 #define NAMED_ARRAY_H
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* Elements are allocated in pages of this many as IDs are handed out, so
+ * growing never moves an existing element */
+#define NAMED_ARRAY_PAGE_SHIFT 6
+#define NAMED_ARRAY_PAGE_SIZE (1u << NAMED_ARRAY_PAGE_SHIFT)
+
 typedef struct {
     unsigned int element_size;
     unsigned int max_element_count;
-    unsigned char* elements;
-    unsigned char* used_markers;
-    unsigned char marker_count;
+    unsigned char** pages;
+    uint32_t* used_markers;
+    unsigned int marker_count;
+    /* No marker word before this one has a free bit */
+    unsigned int free_hint;
 } NamedArray;
 
 void named_array_init(NamedArray* array, unsigned int element_size, unsigned int max_elements);
-static inline char named_array_used(NamedArray* array, unsigned int id) {
-    const unsigned int i = id / 8;
-    const unsigned int j = id % 8;
+static inline char named_array_used(const NamedArray* array, unsigned int id) {
+    if(id >= array->max_element_count) {
+        return 0;
+    }
 
-    unsigned char v = array->used_markers[i] & (unsigned char) (1 << j);
-    return !!(v);
+    return (array->used_markers[id / 32] >> (id % 32)) & 1;
 }
 
 void* named_array_alloc(NamedArray* array, unsigned int* new_id);
@@ -29,6 +38,9 @@ void* named_array_reserve(NamedArray* array, unsigned int id);
 
 void named_array_release(NamedArray* array, unsigned int new_id);
 void* named_array_get(NamedArray* array, unsigned int id);
+
+/* Returns the first used ID >= id, or max_element_count if there isn't one */
+unsigned int named_array_next_used(const NamedArray* array, unsigned int id);
 void named_array_cleanup(NamedArray* array);
 
 #ifdef __cplusplus
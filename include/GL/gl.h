@@ -218,6 +218,22 @@ __BEGIN_DECLS
 #define GL_EXP              0x0800
 #define GL_EXP2             0x0801
 
+/* Texture coordinate generation */
+#define GL_S                0x2000
+#define GL_T                0x2001
+#define GL_R                0x2002
+#define GL_Q                0x2003
+#define GL_TEXTURE_GEN_S    0x0C60
+#define GL_TEXTURE_GEN_T    0x0C61
+#define GL_TEXTURE_GEN_R    0x0C62
+#define GL_TEXTURE_GEN_Q    0x0C63
+#define GL_TEXTURE_GEN_MODE 0x2500
+#define GL_OBJECT_PLANE     0x2501
+#define GL_EYE_PLANE        0x2502
+#define GL_EYE_LINEAR       0x2400
+#define GL_OBJECT_LINEAR    0x2401
+#define GL_SPHERE_MAP       0x2402
+
 /* Hints - Not used by the API, only here for compatibility */
 #define GL_DONT_CARE                    0x1100
 #define GL_FASTEST                      0x1101
@@ -723,6 +739,16 @@ GLAPI void APIENTRY glFogf(GLenum pname, GLfloat param);
 GLAPI void APIENTRY glFogiv(GLenum pname, const GLint* params);
 GLAPI void APIENTRY glFogfv(GLenum pname, const GLfloat *params);
 
+/* Texture Coordinate Generation - client must enable GL_TEXTURE_GEN_S/T.
+ * Only S and T are generated, for the first texture unit */
+GLAPI void APIENTRY glTexGeni(GLenum coord, GLenum pname, GLint param);
+GLAPI void APIENTRY glTexGenf(GLenum coord, GLenum pname, GLfloat param);
+GLAPI void APIENTRY glTexGeniv(GLenum coord, GLenum pname, const GLint* params);
+GLAPI void APIENTRY glTexGenfv(GLenum coord, GLenum pname, const GLfloat* params);
+#define glTexGend glTexGenf
+GLAPI void APIENTRY glGetTexGenfv(GLenum coord, GLenum pname, GLfloat* params);
+GLAPI void APIENTRY glGetTexGeniv(GLenum coord, GLenum pname, GLint* params);
+
 /* Lighting Functions - client must enable GL_LIGHTING for this to take effect */
 
 /* Set Individual Light Parameters */
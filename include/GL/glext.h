@@ -125,6 +125,27 @@ GLAPI void APIENTRY glGenerateMipmap(GLenum target);
 GLAPI GLenum APIENTRY glCheckFramebufferStatusEXT(GLenum target);
 GLAPI GLboolean APIENTRY glIsFramebufferEXT(GLuint framebuffer);
 
+/* ARB_vertex_blend / ARB_matrix_palette */
+#define GL_MAX_VERTEX_UNITS_ARB                 0x86A4
+#define GL_WEIGHT_ARRAY_ARB                     0x86AD
+#define GL_MATRIX_PALETTE_ARB                   0x8840
+#define GL_MAX_MATRIX_PALETTE_STACK_DEPTH_ARB   0x8841
+#define GL_MAX_PALETTE_MATRICES_ARB             0x8842
+#define GL_CURRENT_PALETTE_MATRIX_ARB           0x8843
+#define GL_MATRIX_INDEX_ARRAY_ARB               0x8844
+
+/* Vertex skinning. With GL_MATRIX_PALETTE_ARB enabled and both the weight
+ * and matrix index arrays enabled, each vertex is transformed by the
+ * weighted sum of up to GL_MAX_VERTEX_UNITS_ARB palette matrices, which
+ * stand in for the modelview. glMatrixMode(GL_MATRIX_PALETTE_ARB) makes
+ * the palette entry selected by glCurrentPaletteMatrixARB the current
+ * matrix. Weights can be GL_FLOAT, GL_UNSIGNED_BYTE or GL_UNSIGNED_SHORT
+ * (normalized), indices GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT or
+ * GL_UNSIGNED_INT. */
+GLAPI void APIENTRY glCurrentPaletteMatrixARB(GLint index);
+GLAPI void APIENTRY glMatrixIndexPointerARB(GLint size, GLenum type, GLsizei stride, const GLvoid* pointer);
+GLAPI void APIENTRY glWeightPointerARB(GLint size, GLenum type, GLsizei stride, const GLvoid* pointer);
+
 /* ext_paletted_texture */
 #define GL_COLOR_INDEX1_EXT                0x80E2
 #define GL_COLOR_INDEX2_EXT                0x80E3
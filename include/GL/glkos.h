@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stddef.h>
+
 #include "gl.h"
 
 __BEGIN_DECLS
@@ -39,6 +41,15 @@ extern const char* GLDC_VERSION;
 /* Initialize the GL pipeline. GL will initialize the PVR. */
 GLAPI void APIENTRY glKosInit();
 
+/* Allocator used for all of GLdc's heap memory (see GLdcConfig::allocator).
+ * alloc must return memory aligned to at least alignment, which is a power
+ * of two no larger than 32, or NULL on failure. */
+typedef struct {
+    void* (*alloc)(size_t size, size_t alignment, void* user_data);
+    void (*free)(void* ptr, void* user_data);
+    void* user_data;
+} GLdcAllocator;
+
 typedef struct {
     /* If GL_TRUE, enables pvr autosorting, this *will* break glDepthFunc/glDepthTest */
     GLboolean autosort_enabled;
@@ -53,8 +64,20 @@ typedef struct {
     GLuint initial_op_capacity;
     GLuint initial_tr_capacity;
     GLuint initial_pt_capacity;
+
+    /* Unused, immediate mode now writes straight into the lists above */
     GLuint initial_immediate_capacity;
 
+    /* Default: 600
+     *
+     * glKosSwapBuffers grows a list which nearly filled up during the
+     * frame, so that later frames don't have to grow it mid-frame. A list
+     * which stays under half full for this many frames is shrunk back
+     * towards what it has been using, but never below its initial
+     * capacity. Zero disables shrinking. The most vertices each list has
+     * held in a frame can be queried with GL_*_LIST_HIGH_WATER_KOS */
+    GLuint list_shrink_frames;
+
     /* Default: True
      *
      * Whether glTexImage should automatically twiddle textures
@@ -62,6 +85,46 @@ typedef struct {
      * this is the same as calling glEnable(GL_TEXTURE_TWIDDLE_KOS)
      * on boot */
     GLboolean texture_twiddle;
+
+    /* Default: 0
+     *
+     * If non-zero, glKosSwapBuffers will move up to this many bytes of
+     * texture memory each frame to keep free VRAM contiguous. This is
+     * the same as calling glDefragmentTextureMemoryStep_KOS once a frame
+     * and avoids a long stall when an upload finds VRAM fragmented */
+    GLuint texture_defrag_bytes_per_frame;
+
+    /* Default: 256K
+     *
+     * The most bytes of evicted textures (see GL_TEXTURE_EVICTABLE_KOS)
+     * that will be copied back into VRAM in a single frame. At least one
+     * texture is always restored per frame. */
+    GLuint texture_restore_bytes_per_frame;
+
+    /* Default: 1088
+     *
+     * The most texture names that can exist at once, including the
+     * default texture 0. Texture objects are allocated in small pages as
+     * names are used, so a high ceiling only costs a few bytes per name
+     * until they're needed. glGenTextures raises GL_OUT_OF_MEMORY past it */
+    GLuint texture_count_max;
+
+    /* Default: memalign and free
+     *
+     * Used for every heap allocation GLdc makes (vertex lists, texture
+     * objects, palettes, temporary buffers...). It's installed before
+     * anything is allocated, so it can hand out memory from an arena or
+     * pool owned by the application. Both functions must be set to
+     * replace the default. */
+    GLdcAllocator allocator;
+
+    /* Default: 64K
+     *
+     * Bytes reserved at initialisation for temporary buffers, e.g. for
+     * converting textures or generating mipmaps. Requests which don't fit
+     * go to the allocator, so making this as large as the biggest upload
+     * avoids any allocations after loading. */
+    GLuint scratch_size;
 } GLdcConfig;
 
 
@@ -191,6 +254,12 @@ GLAPI void APIENTRY glKosShutdown();
 /* Memory allocation extension (GL_KOS_texture_memory_management) */
 GLAPI GLvoid APIENTRY glDefragmentTextureMemory_KOS(void);
 
+/* Moves at most maxBytes of texture data towards the start of texture
+ * memory, carrying on from where the previous call stopped. Textures
+ * larger than maxBytes are only moved by glDefragmentTextureMemory_KOS.
+ * Returns the number of bytes moved, 0 when there's nothing left to do. */
+GLAPI GLuint APIENTRY glDefragmentTextureMemoryStep_KOS(GLuint maxBytes);
+
 /* glGet extensions */
 #define GL_FREE_TEXTURE_MEMORY_KOS                  0xEF3D
 #define GL_USED_TEXTURE_MEMORY_KOS                  0xEF3E
@@ -214,6 +283,27 @@ GLAPI GLvoid APIENTRY glDefragmentTextureMemory_KOS(void);
 /* If enabled, will twiddle texture uploads where possible */
 #define GL_TEXTURE_TWIDDLE_KOS                      0xEF51
 
+/*
+ * CUSTOM EXTENSION GL_KOS_texture_auto_palette
+ *
+ * Passing one of these as the internalFormat to glTexImage2D with GL_RGB or
+ * GL_RGBA / GL_UNSIGNED_BYTE data quantises the image down to a 16 or 256
+ * colour paletted texture. Palettes which are near-identical to one already
+ * generated for another texture are merged so they share a palette bank.
+ * Mipmap levels > 0 are mapped onto the palette generated for level 0.
+ *
+ * glEnable(GL_TEXTURE_AUTO_PALETTE_DITHER_KOS) applies error diffusion
+ * dithering when the image is mapped to its palette.
+ */
+#define GL_COLOR_INDEX4_AUTO_KOS                    0xEF52
+#define GL_COLOR_INDEX8_AUTO_KOS                    0xEF53
+#define GL_TEXTURE_AUTO_PALETTE_DITHER_KOS          0xEF54
+
+/* If enabled, glGenerateMipmap averages colours in linear space rather than
+ * directly on the (gamma encoded) texel values. Alpha is always averaged
+ * linearly. */
+#define GL_GENERATE_MIPMAP_GAMMA_CORRECT_KOS        0xEF55
+
 /*
  * CUSTOM EXTENSION GL_KOS_texture_non_power_of_two
  *
@@ -225,4 +315,232 @@ GLAPI GLvoid APIENTRY glDefragmentTextureMemory_KOS(void);
  * dimensions.
  */
 
+/*
+ * CUSTOM EXTENSION GL_KOS_texture_residency
+ *
+ * glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_EVICTABLE_KOS, GL_TRUE) allows
+ * the bound texture to be copied out to RAM when an upload can't find room
+ * in VRAM, even after defragmenting. The least recently drawn evictable
+ * texture goes first; textures drawn in the current frame are never evicted.
+ *
+ * An evicted texture is copied back when it's next bound or drawn with, up
+ * to GLdcConfig::texture_restore_bytes_per_frame per frame. Restoring only
+ * makes room by evicting textures not drawn this frame, never by
+ * defragmenting, since that would move textures the frame already uses.
+ * Until it's back the texture draws as if it had no texture data.
+ *
+ * glGetIntegerv reports the totals since initialisation with the pnames
+ * below. A thrash is a restore within 60 frames of the eviction.
+ */
+#define GL_TEXTURE_EVICTABLE_KOS                    0xEF56
+#define GL_TEXTURE_EVICTION_COUNT_KOS               0xEF57
+#define GL_TEXTURE_RESTORE_COUNT_KOS                0xEF58
+#define GL_TEXTURE_THRASH_COUNT_KOS                 0xEF59
+#define GL_EVICTED_TEXTURE_MEMORY_KOS               0xEF5A
+
+/*
+ * CUSTOM EXTENSION GL_KOS_texture_pack
+ *
+ * Loads textures from a pack built offline by the gldc_texpack tool. Pack
+ * data is already in the PVR's format (twiddled, paletted, with mipmaps in
+ * place) so loading is a straight copy into texture memory.
+ *
+ * Up to n textures are created from the start of the pack and their names
+ * written to textures. Returns the number loaded. If the pack is invalid or
+ * texture memory runs out, the remaining names are set to 0 and
+ * GL_INVALID_VALUE or GL_OUT_OF_MEMORY is raised. The current texture
+ * binding is left unchanged.
+ *
+ * glKosLoadTexturePack reads a pack which is already in memory (e.g. mapped
+ * from the filesystem), size is the size of the pack in bytes.
+ * glKosLoadTexturePackFile streams it from a file instead.
+ */
+GLAPI GLsizei APIENTRY glKosLoadTexturePack(const GLvoid* pack, GLuint size, GLsizei n, GLuint* textures);
+GLAPI GLsizei APIENTRY glKosLoadTexturePackFile(const char* filename, GLsizei n, GLuint* textures);
+
+/*
+ * CUSTOM EXTENSION GL_KOS_texture_atlas
+ *
+ * Packs small textures into shared pages so that draws using different
+ * small textures don't each need their own poly header, and so they don't
+ * each round up to a whole power-of-two texture in VRAM.
+ *
+ * glKosGenTextureAtlas creates an atlas of pageSize x pageSize pages in one
+ * of the 16bpp GL_*_KOS or GL_*_TWID_KOS internal formats. Returns 0 on
+ * failure.
+ *
+ * glKosTexImageAtlas is used instead of glTexImage2D. It copies the image
+ * into a page of the atlas and makes the bound texture a member of that
+ * atlas. Members can be any size up to pageSize - 2 (there's a one texel
+ * border around each member). They can't have mipmaps and can't be updated
+ * with glTexSubImage2D. Calling glTexImage2D on a member makes it a normal
+ * texture again.
+ *
+ * A member is drawn with its own filter, wrap and environment settings.
+ * Texture coordinates 0..1 are remapped onto the member's region of the
+ * page, on either texture unit, so coordinates outside that range sample
+ * neighbouring members.
+ * Binding another member of the same page with the same settings doesn't
+ * start a new poly header.
+ *
+ * Space is only reused once all the members of a page are deleted, at which
+ * point the page is freed. Deleting an atlas which still has members raises
+ * GL_INVALID_OPERATION.
+ */
+GLAPI GLuint APIENTRY glKosGenTextureAtlas(GLenum internalFormat, GLsizei pageSize);
+GLAPI void APIENTRY glKosDeleteTextureAtlas(GLuint atlas);
+GLAPI void APIENTRY glKosTexImageAtlas(GLuint atlas, GLsizei width, GLsizei height,
+                                       GLenum format, GLenum type, const GLvoid* data);
+
+/*
+ * glGetIntegerv pnames reporting the most vertices the opaque, punch-thru
+ * and translucent lists have held in a single frame since initialisation.
+ * Useful for choosing GLdcConfig::initial_*_capacity.
+ */
+#define GL_OP_LIST_HIGH_WATER_KOS                   0xEF5B
+#define GL_PT_LIST_HIGH_WATER_KOS                   0xEF5C
+#define GL_TR_LIST_HIGH_WATER_KOS                   0xEF5D
+
+/*
+ * CUSTOM EXTENSION GL_KOS_frame_stats
+ *
+ * Counters describing what GLdc did for a frame, collected between calls to
+ * glKosSwapBuffers. glKosGetFrameStats returns the last completed frame.
+ *
+ * The counters are only collected when GLdc is built with GLDC_FRAME_STATS
+ * (the CMake option of the same name, which also defines it for anything
+ * linking against GL). Without it glKosGetFrameStats reports all zeros.
+ *
+ * The timings are measured with the clock passed to
+ * glKosSetFrameStatsClock, in whatever unit it counts in. They're zero
+ * until a clock is set.
+ */
+typedef GLuint (*GLdcFrameStatsClock)(void);
+
+typedef struct {
+    /* glDrawArrays, glDrawElements and glEnd calls which submitted
+     * vertices */
+    GLuint draw_calls;
+
+    /* Indexed by primitive mode, GL_POINTS through GL_POLYGON. Vertices
+     * submitted, and vertices written to the poly lists for them */
+    GLuint vertices_in[10];
+    GLuint vertices_out[10];
+
+    /* Draws which needed a new poly header, and those which could carry on
+     * under the previous one because no state had changed */
+    GLuint headers_emitted;
+    GLuint headers_avoided;
+
+    /* Triangles crossing the near plane which were clipped, and triangles
+     * entirely behind it which were dropped */
+    GLuint triangles_clipped;
+    GLuint triangles_culled;
+
+    /* Vertices (including headers) in the opaque, punch-thru and
+     * translucent lists, and the number of those lists which had to grow
+     * while the frame was being built */
+    GLuint list_vertices[3];
+    GLuint list_reallocations;
+
+    /* Bytes written to texture memory by uploads and restores */
+    GLuint texture_bytes_uploaded;
+
+    /* Textures moved by defragmentation */
+    GLuint defrag_moves;
+
+    /* Texture memory free at the end of the frame, and the largest free
+     * block */
+    GLuint vram_free;
+    GLuint vram_contiguous;
+
+    /* Time spent in draw calls, submitting the lists to the GPU and in
+     * glKosSwapBuffers as a whole */
+    GLuint draw_time;
+    GLuint submit_time;
+    GLuint swap_time;
+} GLdcFrameStats;
+
+GLAPI void APIENTRY glKosGetFrameStats(GLdcFrameStats* stats);
+GLAPI void APIENTRY glKosSetFrameStatsClock(GLdcFrameStatsClock clock);
+
+/*
+ * CUSTOM EXTENSION GL_KOS_trace
+ *
+ * When GLdc is built with GLDC_TRACE (the CMake option of the same name),
+ * the stages of the pipeline (draw submission, vertex generation, T&L,
+ * lighting, list submission, texture uploads, texture memory allocation
+ * and defragmentation) record begin and end events into a ring buffer.
+ *
+ * glKosWriteTrace writes the most recent events to filename in the Chrome
+ * trace event format, which chrome://tracing and the Perfetto UI can load.
+ * It returns GL_FALSE if the file couldn't be written, or if GLdc was built
+ * without GLDC_TRACE. glKosClearTrace discards the recorded events.
+ */
+GLAPI GLboolean APIENTRY glKosWriteTrace(const char* filename);
+GLAPI void APIENTRY glKosClearTrace();
+
+/*
+ * CUSTOM EXTENSION GL_KOS_frame_capture
+ *
+ * glKosCaptureFrames writes the next frames calls to glKosSwapBuffers
+ * submit to filename: the opaque, punch-thru and translucent lists exactly
+ * as they're sent to the GPU, palette RAM, and the texture data the lists
+ * refer to. The gldc_replay tool (tools/replay.c) plays captures back
+ * through the backend's list submission to benchmark it in isolation.
+ *
+ * Raises GL_INVALID_OPERATION if a capture is already in progress, and
+ * GL_INVALID_VALUE if frames is zero or the file can't be created. If
+ * writing fails part way the capture stops, keeping the frames written.
+ */
+GLAPI void APIENTRY glKosCaptureFrames(const char* filename, GLuint frames);
+
+/*
+ * CUSTOM EXTENSION GL_KOS_bounding_sphere
+ *
+ * glKosBoundingSphere gives an object space sphere containing every vertex
+ * of the draws which follow. While GL_BOUNDING_SPHERE_KOS is enabled the
+ * lighting stage transforms it by the modelview matrix and, before lighting
+ * any vertices, drops point and spot lights which are out of range or
+ * attenuated to nothing across the whole sphere, and spot lights whose cone
+ * misses it. Point lights far away relative to the sphere's radius are
+ * treated as directional lights for the draw.
+ *
+ * The sphere is ignored when drawing with GL_MATRIX_PALETTE_ARB. Raises
+ * GL_INVALID_VALUE if radius is negative.
+ */
+#define GL_BOUNDING_SPHERE_KOS                      0xEF5E
+
+GLAPI void APIENTRY glKosBoundingSphere(GLfloat x, GLfloat y, GLfloat z, GLfloat radius);
+
+/*
+ * CUSTOM EXTENSION GL_KOS_sprites
+ *
+ * glKosDrawSprites draws count axis-aligned textured quads, each from
+ * (x, y) to (x + width, y + height) at depth z, as PVR sprite primitives:
+ * one 64 byte entry per quad rather than four vertices, and no T&L beyond
+ * transforming the corners by the current modelview and projection.
+ * u0, v0 map to the (x, y) corner and u1, v1 to the opposite one.
+ *
+ * The texture, blending, depth and so on are taken from the current state
+ * as with any other draw, but lighting, fog colour, texture coordinate
+ * generation and the texture matrix don't apply, and the shading is always
+ * flat. Each sprite is one colour, and the PVR only takes that from the
+ * sprite header, so runs of sprites of the same colour (across calls, if
+ * nothing else is drawn in between) share a header; a change of colour
+ * costs one. Sprites with any corner behind the near plane are dropped
+ * rather than clipped.
+ *
+ * Raises GL_INVALID_OPERATION between glBegin and glEnd, and
+ * GL_INVALID_VALUE if count is negative. A count of zero does nothing.
+ */
+typedef struct {
+    GLfloat x, y, z;
+    GLfloat width, height;
+    GLfloat u0, v0, u1, v1;
+    GLuint argb;  /* 0xAARRGGBB */
+} GLSpriteKOS;
+
+GLAPI void APIENTRY glKosDrawSprites(const GLSpriteKOS* sprites, GLsizei count);
+
 __END_DECLS
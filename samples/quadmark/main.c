@@ -70,7 +70,6 @@ int check_start() {
 void setup() {
     GLdcConfig cfg;
     glKosInitConfig(&cfg);
-    cfg.initial_immediate_capacity = 14000;
     glKosInitEx(&cfg);
 
     glMatrixMode(GL_MODELVIEW);
@@ -0,0 +1,107 @@
+#include "tools/gl_bench.h"
+
+#include <cstring>
+#include <vector>
+
+#include <GL/gl.h>
+#include <GL/glkos.h>
+
+/* SceneListSubmit on an opaque list of TRIANGLE_COUNT triangles which are
+ * all in front of the near plane, straddle it (one vertex behind, so each is
+ * clipped into a quad) or are all behind it. Submission clips in place, so
+ * each iteration starts from a fresh copy of the list and the copy is part
+ * of the time; bench_copy_only measures it on its own. */
+class ClippingBenchmarks : public GLBenchmark {
+public:
+    static const GLuint TRIANGLE_COUNT = 512;
+
+    /* Every list holds the same number of entries, one header followed by
+     * the triangles */
+    GLuint list_size = 0;
+
+    Vertex* visible = NULL;
+    Vertex* partial = NULL;
+    Vertex* behind = NULL;
+    Vertex* scratch = NULL;
+
+    void set_up() {
+        GLBenchmark::set_up();
+
+        glMatrixMode(GL_PROJECTION);
+        glFrustum(-0.1f, 0.1f, -0.075f, 0.075f, 0.1f, 100.0f);
+        glMatrixMode(GL_MODELVIEW);
+
+        /* Offsets from the eye of the three vertices of each triangle */
+        visible = build(-2.0f, -3.0f, -4.0f);
+        partial = build(1.0f, -3.0f, -4.0f);
+        behind = build(2.0f, 3.0f, 4.0f);
+
+        scratch = (Vertex*) _glMemalign(32, list_size * sizeof(Vertex));
+    }
+
+    void tear_down() {
+        _glFree(visible);
+        _glFree(partial);
+        _glFree(behind);
+        _glFree(scratch);
+
+        glMatrixMode(GL_PROJECTION);
+        glLoadIdentity();
+        glMatrixMode(GL_MODELVIEW);
+
+        GLBenchmark::tear_down();
+    }
+
+    Vertex* build(GLfloat z0, GLfloat z1, GLfloat z2) {
+        std::vector<GLfloat> positions;
+
+        for(GLuint i = 0; i < TRIANGLE_COUNT; ++i) {
+            GLfloat x = (GLfloat) (i % 32) / 16.0f - 1.0f;
+            GLfloat y = (GLfloat) (i / 32) / 8.0f - 1.0f;
+
+            const GLfloat triangle[] = {
+                x, y, z0,
+                x + 0.1f, y, z1,
+                x, y + 0.1f, z2
+            };
+
+            positions.insert(positions.end(), triangle, triangle + 9);
+        }
+
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glVertexPointer(3, GL_FLOAT, 0, &positions[0]);
+        glDrawArrays(GL_TRIANGLES, 0, TRIANGLE_COUNT * 3);
+        glDisableClientState(GL_VERTEX_ARRAY);
+
+        list_size = aligned_vector_size(&OP_LIST.vector);
+
+        Vertex* list = (Vertex*) _glMemalign(32, list_size * sizeof(Vertex));
+        memcpy(list, aligned_vector_front(&OP_LIST.vector), list_size * sizeof(Vertex));
+        aligned_vector_clear(&OP_LIST.vector);
+
+        return list;
+    }
+
+    void submit(const Vertex* list) {
+        memcpy(scratch, list, list_size * sizeof(Vertex));
+
+        SceneListBegin(GPU_LIST_OP_POLY);
+        SceneListSubmit(scratch, list_size);
+    }
+
+    void bench_copy_only() {
+        memcpy(scratch, visible, list_size * sizeof(Vertex));
+    }
+
+    void bench_all_visible() {
+        submit(visible);
+    }
+
+    void bench_partially_clipped() {
+        submit(partial);
+    }
+
+    void bench_all_behind() {
+        submit(behind);
+    }
+};
@@ -0,0 +1,235 @@
+#include "tools/gl_bench.h"
+
+#include <GL/gl.h>
+#include <GL/glkos.h>
+
+/* The vertex generation kernels in draw.c (generateArraysFastPath_*,
+ * generateElements*, genQuads, genTriangleFan...) are static, so they're
+ * timed through the draw calls that select them. Each iteration draws
+ * VERTEX_COUNT vertices and empties the list again. */
+class DrawBenchmarkCase : public GLBenchmark {
+public:
+    static const GLuint VERTEX_COUNT = 1536;
+
+    GLfloat positions[VERTEX_COUNT * 3];
+    GLfloat uvs[VERTEX_COUNT * 2];
+    GLfloat colours[VERTEX_COUNT * 4];
+    GLubyte byte_colours[VERTEX_COUNT * 4];
+    GLushort indices[VERTEX_COUNT];
+
+    void set_up() {
+        GLBenchmark::set_up();
+
+        for(GLuint i = 0; i < VERTEX_COUNT; ++i) {
+            positions[i * 3 + 0] = (GLfloat) (i % 32) / 16.0f - 1.0f;
+            positions[i * 3 + 1] = (GLfloat) (i / 32) / 24.0f - 1.0f;
+            positions[i * 3 + 2] = -0.5f;
+
+            uvs[i * 2 + 0] = positions[i * 3 + 0];
+            uvs[i * 2 + 1] = positions[i * 3 + 1];
+
+            for(GLuint c = 0; c < 4; ++c) {
+                colours[i * 4 + c] = (GLfloat) ((i + c) % 4) / 3.0f;
+                byte_colours[i * 4 + c] = (GLubyte) (colours[i * 4 + c] * 255.0f);
+            }
+
+            /* Walk the vertices out of order so the indexed paths can't
+             * stream them */
+            indices[i] = (GLushort) ((i * 7) % VERTEX_COUNT);
+        }
+
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        glEnableClientState(GL_COLOR_ARRAY);
+
+        glVertexPointer(3, GL_FLOAT, 0, positions);
+        glTexCoordPointer(2, GL_FLOAT, 0, uvs);
+    }
+
+    void tear_down() {
+        glDisableClientState(GL_VERTEX_ARRAY);
+        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+        glDisableClientState(GL_COLOR_ARRAY);
+
+        GLBenchmark::tear_down();
+    }
+
+    void draw_arrays(GLenum mode) {
+        glDrawArrays(mode, 0, VERTEX_COUNT);
+        aligned_vector_clear(&OP_LIST.vector);
+    }
+
+    void draw_elements(GLenum mode) {
+        glDrawElements(mode, VERTEX_COUNT, GL_UNSIGNED_SHORT, indices);
+        aligned_vector_clear(&OP_LIST.vector);
+    }
+};
+
+/* Every attribute matches the output format, so these take the fast path */
+class FastPathDrawBenchmarks : public DrawBenchmarkCase {
+public:
+    void set_up() {
+        DrawBenchmarkCase::set_up();
+        glColorPointer(4, GL_FLOAT, 0, colours);
+    }
+
+    void bench_arrays_triangles() {
+        draw_arrays(GL_TRIANGLES);
+    }
+
+    void bench_arrays_quads() {
+        draw_arrays(GL_QUADS);
+    }
+
+    void bench_arrays_triangle_fan() {
+        draw_arrays(GL_TRIANGLE_FAN);
+    }
+
+    void bench_arrays_triangle_strip() {
+        draw_arrays(GL_TRIANGLE_STRIP);
+    }
+
+    void bench_elements_triangles() {
+        draw_elements(GL_TRIANGLES);
+    }
+
+    void bench_elements_quads() {
+        draw_elements(GL_QUADS);
+    }
+};
+
+/* Byte colours need converting, which forces the generic readers */
+class DrawBenchmarks : public DrawBenchmarkCase {
+public:
+    void set_up() {
+        DrawBenchmarkCase::set_up();
+        glColorPointer(4, GL_UNSIGNED_BYTE, 0, byte_colours);
+    }
+
+    void bench_arrays_triangles() {
+        draw_arrays(GL_TRIANGLES);
+    }
+
+    void bench_arrays_quads() {
+        draw_arrays(GL_QUADS);
+    }
+
+    void bench_arrays_triangle_fan() {
+        draw_arrays(GL_TRIANGLE_FAN);
+    }
+
+    void bench_elements_triangles() {
+        draw_elements(GL_TRIANGLES);
+    }
+
+    void bench_elements_quads() {
+        draw_elements(GL_QUADS);
+    }
+};
+
+/* The same vertices through glBegin/glEnd, one glColor, glTexCoord and
+ * glVertex call each, as legacy code submits them */
+class ImmediateDrawBenchmarks : public DrawBenchmarkCase {
+public:
+    void draw_immediate(GLenum mode) {
+        glBegin(mode);
+        for(GLuint i = 0; i < VERTEX_COUNT; ++i) {
+            glColor4fv(colours + i * 4);
+            glTexCoord2fv(uvs + i * 2);
+            glVertex3fv(positions + i * 3);
+        }
+        glEnd();
+        glFlush();
+
+        aligned_vector_clear(&OP_LIST.vector);
+    }
+
+    void bench_triangles() {
+        draw_immediate(GL_TRIANGLES);
+    }
+
+    void bench_quads() {
+        draw_immediate(GL_QUADS);
+    }
+
+    void bench_triangle_fan() {
+        draw_immediate(GL_TRIANGLE_FAN);
+    }
+};
+
+/* One glBegin/glEnd per quad, as text and sprite code tends to draw */
+class ImmediateQuadBenchmarks : public DrawBenchmarkCase {
+public:
+    void bench_quad_per_block() {
+        for(GLuint i = 0; i < VERTEX_COUNT; i += 4) {
+            glBegin(GL_QUADS);
+            for(GLuint j = i; j < i + 4; ++j) {
+                glColor4fv(colours + j * 4);
+                glTexCoord2fv(uvs + j * 2);
+                glVertex3fv(positions + j * 3);
+            }
+            glEnd();
+        }
+        glFlush();
+
+        aligned_vector_clear(&OP_LIST.vector);
+    }
+
+    void bench_rects() {
+        for(GLuint i = 0; i < VERTEX_COUNT; i += 4) {
+            glRectf(positions[i * 3], positions[i * 3 + 1],
+                    positions[i * 3] + 0.0625f, positions[i * 3 + 1] + 0.0625f);
+        }
+        glFlush();
+
+        aligned_vector_clear(&OP_LIST.vector);
+    }
+};
+
+/* The same 2D quads as sprites and as immediate mode quads */
+class SpriteBenchmarks : public DrawBenchmarkCase {
+public:
+    static const GLuint SPRITE_COUNT = VERTEX_COUNT / 4;
+
+    GLSpriteKOS sprites[SPRITE_COUNT];
+
+    void set_up() {
+        DrawBenchmarkCase::set_up();
+
+        for(GLuint i = 0; i < SPRITE_COUNT; ++i) {
+            const GLfloat* p = positions + i * 4 * 3;
+            GLSpriteKOS s = {
+                p[0], p[1], p[2], 0.0625f, 0.0625f,
+                0.0f, 0.0f, 1.0f, 1.0f, 0xFFFFFFFF
+            };
+            sprites[i] = s;
+        }
+    }
+
+    void bench_sprites() {
+        glKosDrawSprites(sprites, SPRITE_COUNT);
+        aligned_vector_clear(&OP_LIST.vector);
+    }
+
+    void bench_sprite_per_call() {
+        for(GLuint i = 0; i < SPRITE_COUNT; ++i) {
+            glKosDrawSprites(sprites + i, 1);
+        }
+        aligned_vector_clear(&OP_LIST.vector);
+    }
+
+    void bench_immediate_quads() {
+        glBegin(GL_QUADS);
+        for(GLuint i = 0; i < SPRITE_COUNT; ++i) {
+            const GLSpriteKOS* s = sprites + i;
+            glTexCoord2f(s->u0, s->v0); glVertex3f(s->x, s->y, s->z);
+            glTexCoord2f(s->u1, s->v0); glVertex3f(s->x + s->width, s->y, s->z);
+            glTexCoord2f(s->u1, s->v1); glVertex3f(s->x + s->width, s->y + s->height, s->z);
+            glTexCoord2f(s->u0, s->v1); glVertex3f(s->x, s->y + s->height, s->z);
+        }
+        glEnd();
+        glFlush();
+
+        aligned_vector_clear(&OP_LIST.vector);
+    }
+};
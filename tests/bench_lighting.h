@@ -0,0 +1,137 @@
+#include "tools/gl_bench.h"
+
+#include <cmath>
+
+#include <GL/gl.h>
+#include <GL/glkos.h>
+
+/* _glPerformLighting on a prepared batch of eye-space vertices, with one to
+ * four lights enabled, and with all eight where most are point lights out of
+ * the batch's reach, with and without GL_BOUNDING_SPHERE_KOS. Lighting only
+ * writes the vertex colour so the same batch can be relit every
+ * iteration. */
+class LightingBenchmarks : public GLBenchmark {
+public:
+    static const GLuint VERTEX_COUNT = 1024;
+
+    Vertex vertices[VERTEX_COUNT] __attribute__((aligned(32)));
+
+    void set_up() {
+        GLBenchmark::set_up();
+
+        for(GLuint i = 0; i < VERTEX_COUNT; ++i) {
+            Vertex* v = &vertices[i];
+            v->flags = GPU_CMD_VERTEX;
+            v->xyz[0] = (GLfloat) (i % 32) / 16.0f - 1.0f;
+            v->xyz[1] = (GLfloat) (i / 32) / 16.0f - 1.0f;
+            v->xyz[2] = -5.0f;
+            v->w = 1.0f;
+
+            GLfloat normal[3] = {v->xyz[0] * 0.5f, v->xyz[1] * 0.5f, 0.7f};
+            GLfloat length = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+            normal[0] /= length;
+            normal[1] /= length;
+            normal[2] /= length;
+            v->nxyz = _glPackNormal(normal);
+        }
+
+        /* A mix of directional and positional lights, as a scene would have */
+        const GLfloat positions[4][4] = {
+            {0.3f, 0.4f, 1.0f, 0.0f},
+            {2.0f, 2.0f, -3.0f, 1.0f},
+            {-1.0f, 0.5f, 0.5f, 0.0f},
+            {-2.0f, -2.0f, -4.0f, 1.0f}
+        };
+
+        const GLfloat diffuse[] = {0.8f, 0.7f, 0.6f, 1.0f};
+        const GLfloat specular[] = {1.0f, 1.0f, 1.0f, 1.0f};
+
+        for(GLuint i = 0; i < 4; ++i) {
+            glLightfv(GL_LIGHT0 + i, GL_POSITION, positions[i]);
+            glLightfv(GL_LIGHT0 + i, GL_DIFFUSE, diffuse);
+            glLightfv(GL_LIGHT0 + i, GL_SPECULAR, specular);
+        }
+
+        glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, specular);
+        glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, 32.0f);
+
+        glEnable(GL_LIGHTING);
+    }
+
+    void tear_down() {
+        for(GLuint i = 0; i < 8; ++i) {
+            glDisable(GL_LIGHT0 + i);
+        }
+
+        glDisable(GL_BOUNDING_SPHERE_KOS);
+
+        glDisable(GL_LIGHTING);
+        GLBenchmark::tear_down();
+    }
+
+    void light(GLuint count) {
+        for(GLuint i = 0; i < 4; ++i) {
+            if(i < count) {
+                glEnable(GL_LIGHT0 + i);
+            } else {
+                glDisable(GL_LIGHT0 + i);
+            }
+        }
+
+        _glPerformLighting(vertices, VERTEX_COUNT);
+    }
+
+    void bench_one_light() {
+        light(1);
+    }
+
+    void bench_two_lights() {
+        light(2);
+    }
+
+    void bench_three_lights() {
+        light(3);
+    }
+
+    void bench_four_lights() {
+        light(4);
+    }
+
+    /* The first four lights plus four spot lights elsewhere in the scene,
+     * in range of the batch but pointing away from it */
+    void light_scene(GLboolean cull) {
+        const GLfloat positions[4][4] = {
+            {6.0f, 0.0f, -5.0f, 1.0f},
+            {-6.0f, 0.0f, -5.0f, 1.0f},
+            {0.0f, 6.0f, -5.0f, 1.0f},
+            {0.0f, -6.0f, -5.0f, 1.0f}
+        };
+
+        for(GLuint i = 0; i < 8; ++i) {
+            if(i >= 4) {
+                const GLfloat* p = positions[i - 4];
+                const GLfloat away[3] = {p[0], p[1], 0.0f};
+                glLightfv(GL_LIGHT0 + i, GL_POSITION, p);
+                glLightfv(GL_LIGHT0 + i, GL_SPOT_DIRECTION, away);
+                glLightf(GL_LIGHT0 + i, GL_SPOT_CUTOFF, 30.0f);
+            }
+
+            glEnable(GL_LIGHT0 + i);
+        }
+
+        if(cull) {
+            glKosBoundingSphere(0.0f, 0.0f, -5.0f, 1.5f);
+            glEnable(GL_BOUNDING_SPHERE_KOS);
+        }
+
+        _glPerformLighting(vertices, VERTEX_COUNT);
+    }
+
+    void bench_scene_lights() {
+        light_scene(GL_FALSE);
+    }
+
+    void bench_scene_lights_culled() {
+        light_scene(GL_TRUE);
+    }
+};
@@ -0,0 +1,117 @@
+#include "tools/gl_bench.h"
+
+#include <cstdint>
+
+#include "GL/alloc/alloc.h"
+#include "containers/aligned_vector.h"
+
+/* The VRAM allocator under texture churn: a working set of texture-sized
+ * blocks, one of which is freed and reallocated per iteration. The
+ * allocator only manages one pool, so this churns GL's own texture memory
+ * and gives it all back in tear_down */
+class AllocatorBenchmarks : public GLBenchmark {
+public:
+    static const uint32_t WORKING_SET = 256;
+
+    void* pool = NULL;
+    void* live[WORKING_SET];
+    uint32_t seed = 1234;
+
+    uint32_t next_random() {
+        seed = seed * 1103515245 + 12345;
+        return seed >> 8;
+    }
+
+    size_t random_texture_size() {
+        static const size_t SIZES[] = {
+            128, 512, 512, 2048, 2048, 2048, 8192, 8192, 10928, 32768, 43704, 131072
+        };
+
+        return SIZES[next_random() % (sizeof(SIZES) / sizeof(SIZES[0]))];
+    }
+
+    void set_up() {
+        GLBenchmark::set_up();
+
+        seed = 1234;
+        pool = _glTextureMemoryBase();
+
+        for(uint32_t i = 0; i < WORKING_SET; ++i) {
+            live[i] = alloc_malloc(pool, random_texture_size());
+        }
+    }
+
+    void tear_down() {
+        for(uint32_t i = 0; i < WORKING_SET; ++i) {
+            if(live[i]) {
+                alloc_free(pool, live[i]);
+            }
+        }
+
+        GLBenchmark::tear_down();
+    }
+
+    void bench_churn() {
+        void*& slot = live[next_random() % WORKING_SET];
+
+        if(slot) {
+            alloc_free(pool, slot);
+        }
+
+        slot = alloc_malloc(pool, random_texture_size());
+    }
+
+    void bench_small_malloc_free() {
+        void* p = alloc_malloc(pool, 512);
+        if(p) {
+            alloc_free(pool, p);
+        }
+    }
+};
+
+/* Filling an empty vector from scratch, which is what the poly lists do
+ * every frame until their capacity settles */
+class AlignedVectorBenchmarks : public bench::Benchmark {
+public:
+    static const uint32_t ELEMENT_COUNT = 4096;
+
+    struct Element {
+        uint8_t bytes[64];
+    };
+
+    Element element = {};
+
+    void bench_push_back_growth() {
+        AlignedVector vector;
+        aligned_vector_init(&vector, sizeof(Element));
+
+        for(uint32_t i = 0; i < ELEMENT_COUNT; ++i) {
+            aligned_vector_push_back(&vector, &element, 1);
+        }
+
+        aligned_vector_cleanup(&vector);
+    }
+
+    void bench_extend_growth() {
+        AlignedVector vector;
+        aligned_vector_init(&vector, sizeof(Element));
+
+        for(uint32_t i = 0; i < ELEMENT_COUNT; i += 32) {
+            aligned_vector_extend(&vector, 32);
+        }
+
+        aligned_vector_cleanup(&vector);
+    }
+
+    void bench_push_back_reserved() {
+        AlignedVector vector;
+        aligned_vector_init(&vector, sizeof(Element));
+        aligned_vector_reserve(&vector, ELEMENT_COUNT);
+
+        for(uint32_t i = 0; i < ELEMENT_COUNT; ++i) {
+            aligned_vector_push_back(&vector, &element, 1);
+        }
+
+        aligned_vector_cleanup(&vector);
+    }
+};
@@ -0,0 +1,146 @@
+#include "tools/gl_bench.h"
+
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include <GL/glkos.h>
+
+/* glTexImage2D of a SIZE x SIZE image through each of the conversions in
+ * texture.c's _determineConversion table that glTexImage2D can reach, linear
+ * and twiddled. The internal formats are the explicit _KOS ones so the path
+ * doesn't depend on GL_TEXTURE_TWIDDLE_KOS. Every iteration re-specifies
+ * the same texture, so the storage is reused after the first. */
+class TextureUploadBenchmarks : public GLBenchmark {
+public:
+    static const GLuint SIZE = 256;
+
+    GLubyte* pixels = NULL;
+    GLuint texture = 0;
+
+    void set_up() {
+        GLBenchmark::set_up();
+
+        pixels = (GLubyte*) _glMalloc(SIZE * SIZE * 4);
+        for(GLuint i = 0; i < SIZE * SIZE * 4; ++i) {
+            pixels[i] = (GLubyte) (i * 31);
+        }
+
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+    }
+
+    void tear_down() {
+        glDeleteTextures(1, &texture);
+        _glFree(pixels);
+
+        GLBenchmark::tear_down();
+    }
+
+    void upload(GLint internalFormat, GLenum format, GLenum type) {
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, SIZE, SIZE, 0, format, type, pixels);
+    }
+
+    void bench_rgba8888_to_argb4444() {
+        upload(GL_ARGB4444_KOS, GL_RGBA, GL_UNSIGNED_BYTE);
+    }
+
+    void bench_rgba8888_to_argb4444_twiddled() {
+        upload(GL_ARGB4444_TWID_KOS, GL_RGBA, GL_UNSIGNED_BYTE);
+    }
+
+    void bench_a8_to_argb4444() {
+        upload(GL_ARGB4444_KOS, GL_ALPHA, GL_UNSIGNED_BYTE);
+    }
+
+    void bench_a8_to_argb4444_twiddled() {
+        upload(GL_ARGB4444_TWID_KOS, GL_ALPHA, GL_UNSIGNED_BYTE);
+    }
+
+    void bench_rgba4444_to_argb4444() {
+        upload(GL_ARGB4444_KOS, GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4);
+    }
+
+    void bench_rgba4444_to_argb4444_twiddled() {
+        upload(GL_ARGB4444_TWID_KOS, GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4);
+    }
+
+    void bench_argb4444_copy() {
+        upload(GL_ARGB4444_KOS, GL_BGRA, GL_UNSIGNED_SHORT_4_4_4_4_REV);
+    }
+
+    void bench_argb4444_twiddled() {
+        upload(GL_ARGB4444_TWID_KOS, GL_BGRA, GL_UNSIGNED_SHORT_4_4_4_4_REV);
+    }
+
+    void bench_argb4444_pretwiddled_copy() {
+        upload(GL_ARGB4444_TWID_KOS, GL_BGRA, GL_UNSIGNED_SHORT_4_4_4_4_REV_TWID_KOS);
+    }
+
+    void bench_argb1555_to_argb4444() {
+        upload(GL_ARGB4444_KOS, GL_BGRA, GL_UNSIGNED_SHORT_1_5_5_5_REV);
+    }
+
+    void bench_argb1555_to_argb4444_twiddled() {
+        upload(GL_ARGB4444_TWID_KOS, GL_BGRA, GL_UNSIGNED_SHORT_1_5_5_5_REV);
+    }
+
+    void bench_argb1555_copy() {
+        upload(GL_ARGB1555_KOS, GL_BGRA, GL_UNSIGNED_SHORT_1_5_5_5_REV);
+    }
+
+    void bench_argb1555_twiddled() {
+        upload(GL_ARGB1555_TWID_KOS, GL_BGRA, GL_UNSIGNED_SHORT_1_5_5_5_REV);
+    }
+
+    void bench_argb1555_pretwiddled_copy() {
+        upload(GL_ARGB1555_TWID_KOS, GL_BGRA, GL_UNSIGNED_SHORT_1_5_5_5_REV_TWID_KOS);
+    }
+
+    void bench_r8_to_rgb565() {
+        upload(GL_RGB565_KOS, GL_RED, GL_UNSIGNED_BYTE);
+    }
+
+    void bench_r8_to_rgb565_twiddled() {
+        upload(GL_RGB565_TWID_KOS, GL_RED, GL_UNSIGNED_BYTE);
+    }
+
+    void bench_rgb888_to_rgb565() {
+        upload(GL_RGB565_KOS, GL_RGB, GL_UNSIGNED_BYTE);
+    }
+
+    void bench_rgb888_to_rgb565_twiddled() {
+        upload(GL_RGB565_TWID_KOS, GL_RGB, GL_UNSIGNED_BYTE);
+    }
+
+    void bench_rgba8888_to_rgb565() {
+        upload(GL_RGB565_KOS, GL_RGBA, GL_UNSIGNED_BYTE);
+    }
+
+    void bench_rgba8888_to_rgb565_twiddled() {
+        upload(GL_RGB565_TWID_KOS, GL_RGBA, GL_UNSIGNED_BYTE);
+    }
+
+    void bench_rgb565_copy() {
+        upload(GL_RGB565_KOS, GL_RGB, GL_UNSIGNED_SHORT_5_6_5);
+    }
+
+    void bench_rgb565_twiddled() {
+        upload(GL_RGB565_TWID_KOS, GL_RGB, GL_UNSIGNED_SHORT_5_6_5);
+    }
+
+    void bench_rgb565_pretwiddled_copy() {
+        upload(GL_RGB565_TWID_KOS, GL_RGB, GL_UNSIGNED_SHORT_5_6_5_TWID_KOS);
+    }
+
+    /* Paletted textures are always stored twiddled */
+    void bench_index8() {
+        upload(GL_COLOR_INDEX8_EXT, GL_COLOR_INDEX, GL_UNSIGNED_BYTE);
+    }
+
+    void bench_index8_to_index4_pack() {
+        upload(GL_COLOR_INDEX4_EXT, GL_COLOR_INDEX, GL_UNSIGNED_BYTE);
+    }
+
+    void bench_index4() {
+        upload(GL_COLOR_INDEX4_EXT, GL_COLOR_INDEX4_EXT, GL_UNSIGNED_BYTE);
+    }
+};
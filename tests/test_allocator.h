@@ -222,4 +222,162 @@ public:
         assert_is_not_null(alloc_malloc(pool, 64));
     }
 
+    void test_free_releases_whole_allocation() {
+        alloc_init(pool, POOL_SIZE);
+
+        /* Three adjacent allocations, freeing the middle one must only
+         * release its own sub-blocks */
+        void* a1 = alloc_malloc(pool, 512);
+        void* a2 = alloc_malloc(pool, 768);
+        void* a3 = alloc_malloc(pool, 256);
+
+        assert_equal((uint8_t*) a2, (uint8_t*) a1 + 512);
+        assert_equal((uint8_t*) a3, (uint8_t*) a2 + 768);
+
+        alloc_free(pool, a2);
+        assert_equal(alloc_count_free(pool), POOL_SIZE - 768);
+
+        /* The hole is reused by something that fits it exactly */
+        assert_equal(alloc_malloc(pool, 700), a2);
+
+        alloc_free(pool, a1);
+        alloc_free(pool, a2);
+        alloc_free(pool, a3);
+        assert_equal(alloc_count_free(pool), POOL_SIZE);
+        assert_equal(alloc_count_continuous(pool), POOL_SIZE);
+    }
+
+    void test_large_alloc_uses_partially_free_tail() {
+        alloc_init(pool, POOL_SIZE);
+
+        uint8_t* base = (uint8_t*) alloc_base_address(pool);
+
+        /* Fill the first block except for its first two sub-blocks */
+        void* a1 = alloc_malloc(pool, 512);
+        alloc_malloc(pool, 1536);
+        alloc_free(pool, a1);
+
+        /* 2.5k needs an aligned start, block 0 isn't entirely free so it
+         * must go at block 1 */
+        void* a2 = alloc_malloc(pool, 2560);
+        assert_equal(a2, base + 2048);
+
+        /* Small allocations still find the gap in block 0 */
+        assert_equal(alloc_malloc(pool, 300), base);
+    }
+
+    void test_churn() {
+        uint8_t* large_pool = (uint8_t*) malloc(8 * 1024 * 1024);
+        alloc_init(large_pool, 8 * 1024 * 1024);
+
+        const size_t initial = alloc_count_free(large_pool);
+        uint8_t* base = (uint8_t*) alloc_base_address(large_pool);
+
+        void* live[64] = {0};
+        uint32_t seed = 1234;
+
+        for(int i = 0; i < 4096; ++i) {
+            seed = seed * 1103515245 + 12345;
+            int slot = (seed >> 16) % 64;
+
+            if(live[slot]) {
+                alloc_free(large_pool, live[slot]);
+                live[slot] = NULL;
+            } else {
+                size_t size = 128 << ((seed >> 8) % 11);
+                live[slot] = alloc_malloc(large_pool, size);
+                assert_is_not_null(live[slot]);
+
+                if(size >= 2048) {
+                    assert_equal(((uint8_t*) live[slot] - base) % 2048, 0);
+                }
+            }
+        }
+
+        for(int i = 0; i < 64; ++i) {
+            if(live[i]) {
+                alloc_free(large_pool, live[i]);
+            }
+        }
+
+        assert_equal(alloc_count_free(large_pool), initial);
+        assert_equal(alloc_count_continuous(large_pool), initial);
+
+        alloc_shutdown(large_pool);
+        free(large_pool);
+    }
+
+    void test_incremental_defrag() {
+        alloc_init(pool, POOL_SIZE);
+        defrag_moves.clear();
+
+        void* a1 = alloc_malloc(pool, 2048);
+        void* a2 = alloc_malloc(pool, 2048);
+        void* a3 = alloc_malloc(pool, 2048);
+        void* a4 = alloc_malloc(pool, 4096);
+
+        alloc_free(pool, a1);
+        alloc_free(pool, a2);
+
+        /* Too small a budget to move anything */
+        assert_equal(alloc_run_defrag_incremental(pool, &AllocatorTests::on_defrag, 1024, this), 0u);
+        assert_equal(defrag_moves.size(), 0u);
+
+        /* One allocation per call */
+        assert_equal(alloc_run_defrag_incremental(pool, &AllocatorTests::on_defrag, 2048, this), 2048u);
+        assert_equal(defrag_moves.size(), 1u);
+        assert_equal(defrag_moves[0].first, a3);
+        assert_equal(defrag_moves[0].second, a1);
+
+        /* a4 doesn't fit the budget, so is left where it is */
+        assert_equal(alloc_run_defrag_incremental(pool, &AllocatorTests::on_defrag, 2048, this), 0u);
+
+        /* ...until the budget grows */
+        assert_equal(alloc_run_defrag_incremental(pool, &AllocatorTests::on_defrag, 4096, this), 4096u);
+        assert_equal(defrag_moves.size(), 2u);
+        assert_equal(defrag_moves[1].first, a4);
+        assert_equal(defrag_moves[1].second, a2);
+
+        assert_equal(alloc_run_defrag_incremental(pool, &AllocatorTests::on_defrag, 4096, this), 0u);
+        assert_equal(alloc_count_continuous(pool), POOL_SIZE - (3 * 2048));
+
+        /* The moved allocations can be freed from their new addresses */
+        alloc_free(pool, a1);
+        alloc_free(pool, a2);
+        assert_equal(alloc_count_free(pool), POOL_SIZE);
+    }
+
+    void test_incremental_defrag_moves_each_allocation_once_per_step() {
+        alloc_init(pool, POOL_SIZE);
+        defrag_moves.clear();
+
+        /* Fill the first block, then two holes in front of one small
+         * allocation */
+        void* small[11];
+        for(int i = 0; i < 11; ++i) {
+            small[i] = alloc_malloc(pool, 256);
+        }
+
+        alloc_free(pool, small[8]);
+        alloc_free(pool, small[9]);
+
+        /* Enough budget to carry on into a second pass over the pool */
+        alloc_run_defrag_incremental(pool, &AllocatorTests::on_defrag, 1024, this);
+
+        assert_equal(defrag_moves.size(), 1u);
+        assert_equal(defrag_moves[0].first, small[10]);
+        assert_equal(defrag_moves[0].second, small[8]);
+        assert_equal(alloc_count_free(pool), POOL_SIZE - (9 * 256));
+
+        /* Still consistent enough for a full defrag */
+        alloc_run_defrag(pool, &AllocatorTests::on_defrag, 5, this);
+        assert_equal(alloc_count_free(pool), POOL_SIZE - (9 * 256));
+
+        for(int i = 0; i < 9; ++i) {
+            alloc_free(pool, small[i]);
+        }
+
+        assert_equal(alloc_count_free(pool), POOL_SIZE);
+    }
+
 };
@@ -0,0 +1,110 @@
+#include "tools/test.h"
+#include "tools/gl_test.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <GL/gl.h>
+#include <GL/glkos.h>
+
+#include "GL/frame_capture.h"
+
+class FrameCaptureTests : public GLTestCase {
+public:
+    static std::vector<GLubyte> read_file(const char* filename) {
+        std::vector<GLubyte> contents;
+        FILE* file = fopen(filename, "rb");
+
+        if(file) {
+            GLubyte buffer[512];
+            size_t read;
+            while((read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+                contents.insert(contents.end(), buffer, buffer + read);
+            }
+
+            fclose(file);
+        }
+
+        return contents;
+    }
+
+    void test_capture_contains_lists_and_referenced_textures() {
+        GLushort texels[8 * 8];
+        for(int i = 0; i < 8 * 8; ++i) {
+            texels[i] = (GLushort) (i * 1021);
+        }
+
+        GLuint textures[2];
+        glGenTextures(2, textures);
+
+        /* Only the texture which is drawn with should be captured */
+        glBindTexture(GL_TEXTURE_2D, textures[1]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB565_KOS, 8, 8, 0, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, texels);
+
+        glBindTexture(GL_TEXTURE_2D, textures[0]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB565_KOS, 8, 8, 0, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, texels);
+        glEnable(GL_TEXTURE_2D);
+
+        glBegin(GL_TRIANGLES);
+            glVertex3f(-1.0f, -1.0f, 0.5f);
+            glVertex3f( 1.0f, -1.0f, 0.5f);
+            glVertex3f( 0.0f,  1.0f, 0.5f);
+        glEnd();
+
+        const char* filename = "gldc_capture_test.gfc";
+        glKosCaptureFrames(filename, 1);
+        assert_equal((GLenum) glGetError(), (GLenum) GL_NO_ERROR);
+
+        glKosSwapBuffers();
+        glDeleteTextures(2, textures);
+
+        std::vector<GLubyte> data = read_file(filename);
+        remove(filename);
+
+        FrameCaptureHeader header;
+        FrameCaptureFrame frame;
+        FrameCaptureTexture texture;
+
+        size_t listBytes = 4 * sizeof(Vertex);
+        size_t textureStart = sizeof(header) + sizeof(frame) + FRAME_CAPTURE_PALETTE_ENTRIES * 4 + listBytes;
+
+        assert_true(data.size() >= textureStart + sizeof(texture) + sizeof(texels));
+
+        memcpy(&header, &data[0], sizeof(header));
+        assert_equal(memcmp(header.magic, FRAME_CAPTURE_MAGIC, 4), 0);
+        assert_equal(header.frameCount, 1u);
+        assert_equal(header.vertexSize, (uint32_t) sizeof(Vertex));
+
+        memcpy(&frame, &data[sizeof(header)], sizeof(frame));
+        assert_equal(frame.listSize[0], 4u);
+        assert_equal(frame.listSize[1], 0u);
+        assert_equal(frame.listSize[2], 0u);
+        assert_equal(frame.textureCount, 1u);
+
+        memcpy(&texture, &data[textureStart], sizeof(texture));
+        assert_true(texture.size >= sizeof(texels));
+        assert_equal(data.size(), textureStart + sizeof(texture) + texture.size);
+        assert_equal(memcmp(&data[textureStart + sizeof(texture)], texels, sizeof(texels)), 0);
+    }
+
+    void test_capture_validates_arguments() {
+        glKosCaptureFrames("gldc_capture_test.gfc", 0);
+        assert_equal((GLenum) glGetError(), (GLenum) GL_INVALID_VALUE);
+
+        glKosCaptureFrames("gldc_capture_test.gfc", 2);
+        glKosCaptureFrames("gldc_capture_test.gfc", 1);
+        assert_equal((GLenum) glGetError(), (GLenum) GL_INVALID_OPERATION);
+
+        glKosSwapBuffers();
+        glKosSwapBuffers();
+
+        std::vector<GLubyte> data = read_file("gldc_capture_test.gfc");
+        remove("gldc_capture_test.gfc");
+
+        FrameCaptureHeader header;
+        assert_true(data.size() >= sizeof(header));
+        memcpy(&header, &data[0], sizeof(header));
+        assert_equal(header.frameCount, 2u);
+    }
+};
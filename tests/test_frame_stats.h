@@ -0,0 +1,107 @@
+#include "tools/test.h"
+#include "tools/gl_test.h"
+
+#include <cstdint>
+#include <cstring>
+
+#include <GL/gl.h>
+#include <GL/glkos.h>
+
+class FrameStatsTests : public GLTestCase {
+public:
+    static GLuint& ticks() {
+        static GLuint v = 0;
+        return v;
+    }
+
+    /* Advances one tick every time it's read */
+    static GLuint fake_clock() {
+        return ++ticks();
+    }
+
+    void set_up() {
+        GLTestCase::set_up();
+
+        /* Don't count anything earlier tests left in this frame */
+        glKosSwapBuffers();
+    }
+
+    void tear_down() {
+        glKosSetFrameStatsClock(NULL);
+        GLTestCase::tear_down();
+    }
+
+    static void triangle() {
+        glBegin(GL_TRIANGLES);
+            glVertex3f(-1.0f, -1.0f, 0.5f);
+            glVertex3f( 1.0f, -1.0f, 0.5f);
+            glVertex3f( 0.0f,  1.0f, 0.5f);
+        glEnd();
+    }
+
+    void test_draws_and_headers_are_counted() {
+        triangle();
+        triangle();
+
+        glKosSwapBuffers();
+
+        GLdcFrameStats stats;
+        glKosGetFrameStats(&stats);
+
+        assert_equal(stats.draw_calls, 2u);
+        assert_equal(stats.vertices_in[GL_TRIANGLES], 6u);
+        assert_equal(stats.vertices_out[GL_TRIANGLES], 6u);
+        assert_equal(stats.vertices_in[GL_QUADS], 0u);
+        assert_equal(stats.headers_emitted, 1u);
+        assert_equal(stats.headers_avoided, 1u);
+        assert_equal(stats.list_vertices[0], 7u);
+        assert_equal(stats.list_vertices[2], 0u);
+        assert_equal(stats.triangles_clipped, 0u);
+        assert_equal(stats.triangles_culled, 0u);
+        assert_true(stats.vram_free > 0);
+        assert_true(stats.vram_contiguous <= stats.vram_free);
+    }
+
+    void test_texture_uploads_are_counted() {
+        GLushort data[8 * 8];
+        memset(data, 0, sizeof(data));
+
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB565_KOS, 8, 8, 0, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, data);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 4, 4, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, data);
+
+        glKosSwapBuffers();
+
+        GLdcFrameStats stats;
+        glKosGetFrameStats(&stats);
+        assert_equal(stats.texture_bytes_uploaded, (GLuint) (8 * 8 * 2 + 4 * 4 * 2));
+
+        /* Counters start again from zero each frame */
+        glKosSwapBuffers();
+        glKosGetFrameStats(&stats);
+        assert_equal(stats.texture_bytes_uploaded, 0u);
+
+        glDeleteTextures(1, &texture);
+    }
+
+    void test_timings_use_the_supplied_clock() {
+        GLdcFrameStats stats;
+
+        triangle();
+        glKosSwapBuffers();
+        glKosGetFrameStats(&stats);
+        assert_equal(stats.draw_time, 0u);
+        assert_equal(stats.swap_time, 0u);
+
+        glKosSetFrameStatsClock(fake_clock);
+
+        triangle();
+        glKosSwapBuffers();
+        glKosGetFrameStats(&stats);
+        assert_true(stats.draw_time > 0);
+        assert_true(stats.submit_time > 0);
+        assert_true(stats.swap_time > stats.submit_time);
+    }
+};
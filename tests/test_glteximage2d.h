@@ -4,11 +4,16 @@
 #include "tools/gl_test.h"
 
 #include <cstring>
+#include <vector>
+#include <algorithm>
 #include <stdint.h>
 #include <GL/gl.h>
 #include <GL/glext.h>
 #include <GL/glkos.h>
 
+#include "GL/private.h"
+#include "containers/aligned_vector.h"
+
 
 class TexImage2DTests : public GLTestCase {
 public:
@@ -176,4 +181,329 @@ public:
         glTexImage2D(GL_TEXTURE_2D, 1, GL_RGB, 96, 48, 0, GL_RGB, GL_UNSIGNED_BYTE, stride_image_data);
         assert_equal(glGetError(), GL_INVALID_VALUE);
     }
+
+    void test_defrag_step_updates_texture_pointers() {
+        const GLuint size = 64 * 64 * 2;
+        std::vector<uint16_t> texels(64 * 64);
+
+        GLuint textures[3];
+        glGenTextures(3, textures);
+
+        for(int i = 0; i < 3; ++i) {
+            std::fill(texels.begin(), texels.end(), 0x1111 * (i + 1));
+            glBindTexture(GL_TEXTURE_2D, textures[i]);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB565_KOS, 64, 64, 0, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, texels.data());
+            assert_equal(glGetError(), GL_NO_ERROR);
+        }
+
+        GLuint free_before = _glFreeTextureMemory();
+
+        glDeleteTextures(1, &textures[0]);
+        assert_equal(_glFreeTextureMemory(), free_before + size);
+
+        int steps = 0;
+        GLuint moved;
+        while((moved = glDefragmentTextureMemoryStep_KOS(size))) {
+            assert_true(moved <= size);
+            assert_true(++steps < 1000);
+        }
+
+        assert_equal(glGetError(), GL_NO_ERROR);
+        assert_equal(_glFreeTextureMemory(), free_before + size);
+
+        /* Wherever they ended up, the remaining textures kept their data */
+        for(int i = 1; i < 3; ++i) {
+            glBindTexture(GL_TEXTURE_2D, textures[i]);
+            const uint16_t* data = (const uint16_t*) _glGetBoundTexture()->data;
+            assert_equal(data[0], (uint16_t) (0x1111 * (i + 1)));
+            assert_equal(data[64 * 64 - 1], (uint16_t) (0x1111 * (i + 1)));
+        }
+
+        /* And they free their (possibly new) allocations */
+        glDeleteTextures(2, &textures[1]);
+        assert_equal(_glFreeTextureMemory(), free_before + size * 3);
+    }
+
+    static GLint get_integer(GLenum pname) {
+        GLint value = 0;
+        glGetIntegerv(pname, &value);
+        return value;
+    }
+
+    void test_evictable_textures_are_evicted_and_restored() {
+        /* 1MB each, enough of them to overflow the texture pool */
+        const GLuint size = 1024 * 512 * 2;
+        const GLuint count = (_glFreeTextureMemory() / size) + 2;
+
+        std::vector<uint16_t> texels(1024 * 512);
+        std::vector<GLuint> textures(count);
+        glGenTextures(count, textures.data());
+
+        GLint evictions = get_integer(GL_TEXTURE_EVICTION_COUNT_KOS);
+        GLint restores = get_integer(GL_TEXTURE_RESTORE_COUNT_KOS);
+        GLint thrashes = get_integer(GL_TEXTURE_THRASH_COUNT_KOS);
+        GLint evicted_bytes = get_integer(GL_EVICTED_TEXTURE_MEMORY_KOS);
+
+        for(GLuint i = 0; i < count; ++i) {
+            std::fill(texels.begin(), texels.end(), (uint16_t) (i + 1));
+            glBindTexture(GL_TEXTURE_2D, textures[i]);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_EVICTABLE_KOS, GL_TRUE);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB565_KOS, 1024, 512, 0, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, texels.data());
+            assert_equal(glGetError(), GL_NO_ERROR);
+            assert_is_not_null(_glGetBoundTexture()->data);
+
+            /* Textures used in the current frame can't be evicted */
+            glKosSwapBuffers();
+        }
+
+        assert_true(get_integer(GL_TEXTURE_EVICTION_COUNT_KOS) > evictions);
+        assert_true(get_integer(GL_EVICTED_TEXTURE_MEMORY_KOS) > evicted_bytes);
+
+        /* The first texture was the least recently used so was evicted,
+         * binding it brings it back with its contents */
+        glBindTexture(GL_TEXTURE_2D, textures[0]);
+        TextureObject* first = _glGetBoundTexture();
+        assert_is_not_null(first->data);
+        assert_is_null(first->evictedData);
+        assert_equal(((uint16_t*) first->data)[0], (uint16_t) 1);
+        assert_equal(((uint16_t*) first->data)[1024 * 512 - 1], (uint16_t) 1);
+
+        assert_equal(get_integer(GL_TEXTURE_RESTORE_COUNT_KOS), restores + 1);
+        assert_equal(get_integer(GL_TEXTURE_THRASH_COUNT_KOS), thrashes + 1);
+
+        glDeleteTextures(count, textures.data());
+        assert_equal(get_integer(GL_EVICTED_TEXTURE_MEMORY_KOS), evicted_bytes);
+    }
+
+    /* Restoring happens mid-frame, so it mustn't defragment, and if nothing
+     * can be evicted to make room the texture just stays evicted */
+    void test_restore_without_room_leaves_texture_evicted() {
+        const GLuint size = 1024 * 512 * 2;
+        std::vector<uint16_t> texels(1024 * 512, 0x1234);
+        std::vector<GLuint> textures;
+
+        GLuint evictable;
+        glGenTextures(1, &evictable);
+        glBindTexture(GL_TEXTURE_2D, evictable);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_EVICTABLE_KOS, GL_TRUE);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB565_KOS, 1024, 512, 0, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, texels.data());
+        TextureObject* txr = _glGetBoundTexture();
+        glKosSwapBuffers();
+
+        /* Fill the pool with textures that can't be evicted, the last of
+         * which pushes the evictable one out */
+        while(!txr->evictedData) {
+            GLuint id;
+            glGenTextures(1, &id);
+            glBindTexture(GL_TEXTURE_2D, id);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB565_KOS, 1024, 512, 0, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, texels.data());
+            assert_is_not_null(_glGetBoundTexture()->data);
+            textures.push_back(id);
+        }
+
+        GLint restores = get_integer(GL_TEXTURE_RESTORE_COUNT_KOS);
+        size_t free_before = _glFreeTextureMemory();
+        assert_true(free_before < size);
+
+        glEnable(GL_TEXTURE_2D);
+        glBindTexture(GL_TEXTURE_2D, evictable);
+        draw_textured_triangle();
+        glDisable(GL_TEXTURE_2D);
+
+        assert_is_null(txr->data);
+        assert_is_not_null(txr->evictedData);
+        assert_equal(get_integer(GL_TEXTURE_RESTORE_COUNT_KOS), restores);
+        assert_equal(_glFreeTextureMemory(), free_before);
+        assert_equal(glGetError(), GL_NO_ERROR);
+
+        /* Anything that needs the old image can't have it */
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 8, 8, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, texels.data());
+        assert_equal(glGetError(), GL_OUT_OF_MEMORY);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        assert_equal(glGetError(), GL_OUT_OF_MEMORY);
+        assert_is_not_null(txr->evictedData);
+
+        /* Respecifying it drops the evicted copy instead of restoring it */
+        GLint evicted_bytes = get_integer(GL_EVICTED_TEXTURE_MEMORY_KOS);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB565_KOS, 8, 8, 0, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, texels.data());
+        assert_equal(glGetError(), GL_NO_ERROR);
+        assert_is_null(txr->evictedData);
+        assert_is_not_null(txr->data);
+        assert_equal((int) txr->allocatedSize, 8 * 8 * 2);
+        assert_equal(get_integer(GL_EVICTED_TEXTURE_MEMORY_KOS), evicted_bytes - (GLint) size);
+
+        glEnable(GL_TEXTURE_2D);
+        draw_textured_triangle();
+        glDisable(GL_TEXTURE_2D);
+        assert_equal(((uint16_t*) txr->data)[0], (uint16_t) 0x1234);
+
+        glDeleteTextures(1, &evictable);
+        glDeleteTextures(textures.size(), textures.data());
+    }
+
+    static void draw_textured_triangle() {
+        glBegin(GL_TRIANGLES);
+            glTexCoord2f(0.0f, 0.0f); glVertex3f(-1.0f, -1.0f, 0.5f);
+            glTexCoord2f(1.0f, 0.0f); glVertex3f( 1.0f, -1.0f, 0.5f);
+            glTexCoord2f(0.0f, 1.0f); glVertex3f( 0.0f,  1.0f, 0.5f);
+        glEnd();
+
+        /* Triangles are left pending for the next glBegin, this finishes
+         * them off so they can be read back */
+        glFlush();
+    }
+
+    void test_atlas_members_share_page_and_header() {
+        GLuint atlas = glKosGenTextureAtlas(GL_RGB565_KOS, 64);
+        assert_true(atlas != 0);
+
+        std::vector<uint16_t> a(8 * 8, 0x1111);
+        std::vector<uint16_t> b(16 * 4, 0x2222);
+        b[0] = 0x3333;
+
+        GLuint textures[2];
+        glGenTextures(2, textures);
+
+        glBindTexture(GL_TEXTURE_2D, textures[0]);
+        glKosTexImageAtlas(atlas, 8, 8, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, a.data());
+        TextureObject* first = _glGetBoundTexture();
+
+        glBindTexture(GL_TEXTURE_2D, textures[1]);
+        glKosTexImageAtlas(atlas, 16, 4, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, b.data());
+        TextureObject* second = _glGetBoundTexture();
+        assert_equal(glGetError(), GL_NO_ERROR);
+
+        assert_is_not_null(first->atlasPage);
+        assert_equal(first->atlasPage, second->atlasPage);
+        assert_is_null(second->data);
+        assert_equal((int) second->width, 16);
+        assert_equal((int) second->height, 4);
+
+        /* The image is in the page, with its edges repeated around it */
+        const TextureObject* page = second->atlasPage;
+        const uint16_t* texels = (const uint16_t*) page->data;
+        GLuint x = second->atlasX, y = second->atlasY;
+        assert_equal(texels[y * 64 + x], (uint16_t) 0x3333);
+        assert_equal(texels[(y - 1) * 64 + x - 1], (uint16_t) 0x3333);
+        assert_equal(texels[(y + 3) * 64 + x + 15], (uint16_t) 0x2222);
+        assert_equal(texels[(y + 4) * 64 + x + 16], (uint16_t) 0x2222);
+        assert_equal(texels[first->atlasY * 64 + first->atlasX], (uint16_t) 0x1111);
+
+        /* Drawing with both members needs a single header, and the
+         * texture coordinates are mapped onto each member's region */
+        glEnable(GL_TEXTURE_2D);
+        glBindTexture(GL_TEXTURE_2D, textures[0]);
+        draw_textured_triangle();
+        glBindTexture(GL_TEXTURE_2D, textures[1]);
+        draw_textured_triangle();
+        assert_equal(aligned_vector_size(&OP_LIST.vector), 7u);
+
+        const Vertex* v = (const Vertex*) aligned_vector_at(&OP_LIST.vector, 5);
+        assert_close(v->uv[0], (x + 16) / 64.0f, 0.0001f);
+        assert_close(v->uv[1], y / 64.0f, 0.0001f);
+
+        /* Different filtering means a different header */
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glBindTexture(GL_TEXTURE_2D, textures[0]);
+        draw_textured_triangle();
+        assert_equal(aligned_vector_size(&OP_LIST.vector), 11u);
+
+        glDeleteTextures(2, textures);
+        glKosDeleteTextureAtlas(atlas);
+        assert_equal(glGetError(), GL_NO_ERROR);
+    }
+
+    void test_atlas_member_on_second_unit_maps_st() {
+        GLuint atlas = glKosGenTextureAtlas(GL_RGB565_KOS, 64);
+        std::vector<uint16_t> a(8 * 8, 0x1111);
+
+        GLuint texture;
+        glGenTextures(1, &texture);
+
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glKosTexImageAtlas(atlas, 8, 8, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, a.data());
+        const TextureObject* member = _glGetBoundTexture();
+        glActiveTexture(GL_TEXTURE0);
+
+        glBegin(GL_TRIANGLES);
+            glMultiTexCoord2f(GL_TEXTURE1, 0.0f, 0.0f); glVertex3f(-1.0f, -1.0f, 0.5f);
+            glMultiTexCoord2f(GL_TEXTURE1, 1.0f, 0.0f); glVertex3f( 1.0f, -1.0f, 0.5f);
+            glMultiTexCoord2f(GL_TEXTURE1, 0.0f, 1.0f); glVertex3f( 0.0f,  1.0f, 0.5f);
+        glEnd();
+        glFlush();
+
+        /* The second unit's coordinates are mapped onto its member's region */
+        const Vertex* v = (const Vertex*) aligned_vector_at(&OP_LIST.vector, 2);
+        assert_close(_glUnpackHalfFloat(v->st[0]), (member->atlasX + 8) / 64.0f, 0.001f);
+        assert_close(_glUnpackHalfFloat(v->st[1]), member->atlasY / 64.0f, 0.001f);
+
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glActiveTexture(GL_TEXTURE0);
+
+        glDeleteTextures(1, &texture);
+        glKosDeleteTextureAtlas(atlas);
+        assert_equal(glGetError(), GL_NO_ERROR);
+    }
+
+    /* Square twiddled textures interleave y into the even bits and x
+     * into the odd bits of the texel index */
+    static uint32_t twiddled(uint32_t x, uint32_t y) {
+        uint32_t index = 0;
+        for(int bit = 0; bit < 16; ++bit) {
+            index |= ((y >> bit) & 1) << (bit * 2);
+            index |= ((x >> bit) & 1) << (bit * 2 + 1);
+        }
+        return index;
+    }
+
+    void test_atlas_pages_are_twiddled_and_freed_with_their_members() {
+        GLuint free_before = _glFreeTextureMemory();
+
+        GLuint atlas = glKosGenTextureAtlas(GL_RGB565_TWID_KOS, 32);
+        std::vector<uint16_t> texels(4 * 4, 0x4444);
+
+        GLuint textures[2];
+        glGenTextures(2, textures);
+        glBindTexture(GL_TEXTURE_2D, textures[0]);
+        glKosTexImageAtlas(atlas, 4, 4, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, texels.data());
+        glBindTexture(GL_TEXTURE_2D, textures[1]);
+        glKosTexImageAtlas(atlas, 4, 4, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, texels.data());
+        assert_equal(glGetError(), GL_NO_ERROR);
+        assert_equal(_glFreeTextureMemory(), free_before - 32 * 32 * 2);
+
+        /* The first member sits at 1, 1 inside its border */
+        const uint16_t* page = (const uint16_t*) _glGetBoundTexture()->atlasPage->data;
+        assert_equal(page[twiddled(1, 1)], (uint16_t) 0x4444);
+        assert_equal(page[twiddled(0, 0)], (uint16_t) 0x4444);
+        assert_equal(page[twiddled(12, 12)], (uint16_t) 0);
+
+        /* An atlas with members can't be deleted */
+        glKosDeleteTextureAtlas(atlas);
+        assert_equal(glGetError(), (GLenum) GL_INVALID_OPERATION);
+
+        /* A member given a normal image leaves the atlas */
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB565_KOS, 8, 8, 0, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, image_data);
+        assert_is_null(_glGetBoundTexture()->atlasPage);
+        assert_is_not_null(_glGetBoundTexture()->data);
+
+        glDeleteTextures(2, textures);
+        assert_equal(_glFreeTextureMemory(), free_before);
+
+        glKosDeleteTextureAtlas(atlas);
+        assert_equal(glGetError(), GL_NO_ERROR);
+    }
+
+    void test_atlas_rejects_oversized_images() {
+        GLuint atlas = glKosGenTextureAtlas(GL_ARGB4444_KOS, 16);
+        glKosTexImageAtlas(atlas, 16, 8, GL_RGBA, GL_UNSIGNED_BYTE, image_data);
+        assert_equal(glGetError(), (GLenum) GL_INVALID_VALUE);
+
+        glKosGenTextureAtlas(GL_COLOR_INDEX8_EXT, 16);
+        assert_equal(glGetError(), (GLenum) GL_INVALID_ENUM);
+
+        glKosDeleteTextureAtlas(atlas);
+    }
+
 };
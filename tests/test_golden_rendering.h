@@ -221,6 +221,16 @@ public:
         golden::rasterize_all_lists(img, _glGetBoundTexture());
         assert_true(golden::check(img, "textured_quad"));
 
+        /* The same quad as a sprite must draw the same image */
+        img.clear(0, 0, 0);
+        aligned_vector_clear(&OP_LIST.vector);
+
+        GLSpriteKOS sprite = {-0.8f, -0.8f, 0.0f, 1.6f, 1.6f, 0.0f, 1.0f, 1.0f, 0.0f, 0xFFFFFFFF};
+        glKosDrawSprites(&sprite, 1);
+
+        golden::rasterize_list(img, &OP_LIST, _glGetBoundTexture(), false);
+        assert_true(golden::check(img, "textured_quad"));
+
         glDeleteTextures(1, &tex);
     }
 
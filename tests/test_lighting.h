@@ -0,0 +1,356 @@
+#include "tools/test.h"
+#include "tools/gl_test.h"
+
+#include <GL/gl.h>
+#include <GL/glkos.h>
+
+#include "GL/private.h"
+#include "GL/platform.h"
+#include "containers/aligned_vector.h"
+
+/* _glPerformLighting picks a kernel per draw from the enabled lights, the
+ * viewer model, colour material and whether there's any specular. These
+ * light the same eye-space vertices through the different kernels and
+ * check they agree with each other and with hand-computed results. */
+class LightingTests : public GLTestCase {
+public:
+    static const GLuint VERTEX_COUNT = 4;
+
+    Vertex vertices[VERTEX_COUNT] __attribute__((aligned(32)));
+
+    void set_up() {
+        GLTestCase::set_up();
+
+        for(GLuint i = 0; i < VERTEX_COUNT; ++i) {
+            Vertex* v = &vertices[i];
+            v->flags = GPU_CMD_VERTEX;
+            v->xyz[0] = (GLfloat) i * 0.25f;
+            v->xyz[1] = 0.0f;
+            v->xyz[2] = -2.0f;
+            v->w = 1.0f;
+
+            const GLfloat normal[3] = {0.0f, 0.0f, 1.0f};
+            v->nxyz = _glPackNormal(normal);
+        }
+
+        glEnable(GL_LIGHTING);
+    }
+
+    void tear_down() {
+        const GLfloat ZERO[] = {0.0f, 0.0f, 0.0f, 1.0f};
+        const GLfloat ONE[] = {1.0f, 1.0f, 1.0f, 1.0f};
+        const GLfloat MOSTLY[] = {0.8f, 0.8f, 0.8f, 1.0f};
+        const GLfloat POSITION[] = {0.0f, 0.0f, 1.0f, 0.0f};
+        const GLfloat SPOT_DIRECTION[] = {0.0f, 0.0f, -1.0f};
+
+        glDisable(GL_COLOR_MATERIAL);
+        glDisable(GL_BOUNDING_SPHERE_KOS);
+        glLightModeli(GL_LIGHT_MODEL_LOCAL_VIEWER, GL_FALSE);
+        glLightModeli(GL_LIGHT_MODEL_COLOR_CONTROL, GL_SINGLE_COLOR);
+
+        glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, MOSTLY);
+        glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, ZERO);
+        glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, 0.0f);
+
+        for(GLuint i = 0; i < 2; ++i) {
+            glDisable(GL_LIGHT0 + i);
+            glLightfv(GL_LIGHT0 + i, GL_POSITION, POSITION);
+            glLightfv(GL_LIGHT0 + i, GL_DIFFUSE, (i == 0) ? ONE : ZERO);
+            glLightfv(GL_LIGHT0 + i, GL_SPECULAR, (i == 0) ? ONE : ZERO);
+            glLightfv(GL_LIGHT0 + i, GL_SPOT_DIRECTION, SPOT_DIRECTION);
+            glLightf(GL_LIGHT0 + i, GL_SPOT_CUTOFF, 180.0f);
+            glLightf(GL_LIGHT0 + i, GL_LINEAR_ATTENUATION, 0.0f);
+        }
+
+        glDisable(GL_LIGHTING);
+        GLTestCase::tear_down();
+    }
+
+    /* Lights the batch and returns the red channel of vertex i */
+    GLfloat light(GLuint i) {
+        _glPerformLighting(vertices, VERTEX_COUNT);
+        return vertices[i].argb[R8IDX];
+    }
+
+    /* Light 0 shines straight down the normal (directional light
+     * positions point away from the light), light 1 is a point light in
+     * front of the vertices */
+    void set_up_lights() {
+        const GLfloat ONE[] = {1.0f, 1.0f, 1.0f, 1.0f};
+        const GLfloat HALF[] = {0.5f, 0.5f, 0.5f, 1.0f};
+        const GLfloat DIRECTION[] = {0.0f, 0.0f, -1.0f, 0.0f};
+        const GLfloat POINT[] = {0.5f, 0.5f, 0.0f, 1.0f};
+
+        glLightfv(GL_LIGHT0, GL_POSITION, DIRECTION);
+        glLightfv(GL_LIGHT0, GL_DIFFUSE, ONE);
+
+        glLightfv(GL_LIGHT1, GL_POSITION, POINT);
+        glLightfv(GL_LIGHT1, GL_DIFFUSE, HALF);
+        glLightfv(GL_LIGHT1, GL_SPECULAR, ONE);
+        glLightf(GL_LIGHT1, GL_LINEAR_ATTENUATION, 0.5f);
+    }
+
+    /* Vertex i is a grey of i / 4, for colour material */
+    void set_grey_vertex_colours() {
+        for(GLuint i = 0; i < VERTEX_COUNT; ++i) {
+            GLfloat grey = (GLfloat) i * 0.25f;
+            vertices[i].argb[0] = vertices[i].argb[1] = grey;
+            vertices[i].argb[2] = vertices[i].argb[3] = grey;
+        }
+    }
+
+    void test_directional_diffuse() {
+        set_up_lights();
+        glEnable(GL_LIGHT0);
+
+        /* Scene ambient (0.2 * 0.2) + full diffuse (0.8) */
+        assert_close(0.84f, light(0), 0.01f);
+        assert_close(0.84f, light(3), 0.01f);
+    }
+
+    void test_mixed_lights_are_the_sum_of_each() {
+        set_up_lights();
+        const GLfloat base = 0.04f;
+
+        for(GLuint i = 0; i < VERTEX_COUNT; ++i) {
+            glEnable(GL_LIGHT0);
+            glDisable(GL_LIGHT1);
+            GLfloat directional = light(i) - base;
+
+            glDisable(GL_LIGHT0);
+            glEnable(GL_LIGHT1);
+            GLfloat point = light(i) - base;
+
+            glEnable(GL_LIGHT0);
+            assert_close(base + directional + point, light(i), 0.001f);
+        }
+    }
+
+    void test_specular_only_when_present() {
+        set_up_lights();
+        glEnable(GL_LIGHT0);
+
+        GLfloat diffuse = light(0);
+
+        /* Light 0 has specular, but the material has none */
+        glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, 8.0f);
+        assert_close(diffuse, light(0), 0.0001f);
+
+        const GLfloat SPECULAR[] = {0.5f, 0.5f, 0.5f, 1.0f};
+        glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, SPECULAR);
+
+        /* N == H for an infinite viewer, so it's the full specular */
+        assert_close(diffuse + 0.5f, light(0), 0.02f);
+    }
+
+    void test_local_viewer_changes_specular() {
+        set_up_lights();
+        glEnable(GL_LIGHT0);
+
+        const GLfloat SPECULAR[] = {0.5f, 0.5f, 0.5f, 1.0f};
+        glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, SPECULAR);
+        glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, 64.0f);
+
+        GLfloat infinite = light(3);
+
+        glLightModeli(GL_LIGHT_MODEL_LOCAL_VIEWER, GL_TRUE);
+        GLfloat local = light(3);
+
+        /* Vertex 3 is off to the side, so the view vector and N differ */
+        assert_true(local < infinite - 0.01f);
+
+        /* Straight in front of the eye they're the same */
+        assert_close(infinite, light(0), 0.02f);
+    }
+
+    void test_spot_outside_cutoff_adds_nothing() {
+        set_up_lights();
+        glEnable(GL_LIGHT1);
+
+        const GLfloat AWAY[] = {0.0f, 1.0f, 0.0f};
+        glLightfv(GL_LIGHT1, GL_SPOT_DIRECTION, AWAY);
+        glLightf(GL_LIGHT1, GL_SPOT_CUTOFF, 10.0f);
+
+        assert_close(0.04f, light(0), 0.0001f);
+    }
+
+    void test_color_material_uses_vertex_colour() {
+        set_up_lights();
+        glEnable(GL_LIGHT0);
+
+        glColorMaterial(GL_FRONT_AND_BACK, GL_DIFFUSE);
+        glEnable(GL_COLOR_MATERIAL);
+
+        set_grey_vertex_colours();
+        _glPerformLighting(vertices, VERTEX_COUNT);
+
+        for(GLuint i = 0; i < VERTEX_COUNT; ++i) {
+            assert_close(0.04f + (GLfloat) i * 0.25f, vertices[i].argb[R8IDX], 0.01f);
+        }
+    }
+
+    /* The vertices span x = 0 to 0.75 at z = -2 */
+    void enable_bounding_sphere() {
+        glKosBoundingSphere(0.375f, 0.0f, -2.0f, 0.375f);
+        glEnable(GL_BOUNDING_SPHERE_KOS);
+    }
+
+    void test_bounding_sphere_keeps_reachable_lights() {
+        set_up_lights();
+        glEnable(GL_LIGHT0);
+        glEnable(GL_LIGHT1);
+
+        GLfloat unculled[VERTEX_COUNT];
+        for(GLuint i = 0; i < VERTEX_COUNT; ++i) {
+            unculled[i] = light(i);
+        }
+
+        enable_bounding_sphere();
+        for(GLuint i = 0; i < VERTEX_COUNT; ++i) {
+            assert_close(unculled[i], light(i), 0.0001f);
+        }
+    }
+
+    void test_bounding_sphere_drops_unreachable_lights() {
+        set_up_lights();
+        glEnable(GL_LIGHT1);
+        enable_bounding_sphere();
+
+        /* Out of range of the whole sphere */
+        const GLfloat FAR[] = {0.0f, 0.0f, 12.0f, 1.0f};
+        glLightfv(GL_LIGHT1, GL_POSITION, FAR);
+        assert_close(0.04f, light(0), 0.0001f);
+
+        /* A spot in range, but pointing away */
+        const GLfloat NEAR[] = {0.5f, 0.5f, 0.0f, 1.0f};
+        const GLfloat AWAY[] = {0.0f, 0.0f, 1.0f};
+        glLightfv(GL_LIGHT1, GL_POSITION, NEAR);
+        glLightfv(GL_LIGHT1, GL_SPOT_DIRECTION, AWAY);
+        glLightf(GL_LIGHT1, GL_SPOT_CUTOFF, 45.0f);
+        assert_close(0.04f, light(0), 0.0001f);
+
+        /* The same spot pointing at the sphere still lights it */
+        const GLfloat TOWARDS[] = {0.0f, 0.0f, -1.0f};
+        glLightfv(GL_LIGHT1, GL_SPOT_DIRECTION, TOWARDS);
+        assert_true(light(0) > 0.1f);
+    }
+
+    void test_distant_point_light_becomes_directional() {
+        set_up_lights();
+        glEnable(GL_LIGHT1);
+
+        const GLfloat DISTANT[] = {0.0f, 0.0f, 5.0f, 1.0f};
+        glLightfv(GL_LIGHT1, GL_POSITION, DISTANT);
+
+        GLfloat point = light(0);
+        assert_true(light(3) < point);
+
+        /* A small sphere around vertex 0, seven units from the light */
+        glKosBoundingSphere(0.0f, 0.0f, -2.0f, 0.1f);
+        glEnable(GL_BOUNDING_SPHERE_KOS);
+
+        /* Lit from the sphere's centre, so every vertex matches vertex 0 */
+        assert_close(point, light(0), 0.001f);
+        assert_close(point, light(3), 0.001f);
+    }
+
+    void test_distant_point_light_follows_colour_material() {
+        set_up_lights();
+        glEnable(GL_LIGHT1);
+
+        const GLfloat DISTANT[] = {0.0f, 0.0f, 5.0f, 1.0f};
+        glLightfv(GL_LIGHT1, GL_POSITION, DISTANT);
+
+        glColorMaterial(GL_FRONT_AND_BACK, GL_DIFFUSE);
+        glEnable(GL_COLOR_MATERIAL);
+
+        GLfloat unculled[VERTEX_COUNT];
+        set_grey_vertex_colours();
+        _glPerformLighting(vertices, VERTEX_COUNT);
+        for(GLuint i = 0; i < VERTEX_COUNT; ++i) {
+            unculled[i] = vertices[i].argb[R8IDX];
+        }
+
+        glKosBoundingSphere(0.0f, 0.0f, -2.0f, 0.1f);
+        glEnable(GL_BOUNDING_SPHERE_KOS);
+
+        /* Each vertex's colour must reach the light, not the material
+         * left over from the last batch */
+        set_grey_vertex_colours();
+        _glPerformLighting(vertices, VERTEX_COUNT);
+        for(GLuint i = 0; i < VERTEX_COUNT; ++i) {
+            assert_close(unculled[i], vertices[i].argb[R8IDX], 0.001f);
+        }
+    }
+
+    void test_bounding_sphere_errors() {
+        assert_false(glIsEnabled(GL_BOUNDING_SPHERE_KOS));
+        glEnable(GL_BOUNDING_SPHERE_KOS);
+        assert_true(glIsEnabled(GL_BOUNDING_SPHERE_KOS));
+
+        glKosBoundingSphere(0.0f, 0.0f, 0.0f, -1.0f);
+        assert_equal((GLenum) GL_INVALID_VALUE, glGetError());
+    }
+
+    void test_separate_specular_goes_to_offset_colour() {
+        set_up_lights();
+        glEnable(GL_LIGHT0);
+
+        GLfloat diffuse = light(0);
+
+        const GLfloat SPECULAR[] = {0.5f, 0.5f, 0.5f, 1.0f};
+        glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, SPECULAR);
+        glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, 8.0f);
+
+        glLightModeli(GL_LIGHT_MODEL_COLOR_CONTROL, GL_SEPARATE_SPECULAR_COLOR);
+        assert_close(diffuse, light(0), 0.0001f);
+        assert_close(0.5f, vertices[0].offset_rgb[0], 0.02f);
+        assert_close(0.5f, vertices[0].offset_rgb[2], 0.02f);
+    }
+
+    void test_separate_specular_without_specular_clears_offset_colour() {
+        set_up_lights();
+        glEnable(GL_LIGHT0);
+        glLightModeli(GL_LIGHT_MODEL_COLOR_CONTROL, GL_SEPARATE_SPECULAR_COLOR);
+
+        for(GLuint i = 0; i < VERTEX_COUNT; ++i) {
+            vertices[i].offset_rgb[0] = vertices[i].offset_rgb[1] = vertices[i].offset_rgb[2] = 1.0f;
+        }
+
+        light(0);
+
+        for(GLuint i = 0; i < VERTEX_COUNT; ++i) {
+            assert_equal(0.0f, vertices[i].offset_rgb[0]);
+            assert_equal(0.0f, vertices[i].offset_rgb[2]);
+        }
+    }
+
+    static uint32_t draw_and_get_header_cmd() {
+        glBegin(GL_TRIANGLES);
+            glNormal3f(0.0f, 0.0f, 1.0f);
+            glVertex3f(0.0f, 0.0f, 0.5f);
+            glVertex3f(0.5f, 0.0f, 0.5f);
+            glVertex3f(0.0f, 0.5f, 0.5f);
+        glEnd();
+
+        uint32_t size = aligned_vector_size(&OP_LIST.vector);
+        return ((const PolyHeader*) aligned_vector_at(&OP_LIST.vector, size - 4))->cmd;
+    }
+
+    void test_separate_specular_enables_header_offset_colour() {
+        set_up_lights();
+        glEnable(GL_LIGHT0);
+
+        assert_equal(0u, draw_and_get_header_cmd() & GPU_TA_CMD_SPECULAR_MASK);
+
+        glLightModeli(GL_LIGHT_MODEL_COLOR_CONTROL, GL_SEPARATE_SPECULAR_COLOR);
+        assert_equal((uint32_t) GPU_TA_CMD_SPECULAR_MASK, draw_and_get_header_cmd() & GPU_TA_CMD_SPECULAR_MASK);
+
+        /* Unlit draws have no offset colour */
+        glDisable(GL_LIGHTING);
+        assert_equal(0u, draw_and_get_header_cmd() & GPU_TA_CMD_SPECULAR_MASK);
+
+        glLightModeli(GL_LIGHT_MODEL_COLOR_CONTROL, GL_FALSE);
+        assert_equal((GLenum) GL_INVALID_ENUM, glGetError());
+    }
+};
@@ -0,0 +1,60 @@
+#include "tools/test.h"
+#include "tools/gl_test.h"
+
+#include <GL/gl.h>
+#include <GL/glkos.h>
+
+#include "GL/private.h"
+#include "containers/aligned_vector.h"
+
+/* The combined modelview-projection matrix is cached between draws, so each
+ * of these changes the matrices between two draws and checks the second one
+ * didn't reuse a stale transform. */
+class MatrixCacheTests : public GLTestCase {
+public:
+    /* Draws a triangle with its first vertex at the origin and returns where
+     * that vertex ended up on screen */
+    static float draw_origin_x() {
+        glBegin(GL_TRIANGLES);
+            glVertex3f(0.0f, 0.0f, 0.5f);
+            glVertex3f(0.5f, 0.0f, 0.5f);
+            glVertex3f(0.0f, 0.5f, 0.5f);
+        glEnd();
+        glFlush();
+
+        uint32_t size = aligned_vector_size(&OP_LIST.vector);
+        const Vertex* v = (const Vertex*) aligned_vector_at(&OP_LIST.vector, size - 3);
+        return v->xyz[0];
+    }
+
+    void test_modelview_change_between_draws() {
+        assert_close(320.0f, draw_origin_x(), 0.001f);
+
+        glTranslatef(0.5f, 0.0f, 0.0f);
+        assert_close(480.0f, draw_origin_x(), 0.001f);
+
+        glLoadIdentity();
+        assert_close(320.0f, draw_origin_x(), 0.001f);
+    }
+
+    void test_pop_restores_previous_transform() {
+        glPushMatrix();
+            glTranslatef(-0.5f, 0.0f, 0.0f);
+            assert_close(160.0f, draw_origin_x(), 0.001f);
+        glPopMatrix();
+
+        assert_close(320.0f, draw_origin_x(), 0.001f);
+    }
+
+    void test_projection_and_viewport_changes_between_draws() {
+        assert_close(320.0f, draw_origin_x(), 0.001f);
+
+        glMatrixMode(GL_PROJECTION);
+        glTranslatef(0.25f, 0.0f, 0.0f);
+        glMatrixMode(GL_MODELVIEW);
+        assert_close(400.0f, draw_origin_x(), 0.001f);
+
+        glViewport(0, 0, 320, 480);
+        assert_close(200.0f, draw_origin_x(), 0.001f);
+    }
+};
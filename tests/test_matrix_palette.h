@@ -0,0 +1,223 @@
+#include "tools/test.h"
+#include "tools/gl_test.h"
+
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include <GL/glkos.h>
+
+#include "GL/private.h"
+#include "containers/aligned_vector.h"
+
+/* ARB_matrix_palette skinning. Palette entry 1 translates by half the
+ * screen width, so a vertex at the origin lands at x == 480 when it's fully
+ * bound to it and at 320 when it's bound to the untouched entry 0. */
+class MatrixPaletteTests : public GLTestCase {
+public:
+    GLfloat positions[9] = {
+        0.0f, 0.0f, 0.5f,
+        0.5f, 0.0f, 0.5f,
+        0.0f, 0.5f, 0.5f
+    };
+
+    GLfloat weights[6] = {};
+    GLubyte matrices[6] = {};
+
+    void set_up() {
+        GLTestCase::set_up();
+
+        for(GLint i = 0; i < 2; ++i) {
+            glCurrentPaletteMatrixARB(i);
+            glMatrixMode(GL_MATRIX_PALETTE_ARB);
+            glLoadIdentity();
+        }
+
+        glCurrentPaletteMatrixARB(1);
+        glTranslatef(0.5f, 0.0f, 0.0f);
+        glMatrixMode(GL_MODELVIEW);
+
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_WEIGHT_ARRAY_ARB);
+        glEnableClientState(GL_MATRIX_INDEX_ARRAY_ARB);
+        glVertexPointer(3, GL_FLOAT, 0, positions);
+        glWeightPointerARB(2, GL_FLOAT, 0, weights);
+        glMatrixIndexPointerARB(2, GL_UNSIGNED_BYTE, 0, matrices);
+
+        glEnable(GL_MATRIX_PALETTE_ARB);
+    }
+
+    void tear_down() {
+        glDisable(GL_MATRIX_PALETTE_ARB);
+        glDisableClientState(GL_WEIGHT_ARRAY_ARB);
+        glDisableClientState(GL_MATRIX_INDEX_ARRAY_ARB);
+        glDisableClientState(GL_VERTEX_ARRAY);
+
+        GLTestCase::tear_down();
+    }
+
+    /* Every vertex gets the same two units */
+    void bind(GLubyte m0, GLfloat w0, GLubyte m1, GLfloat w1) {
+        for(GLuint i = 0; i < 3; ++i) {
+            matrices[i * 2] = m0;
+            matrices[i * 2 + 1] = m1;
+            weights[i * 2] = w0;
+            weights[i * 2 + 1] = w1;
+        }
+    }
+
+    static const Vertex* last_triangle() {
+        uint32_t size = aligned_vector_size(&OP_LIST.vector);
+        return (const Vertex*) aligned_vector_at(&OP_LIST.vector, size - 3);
+    }
+
+    void test_single_weight() {
+        bind(1, 1.0f, 0, 0.0f);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+
+        assert_close(480.0f, last_triangle()->xyz[0], 0.001f);
+        assert_equal((GLenum) GL_NO_ERROR, glGetError());
+    }
+
+    void test_weights_blend_matrices() {
+        bind(0, 0.5f, 1, 0.5f);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+
+        assert_close(400.0f, last_triangle()->xyz[0], 0.001f);
+    }
+
+    void test_unsigned_byte_weights() {
+        GLubyte ub_weights[6] = {64, 191, 64, 191, 64, 191};
+        matrices[0] = matrices[2] = matrices[4] = 1;
+        matrices[1] = matrices[3] = matrices[5] = 0;
+
+        glWeightPointerARB(2, GL_UNSIGNED_BYTE, 0, ub_weights);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+
+        assert_close(320.0f + 160.0f * (64.0f / 255.0f), last_triangle()->xyz[0], 0.01f);
+    }
+
+    void test_per_vertex_matrices() {
+        bind(0, 1.0f, 0, 0.0f);
+        matrices[2] = 1;  /* Only the second vertex moves */
+
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+
+        const Vertex* v = last_triangle();
+        assert_close(320.0f, v[0].xyz[0], 0.001f);
+        assert_close(640.0f, v[1].xyz[0], 0.001f);
+        assert_close(320.0f, v[2].xyz[0], 0.001f);
+    }
+
+    void test_elements_use_source_vertex_units() {
+        bind(0, 1.0f, 0, 0.0f);
+        matrices[0] = 1;  /* Source vertex 0, drawn last */
+
+        const GLubyte indices[] = {1, 2, 0};
+        glDrawElements(GL_TRIANGLES, 3, GL_UNSIGNED_BYTE, indices);
+
+        const Vertex* v = last_triangle();
+        assert_close(480.0f, v[0].xyz[0], 0.001f);
+        assert_close(320.0f, v[1].xyz[0], 0.001f);
+        assert_close(480.0f, v[2].xyz[0], 0.001f);
+    }
+
+    void test_palette_replaces_modelview() {
+        bind(1, 1.0f, 0, 0.0f);
+        glTranslatef(-0.5f, 0.0f, 0.0f);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+
+        assert_close(480.0f, last_triangle()->xyz[0], 0.001f);
+    }
+
+    void test_disabled_palette_uses_modelview() {
+        bind(1, 1.0f, 0, 0.0f);
+        glDisable(GL_MATRIX_PALETTE_ARB);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+
+        assert_close(320.0f, last_triangle()->xyz[0], 0.001f);
+    }
+
+    void test_projection_and_palette_changes_between_draws() {
+        bind(1, 1.0f, 0, 0.0f);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        assert_close(480.0f, last_triangle()->xyz[0], 0.001f);
+
+        glMatrixMode(GL_PROJECTION);
+        glTranslatef(0.25f, 0.0f, 0.0f);
+        glMatrixMode(GL_MODELVIEW);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        assert_close(560.0f, last_triangle()->xyz[0], 0.001f);
+
+        glMatrixMode(GL_MATRIX_PALETTE_ARB);
+        glPushMatrix();
+            glLoadIdentity();
+            glMatrixMode(GL_MODELVIEW);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+            assert_close(400.0f, last_triangle()->xyz[0], 0.001f);
+            glMatrixMode(GL_MATRIX_PALETTE_ARB);
+        glPopMatrix();
+        glMatrixMode(GL_MODELVIEW);
+
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        assert_close(560.0f, last_triangle()->xyz[0], 0.001f);
+    }
+
+    void test_lit_vertices_are_skinned() {
+        bind(1, 1.0f, 0, 0.0f);
+        glEnable(GL_LIGHTING);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glDisable(GL_LIGHTING);
+
+        assert_close(480.0f, last_triangle()->xyz[0], 0.001f);
+    }
+
+    void test_palette_matrix_mode_leaves_modelview() {
+        glCurrentPaletteMatrixARB(1);
+        glMatrixMode(GL_MATRIX_PALETTE_ARB);
+        glTranslatef(0.5f, 0.0f, 0.0f);
+        glMatrixMode(GL_MODELVIEW);
+
+        assert_true(_glIsIdentity(_glGetModelViewMatrix()));
+
+        bind(1, 1.0f, 0, 0.0f);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        assert_close(640.0f, last_triangle()->xyz[0], 0.001f);
+    }
+
+    void test_limits_and_errors() {
+        GLint value = 0;
+
+        glGetIntegerv(GL_MAX_PALETTE_MATRICES_ARB, &value);
+        assert_equal(MAX_GLDC_PALETTE_MATRICES, value);
+
+        glGetIntegerv(GL_MAX_VERTEX_UNITS_ARB, &value);
+        assert_equal(MAX_GLDC_VERTEX_UNITS, value);
+
+        glGetIntegerv(GL_CURRENT_PALETTE_MATRIX_ARB, &value);
+        assert_equal(1, value);
+
+        assert_true(glIsEnabled(GL_MATRIX_PALETTE_ARB));
+
+        glCurrentPaletteMatrixARB(MAX_GLDC_PALETTE_MATRICES);
+        assert_equal((GLenum) GL_INVALID_VALUE, glGetError());
+
+        glWeightPointerARB(MAX_GLDC_VERTEX_UNITS + 1, GL_FLOAT, 0, weights);
+        assert_equal((GLenum) GL_INVALID_VALUE, glGetError());
+
+        glMatrixIndexPointerARB(2, GL_FLOAT, 0, matrices);
+        assert_equal((GLenum) GL_INVALID_ENUM, glGetError());
+
+        glMatrixMode(GL_MATRIX_PALETTE_ARB);
+        for(GLint i = 1; i < MAX_GLDC_PALETTE_STACK_DEPTH; ++i) {
+            glPushMatrix();
+        }
+        assert_equal((GLenum) GL_NO_ERROR, glGetError());
+
+        glPushMatrix();
+        assert_equal((GLenum) GL_STACK_OVERFLOW, glGetError());
+
+        for(GLint i = 1; i < MAX_GLDC_PALETTE_STACK_DEPTH; ++i) {
+            glPopMatrix();
+        }
+        glMatrixMode(GL_MODELVIEW);
+    }
+};
@@ -0,0 +1,78 @@
+#include "tools/test.h"
+
+#include <cstdint>
+#include <malloc.h>
+
+#include <GL/gl.h>
+#include <GL/glkos.h>
+
+#include "GL/memory.h"
+
+class MemoryTests : public test::TestCase {
+public:
+    static int& allocations() {
+        static int v = 0;
+        return v;
+    }
+
+    static void* counting_alloc(size_t size, size_t alignment, void*) {
+        allocations()++;
+        return memalign(alignment, size);
+    }
+
+    static void counting_free(void* ptr, void*) {
+        free(ptr);
+    }
+
+    void set_up() {
+        GLdcAllocator allocator = {counting_alloc, counting_free, NULL};
+        _glInitMemory(&allocator, 1024);
+        allocations() = 0;
+    }
+
+    void tear_down() {
+        GLdcAllocator defaults = {NULL, NULL, NULL};
+        _glInitMemory(&defaults, 64 * 1024);
+    }
+
+    void test_scratch_is_reused_without_allocating() {
+        for(int i = 0; i < 10; ++i) {
+            void* a = _glScratchAlloc(300);
+            void* b = _glScratchAlloc(500);
+
+            assert_is_not_null(a);
+            assert_is_not_null(b);
+            assert_equal(((uintptr_t) a) % 32, 0u);
+            assert_equal(((uintptr_t) b) % 32, 0u);
+
+            /* Out of order is fine */
+            _glScratchFree(a);
+            _glScratchFree(b);
+        }
+
+        assert_equal(allocations(), 0);
+    }
+
+    void test_scratch_overflow_uses_the_allocator() {
+        void* a = _glScratchAlloc(800);
+        void* b = _glScratchAlloc(800);
+        assert_equal(allocations(), 1);
+
+        _glScratchFree(b);
+        _glScratchFree(a);
+
+        /* Both released, so the block is whole again */
+        void* c = _glScratchAlloc(1024);
+        assert_equal(c, a);
+        _glScratchFree(c);
+        assert_equal(allocations(), 1);
+    }
+
+    void test_allocations_go_through_the_hooks() {
+        void* p = _glCalloc(4, 16);
+        assert_is_not_null(p);
+        assert_equal(allocations(), 1);
+        assert_equal(((uint8_t*) p)[63], 0);
+        _glFree(p);
+    }
+};
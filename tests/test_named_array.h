@@ -0,0 +1,90 @@
+#include "tools/test.h"
+
+#include <cstdint>
+#include <vector>
+
+#include "containers/named_array.h"
+
+class NamedArrayTests : public test::TestCase {
+public:
+    NamedArray array;
+
+    void set_up() {
+        named_array_init(&array, sizeof(uint32_t), 200);
+    }
+
+    void tear_down() {
+        named_array_cleanup(&array);
+    }
+
+    void test_alloc_returns_lowest_free_id() {
+        unsigned int id;
+
+        for(unsigned int i = 0; i < 40; ++i) {
+            assert_is_not_null(named_array_alloc(&array, &id));
+            assert_equal(id, i);
+        }
+
+        named_array_release(&array, 3);
+        named_array_release(&array, 35);
+
+        assert_is_not_null(named_array_alloc(&array, &id));
+        assert_equal(id, 3u);
+        assert_is_not_null(named_array_alloc(&array, &id));
+        assert_equal(id, 35u);
+        assert_is_not_null(named_array_alloc(&array, &id));
+        assert_equal(id, 40u);
+    }
+
+    void test_alloc_stops_at_the_ceiling() {
+        unsigned int id;
+
+        for(unsigned int i = 0; i < 200; ++i) {
+            assert_is_not_null(named_array_alloc(&array, &id));
+        }
+
+        assert_is_null(named_array_alloc(&array, &id));
+        assert_is_null(named_array_reserve(&array, 200));
+        assert_false(named_array_used(&array, 200));
+        assert_is_null(named_array_get(&array, 5000));
+
+        named_array_release(&array, 150);
+        assert_is_not_null(named_array_alloc(&array, &id));
+        assert_equal(id, 150u);
+    }
+
+    void test_elements_do_not_move_when_growing() {
+        unsigned int id;
+        std::vector<uint32_t*> elements;
+
+        for(unsigned int i = 0; i < 200; ++i) {
+            uint32_t* e = (uint32_t*) named_array_alloc(&array, &id);
+            *e = i;
+            elements.push_back(e);
+        }
+
+        for(unsigned int i = 0; i < 200; ++i) {
+            assert_equal(named_array_get(&array, i), (void*) elements[i]);
+            assert_equal(*elements[i], i);
+        }
+    }
+
+    void test_reserve_and_next_used() {
+        assert_is_not_null(named_array_reserve(&array, 0));
+        assert_is_not_null(named_array_reserve(&array, 70));
+        assert_is_not_null(named_array_reserve(&array, 199));
+
+        assert_equal(named_array_next_used(&array, 0), 0u);
+        assert_equal(named_array_next_used(&array, 1), 70u);
+        assert_equal(named_array_next_used(&array, 71), 199u);
+        assert_equal(named_array_next_used(&array, 200), 200u);
+
+        named_array_release(&array, 199);
+        assert_equal(named_array_next_used(&array, 71), 200u);
+
+        /* Reserved IDs are skipped by alloc */
+        unsigned int id;
+        named_array_alloc(&array, &id);
+        assert_equal(id, 1u);
+    }
+};
@@ -4,8 +4,10 @@
 #include "tools/gl_test.h"
 
 #include <stdint.h>
+#include <vector>
 #include <GL/gl.h>
 #include <GL/glkos.h>
+#include <GL/glu.h>
 
 /*
  * Internal headers needed to inspect the Tile Accelerator (TA) submission
@@ -15,7 +17,9 @@
  * (OP_LIST / PT_LIST / TR_LIST).  Each list is an AlignedVector whose
  * elements are 64-byte Vertex structs.  The first element in the vector
  * after a draw is a PolyHeader (also 64 bytes), followed by the actual
- * vertex data.
+ * vertex data.  Immediate mode triangles and quads are only finished off
+ * (flags, transform) when something stops the next glBegin following on,
+ * so tests which look at those call glFlush() first.
  *
  * This file tests:
  *   - That the expected number of PolyHeader + Vertex entries appear
@@ -83,6 +87,228 @@ public:
         assert_equal(aligned_vector_size(&OP_LIST.vector), 7u);
     }
 
+    /* Immediate mode expands primitives in place at glEnd; a fan must
+     * come out exactly as glDrawArrays would have produced it. */
+    void test_immediate_fan_matches_draw_arrays() {
+        GLfloat verts[] = {
+             0.0f,  0.0f, 0.5f,
+             1.0f,  0.0f, 0.5f,
+             1.0f,  1.0f, 0.5f,
+             0.0f,  1.0f, 0.5f
+        };
+
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glVertexPointer(3, GL_FLOAT, 0, verts);
+        glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+        glDisableClientState(GL_VERTEX_ARRAY);
+
+        glBegin(GL_TRIANGLE_FAN);
+        for(int i = 0; i < 4; ++i) {
+            glVertex3fv(verts + i * 3);
+        }
+        glEnd();
+
+        /* 1 header + 6 verts, twice */
+        assert_equal(aligned_vector_size(&OP_LIST.vector), 13u);
+
+        for(uint32_t i = 1; i < 7; ++i) {
+            Vertex* a = vertex_at(&OP_LIST, i);
+            Vertex* b = vertex_at(&OP_LIST, i + 6);
+            assert_equal(a->flags, b->flags);
+            assert_close(a->xyz[0], b->xyz[0], 0.001f);
+            assert_close(a->xyz[1], b->xyz[1], 0.001f);
+        }
+
+        assert_equal(vertex_at(&OP_LIST, 9)->flags, (uint32_t) GPU_CMD_VERTEX_EOL);
+        assert_equal(vertex_at(&OP_LIST, 12)->flags, (uint32_t) GPU_CMD_VERTEX_EOL);
+    }
+
+    /* A trailing incomplete triangle is dropped, and glBegin/glEnd with
+     * nothing to draw leaves no header behind for the next draw to skip. */
+    void test_immediate_drops_incomplete_primitives() {
+        glBegin(GL_TRIANGLES);
+            glVertex3f(-1.0f, -1.0f, 0.5f);
+        glEnd();
+
+        assert_equal(aligned_vector_size(&OP_LIST.vector), 0u);
+
+        glBegin(GL_TRIANGLES);
+            glVertex3f(-1.0f, -1.0f, 0.5f);
+            glVertex3f( 1.0f, -1.0f, 0.5f);
+            glVertex3f( 0.0f,  1.0f, 0.5f);
+            glVertex3f( 0.0f,  0.0f, 0.5f);
+        glEnd();
+        glFlush();
+
+        assert_equal(aligned_vector_size(&OP_LIST.vector), 4u);
+        assert_equal(vertex_at(&OP_LIST, 3)->flags, (uint32_t) GPU_CMD_VERTEX_EOL);
+    }
+
+    /* Immediate mode doesn't go through the client arrays, so whatever
+     * they're set to can't leak into it. */
+    void test_immediate_ignores_client_arrays() {
+        GLfloat colors[] = {
+            0.0f, 0.0f, 1.0f, 1.0f,
+            0.0f, 0.0f, 1.0f, 1.0f,
+            0.0f, 0.0f, 1.0f, 1.0f
+        };
+
+        glEnableClientState(GL_COLOR_ARRAY);
+        glColorPointer(4, GL_FLOAT, 0, colors);
+
+        glColor3f(1.0f, 0.0f, 0.0f);
+        glBegin(GL_TRIANGLES);
+            glVertex3f(-1.0f, -1.0f, 0.5f);
+            glVertex3f( 1.0f, -1.0f, 0.5f);
+            glVertex3f( 0.0f,  1.0f, 0.5f);
+        glEnd();
+
+        glDisableClientState(GL_COLOR_ARRAY);
+
+        Vertex* v = vertex_at(&OP_LIST, 2);
+        assert_close(v->argb[R8IDX], 1.0f, 0.001f);
+        assert_close(v->argb[B8IDX], 0.0f, 0.001f);
+    }
+
+    void test_immediate_end_without_begin_is_an_error() {
+        glEnd();
+        assert_equal(glGetError(), (GLenum) GL_INVALID_OPERATION);
+
+        glVertex3f(0.0f, 0.0f, 0.5f);
+        assert_equal(aligned_vector_size(&OP_LIST.vector), 0u);
+    }
+
+    /* Quads drawn one glBegin/glEnd at a time are finished off together,
+     * under the header the first one wrote */
+    void test_consecutive_immediate_blocks_are_batched() {
+        for(int i = 0; i < 2; ++i) {
+            glBegin(GL_QUADS);
+                glVertex3f(0.0f, 0.0f, 0.5f);
+                glVertex3f(0.5f, 0.0f, 0.5f);
+                glVertex3f(0.5f, 0.5f, 0.5f);
+                glVertex3f(0.0f, 0.5f, 0.5f);
+            glEnd();
+        }
+
+        /* Still pending, so nothing has been transformed yet */
+        assert_equal(aligned_vector_size(&OP_LIST.vector), 9u);
+        assert_close(vertex_at(&OP_LIST, 2)->xyz[0], 0.5f, 0.0001f);
+
+        /* A different mode can't follow on, so the quads go first */
+        glBegin(GL_TRIANGLES);
+            glVertex3f(0.0f, 0.0f, 0.5f);
+            glVertex3f(0.5f, 0.0f, 0.5f);
+            glVertex3f(0.0f, 0.5f, 0.5f);
+        glEnd();
+
+        assert_close(vertex_at(&OP_LIST, 2)->xyz[0], 480.0f, 0.001f);
+        assert_close(vertex_at(&OP_LIST, 6)->xyz[0], 480.0f, 0.001f);
+        assert_equal(vertex_at(&OP_LIST, 4)->flags, (uint32_t) GPU_CMD_VERTEX_EOL);
+        assert_equal(vertex_at(&OP_LIST, 8)->flags, (uint32_t) GPU_CMD_VERTEX_EOL);
+
+        glFlush();
+        assert_equal(aligned_vector_size(&OP_LIST.vector), 12u);
+        assert_equal(vertex_at(&OP_LIST, 11)->flags, (uint32_t) GPU_CMD_VERTEX_EOL);
+    }
+
+    /* Changing the modelview between blocks finishes the first with the
+     * matrix it was drawn with */
+    void test_matrix_change_flushes_pending_blocks() {
+        glBegin(GL_TRIANGLES);
+            glVertex3f(0.0f, 0.0f, 0.5f);
+            glVertex3f(0.5f, 0.0f, 0.5f);
+            glVertex3f(0.0f, 0.5f, 0.5f);
+        glEnd();
+
+        glTranslatef(0.5f, 0.0f, 0.0f);
+
+        glBegin(GL_TRIANGLES);
+            glVertex3f(0.0f, 0.0f, 0.5f);
+            glVertex3f(0.5f, 0.0f, 0.5f);
+            glVertex3f(0.0f, 0.5f, 0.5f);
+        glEnd();
+        glFlush();
+
+        assert_equal(aligned_vector_size(&OP_LIST.vector), 7u);
+        assert_close(vertex_at(&OP_LIST, 1)->xyz[0], 320.0f, 0.001f);
+        assert_close(vertex_at(&OP_LIST, 4)->xyz[0], 480.0f, 0.001f);
+    }
+
+    void test_look_at_flushes_pending_blocks() {
+        glBegin(GL_TRIANGLES);
+            glVertex3f(0.0f, 0.0f, 0.5f);
+            glVertex3f(0.5f, 0.0f, 0.5f);
+            glVertex3f(0.0f, 0.5f, 0.5f);
+        glEnd();
+
+        /* Looking down +z mirrors x */
+        gluLookAt(0.0, 0.0, 0.0, 0.0, 0.0, 1.0, 0.0, 1.0, 0.0);
+
+        glBegin(GL_TRIANGLES);
+            glVertex3f(0.0f, 0.0f, 0.5f);
+            glVertex3f(0.5f, 0.0f, 0.5f);
+            glVertex3f(0.0f, 0.5f, 0.5f);
+        glEnd();
+        glFlush();
+
+        assert_equal(aligned_vector_size(&OP_LIST.vector), 7u);
+        assert_close(vertex_at(&OP_LIST, 1)->xyz[0], 320.0f, 0.001f);
+        assert_close(vertex_at(&OP_LIST, 2)->xyz[0], 480.0f, 0.001f);
+        assert_close(vertex_at(&OP_LIST, 5)->xyz[0], 160.0f, 0.001f);
+    }
+
+    /* glMaterial is allowed between glBegin and glEnd, and the blocks
+     * already drawn are lit with the material as it was */
+    void test_material_change_inside_a_block() {
+        const GLfloat ZERO[] = {0.0f, 0.0f, 0.0f, 1.0f};
+        const GLfloat ONE[] = {1.0f, 1.0f, 1.0f, 1.0f};
+        const GLfloat RED[] = {1.0f, 0.0f, 0.0f, 1.0f};
+        const GLfloat GREEN[] = {0.0f, 1.0f, 0.0f, 1.0f};
+        const GLfloat DEFAULT_AMBIENT[] = {0.2f, 0.2f, 0.2f, 1.0f};
+
+        /* Only the light's ambient term, so the colour is the material's */
+        glEnable(GL_LIGHTING);
+        glEnable(GL_LIGHT0);
+        glLightfv(GL_LIGHT0, GL_AMBIENT, ONE);
+        glLightfv(GL_LIGHT0, GL_DIFFUSE, ZERO);
+        glLightfv(GL_LIGHT0, GL_SPECULAR, ZERO);
+        glLightModelfv(GL_LIGHT_MODEL_AMBIENT, ZERO);
+        glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, RED);
+
+        glBegin(GL_TRIANGLES);
+            glVertex3f(0.0f, 0.0f, 0.5f);
+            glVertex3f(0.5f, 0.0f, 0.5f);
+            glVertex3f(0.0f, 0.5f, 0.5f);
+        glEnd();
+
+        glBegin(GL_TRIANGLES);
+            glVertex3f(0.0f, 0.0f, 0.5f);
+            glVertex3f(0.5f, 0.0f, 0.5f);
+            glVertex3f(0.0f, 0.5f, 0.5f);
+            glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, GREEN);
+            glVertex3f(0.0f, 0.0f, 0.5f);
+            glVertex3f(0.5f, 0.0f, 0.5f);
+            glVertex3f(0.0f, 0.5f, 0.5f);
+        glEnd();
+        glFlush();
+
+        glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, DEFAULT_AMBIENT);
+        glLightModelfv(GL_LIGHT_MODEL_AMBIENT, DEFAULT_AMBIENT);
+        glLightfv(GL_LIGHT0, GL_AMBIENT, ZERO);
+        glLightfv(GL_LIGHT0, GL_DIFFUSE, ONE);
+        glLightfv(GL_LIGHT0, GL_SPECULAR, ONE);
+        glDisable(GL_LIGHT0);
+        glDisable(GL_LIGHTING);
+
+        assert_equal(aligned_vector_size(&OP_LIST.vector), 10u);
+        assert_close(vertex_at(&OP_LIST, 3)->argb[R8IDX], 1.0f, 0.01f);
+        assert_close(vertex_at(&OP_LIST, 3)->argb[G8IDX], 0.0f, 0.01f);
+        assert_close(vertex_at(&OP_LIST, 9)->argb[R8IDX], 0.0f, 0.01f);
+        assert_close(vertex_at(&OP_LIST, 9)->argb[G8IDX], 1.0f, 0.01f);
+        assert_equal(vertex_at(&OP_LIST, 9)->flags, (uint32_t) GPU_CMD_VERTEX_EOL);
+        assert_close(vertex_at(&OP_LIST, 9)->xyz[1], 120.0f, 0.001f);
+    }
+
     /* After glKosSwapBuffers the list must be cleared. */
     void test_op_list_is_empty_after_swap_buffers() {
         glBegin(GL_TRIANGLES);
@@ -96,6 +322,37 @@ public:
         assert_equal(aligned_vector_size(&OP_LIST.vector), 0u);
     }
 
+    /* A frame which nearly fills a list grows it at swap time, and it's
+     * shrunk back once it has been quiet for long enough. */
+    void test_list_capacity_adapts_to_usage() {
+        const int count = 1200 * 3;
+        std::vector<GLfloat> vertices(count * 3, 0.5f);
+
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glVertexPointer(3, GL_FLOAT, 0, vertices.data());
+        glDrawArrays(GL_TRIANGLES, 0, count);
+        glDisableClientState(GL_VERTEX_ARRAY);
+
+        uint32_t used = aligned_vector_size(&OP_LIST.vector);
+        assert_true(used > (uint32_t) count);
+
+        glKosSwapBuffers();
+
+        assert_true(aligned_vector_capacity(&OP_LIST.vector) >= used + used / 2);
+
+        GLint highWater = 0;
+        glGetIntegerv(GL_OP_LIST_HIGH_WATER_KOS, &highWater);
+        assert_true((uint32_t) highWater >= used);
+
+        GLdcConfig config;
+        glKosInitConfig(&config);
+        for(GLuint i = 0; i < config.list_shrink_frames; ++i) {
+            glKosSwapBuffers();
+        }
+
+        assert_equal(aligned_vector_capacity(&OP_LIST.vector), ROUND_TO_CHUNK_SIZE(OP_LIST.min_capacity));
+    }
+
     /* -----------------------------------------------------------------------
      * PolyHeader validation
      * -------------------------------------------------------------------- */
@@ -145,6 +402,7 @@ public:
             glVertex3f( 1.0f, -1.0f, 0.5f);
             glVertex3f( 0.0f,  1.0f, 0.5f);
         glEnd();
+        glFlush();
 
         /* Index 0 is the PolyHeader; vertices start at index 1. */
         Vertex* v0 = vertex_at(&OP_LIST, 1);
@@ -170,6 +428,7 @@ public:
             glVertex3f( 0.5f, -0.5f, 0.5f);
             glVertex3f( 0.0f,  0.5f, 0.5f);
         glEnd();
+        glFlush();
 
         /* 1 header + 6 vertices (indices 1..6) */
         assert_equal(vertex_at(&OP_LIST, 1)->flags, (uint32_t)GPU_CMD_VERTEX);
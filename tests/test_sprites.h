@@ -0,0 +1,206 @@
+#include "tools/test.h"
+#include "tools/gl_test.h"
+
+#include <GL/gl.h>
+#include <GL/glkos.h>
+
+#include "GL/private.h"
+#include "containers/aligned_vector.h"
+
+/* glKosDrawSprites. Sprites go into the active list as a sprite header
+ * followed by one 64 byte entry per sprite, already in screen space. With
+ * the default matrices (-1, -1) to (1, 1) covers the 640x480 viewport. */
+class SpriteTests : public GLTestCase {
+public:
+    static GLSpriteKOS sprite(GLfloat x, GLfloat y, GLuint argb) {
+        GLSpriteKOS s = {x, y, 0.0f, 0.5f, 0.5f, 0.0f, 0.0f, 1.0f, 1.0f, argb};
+        return s;
+    }
+
+    static const Vertex* entry(uint32_t i) {
+        return (const Vertex*) aligned_vector_at(&OP_LIST.vector, i);
+    }
+
+    static uint32_t list_size() {
+        return aligned_vector_size(&OP_LIST.vector);
+    }
+
+    void tear_down() {
+        glMatrixMode(GL_PROJECTION);
+        glLoadIdentity();
+        glMatrixMode(GL_MODELVIEW);
+        glLoadIdentity();
+
+        GLTestCase::tear_down();
+    }
+
+    void test_sprite_is_packed() {
+        GLSpriteKOS s = {-0.5f, -0.5f, 0.0f, 1.0f, 0.5f, 0.25f, 0.5f, 0.75f, 1.0f, 0x80112233};
+        glKosDrawSprites(&s, 1);
+
+        assert_equal(list_size(), 2u);
+        assert_true(IsSpriteHeader(entry(0)));
+
+        const PolyHeader* header = (const PolyHeader*) entry(0);
+        assert_equal(header->d1, (uint32_t) 0x80112233);
+
+        const SpriteVertex* sv = (const SpriteVertex*) entry(1);
+        assert_equal(sv->flags, (uint32_t) GPU_CMD_VERTEX_EOL);
+        assert_close(160.0f, sv->ax, 0.001f);
+        assert_close(480.0f, sv->bx, 0.001f);
+        assert_close(480.0f, sv->cx, 0.001f);
+        assert_close(160.0f, sv->dx, 0.001f);
+        assert_close(sv->ay, sv->by, 0.001f);
+        assert_close(sv->cy, sv->dy, 0.001f);
+        assert_close(120.0f, sv->ay - sv->cy, 0.001f);
+        assert_close(1.0f / 1.0001f, sv->az, 0.001f);
+
+        float u, v;
+        UnpackSpriteUV(sv->auv, &u, &v);
+        assert_close(0.25f, u, 0.001f);
+        assert_close(0.5f, v, 0.001f);
+        UnpackSpriteUV(sv->buv, &u, &v);
+        assert_close(0.75f, u, 0.001f);
+        assert_close(0.5f, v, 0.001f);
+        UnpackSpriteUV(sv->cuv, &u, &v);
+        assert_close(0.75f, u, 0.001f);
+        assert_close(1.0f, v, 0.001f);
+
+        assert_equal((GLenum) GL_NO_ERROR, glGetError());
+    }
+
+    void test_sprites_follow_the_modelview() {
+        glTranslatef(0.5f, 0.0f, 0.0f);
+
+        GLSpriteKOS s = sprite(-0.5f, 0.0f, 0xFFFFFFFF);
+        glKosDrawSprites(&s, 1);
+
+        const SpriteVertex* sv = (const SpriteVertex*) entry(1);
+        assert_close(320.0f, sv->ax, 0.001f);
+        assert_close(480.0f, sv->bx, 0.001f);
+    }
+
+    void test_same_colour_shares_a_header() {
+        GLSpriteKOS s[3] = {
+            sprite(-1.0f, -1.0f, 0xFFFF0000),
+            sprite(0.0f, -1.0f, 0xFFFF0000),
+            sprite(0.5f, 0.5f, 0xFFFF0000)
+        };
+
+        glKosDrawSprites(s, 2);
+        assert_equal(list_size(), 3u);
+
+        /* And carries on under it in the next call */
+        glKosDrawSprites(s + 2, 1);
+        assert_equal(list_size(), 4u);
+        assert_false(IsSpriteHeader(entry(3)));
+    }
+
+    void test_colour_change_starts_a_header() {
+        GLSpriteKOS s[3] = {
+            sprite(-1.0f, -1.0f, 0xFFFF0000),
+            sprite(0.0f, -1.0f, 0xFF00FF00),
+            sprite(0.5f, 0.5f, 0xFF00FF00)
+        };
+
+        glKosDrawSprites(s, 3);
+        assert_equal(list_size(), 5u);
+        assert_true(IsSpriteHeader(entry(2)));
+        assert_equal(((const PolyHeader*) entry(2))->d1, (uint32_t) 0xFF00FF00);
+    }
+
+    void test_state_change_starts_a_header() {
+        GLSpriteKOS s = sprite(-1.0f, -1.0f, 0xFFFFFFFF);
+
+        glKosDrawSprites(&s, 1);
+        glEnable(GL_DEPTH_TEST);
+        glKosDrawSprites(&s, 1);
+        glDisable(GL_DEPTH_TEST);
+
+        assert_equal(list_size(), 4u);
+        assert_true(IsSpriteHeader(entry(2)));
+    }
+
+    void test_polygons_and_sprites_get_their_own_headers() {
+        GLSpriteKOS s = sprite(-1.0f, -1.0f, 0xFFFFFFFF);
+
+        glBegin(GL_TRIANGLES);
+            glVertex3f(0.0f, 0.0f, 0.0f);
+            glVertex3f(1.0f, 0.0f, 0.0f);
+            glVertex3f(0.0f, 1.0f, 0.0f);
+        glEnd();
+
+        glKosDrawSprites(&s, 1);
+        assert_equal(list_size(), 6u);
+        assert_true(IsSpriteHeader(entry(4)));
+
+        glBegin(GL_TRIANGLES);
+            glVertex3f(0.0f, 0.0f, 0.0f);
+            glVertex3f(1.0f, 0.0f, 0.0f);
+            glVertex3f(0.0f, 1.0f, 0.0f);
+        glEnd();
+        glFlush();
+
+        assert_equal(list_size(), 10u);
+        assert_equal(entry(6)->flags & GPU_CMD_POLYHDR, (uint32_t) GPU_CMD_POLYHDR);
+
+        /* The polygon header ended the sprite run */
+        glKosDrawSprites(&s, 1);
+        assert_equal(list_size(), 12u);
+        assert_true(IsSpriteHeader(entry(10)));
+    }
+
+    void test_sprites_behind_the_near_plane_are_dropped() {
+        glMatrixMode(GL_PROJECTION);
+        glFrustum(-1.0f, 1.0f, -1.0f, 1.0f, 1.0f, 10.0f);
+        glMatrixMode(GL_MODELVIEW);
+
+        GLSpriteKOS s[2] = {
+            sprite(-0.5f, -0.5f, 0xFFFFFFFF),
+            sprite(-0.5f, -0.5f, 0xFFFFFFFF)
+        };
+        s[1].z = -2.0f;
+
+        glKosDrawSprites(s, 1);
+        assert_equal(list_size(), 0u);
+
+        glKosDrawSprites(s, 2);
+        assert_equal(list_size(), 2u);
+
+        /* Perspective divided, a quarter of the way across at half size */
+        const SpriteVertex* sv = (const SpriteVertex*) entry(1);
+        assert_close(240.0f, sv->ax, 0.001f);
+        assert_close(320.0f, sv->bx, 0.001f);
+        assert_close(0.5f, sv->az, 0.001f);
+    }
+
+    void test_sprites_are_submitted() {
+        GLSpriteKOS s[2] = {
+            sprite(-1.0f, -1.0f, 0xFFFF0000),
+            sprite(0.0f, 0.0f, 0xFF0000FF)
+        };
+
+        glKosDrawSprites(s, 2);
+        glKosSwapBuffers();
+
+        assert_equal(list_size(), 0u);
+        assert_equal((GLenum) GL_NO_ERROR, glGetError());
+    }
+
+    void test_errors() {
+        GLSpriteKOS s = sprite(-1.0f, -1.0f, 0xFFFFFFFF);
+
+        glBegin(GL_TRIANGLES);
+        glKosDrawSprites(&s, 1);
+        glEnd();
+        assert_equal((GLenum) GL_INVALID_OPERATION, glGetError());
+
+        glKosDrawSprites(&s, 0);
+        assert_equal((GLenum) GL_NO_ERROR, glGetError());
+        assert_equal(list_size(), 0u);
+
+        glKosDrawSprites(&s, -1);
+        assert_equal((GLenum) GL_INVALID_VALUE, glGetError());
+        assert_equal(list_size(), 0u);
+    }
+};
@@ -35,11 +35,14 @@ public:
     }
 
     static void reset_list() {
+        glFlush();
         aligned_vector_clear(&OP_LIST.vector);
         _glGPUStateMarkDirty();
     }
 
     static std::vector<Vertex> captured() {
+        glFlush();
+
         std::vector<Vertex> out;
         uint32_t n = aligned_vector_size(&OP_LIST.vector);
         for(uint32_t i = 0; i < n; ++i) {
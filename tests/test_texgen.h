@@ -0,0 +1,229 @@
+#include "tools/test.h"
+#include "tools/gl_test.h"
+
+#include <cmath>
+
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include <GL/glkos.h>
+
+#include "GL/private.h"
+#include "containers/aligned_vector.h"
+
+/* glTexGen for S and T. The same triangle is drawn each time and the
+ * generated coordinates are read back from the submitted vertices; the
+ * second vertex is the interesting one, at (0.5, 0, 0.5) facing +Z. */
+class TexGenTests : public GLTestCase {
+public:
+    GLfloat positions[9] = {
+        0.0f, 0.0f, 0.5f,
+        0.5f, 0.0f, 0.5f,
+        0.0f, 0.5f, 0.5f
+    };
+
+    GLfloat normals[9] = {
+        0.0f, 0.0f, 1.0f,
+        0.0f, 0.0f, 1.0f,
+        0.0f, 0.0f, 1.0f
+    };
+
+    void set_up() {
+        GLTestCase::set_up();
+
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_NORMAL_ARRAY);
+        glVertexPointer(3, GL_FLOAT, 0, positions);
+        glNormalPointer(GL_FLOAT, 0, normals);
+    }
+
+    void tear_down() {
+        const GLfloat S[] = {1.0f, 0.0f, 0.0f, 0.0f};
+        const GLfloat T[] = {0.0f, 1.0f, 0.0f, 0.0f};
+
+        glDisable(GL_TEXTURE_GEN_S);
+        glDisable(GL_TEXTURE_GEN_T);
+
+        glLoadIdentity();
+        for(GLuint i = 0; i < 2; ++i) {
+            const GLenum coord = (i == 0) ? GL_S : GL_T;
+            glTexGeni(coord, GL_TEXTURE_GEN_MODE, GL_EYE_LINEAR);
+            glTexGenfv(coord, GL_OBJECT_PLANE, (i == 0) ? S : T);
+            glTexGenfv(coord, GL_EYE_PLANE, (i == 0) ? S : T);
+        }
+
+        glMatrixMode(GL_TEXTURE);
+        glLoadIdentity();
+        glMatrixMode(GL_MODELVIEW);
+
+        glDisableClientState(GL_NORMAL_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
+
+        GLTestCase::tear_down();
+    }
+
+    static const Vertex* draw() {
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+
+        uint32_t size = aligned_vector_size(&OP_LIST.vector);
+        return (const Vertex*) aligned_vector_at(&OP_LIST.vector, size - 3);
+    }
+
+    void generate(GLenum mode) {
+        glTexGeni(GL_S, GL_TEXTURE_GEN_MODE, mode);
+        glTexGeni(GL_T, GL_TEXTURE_GEN_MODE, mode);
+        glEnable(GL_TEXTURE_GEN_S);
+        glEnable(GL_TEXTURE_GEN_T);
+    }
+
+    void test_object_linear_ignores_modelview() {
+        const GLfloat S[] = {1.0f, 0.0f, 0.0f, 0.25f};
+        const GLfloat T[] = {0.0f, 0.0f, 2.0f, 0.0f};
+
+        generate(GL_OBJECT_LINEAR);
+        glTexGenfv(GL_S, GL_OBJECT_PLANE, S);
+        glTexGenfv(GL_T, GL_OBJECT_PLANE, T);
+
+        glTranslatef(0.25f, 0.0f, 0.0f);
+        glScalef(0.5f, 0.5f, 0.5f);
+
+        const Vertex* v = draw();
+        assert_close(0.25f, v[0].uv[0], 0.0001f);
+        assert_close(0.75f, v[1].uv[0], 0.0001f);
+        assert_close(1.0f, v[1].uv[1], 0.0001f);
+
+        /* Positions still go through the modelview: 0.25 + 0.5 * 0.5 */
+        assert_close(320.0f + 0.5f * 320.0f, v[1].xyz[0], 0.001f);
+        assert_equal((GLenum) GL_NO_ERROR, glGetError());
+    }
+
+    void test_eye_plane_uses_modelview_when_specified() {
+        const GLfloat S[] = {1.0f, 0.0f, 0.0f, 0.0f};
+
+        glTranslatef(0.25f, 0.0f, 0.0f);
+        generate(GL_EYE_LINEAR);
+        glTexGenfv(GL_S, GL_EYE_PLANE, S);
+
+        /* Same modelview as when the plane was set, so it's object x */
+        const Vertex* v = draw();
+        assert_close(0.5f, v[1].uv[0], 0.0001f);
+
+        /* Eye x is now 0.25 less than when the plane was set */
+        glLoadIdentity();
+        v = draw();
+        assert_close(0.25f, v[1].uv[0], 0.0001f);
+        assert_close(0.0f, v[1].uv[1], 0.0001f);
+    }
+
+    void test_sphere_map() {
+        generate(GL_SPHERE_MAP);
+
+        /* u = (1, 0, 1) / sqrt(2), reflected off +Z to r = (1, 0, -1) / sqrt(2) */
+        const GLfloat r = 1.0f / std::sqrt(2.0f);
+        const GLfloat m = 2.0f * std::sqrt(r * r + (1.0f - r) * (1.0f - r));
+
+        /* Normals are packed, so only good to a couple of places */
+        const Vertex* v = draw();
+        assert_close(r / m + 0.5f, v[1].uv[0], 0.01f);
+        assert_close(0.5f, v[1].uv[1], 0.01f);
+    }
+
+    void test_reflection_map() {
+        generate(GL_REFLECTION_MAP_ARB);
+
+        const Vertex* v = draw();
+        assert_close(1.0f / std::sqrt(2.0f), v[1].uv[0], 0.01f);
+        assert_close(0.0f, v[1].uv[1], 0.01f);
+    }
+
+    void test_lit_vertices_generate_the_same() {
+        generate(GL_SPHERE_MAP);
+        const GLfloat unlit = draw()[1].uv[0];
+
+        glEnable(GL_LIGHTING);
+        const Vertex* v = draw();
+        glDisable(GL_LIGHTING);
+
+        assert_close(unlit, v[1].uv[0], 0.0001f);
+        assert_close(480.0f, v[1].xyz[0], 0.001f);
+    }
+
+    void test_texture_matrix_applied_after_generation() {
+        generate(GL_OBJECT_LINEAR);
+
+        glMatrixMode(GL_TEXTURE);
+        glTranslatef(0.5f, 0.25f, 0.0f);
+        glMatrixMode(GL_MODELVIEW);
+
+        const Vertex* v = draw();
+        assert_close(1.0f, v[1].uv[0], 0.0001f);
+        assert_close(0.25f, v[1].uv[1], 0.0001f);
+        assert_close(0.75f, v[2].uv[1], 0.0001f);
+    }
+
+    void test_only_enabled_coordinates_are_generated() {
+        GLfloat uvs[6] = {0.1f, 0.2f, 0.3f, 0.4f, 0.5f, 0.6f};
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        glTexCoordPointer(2, GL_FLOAT, 0, uvs);
+
+        glTexGeni(GL_S, GL_TEXTURE_GEN_MODE, GL_OBJECT_LINEAR);
+        glEnable(GL_TEXTURE_GEN_S);
+        assert_true(glIsEnabled(GL_TEXTURE_GEN_S));
+        assert_false(glIsEnabled(GL_TEXTURE_GEN_T));
+
+        const Vertex* v = draw();
+        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+
+        assert_close(0.5f, v[1].uv[0], 0.0001f);
+        assert_close(0.4f, v[1].uv[1], 0.0001f);
+    }
+
+    void test_get_tex_gen() {
+        const GLfloat S[] = {1.0f, 0.0f, 0.0f, 2.0f};
+
+        glTexGeni(GL_T, GL_TEXTURE_GEN_MODE, GL_SPHERE_MAP);
+        GLint mode = 0;
+        glGetTexGeniv(GL_T, GL_TEXTURE_GEN_MODE, &mode);
+        assert_equal((GLint) GL_SPHERE_MAP, mode);
+
+        glTexGenfv(GL_S, GL_OBJECT_PLANE, S);
+        GLfloat plane[4];
+        glGetTexGenfv(GL_S, GL_OBJECT_PLANE, plane);
+        for(GLuint i = 0; i < 4; ++i) {
+            assert_close(S[i], plane[i], 0.0001f);
+        }
+
+        /* Eye planes come back in eye coordinates, as transformed by the
+         * modelview when they were set */
+        glTranslatef(0.25f, 0.0f, 0.0f);
+        glTexGenfv(GL_S, GL_EYE_PLANE, S);
+        glGetTexGenfv(GL_S, GL_EYE_PLANE, plane);
+        assert_close(1.0f, plane[0], 0.0001f);
+        assert_close(1.75f, plane[3], 0.0001f);
+
+        GLint iplane[4];
+        glGetTexGeniv(GL_S, GL_OBJECT_PLANE, iplane);
+        assert_equal(2, iplane[3]);
+        assert_equal((GLenum) GL_NO_ERROR, glGetError());
+
+        glGetTexGenfv(GL_Q, GL_OBJECT_PLANE, plane);
+        assert_equal((GLenum) GL_INVALID_ENUM, glGetError());
+        glGetTexGeniv(GL_S, GL_TEXTURE_GEN_S, iplane);
+        assert_equal((GLenum) GL_INVALID_ENUM, glGetError());
+    }
+
+    void test_errors() {
+        glTexGeni(GL_R, GL_TEXTURE_GEN_MODE, GL_OBJECT_LINEAR);
+        assert_equal((GLenum) GL_INVALID_ENUM, glGetError());
+
+        glTexGeni(GL_S, GL_TEXTURE_GEN_MODE, GL_LINEAR);
+        assert_equal((GLenum) GL_INVALID_ENUM, glGetError());
+
+        glTexGeni(GL_S, GL_EYE_PLANE, 0);
+        assert_equal((GLenum) GL_INVALID_ENUM, glGetError());
+
+        const GLint plane[] = {0, 1, 0, 0};
+        glTexGeniv(GL_T, GL_OBJECT_PLANE, plane);
+        glTexGenf(GL_T, GL_TEXTURE_GEN_MODE, GL_SPHERE_MAP);
+        assert_equal((GLenum) GL_NO_ERROR, glGetError());
+    }
+};
@@ -4,12 +4,16 @@
 #include "tools/gl_test.h"
 
 #include <stdint.h>
+#include <string.h>
 #include <vector>
+#include <malloc.h>
 #include <GL/gl.h>
 #include <GL/glext.h>
 #include <GL/glkos.h>
 
 #include "GL/private.h"
+#include "GL/memory.h"
+#include "GL/texture_pack.h"
 
 /* =========================================================================
  * TextureFormatTests
@@ -251,6 +255,304 @@ public:
         assert_is_not_null(t->palette);
     }
 
+    void test_color_sub_table_updates_entries_and_dirty_range() {
+        uint8_t palette[16 * 4] = {0};
+        glColorTableEXT(GL_TEXTURE_2D, GL_RGBA8, 16, GL_RGBA, GL_UNSIGNED_BYTE, palette);
+        assert_equal(glGetError(), GL_NO_ERROR);
+
+        TexturePalette* p = _glGetBoundTexture()->palette;
+        assert_equal((int) p->dirtyStart, 0);
+        assert_equal((int) p->dirtyEnd, 16);
+
+        /* The upload happens at the start of the frame */
+        glKosSwapBuffers();
+        assert_equal((int) p->dirtyStart, (int) p->dirtyEnd);
+
+        uint8_t colours[2 * 4] = {1, 2, 3, 4, 5, 6, 7, 8};
+        glColorSubTableEXT(GL_TEXTURE_2D, 5, 2, GL_RGBA, GL_UNSIGNED_BYTE, colours);
+        assert_equal(glGetError(), GL_NO_ERROR);
+        assert_equal(memcmp(p->data + 5 * 4, colours, sizeof(colours)), 0);
+        assert_equal((int) p->data[4 * 4], 0);
+        assert_equal((int) p->data[7 * 4], 0);
+        assert_equal((int) p->dirtyStart, 5);
+        assert_equal((int) p->dirtyEnd, 7);
+
+        /* Further edits before the upload extend the range */
+        glColorSubTableEXT(GL_TEXTURE_2D, 10, 1, GL_RGBA, GL_UNSIGNED_BYTE, colours);
+        assert_equal((int) p->dirtyStart, 5);
+        assert_equal((int) p->dirtyEnd, 11);
+
+        glKosSwapBuffers();
+        assert_equal((int) p->dirtyStart, (int) p->dirtyEnd);
+    }
+
+    void test_color_sub_table_rejects_bad_ranges() {
+        uint8_t colours[4 * 4] = {0};
+
+        glColorSubTableEXT(GL_TEXTURE_2D, 0, 1, GL_RGBA, GL_UNSIGNED_BYTE, colours);
+        assert_equal(glGetError(), (GLenum) GL_INVALID_OPERATION);
+
+        glColorTableEXT(GL_SHARED_TEXTURE_PALETTE_1_KOS, GL_RGBA8, 4, GL_RGBA, GL_UNSIGNED_BYTE, colours);
+        assert_equal(glGetError(), GL_NO_ERROR);
+
+        glColorSubTableEXT(GL_SHARED_TEXTURE_PALETTE_1_KOS, 3, 2, GL_RGBA, GL_UNSIGNED_BYTE, colours);
+        assert_equal(glGetError(), (GLenum) GL_INVALID_VALUE);
+
+        glColorSubTableEXT(GL_SHARED_TEXTURE_PALETTE_1_KOS, -1, 1, GL_RGBA, GL_UNSIGNED_BYTE, colours);
+        assert_equal(glGetError(), (GLenum) GL_INVALID_VALUE);
+
+        glColorSubTableEXT(GL_SHARED_TEXTURE_PALETTE_1_KOS, 2, -1, GL_RGBA, GL_UNSIGNED_BYTE, colours);
+        assert_equal(glGetError(), (GLenum) GL_INVALID_VALUE);
+
+        glColorSubTableEXT(GL_SHARED_TEXTURE_PALETTE_1_KOS, 0, 4, GL_RGBA, GL_UNSIGNED_BYTE, colours);
+        assert_equal(glGetError(), GL_NO_ERROR);
+
+        glColorSubTableEXT(GL_TEXTURE_ENV, 0, 1, GL_RGBA, GL_UNSIGNED_BYTE, colours);
+        assert_equal(glGetError(), (GLenum) GL_INVALID_ENUM);
+    }
+
+    /* ------------------------------------------------- Automatic palettes */
+
+    /* An image with fewer colours than the palette must survive exactly. */
+    void test_auto_palette8_keeps_exact_colours() {
+        const uint8_t colors[4][4] = {
+            {255, 0, 0, 255}, {0, 255, 0, 255}, {0, 0, 255, 128}, {10, 20, 30, 255},
+        };
+        uint8_t img[8 * 8 * 4];
+        for(int i = 0; i < 8 * 8; ++i) {
+            memcpy(img + i * 4, colors[(i / 3) & 3], 4);
+        }
+
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_COLOR_INDEX8_AUTO_KOS, 8, 8, 0, GL_RGBA, GL_UNSIGNED_BYTE, img);
+        assert_equal(glGetError(), GL_NO_ERROR);
+
+        TextureObject* t = _glGetBoundTexture();
+        assert_true(t->isPaletted);
+        assert_equal(t->internalFormat, GL_COLOR_INDEX8_TWID_KOS);
+        assert_is_not_null(t->palette);
+        assert_equal((int) t->palette->size, 256);
+        assert_equal((int) t->palette->width, 4);
+
+        /* Texel (0, 0) is at index 0 whether twiddled or not */
+        const uint8_t* entry = t->palette->data + data8()[0] * 4;
+        assert_equal(memcmp(entry, colors[0], 4), 0);
+    }
+
+    void test_auto_palette4_quantises_to_16_colours() {
+        std::vector<uint8_t> img(16 * 16 * 3);
+        for(int i = 0; i < 16 * 16; ++i) {
+            img[i * 3 + 0] = i;
+            img[i * 3 + 1] = 255 - i;
+            img[i * 3 + 2] = (i * 7) & 0xFF;
+        }
+
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_COLOR_INDEX4_AUTO_KOS, 16, 16, 0, GL_RGB, GL_UNSIGNED_BYTE, img.data());
+        assert_equal(glGetError(), GL_NO_ERROR);
+
+        TextureObject* t = _glGetBoundTexture();
+        assert_equal(t->internalFormat, GL_COLOR_INDEX4_TWID_KOS);
+        assert_equal((int) t->palette->size, 16);
+        assert_equal((int) t->palette->width, 16);
+        /* 4bpp: half a byte per texel */
+        assert_equal((int) t->baseDataSize, 16 * 16 / 2);
+
+        /* Dithering only changes which indexes are chosen */
+        glEnable(GL_TEXTURE_AUTO_PALETTE_DITHER_KOS);
+        assert_true(glIsEnabled(GL_TEXTURE_AUTO_PALETTE_DITHER_KOS));
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_COLOR_INDEX4_AUTO_KOS, 16, 16, 0, GL_RGB, GL_UNSIGNED_BYTE, img.data());
+        glDisable(GL_TEXTURE_AUTO_PALETTE_DITHER_KOS);
+        assert_equal(glGetError(), GL_NO_ERROR);
+        assert_equal((int) _glGetBoundTexture()->palette->width, 16);
+    }
+
+    /* Allows budget() allocations, then fails */
+    static int& budget() {
+        static int v = 0;
+        return v;
+    }
+
+    static void* budget_alloc(size_t size, size_t alignment, void*) {
+        return (budget()-- > 0) ? memalign(alignment, size) : NULL;
+    }
+
+    static void budget_free(void* ptr, void*) {
+        free(ptr);
+    }
+
+    /* Running out of memory for a new palette leaves the old one alone */
+    void test_auto_palette_out_of_memory() {
+        uint8_t img[8 * 8 * 3];
+        for(int i = 0; i < 8 * 8 * 3; ++i) {
+            img[i] = (i * 13) & 0xFF;
+        }
+
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_COLOR_INDEX8_AUTO_KOS, 8, 8, 0, GL_RGB, GL_UNSIGNED_BYTE, img);
+        assert_equal(glGetError(), GL_NO_ERROR);
+
+        TexturePalette* palette = _glGetBoundTexture()->palette;
+        GLushort width = palette->width;
+
+        /* Just the scratch buffer, which the quantiser fits in */
+        budget() = 1;
+        GLdcAllocator failing = {budget_alloc, budget_free, NULL};
+        _glInitMemory(&failing, 64 * 1024);
+
+        memset(img, 0x80, sizeof(img));
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_COLOR_INDEX8_AUTO_KOS, 8, 8, 0, GL_RGB, GL_UNSIGNED_BYTE, img);
+
+        GLdcAllocator defaults = {NULL, NULL, NULL};
+        _glInitMemory(&defaults, 64 * 1024);
+
+        assert_equal(glGetError(), GL_OUT_OF_MEMORY);
+        assert_equal(_glGetBoundTexture()->palette, palette);
+        assert_equal(palette->width, width);
+    }
+
+    /* Textures with the same colours share a palette bank, which must outlive
+     * the deletion of any one of them. */
+    void test_auto_palettes_are_shared_between_textures() {
+        uint8_t img[8 * 8 * 3];
+        for(int i = 0; i < 8 * 8; ++i) {
+            img[i * 3 + 0] = (i & 1) ? 255 : 0;
+            img[i * 3 + 1] = 64;
+            img[i * 3 + 2] = 0;
+        }
+
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_COLOR_INDEX4_AUTO_KOS, 8, 8, 0, GL_RGB, GL_UNSIGNED_BYTE, img);
+        TexturePalette* first = _glGetBoundTexture()->palette;
+
+        /* A near-identical image lands in the same palette */
+        img[0] += 2;
+
+        GLuint other = 0;
+        glGenTextures(1, &other);
+        glBindTexture(GL_TEXTURE_2D, other);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_COLOR_INDEX4_AUTO_KOS, 8, 8, 0, GL_RGB, GL_UNSIGNED_BYTE, img);
+        assert_equal(glGetError(), GL_NO_ERROR);
+
+        TexturePalette* second = _glGetBoundTexture()->palette;
+        assert_true(first == second);
+        assert_equal((int) second->refcount, 2);
+
+        GLshort bank = first->bank;
+        glDeleteTextures(1, &other);
+
+        glBindTexture(GL_TEXTURE_2D, tex);
+        assert_true(_glGetBoundTexture()->palette == first);
+        assert_equal((int) first->refcount, 1);
+        assert_equal(first->bank, bank);
+    }
+
+    void test_auto_palette_mipmap_without_base_level_is_an_error() {
+        uint8_t img[8 * 8 * 4] = {0};
+        glTexImage2D(GL_TEXTURE_2D, 1, GL_COLOR_INDEX8_AUTO_KOS, 8, 8, 0, GL_RGBA, GL_UNSIGNED_BYTE, img);
+        assert_equal(glGetError(), GL_INVALID_OPERATION);
+    }
+
+    /* ------------------------------------------------- glGenerateMipmap */
+
+    /* Fills an 8x8 image with a checkerboard of a and b, so every 2x2 block
+     * (and so every texel of level 1) is an even mix of the two */
+    static std::vector<uint8_t> checkerboard(const uint8_t* a, const uint8_t* b, int components) {
+        std::vector<uint8_t> img(8 * 8 * components);
+        for(int y = 0; y < 8; ++y) {
+            for(int x = 0; x < 8; ++x) {
+                memcpy(&img[(y * 8 + x) * components], ((x + y) & 1) ? b : a, components);
+            }
+        }
+        return img;
+    }
+
+    static uint16_t level1_texel16() {
+        return *((const uint16_t*) _glGetMipmapLocation(_glGetBoundTexture(), 1));
+    }
+
+    void test_generate_mipmap_argb4444_averages_all_channels() {
+        const uint8_t red[4] = {255, 0, 0, 255};
+        const uint8_t blue[4] = {0, 0, 255, 255};
+        std::vector<uint8_t> img = checkerboard(red, blue, 4);
+
+        glEnable(GL_TEXTURE_TWIDDLE_KOS);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 8, 8, 0, GL_RGBA, GL_UNSIGNED_BYTE, img.data());
+        glDisable(GL_TEXTURE_TWIDDLE_KOS);
+        assert_equal(internal_format(), GL_ARGB4444_TWID_KOS);
+
+        glGenerateMipmap(GL_TEXTURE_2D);
+        assert_equal(glGetError(), GL_NO_ERROR);
+        assert_true(_glIsMipmapComplete(_glGetBoundTexture()));
+
+        /* Opaque, half red, half blue */
+        assert_equal(level1_texel16(), (uint16_t) 0xF808);
+    }
+
+    void test_generate_mipmap_gamma_correct() {
+        const uint8_t black[3] = {0, 0, 0};
+        const uint8_t white[3] = {255, 255, 255};
+        std::vector<uint8_t> img = checkerboard(black, white, 3);
+
+        glEnable(GL_TEXTURE_TWIDDLE_KOS);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 8, 8, 0, GL_RGB, GL_UNSIGNED_BYTE, img.data());
+        glDisable(GL_TEXTURE_TWIDDLE_KOS);
+
+        glGenerateMipmap(GL_TEXTURE_2D);
+        /* 128 grey */
+        assert_equal(level1_texel16(), (uint16_t) ((16 << 11) | (32 << 5) | 16));
+
+        GLuint other;
+        glGenTextures(1, &other);
+        glBindTexture(GL_TEXTURE_2D, other);
+        glEnable(GL_TEXTURE_TWIDDLE_KOS);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 8, 8, 0, GL_RGB, GL_UNSIGNED_BYTE, img.data());
+        glDisable(GL_TEXTURE_TWIDDLE_KOS);
+
+        glEnable(GL_GENERATE_MIPMAP_GAMMA_CORRECT_KOS);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glDisable(GL_GENERATE_MIPMAP_GAMMA_CORRECT_KOS);
+        assert_equal(glGetError(), GL_NO_ERROR);
+
+        /* Half intensity in linear space is 186 with gamma 2.2 */
+        assert_equal(level1_texel16(), (uint16_t) ((23 << 11) | (46 << 5) | 23));
+
+        glDeleteTextures(1, &other);
+    }
+
+    void test_generate_mipmap_paletted_picks_nearest_entry() {
+        uint8_t palette[3 * 4] = {
+              0,   0,   0, 255,
+            255, 255, 255, 255,
+            128, 128, 128, 255,
+        };
+        glColorTableEXT(GL_TEXTURE_2D, GL_RGBA8, 3, GL_RGBA, GL_UNSIGNED_BYTE, palette);
+
+        const uint8_t zero = 0, one = 1;
+        std::vector<uint8_t> img = checkerboard(&zero, &one, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_COLOR_INDEX8_EXT, 8, 8, 0, GL_COLOR_INDEX, GL_UNSIGNED_BYTE, img.data());
+
+        glGenerateMipmap(GL_TEXTURE_2D);
+        assert_equal(glGetError(), GL_NO_ERROR);
+
+        const uint8_t* level1 = _glGetMipmapLocation(_glGetBoundTexture(), 1);
+        for(int i = 0; i < 4 * 4; ++i) {
+            assert_equal((int) level1[i], 2);
+        }
+    }
+
+    void test_generate_mipmap_rejects_unsupported_formats() {
+        std::vector<uint8_t> img(8 * 8 * 3, 0x80);
+
+        glEnable(GL_TEXTURE_TWIDDLE_KOS);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 8, 8, 0, GL_RGB, GL_UNSIGNED_BYTE, img.data());
+        glDisable(GL_TEXTURE_TWIDDLE_KOS);
+
+        /* Nothing uploads YUV422 yet, but it mustn't be reduced as ARGB1555 */
+        TextureObject* t = _glGetBoundTexture();
+        t->color = (t->color & ~(7 << 27)) | GPU_TXRFMT_YUV422;
+
+        glGenerateMipmap(GL_TEXTURE_2D);
+        assert_equal(glGetError(), GL_INVALID_OPERATION);
+        assert_false(_glIsMipmapComplete(t));
+    }
+
     /* ------------------------------------------------- Error handling */
 
     void test_non_power_of_two_width_raises_invalid_value() {
@@ -318,4 +620,153 @@ public:
         assert_equal((int) t->width, 32);
         assert_equal((int) t->height, 32);
     }
+
+    /* ------------------------------------------------- Texture packs */
+
+    /* Appends the bound texture's data (and palette) to a pack under
+     * construction, the same way tools/texpack.c lays it out */
+    static void append_to_pack(std::vector<uint8_t>& payload, std::vector<TexturePackEntry>& entries, bool mipmapped) {
+        const TextureObject* t = _glGetBoundTexture();
+
+        TexturePackEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.internalFormat = t->internalFormat;
+        entry.width = t->width;
+        entry.height = t->height;
+        entry.flags = (mipmapped) ? TEXTURE_PACK_FLAG_MIPMAPPED : 0;
+        entry.dataOffset = payload.size();
+        entry.dataSize = t->allocatedSize;
+        payload.insert(payload.end(), (const uint8_t*) t->data, (const uint8_t*) t->data + t->allocatedSize);
+        payload.resize((payload.size() + 31) & ~31);
+
+        if(t->isPaletted) {
+            entry.paletteOffset = payload.size();
+            entry.paletteCount = t->palette->width;
+            payload.insert(payload.end(), t->palette->data, t->palette->data + t->palette->width * 4);
+            payload.resize((payload.size() + 31) & ~31);
+        }
+
+        entries.push_back(entry);
+    }
+
+    static std::vector<uint8_t> build_pack(const std::vector<uint8_t>& payload, std::vector<TexturePackEntry> entries) {
+        TexturePackHeader header;
+        memcpy(header.magic, TEXTURE_PACK_MAGIC, 4);
+        header.version = TEXTURE_PACK_VERSION;
+        header.count = entries.size();
+        header.reserved = 0;
+
+        uint32_t start = (sizeof(header) + entries.size() * sizeof(TexturePackEntry) + 31) & ~31;
+        for(auto& entry: entries) {
+            entry.dataOffset += start;
+            if(entry.paletteCount) {
+                entry.paletteOffset += start;
+            }
+        }
+
+        std::vector<uint8_t> pack(start + payload.size(), 0);
+        memcpy(&pack[0], &header, sizeof(header));
+        memcpy(&pack[sizeof(header)], &entries[0], entries.size() * sizeof(TexturePackEntry));
+        memcpy(&pack[start], &payload[0], payload.size());
+        return pack;
+    }
+
+    void test_texture_pack_loads_identical_textures() {
+        GLuint sources[2];
+        glGenTextures(2, sources);
+
+        std::vector<uint8_t> payload;
+        std::vector<TexturePackEntry> entries;
+
+        std::vector<uint8_t> img(16 * 16 * 4);
+        for(size_t i = 0; i < img.size(); ++i) {
+            img[i] = (uint8_t) (i * 7);
+        }
+
+        glBindTexture(GL_TEXTURE_2D, sources[0]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_ARGB4444_TWID_KOS, 16, 16, 0, GL_RGBA, GL_UNSIGNED_BYTE, img.data());
+        glGenerateMipmap(GL_TEXTURE_2D);
+        append_to_pack(payload, entries, true);
+
+        glBindTexture(GL_TEXTURE_2D, sources[1]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_COLOR_INDEX4_AUTO_KOS, 16, 16, 0, GL_RGBA, GL_UNSIGNED_BYTE, img.data());
+        append_to_pack(payload, entries, false);
+        assert_equal((GLenum) GL_NO_ERROR, glGetError());
+
+        std::vector<uint8_t> pack = build_pack(payload, entries);
+
+        glBindTexture(GL_TEXTURE_2D, tex);
+
+        GLuint loaded[3] = {0, 0, 0};
+        assert_equal(2, (int) glKosLoadTexturePack(&pack[0], pack.size(), 3, loaded));
+        assert_equal((GLenum) GL_NO_ERROR, glGetError());
+        assert_equal(tex, _glGetBoundTexture()->index);
+        assert_equal(0u, loaded[2]);
+
+        for(int i = 0; i < 2; ++i) {
+            glBindTexture(GL_TEXTURE_2D, sources[i]);
+            const TextureObject* src = _glGetBoundTexture();
+            glBindTexture(GL_TEXTURE_2D, loaded[i]);
+            const TextureObject* dst = _glGetBoundTexture();
+
+            assert_equal(src->internalFormat, dst->internalFormat);
+            assert_equal(src->color, dst->color);
+            assert_equal(src->baseDataOffset, dst->baseDataOffset);
+            assert_equal(src->allocatedSize, dst->allocatedSize);
+            assert_equal(_glIsMipmapComplete(src), _glIsMipmapComplete(dst));
+            assert_equal(0, memcmp(src->data, dst->data, src->allocatedSize));
+        }
+
+        const TextureObject* paletted = _glGetBoundTexture();
+        assert_true(paletted->palette != NULL);
+        assert_equal(entries[1].paletteCount, (uint32_t) paletted->palette->width);
+        assert_equal(0, memcmp(&payload[entries[1].paletteOffset], paletted->palette->data, entries[1].paletteCount * 4));
+
+        glDeleteTextures(2, sources);
+        glDeleteTextures(2, loaded);
+    }
+
+    void test_texture_pack_rejects_bad_data() {
+        std::vector<uint8_t> img(8 * 8 * 4, 0x80);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB565_TWID_KOS, 8, 8, 0, GL_RGBA, GL_UNSIGNED_BYTE, img.data());
+
+        std::vector<uint8_t> payload;
+        std::vector<TexturePackEntry> entries;
+        append_to_pack(payload, entries, false);
+
+        GLuint loaded = 0;
+
+        std::vector<uint8_t> pack = build_pack(payload, entries);
+        pack[0] = 'X';
+        assert_equal(0, (int) glKosLoadTexturePack(&pack[0], pack.size(), 1, &loaded));
+        assert_equal((GLenum) GL_INVALID_VALUE, glGetError());
+
+        /* Payload runs off the end of the pack */
+        pack = build_pack(payload, entries);
+        assert_equal(0, (int) glKosLoadTexturePack(&pack[0], pack.size() - 32, 1, &loaded));
+        assert_equal((GLenum) GL_INVALID_VALUE, glGetError());
+        assert_equal(0u, loaded);
+
+        /* Size doesn't match the format */
+        entries[0].dataSize /= 2;
+        pack = build_pack(payload, entries);
+        assert_equal(0, (int) glKosLoadTexturePack(&pack[0], pack.size(), 1, &loaded));
+        assert_equal((GLenum) GL_INVALID_VALUE, glGetError());
+    }
+
+    void test_texture_pack_rejects_mipmapped_4bpp() {
+        std::vector<uint8_t> img(16 * 16 * 4, 0x80);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_COLOR_INDEX4_AUTO_KOS, 16, 16, 0, GL_RGBA, GL_UNSIGNED_BYTE, img.data());
+        assert_equal((GLenum) GL_NO_ERROR, glGetError());
+
+        std::vector<uint8_t> payload;
+        std::vector<TexturePackEntry> entries;
+        append_to_pack(payload, entries, true);
+
+        GLuint loaded = 0;
+        std::vector<uint8_t> pack = build_pack(payload, entries);
+        assert_equal(0, (int) glKosLoadTexturePack(&pack[0], pack.size(), 1, &loaded));
+        assert_equal((GLenum) GL_INVALID_OPERATION, glGetError());
+        assert_equal(0u, loaded);
+    }
 };
@@ -0,0 +1,70 @@
+#include "tools/test.h"
+#include "tools/gl_test.h"
+
+#include <cstdio>
+#include <string>
+
+#include <GL/gl.h>
+#include <GL/glkos.h>
+
+class TraceTests : public GLTestCase {
+public:
+    static std::string read_file(const char* filename) {
+        std::string contents;
+        FILE* file = fopen(filename, "r");
+
+        if(file) {
+            char buffer[512];
+            size_t read;
+            while((read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+                contents.append(buffer, read);
+            }
+
+            fclose(file);
+        }
+
+        return contents;
+    }
+
+    static int occurrences(const std::string& haystack, const std::string& needle) {
+        int count = 0;
+        for(size_t i = haystack.find(needle); i != std::string::npos; i = haystack.find(needle, i + 1)) {
+            ++count;
+        }
+
+        return count;
+    }
+
+    void test_draws_are_traced_as_balanced_scopes() {
+        glKosClearTrace();
+
+        glBegin(GL_TRIANGLES);
+            glVertex3f(-1.0f, -1.0f, 0.5f);
+            glVertex3f( 1.0f, -1.0f, 0.5f);
+            glVertex3f( 0.0f,  1.0f, 0.5f);
+        glEnd();
+
+        const char* filename = "gldc_trace_test.json";
+        assert_true(glKosWriteTrace(filename));
+
+        std::string json = read_file(filename);
+        remove(filename);
+
+        assert_equal(json.find("{\"traceEvents\":["), (size_t) 0);
+        assert_equal(occurrences(json, "\"name\":\"submitVertices\",\"ph\":\"B\""), 1);
+        assert_equal(occurrences(json, "\"name\":\"submitVertices\",\"ph\":\"E\""), 1);
+        assert_equal(occurrences(json, "\"ph\":\"B\""), occurrences(json, "\"ph\":\"E\""));
+    }
+
+    void test_clear_discards_events() {
+        glKosClearTrace();
+
+        const char* filename = "gldc_trace_test.json";
+        assert_true(glKosWriteTrace(filename));
+
+        std::string json = read_file(filename);
+        remove(filename);
+
+        assert_equal(occurrences(json, "\"ph\""), 0);
+    }
+};
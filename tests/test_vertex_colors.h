@@ -42,6 +42,8 @@ public:
 
     /* Submitted (non-header) vertices currently in OP_LIST. */
     static std::vector<Vertex> captured() {
+        glFlush();
+
         std::vector<Vertex> out;
         uint32_t n = aligned_vector_size(&OP_LIST.vector);
         for(uint32_t i = 0; i < n; ++i) {
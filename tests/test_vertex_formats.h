@@ -34,12 +34,15 @@ public:
 
     /* Empty OP_LIST and force a fresh poly header on the next draw. */
     static void reset_list() {
+        glFlush();
         aligned_vector_clear(&OP_LIST.vector);
         _glGPUStateMarkDirty();
     }
 
     /* All vertex-flagged entries currently in OP_LIST (headers skipped). */
     static std::vector<Vertex> captured() {
+        glFlush();
+
         std::vector<Vertex> out;
         uint32_t n = aligned_vector_size(&OP_LIST.vector);
         for(uint32_t i = 0; i < n; ++i) {
@@ -0,0 +1,170 @@
+/*
+ * Minimal micro-benchmark harness for the gldc_bench target.
+ *
+ * Every class deriving from bench::Benchmark (or GLBenchmark) is
+ * auto-discovered by tools/bench_generator.py and each `void bench_*()`
+ * method becomes a benchmark. A bench_ method performs exactly one
+ * iteration of the thing being measured; set_up() and tear_down() run once
+ * around the whole benchmark, not around every iteration, so anything an
+ * iteration leaves behind (list contents, allocations) must be undone by
+ * the method itself.
+ *
+ * The runner calibrates how many iterations make up a sample (at least
+ * min_sample_ns long, so timer resolution doesn't matter), takes a number
+ * of samples and reports the minimum and median time per iteration as JSON:
+ *
+ *   {"benchmarks": [
+ *     {"name": "Suite::bench_x", "iterations": 4096, "samples": 15,
+ *      "min_ns": 101.2, "median_ns": 104.9}
+ *   ]}
+ */
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+namespace bench {
+
+class Benchmark {
+public:
+    virtual ~Benchmark() {}
+
+    virtual void set_up() {}
+    virtual void tear_down() {}
+};
+
+struct Result {
+    std::string name;
+    uint64_t iterations;
+    uint32_t samples;
+    double min_ns;
+    double median_ns;
+};
+
+class BenchmarkRunner {
+public:
+    template<typename T, typename U>
+    void register_case(std::vector<U> methods, std::vector<std::string> names) {
+        std::shared_ptr<Benchmark> instance = std::make_shared<T>();
+
+        for(std::string name: names) {
+            names_.push_back(name);
+        }
+
+        for(U& method: methods) {
+            benchmarks_.push_back(std::bind(method, dynamic_cast<T*>(instance.get())));
+            owners_.push_back(instance); //Hold on to it
+        }
+    }
+
+    int run(const std::string& filter, const std::string& output, uint32_t samples, uint64_t min_sample_ns) {
+        std::vector<Result> results;
+
+        /* Progress, and anything GL prints while running (glKosInit's
+         * banner, warnings), goes to stderr so stdout is only ever the JSON */
+        fflush(stdout);
+        int saved_stdout = dup(STDOUT_FILENO);
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+
+        for(size_t i = 0; i < benchmarks_.size(); ++i) {
+            if(!filter.empty() && names_[i].find(filter) != 0) {
+                continue;
+            }
+
+            fprintf(stderr, "    %-72s", names_[i].c_str());
+            fflush(stderr);
+
+            owners_[i]->set_up();
+            Result result = measure(names_[i], benchmarks_[i], samples, min_sample_ns);
+            owners_[i]->tear_down();
+
+            fprintf(stderr, "%10.1f ns\n", result.median_ns);
+            results.push_back(result);
+        }
+
+        fflush(stdout);
+        dup2(saved_stdout, STDOUT_FILENO);
+        close(saved_stdout);
+
+        FILE* out = output.empty() ? stdout : fopen(output.c_str(), "wt");
+        if(!out) {
+            fprintf(stderr, "Unable to open %s\n", output.c_str());
+            return 1;
+        }
+
+        write_json(out, results);
+
+        if(out != stdout) {
+            fclose(out);
+        }
+
+        return 0;
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    static uint64_t time_ns(const std::function<void()>& func, uint64_t iterations) {
+        auto start = Clock::now();
+        for(uint64_t i = 0; i < iterations; ++i) {
+            func();
+        }
+
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+    }
+
+    static Result measure(const std::string& name, const std::function<void()>& func, uint32_t samples, uint64_t min_sample_ns) {
+        /* Warm the caches (and any lazily allocated state) first */
+        func();
+
+        uint64_t iterations = 1;
+        uint64_t elapsed;
+        while((elapsed = time_ns(func, iterations)) < min_sample_ns && iterations < (1u << 30)) {
+            /* Jump most of the way there once the time is measurable */
+            iterations = (elapsed > min_sample_ns / 16) ?
+                (iterations * min_sample_ns) / elapsed + 1 : iterations * 8;
+        }
+
+        std::vector<double> per_iteration;
+        for(uint32_t i = 0; i < samples; ++i) {
+            per_iteration.push_back((double) time_ns(func, iterations) / iterations);
+        }
+
+        std::sort(per_iteration.begin(), per_iteration.end());
+
+        Result result;
+        result.name = name;
+        result.iterations = iterations;
+        result.samples = samples;
+        result.min_ns = per_iteration.front();
+        result.median_ns = per_iteration[per_iteration.size() / 2];
+        return result;
+    }
+
+    static void write_json(FILE* out, const std::vector<Result>& results) {
+        fprintf(out, "{\"benchmarks\": [");
+
+        for(size_t i = 0; i < results.size(); ++i) {
+            const Result& r = results[i];
+            fprintf(out, "%s\n  {\"name\": \"%s\", \"iterations\": %llu, \"samples\": %u, \"min_ns\": %.1f, \"median_ns\": %.1f}",
+                (i) ? "," : "", r.name.c_str(), (unsigned long long) r.iterations, r.samples, r.min_ns, r.median_ns
+            );
+        }
+
+        fprintf(out, "\n]}\n");
+    }
+
+    std::vector<std::shared_ptr<Benchmark>> owners_;
+    std::vector<std::function<void()>> benchmarks_;
+    std::vector<std::string> names_;
+};
+
+}
@@ -0,0 +1,205 @@
+#!/usr/bin/env python3
+
+import argparse
+import re
+import sys
+
+parser = argparse.ArgumentParser(description="Generate the main() for C++ micro-benchmarks")
+parser.add_argument("--output", type=str, nargs=1, help="The output source file for the generated benchmark main()", required=True)
+parser.add_argument("bench_files", type=str, nargs="+", help="The list of C++ files containing your benchmarks")
+parser.add_argument("--verbose", help="Verbose logging", action="store_true", default=False)
+
+
+CLASS_REGEX = r"\s*class\s+(\w+)\s*([\:|,]\s*(?:public|private|protected)\s+[\w|::]+\s*)*"
+BENCH_FUNC_REGEX = r"void\s+(?P<func_name>bench_\S[^\(]+)\(\s*(void)?\s*\)"
+
+BASE_CLASSES = ("Benchmark", "GLBenchmark")
+
+
+INCLUDE_TEMPLATE = "#include \"%(file_path)s\""
+
+REGISTER_TEMPLATE = """
+    runner->register_case<%(class_name)s>(
+        std::vector<void (%(class_name)s::*)()>({%(members)s}),
+        {%(names)s}
+    );"""
+
+MAIN_TEMPLATE = """
+
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+#include "tools/bench.h"
+
+%(includes)s
+
+
+static void usage() {
+    fprintf(stderr, "usage: gldc_bench [--samples N] [--min-sample-us N] [--output FILE] [filter]\\n");
+}
+
+int main(int argc, char* argv[]) {
+    auto runner = std::make_shared<bench::BenchmarkRunner>();
+
+    std::string filter;
+    std::string output;
+    long samples = 15;
+    long min_sample_us = 2000;
+
+    for(int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = i < (argc - 1);
+
+        if(arg == "--samples" && has_value) {
+            samples = atol(argv[++i]);
+        } else if(arg == "--min-sample-us" && has_value) {
+            min_sample_us = atol(argv[++i]);
+        } else if(arg == "--output" && has_value) {
+            output = argv[++i];
+        } else if(arg[0] != '-' && filter.empty()) {
+            filter = arg;  // Prefix match on "Suite::bench_x"
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    if(samples < 1 || min_sample_us < 1) {
+        usage();
+        return 1;
+    }
+
+    %(registrations)s
+
+    return runner->run(filter, output, (uint32_t) samples, (uint64_t) min_sample_us * 1000);
+}
+
+
+"""
+
+VERBOSE = False
+
+def log_verbose(message):
+    if VERBOSE:
+        print(message)
+
+
+def find_benchmarks(files):
+
+    subclasses = []
+
+    # First pass, find all class definitions along with their bench_ methods
+    for path in files:
+        with open(path, "rt") as f:
+            source_file_data = f.read().replace("\r\n", "").replace("\n", "")
+
+            while True:
+                match = re.search(CLASS_REGEX, source_file_data)
+                if not match:
+                    break
+
+                class_name = match.group().split(":")[0].replace("class", "").strip()
+
+                try:
+                    parents = match.group().split(":", 1)[1]
+                except IndexError:
+                    pass
+                else:
+                    parents = [ x.strip() for x in parents.split(",") ]
+                    parents = [
+                        x.replace("public", "").replace("private", "").replace("protected", "").strip()
+                        for x in parents
+                    ]
+
+                    subclasses.append((path, class_name, parents, []))
+                    log_verbose("Found: %s" % str(subclasses[-1]))
+
+                start = match.end()
+
+                # Find the next opening brace
+                while source_file_data[start] in (' ', '\t'):
+                    start += 1
+
+                start -= 1
+                end = start
+                if source_file_data[start+1] == '{':
+
+                    class_data = []
+                    brace_counter = 1
+                    for i in range(start+2, len(source_file_data)):
+                        class_data.append(source_file_data[i])
+                        if class_data[-1] == '{': brace_counter += 1
+                        if class_data[-1] == '}': brace_counter -= 1
+                        if not brace_counter:
+                            end = i
+                            break
+
+                    class_data = "".join(class_data)
+
+                    while True:
+                        match = re.search(BENCH_FUNC_REGEX, class_data)
+                        if not match:
+                            break
+
+                        subclasses[-1][-1].append(match.group('func_name'))
+                        class_data = class_data[match.end():]
+
+                source_file_data = source_file_data[end:]
+
+
+    # Keep the classes which derive from one of the base classes, directly
+    # or through another benchmark class
+    bench_subclasses = []
+    i = 0
+    while i < len(subclasses):
+        subclass_names = [x.rsplit("::")[-1] for x in subclasses[i][2]]
+
+        if any(x in BASE_CLASSES for x in subclass_names) or any(x[1] in subclasses[i][2] for x in bench_subclasses):
+            if subclasses[i] not in bench_subclasses:
+                bench_subclasses.append(subclasses[i])
+
+                i = 0 # Go back to the start, as we may have just found another parent class
+                continue
+        i += 1
+
+    log_verbose("\n".join([str(x) for x in bench_subclasses]))
+    return bench_subclasses
+
+
+def main():
+    global VERBOSE
+
+    args = parser.parse_args()
+
+    VERBOSE = args.verbose
+
+    benchmarks = find_benchmarks(args.bench_files)
+
+    includes = "\n".join([ INCLUDE_TEMPLATE % { 'file_path' : x } for x in sorted(set([y[0] for y in benchmarks])) ])
+    registrations = []
+
+    for path, class_name, superclasses, funcs in benchmarks:
+        if not funcs:
+            continue
+
+        BIND_TEMPLATE = "&%(class_name)s::%(func)s"
+
+        members = ", ".join([ BIND_TEMPLATE % { 'class_name' : class_name, 'func' : x } for x in funcs ])
+        names = ", ".join([ '"%s::%s"' % (class_name, x) for x in funcs ])
+
+        registrations.append(REGISTER_TEMPLATE % { 'class_name' : class_name, 'members' : members, 'names' : names })
+
+    registrations = "\n".join(registrations)
+
+    final = MAIN_TEMPLATE % {
+        'registrations' : registrations,
+        'includes' : includes
+    }
+
+    open(args.output[0], "w").write(final)
+
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
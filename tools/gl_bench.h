@@ -0,0 +1,27 @@
+/*
+ * Fixture for benchmarks that need a live GL context. Shares GLTestCase's
+ * one-shot initialisation and state reset, so every benchmark starts from
+ * the same baseline the tests do (empty lists, identity matrices, nothing
+ * enabled, GL_TEXTURE_TWIDDLE_KOS off).
+ */
+#pragma once
+
+#include "tools/bench.h"
+#include "tools/gl_test.h"
+
+class GLBenchmark : public bench::Benchmark {
+public:
+    void set_up() {
+        GLTestCase::ensure_gpu_initialized();
+
+        GLTestCase baseline;
+        baseline.reset_gl_state();
+    }
+
+    void tear_down() {
+        glFlush();
+        aligned_vector_clear(&OP_LIST.vector);
+        aligned_vector_clear(&PT_LIST.vector);
+        aligned_vector_clear(&TR_LIST.vector);
+    }
+};
@@ -61,6 +61,10 @@ public:
      * the allocating _glInit* helpers (immediate-mode buffer, texture/named
      * arrays, framebuffers) so it is safe to call repeatedly. */
     void reset_gl_state() {
+        /* Finish any immediate mode batch the last test left pending
+         * before the lists it was written to are cleared */
+        glFlush();
+
         aligned_vector_clear(&OP_LIST.vector);
         aligned_vector_clear(&PT_LIST.vector);
         aligned_vector_clear(&TR_LIST.vector);
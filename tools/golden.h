@@ -266,16 +266,60 @@ inline RVertex to_screen(const Vertex* v) {
     return out;
 }
 
+/* The sprites following the sprite header at index first, as the two
+ * triangles the software backend expands each into. Returns how many. */
+inline uint32_t rasterize_sprites(Image& img, PolyList* list, uint32_t first,
+                                  const TextureObject* tex, bool blend) {
+    const PolyHeader* header = (const PolyHeader*) aligned_vector_at(&list->vector, first);
+    const uint32_t n = aligned_vector_size(&list->vector);
+
+    RVertex corner;
+    corner.a = ((header->d1 >> 24) & 0xFF) / 255.0f;
+    corner.r = ((header->d1 >> 16) & 0xFF) / 255.0f;
+    corner.g = ((header->d1 >> 8) & 0xFF) / 255.0f;
+    corner.b = ((header->d1 >> 0) & 0xFF) / 255.0f;
+
+    uint32_t count = 0;
+    for(uint32_t i = first + 1; i < n; ++i, ++count) {
+        const SpriteVertex* s = (const SpriteVertex*) aligned_vector_at(&list->vector, i);
+        if(s->flags != GPU_CMD_VERTEX && s->flags != GPU_CMD_VERTEX_EOL) {
+            break;
+        }
+
+        RVertex a = corner, b = corner, c = corner, d = corner;
+        a.x = s->ax; a.y = s->ay;
+        b.x = s->bx; b.y = s->by;
+        c.x = s->cx; c.y = s->cy;
+        d.x = s->dx; d.y = s->dy;
+        UnpackSpriteUV(s->auv, &a.u, &a.v);
+        UnpackSpriteUV(s->buv, &b.u, &b.v);
+        UnpackSpriteUV(s->cuv, &c.u, &c.v);
+        d.u = a.u + c.u - b.u;
+        d.v = a.v + c.v - b.v;
+
+        fill_triangle(img, a, b, d, tex, blend);
+        fill_triangle(img, b, d, c, tex, blend);
+    }
+
+    return count;
+}
+
 /* Rasterise a single poly list. Triangle-strip extraction mirrors
  * SceneListFinish() exactly so the same triangles are produced. */
 inline void rasterize_list(Image& img, PolyList* list, const TextureObject* tex, bool blend) {
     uint32_t n = aligned_vector_size(&list->vector);
-    if(n < 4) return;
+    if(n < 2) return;
 
     uint32_t vidx = 0;
     for(uint32_t i = 0; i < n; ++i) {
         Vertex* v = (Vertex*) aligned_vector_at(&list->vector, i);
 
+        if(IsSpriteHeader(v)) {
+            i += rasterize_sprites(img, list, i, tex, blend);
+            vidx = 0;
+            continue;
+        }
+
         if((v->flags & GPU_CMD_POLYHDR) == GPU_CMD_POLYHDR) {
             vidx = 0;
             continue;
@@ -303,6 +347,8 @@ inline void rasterize_list(Image& img, PolyList* list, const TextureObject* tex,
 /* Convenience: rasterise the opaque, punch-through and transparent lists in
  * the order the backend submits them. */
 inline void rasterize_all_lists(Image& img, const TextureObject* tex = NULL) {
+    glFlush();
+
     rasterize_list(img, &OP_LIST, tex, false);
     rasterize_list(img, &PT_LIST, tex, false);
     rasterize_list(img, &TR_LIST, tex, true);
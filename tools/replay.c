@@ -0,0 +1,283 @@
+/*
+ * gldc_replay - plays back a frame capture written by glKosCaptureFrames
+ *
+ *   gldc_replay capture.gfc [iterations]
+ *
+ * Each captured frame is submitted iterations times (default 100) through
+ * SceneBegin / SceneListSubmit / SceneListFinish / SceneFinish, restoring
+ * its palette and a fresh copy of its lists first. None of the GL state
+ * machine or vertex processing runs, so this times the clipping and
+ * submission half of the backend on real frames, and the numbers only
+ * change when the backend does.
+ *
+ * Reports the minimum, median and mean submission time of every frame in
+ * microseconds.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "GL/gl.h"
+#include "GL/glext.h"
+#include "GL/glkos.h"
+
+#include "GL/private.h"
+#include "GL/frame_capture.h"
+
+typedef struct {
+    const FrameCaptureFrame* info;
+    const uint32_t* palette;
+    Vertex* lists[FRAME_CAPTURE_LIST_COUNT];
+    /* textureCount FrameCaptureTextures, each followed by its data */
+    const GLubyte* textures;
+} ReplayFrame;
+
+static const GPUList LIST_TYPES[FRAME_CAPTURE_LIST_COUNT] = {
+    GPU_LIST_OP_POLY, GPU_LIST_PT_POLY, GPU_LIST_TR_POLY
+};
+
+static GLubyte* read_file(const char* filename, size_t* size) {
+    FILE* file = fopen(filename, "rb");
+    if(!file) {
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    GLubyte* data = (length > 0) ? (GLubyte*) malloc(length) : NULL;
+    if(data && fread(data, 1, length, file) != (size_t) length) {
+        free(data);
+        data = NULL;
+    }
+
+    fclose(file);
+    *size = (size_t) length;
+    return data;
+}
+
+static uint64_t now_us() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000u + now.tv_nsec / 1000;
+}
+
+static int compare_times(const void* a, const void* b) {
+    uint64_t lhs = *(const uint64_t*) a;
+    uint64_t rhs = *(const uint64_t*) b;
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+/* Points the poly headers' texture addresses at this process's texture
+ * memory */
+static void rebase_headers(Vertex* list, uint32_t count, uint32_t from, uint32_t to) {
+    for(uint32_t i = 0; i < count; ++i) {
+        PolyHeader* header = (PolyHeader*) &list[i];
+
+        const int sprite = IsSpriteHeader(header);
+        if((header->cmd & GPU_CMD_POLYHDR) != GPU_CMD_POLYHDR && !sprite) {
+            continue;
+        }
+
+        uint32_t address = header->mode3 & FRAME_CAPTURE_ADDRESS_MASK;
+        header->mode3 &= ~FRAME_CAPTURE_ADDRESS_MASK;
+        header->mode3 |= (address - from + to) & FRAME_CAPTURE_ADDRESS_MASK;
+
+        /* Modifier volume headers carry a second copy of mode3, sprite
+         * headers carry colours there instead */
+        if(!sprite && header->d1 != 0xffffffff) {
+            address = header->d2 & FRAME_CAPTURE_ADDRESS_MASK;
+            header->d2 &= ~FRAME_CAPTURE_ADDRESS_MASK;
+            header->d2 |= (address - from + to) & FRAME_CAPTURE_ADDRESS_MASK;
+        }
+    }
+}
+
+/* Splits the capture into frames, validating it and rebasing headers as it
+ * goes. Returns the number of frames, or -1 if the file is malformed */
+static int parse_capture(GLubyte* data, size_t size, ReplayFrame* frames, uint32_t frameCount) {
+    const uint32_t textureBase = FRAME_CAPTURE_ENCODE_ADDRESS(_glTextureMemoryBase());
+    const GLuint textureSize = _glMaxTextureMemory();
+
+    GLubyte* it = data + sizeof(FrameCaptureHeader);
+    GLubyte* end = data + size;
+
+    for(uint32_t f = 0; f < frameCount; ++f) {
+        ReplayFrame* frame = &frames[f];
+
+        if((size_t) (end - it) < sizeof(FrameCaptureFrame) + FRAME_CAPTURE_PALETTE_ENTRIES * sizeof(uint32_t)) {
+            return -1;
+        }
+
+        frame->info = (const FrameCaptureFrame*) it;
+        it += sizeof(FrameCaptureFrame);
+
+        frame->palette = (const uint32_t*) it;
+        it += FRAME_CAPTURE_PALETTE_ENTRIES * sizeof(uint32_t);
+
+        for(int i = 0; i < FRAME_CAPTURE_LIST_COUNT; ++i) {
+            size_t bytes = (size_t) frame->info->listSize[i] * sizeof(Vertex);
+            if((size_t) (end - it) < bytes) {
+                return -1;
+            }
+
+            frame->lists[i] = (Vertex*) it;
+            rebase_headers(frame->lists[i], frame->info->listSize[i], frame->info->textureBase, textureBase);
+            it += bytes;
+        }
+
+        frame->textures = it;
+
+        for(uint32_t t = 0; t < frame->info->textureCount; ++t) {
+            FrameCaptureTexture texture;
+            if((size_t) (end - it) < sizeof(texture)) {
+                return -1;
+            }
+
+            memcpy(&texture, it, sizeof(texture));
+            it += sizeof(texture);
+
+            if((size_t) (end - it) < texture.size || texture.offset > textureSize ||
+                texture.size > textureSize - texture.offset) {
+                return -1;
+            }
+
+            it += texture.size;
+        }
+    }
+
+    return (int) frameCount;
+}
+
+/* Frames can share texture memory, so each one puts back what it used */
+static void load_textures(const ReplayFrame* frame) {
+    GLubyte* textureMemory = (GLubyte*) _glTextureMemoryBase();
+    const GLubyte* it = frame->textures;
+
+    for(uint32_t t = 0; t < frame->info->textureCount; ++t) {
+        FrameCaptureTexture texture;
+        memcpy(&texture, it, sizeof(texture));
+        it += sizeof(texture);
+
+        memcpy(textureMemory + texture.offset, it, texture.size);
+        it += texture.size;
+    }
+}
+
+static uint64_t submit_frame(const ReplayFrame* frame, Vertex** scratch) {
+    load_textures(frame);
+    _glSetInternalPaletteFormat(frame->info->paletteFormat);
+    GPUSetPaletteEntries(0, FRAME_CAPTURE_PALETTE_ENTRIES, frame->palette);
+
+    /* Submission modifies the lists so it always needs a fresh copy */
+    for(int i = 0; i < FRAME_CAPTURE_LIST_COUNT; ++i) {
+        memcpy(scratch[i], frame->lists[i], frame->info->listSize[i] * sizeof(Vertex));
+    }
+
+    uint64_t start = now_us();
+
+    SceneBegin();
+    for(int i = 0; i < FRAME_CAPTURE_LIST_COUNT; ++i) {
+        if(frame->info->listSize[i] > 2) {
+            SceneListBegin(LIST_TYPES[i]);
+            SceneListSubmit(scratch[i], frame->info->listSize[i]);
+            SceneListFinish();
+        }
+    }
+    SceneFinish();
+
+    return now_us() - start;
+}
+
+int main(int argc, char* argv[]) {
+    if(argc < 2 || argc > 3) {
+        fprintf(stderr, "usage: gldc_replay capture.gfc [iterations]\n");
+        return 1;
+    }
+
+    int iterations = (argc == 3) ? atoi(argv[2]) : 100;
+    if(iterations < 1) {
+        fprintf(stderr, "iterations must be at least 1\n");
+        return 1;
+    }
+
+    size_t size = 0;
+    GLubyte* data = read_file(argv[1], &size);
+    const FrameCaptureHeader* header = (const FrameCaptureHeader*) data;
+
+    if(!data || size < sizeof(FrameCaptureHeader) ||
+        memcmp(header->magic, FRAME_CAPTURE_MAGIC, 4) != 0 ||
+        header->version != FRAME_CAPTURE_VERSION) {
+        fprintf(stderr, "%s is not a frame capture\n", argv[1]);
+        return 1;
+    }
+
+    if(header->vertexSize != sizeof(Vertex)) {
+        fprintf(stderr, "capture has %u byte vertices, expected %u\n",
+            (unsigned) header->vertexSize, (unsigned) sizeof(Vertex));
+        return 1;
+    }
+
+    glKosInit();
+
+    ReplayFrame* frames = (ReplayFrame*) calloc(header->frameCount ? header->frameCount : 1, sizeof(ReplayFrame));
+    if(parse_capture(data, size, frames, header->frameCount) < 0) {
+        fprintf(stderr, "%s is truncated or corrupt\n", argv[1]);
+        return 1;
+    }
+
+    uint32_t largest[FRAME_CAPTURE_LIST_COUNT] = {1, 1, 1};
+    for(uint32_t f = 0; f < header->frameCount; ++f) {
+        for(int i = 0; i < FRAME_CAPTURE_LIST_COUNT; ++i) {
+            largest[i] = MAX(largest[i], frames[f].info->listSize[i]);
+        }
+    }
+
+    Vertex* scratch[FRAME_CAPTURE_LIST_COUNT];
+    for(int i = 0; i < FRAME_CAPTURE_LIST_COUNT; ++i) {
+        scratch[i] = (Vertex*) _glMemalign(32, largest[i] * sizeof(Vertex));
+    }
+
+    uint64_t* times = (uint64_t*) malloc(sizeof(uint64_t) * iterations * (header->frameCount ? header->frameCount : 1));
+
+    /* Frames are interleaved so each iteration plays the capture through
+     * in order, the way it was rendered */
+    for(int n = 0; n < iterations; ++n) {
+        for(uint32_t f = 0; f < header->frameCount; ++f) {
+            times[f * iterations + n] = submit_frame(&frames[f], scratch);
+        }
+    }
+
+    printf("frame,vertices,min_us,median_us,mean_us\n");
+
+    for(uint32_t f = 0; f < header->frameCount; ++f) {
+        uint64_t* frameTimes = times + f * iterations;
+        uint64_t total = 0;
+
+        qsort(frameTimes, iterations, sizeof(uint64_t), compare_times);
+        for(int n = 0; n < iterations; ++n) {
+            total += frameTimes[n];
+        }
+
+        const FrameCaptureFrame* info = frames[f].info;
+        printf("%u,%u,%llu,%llu,%.1f\n", (unsigned) f,
+            (unsigned) (info->listSize[0] + info->listSize[1] + info->listSize[2]),
+            (unsigned long long) frameTimes[0],
+            (unsigned long long) frameTimes[iterations / 2],
+            (double) total / iterations);
+    }
+
+    for(int i = 0; i < FRAME_CAPTURE_LIST_COUNT; ++i) {
+        _glFree(scratch[i]);
+    }
+
+    free(times);
+    free(frames);
+    free(data);
+
+    glKosShutdown();
+    return 0;
+}
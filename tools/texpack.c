@@ -0,0 +1,346 @@
+/*
+ * gldc_texpack - builds a texture pack for glKosLoadTexturePack
+ *
+ *   gldc_texpack -o out.gtp [options] image... [[options] image...]
+ *
+ * Options apply to the images which follow them:
+ *
+ *   --format rgb565|argb4444|argb1555|pal4|pal8   (default argb4444)
+ *   --mipmap / --no-mipmap                         generate mipmaps
+ *   --twiddle / --no-twiddle                       16bpp formats only,
+ *                                                  paletted are always twiddled
+ *
+ * Images are binary PPM (P6) or RGBA PAM (P7) files with power of two sides.
+ * Textures are created through GLdc's software backend, so the pack contains
+ * exactly what glTexImage2D / glGenerateMipmap would have put in VRAM. The
+ * textures appear in the pack in the order they were given.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "GL/gl.h"
+#include "GL/glext.h"
+#include "GL/glkos.h"
+
+#include "GL/private.h"
+#include "GL/texture_pack.h"
+
+#define ALIGN_UP(x) (((x) + TEXTURE_PACK_ALIGNMENT - 1) & ~(TEXTURE_PACK_ALIGNMENT - 1))
+
+typedef enum {
+    FORMAT_RGB565,
+    FORMAT_ARGB4444,
+    FORMAT_ARGB1555,
+    FORMAT_PAL4,
+    FORMAT_PAL8
+} PackFormat;
+
+typedef struct {
+    TexturePackEntry entry;
+    GLubyte* data;
+    GLubyte* palette;
+} PackedTexture;
+
+static int read_token(FILE* file, char* token, int size) {
+    int c = fgetc(file);
+    int len = 0;
+
+    for(;;) {
+        while(c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            c = fgetc(file);
+        }
+
+        if(c != '#') {
+            break;
+        }
+
+        while(c != '\n' && c != EOF) {
+            c = fgetc(file);
+        }
+    }
+
+    while(c != EOF && c != ' ' && c != '\t' && c != '\r' && c != '\n' && len < size - 1) {
+        token[len++] = (char) c;
+        c = fgetc(file);
+    }
+
+    token[len] = '\0';
+    return len;
+}
+
+/* Returns an RGBA8888 image, or NULL */
+static GLubyte* load_image(const char* filename, int* width, int* height) {
+    FILE* file = fopen(filename, "rb");
+    if(!file) {
+        fprintf(stderr, "%s: can't open\n", filename);
+        return NULL;
+    }
+
+    char token[64];
+    int channels = 0, maxval = 0;
+    *width = *height = 0;
+
+    read_token(file, token, sizeof(token));
+
+    if(strcmp(token, "P6") == 0) {
+        channels = 3;
+        read_token(file, token, sizeof(token)); *width = atoi(token);
+        read_token(file, token, sizeof(token)); *height = atoi(token);
+        read_token(file, token, sizeof(token)); maxval = atoi(token);
+    } else if(strcmp(token, "P7") == 0) {
+        while(read_token(file, token, sizeof(token)) && strcmp(token, "ENDHDR") != 0) {
+            char value[64];
+            read_token(file, value, sizeof(value));
+
+            if(strcmp(token, "WIDTH") == 0) *width = atoi(value);
+            else if(strcmp(token, "HEIGHT") == 0) *height = atoi(value);
+            else if(strcmp(token, "DEPTH") == 0) channels = atoi(value);
+            else if(strcmp(token, "MAXVAL") == 0) maxval = atoi(value);
+        }
+    }
+
+    if((channels != 3 && channels != 4) || maxval != 255 || *width <= 0 || *height <= 0) {
+        fprintf(stderr, "%s: not an 8 bit RGB PPM or RGBA PAM\n", filename);
+        fclose(file);
+        return NULL;
+    }
+
+    int count = (*width) * (*height);
+    GLubyte* pixels = (GLubyte*) malloc(count * 4);
+    GLubyte* src = (GLubyte*) malloc(count * channels);
+
+    if(fread(src, channels, count, file) != (size_t) count) {
+        fprintf(stderr, "%s: truncated\n", filename);
+        free(src);
+        free(pixels);
+        fclose(file);
+        return NULL;
+    }
+
+    for(int i = 0; i < count; ++i) {
+        pixels[i * 4 + 0] = src[i * channels + 0];
+        pixels[i * 4 + 1] = src[i * channels + 1];
+        pixels[i * 4 + 2] = src[i * channels + 2];
+        pixels[i * 4 + 3] = (channels == 4) ? src[i * channels + 3] : 255;
+    }
+
+    free(src);
+    fclose(file);
+    return pixels;
+}
+
+static GLboolean upload(PackFormat format, GLboolean twiddle, int width, int height, const GLubyte* rgba) {
+    switch(format) {
+        case FORMAT_RGB565:
+            glTexImage2D(GL_TEXTURE_2D, 0, twiddle ? GL_RGB565_TWID_KOS : GL_RGB565_KOS,
+                width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+            break;
+        case FORMAT_ARGB4444:
+            glTexImage2D(GL_TEXTURE_2D, 0, twiddle ? GL_ARGB4444_TWID_KOS : GL_ARGB4444_KOS,
+                width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+            break;
+        case FORMAT_ARGB1555: {
+            GLushort* texels = (GLushort*) malloc(width * height * 2);
+            for(int i = 0; i < width * height; ++i) {
+                const GLubyte* p = rgba + i * 4;
+                texels[i] = ((p[3] >= 128) << 15) | ((p[0] >> 3) << 10) | ((p[1] >> 3) << 5) | (p[2] >> 3);
+            }
+
+            glTexImage2D(GL_TEXTURE_2D, 0, twiddle ? GL_ARGB1555_TWID_KOS : GL_ARGB1555_KOS,
+                width, height, 0, GL_BGRA, GL_UNSIGNED_SHORT_1_5_5_5_REV, texels);
+            free(texels);
+        } break;
+        case FORMAT_PAL4:
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_COLOR_INDEX4_AUTO_KOS,
+                width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+            break;
+        case FORMAT_PAL8:
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_COLOR_INDEX8_AUTO_KOS,
+                width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+            break;
+    }
+
+    return glGetError() == GL_NO_ERROR;
+}
+
+static GLboolean pack_image(const char* filename, PackFormat format, GLboolean twiddle, GLboolean mipmap, PackedTexture* out) {
+    int width, height;
+    GLubyte* rgba = load_image(filename, &width, &height);
+    if(!rgba) {
+        return GL_FALSE;
+    }
+
+    GLuint id;
+    glGenTextures(1, &id);
+    glBindTexture(GL_TEXTURE_2D, id);
+
+    GLboolean ok = upload(format, twiddle, width, height, rgba);
+    free(rgba);
+
+    if(ok && mipmap) {
+        glGenerateMipmap(GL_TEXTURE_2D);
+        ok = glGetError() == GL_NO_ERROR;
+    }
+
+    TextureObject* tex = _glGetBoundTexture();
+
+    if(!ok || !tex->data || tex->isStrided) {
+        fprintf(stderr, "%s: can't create a %dx%d texture in this format\n", filename, width, height);
+        glDeleteTextures(1, &id);
+        return GL_FALSE;
+    }
+
+    memset(out, 0, sizeof(*out));
+    out->entry.internalFormat = tex->internalFormat;
+    out->entry.width = tex->width;
+    out->entry.height = tex->height;
+    out->entry.flags = (mipmap) ? TEXTURE_PACK_FLAG_MIPMAPPED : 0;
+    out->entry.dataSize = tex->allocatedSize;
+    out->data = (GLubyte*) malloc(tex->allocatedSize);
+    memcpy(out->data, tex->data, tex->allocatedSize);
+
+    if(tex->isPaletted && tex->palette) {
+        out->entry.paletteCount = tex->palette->width;
+        out->palette = (GLubyte*) malloc(tex->palette->width * 4);
+        memcpy(out->palette, tex->palette->data, tex->palette->width * 4);
+    }
+
+    glDeleteTextures(1, &id);
+    return GL_TRUE;
+}
+
+static GLboolean write_pack(const char* filename, PackedTexture* textures, uint32_t count) {
+    static const GLubyte PADDING[TEXTURE_PACK_ALIGNMENT] = {0};
+
+    TexturePackHeader header;
+    memcpy(header.magic, TEXTURE_PACK_MAGIC, 4);
+    header.version = TEXTURE_PACK_VERSION;
+    header.count = count;
+    header.reserved = 0;
+
+    uint32_t offset = ALIGN_UP(sizeof(TexturePackHeader) + count * sizeof(TexturePackEntry));
+    for(uint32_t i = 0; i < count; ++i) {
+        textures[i].entry.dataOffset = offset;
+        offset = ALIGN_UP(offset + textures[i].entry.dataSize);
+
+        if(textures[i].entry.paletteCount) {
+            textures[i].entry.paletteOffset = offset;
+            offset = ALIGN_UP(offset + textures[i].entry.paletteCount * 4);
+        }
+    }
+
+    FILE* file = fopen(filename, "wb");
+    if(!file) {
+        fprintf(stderr, "%s: can't open for writing\n", filename);
+        return GL_FALSE;
+    }
+
+    uint32_t written = sizeof(header);
+    fwrite(&header, sizeof(header), 1, file);
+
+    for(uint32_t i = 0; i < count; ++i) {
+        fwrite(&textures[i].entry, sizeof(TexturePackEntry), 1, file);
+        written += sizeof(TexturePackEntry);
+    }
+
+    for(uint32_t i = 0; i < count; ++i) {
+        const TexturePackEntry* entry = &textures[i].entry;
+
+        fwrite(PADDING, 1, entry->dataOffset - written, file);
+        fwrite(textures[i].data, 1, entry->dataSize, file);
+        written = entry->dataOffset + entry->dataSize;
+
+        if(entry->paletteCount) {
+            fwrite(PADDING, 1, entry->paletteOffset - written, file);
+            fwrite(textures[i].palette, 4, entry->paletteCount, file);
+            written = entry->paletteOffset + entry->paletteCount * 4;
+        }
+    }
+
+    fwrite(PADDING, 1, offset - written, file);
+
+    GLboolean ok = !ferror(file);
+    fclose(file);
+    return ok;
+}
+
+static void usage() {
+    fprintf(stderr,
+        "usage: gldc_texpack -o out.gtp [options] image... [[options] image...]\n"
+        "  --format rgb565|argb4444|argb1555|pal4|pal8\n"
+        "  --mipmap / --no-mipmap\n"
+        "  --twiddle / --no-twiddle\n"
+    );
+}
+
+int main(int argc, char* argv[]) {
+    const char* output = NULL;
+    PackFormat format = FORMAT_ARGB4444;
+    GLboolean twiddle = GL_TRUE;
+    GLboolean mipmap = GL_FALSE;
+
+    PackedTexture* textures = (PackedTexture*) calloc(argc, sizeof(PackedTexture));
+    uint32_t count = 0;
+
+    /* Only the software backend's texture memory is used, there's nothing to show */
+    setenv("SDL_VIDEODRIVER", "dummy", 0);
+    glKosInit();
+
+    for(int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+
+        if(strcmp(arg, "-o") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else if(strcmp(arg, "--format") == 0 && i + 1 < argc) {
+            const char* name = argv[++i];
+
+            if(strcmp(name, "rgb565") == 0) format = FORMAT_RGB565;
+            else if(strcmp(name, "argb4444") == 0) format = FORMAT_ARGB4444;
+            else if(strcmp(name, "argb1555") == 0) format = FORMAT_ARGB1555;
+            else if(strcmp(name, "pal4") == 0) format = FORMAT_PAL4;
+            else if(strcmp(name, "pal8") == 0) format = FORMAT_PAL8;
+            else {
+                fprintf(stderr, "unknown format: %s\n", name);
+                return 1;
+            }
+        } else if(strcmp(arg, "--mipmap") == 0) {
+            mipmap = GL_TRUE;
+        } else if(strcmp(arg, "--no-mipmap") == 0) {
+            mipmap = GL_FALSE;
+        } else if(strcmp(arg, "--twiddle") == 0) {
+            twiddle = GL_TRUE;
+        } else if(strcmp(arg, "--no-twiddle") == 0) {
+            twiddle = GL_FALSE;
+        } else if(arg[0] == '-') {
+            usage();
+            return 1;
+        } else {
+            if(mipmap && format == FORMAT_PAL4) {
+                fprintf(stderr, "%s: 4bpp textures can't be mipmapped\n", arg);
+                return 1;
+            }
+
+            if(!pack_image(arg, format, twiddle, mipmap, &textures[count])) {
+                return 1;
+            }
+
+            ++count;
+        }
+    }
+
+    if(!output || !count) {
+        usage();
+        return 1;
+    }
+
+    if(!write_pack(output, textures, count)) {
+        return 1;
+    }
+
+    printf("%s: %u textures\n", output, count);
+
+    glKosShutdown();
+    return 0;
+}